@@ -34,6 +34,7 @@
 #include "others.h"
 #include "bytecode.h"
 #include "bytecode_priv.h"
+#include "builtin_bytecodes.h"
 #include "clamav_rust.h"
 
 // common
@@ -69,6 +70,8 @@ static void help(void)
     printf("    --trace <level>        -T         Set bytecode trace level 0..7 (default 7)\n");
     printf("    --no-trace-showsource  -s         Don't show source line during tracing\n");
     printf("    --statistics=bytecode             Collect and print bytecode execution statistics\n");
+    printf("    --benchmark=#n         -b         Run the function #n times in each interpreter mode and print the average time\n");
+    printf("                                      Without a file the builtin startup bytecode is used\n");
     printf("    file                              File to test\n");
     printf("\n");
     printf("**Caution**: You should NEVER run bytecode signatures from untrusted sources.\nDoing so may result in arbitrary code execution.\n");
@@ -249,6 +252,111 @@ static uint32_t deadbeefcounts[64] = {
     0xdeadbeef,
     0xdeadbeef,
 };
+static const struct {
+    const char *name;
+    unsigned dconfmask;
+} bench_modes[] = {
+    {"switch", BYTECODE_INTERPRETER},
+    {"threaded", BYTECODE_INTERPRETER | BYTECODE_INTERP_THREADED},
+    {"threaded+superinst", BYTECODE_INTERPRETER | BYTECODE_INTERP_MASK},
+};
+
+/* runs a function of the bytecode in each of the interpreter modes, and
+ * prints the average time of a run. Only cli_bytecode_run() is timed. */
+static int benchmark(const char *file, char **args, long runs, int trust)
+{
+    unsigned m, i, funcid = 0;
+    long n;
+    int rc = 0;
+
+    if (args && args[0])
+        funcid = atoi(args[0]);
+
+    for (m = 0; m < sizeof(bench_modes) / sizeof(bench_modes[0]) && !rc; m++) {
+        struct cli_bc bc;
+        struct cli_all_bc bcs;
+        struct cl_engine *engine = NULL;
+        struct timeval t0, t1;
+        uint64_t usecs = 0, result = 0;
+        FILE *f;
+
+        memset(&bc, 0, sizeof(bc));
+        memset(&bcs, 0, sizeof(bcs));
+        bcs.all_bcs = &bc;
+        bcs.count   = 1;
+
+        if (file) {
+            f = fopen(file, "r");
+            if (!f) {
+                fprintf(stderr, "Unable to load %s\n", file);
+                return 2;
+            }
+        } else {
+            f = tmpfile();
+            if (!f || fputs(builtin_bc_startup, f) == EOF) {
+                fprintf(stderr, "Unable to load the builtin bytecode\n");
+                if (f)
+                    fclose(f);
+                return 2;
+            }
+            rewind(f);
+        }
+        rc = cli_bytecode_load(&bc, f, NULL, trust, 0);
+        fclose(f);
+        if (rc != CL_SUCCESS) {
+            fprintf(stderr, "Unable to load bytecode: %s\n", cl_strerror(rc));
+            return 4;
+        }
+
+        engine = cl_engine_new();
+        if (!engine) {
+            fprintf(stderr, "Unable to create engine\n");
+            cli_bytecode_destroy(&bc);
+            return 3;
+        }
+        if ((rc = cl_engine_compile(engine)) != CL_SUCCESS ||
+            (rc = cli_bytecode_prepare2(engine, &bcs, bench_modes[m].dconfmask)) != CL_SUCCESS) {
+            fprintf(stderr, "Unable to prepare bytecode: %s\n", cl_strerror(rc));
+            rc = 4;
+        }
+
+        for (n = 0; n < runs && !rc; n++) {
+            struct cli_bc_ctx *ctx = cli_bytecode_context_alloc(engine);
+            if (!ctx) {
+                fprintf(stderr, "Out of memory\n");
+                rc = 3;
+                break;
+            }
+            cli_bytecode_context_setfuncid(ctx, &bc, funcid);
+            for (i = 1; args && args[0] && args[i]; i++)
+                cli_bytecode_context_setparam_int(ctx, i - 1, atoi(args[i]));
+            ctx->hooks.match_counts  = deadbeefcounts;
+            ctx->hooks.match_offsets = deadbeefcounts;
+
+            gettimeofday(&t0, NULL);
+            rc = cli_bytecode_run(&bcs, &bc, ctx);
+            gettimeofday(&t1, NULL);
+            usecs += (t1.tv_sec - t0.tv_sec) * 1000000 + (t1.tv_usec - t0.tv_usec);
+
+            if (rc != CL_SUCCESS) {
+                fprintf(stderr, "Unable to run bytecode: %s\n", cl_strerror(rc));
+                rc = 5;
+            } else {
+                result = cli_bytecode_context_getresult_int(ctx);
+            }
+            cli_bytecode_context_destroy(ctx);
+        }
+        if (!rc)
+            printf("%-20s %10.3f us/run (%ld runs, result 0x%llx)\n", bench_modes[m].name,
+                   (double)usecs / runs, runs, (long long)result);
+
+        cl_engine_free(engine);
+        cli_bytecode_destroy(&bc);
+        cli_bytecode_done(&bcs);
+    }
+    return rc;
+}
+
 int main(int argc, char *argv[])
 {
     FILE *f;
@@ -277,6 +385,26 @@ int main(int argc, char *argv[])
         optfree(opts);
         exit(0);
     }
+    if ((opt = optget(opts, "benchmark"))->enabled) {
+        if (opt->numarg <= 0) {
+            fprintf(stderr, "ERROR: --benchmark requires a positive number of runs\n");
+            optfree(opts);
+            exit(1);
+        }
+        if (optget(opts, "debug")->enabled)
+            cl_debug();
+        rc = cl_init(CL_INIT_DEFAULT);
+        if (rc != CL_SUCCESS) {
+            fprintf(stderr, "Unable to init libclamav: %s\n", cl_strerror(rc));
+            optfree(opts);
+            exit(4);
+        }
+        rc = benchmark(opts->filename ? opts->filename[0] : NULL,
+                       opts->filename ? opts->filename + 1 : NULL,
+                       opt->numarg, optget(opts, "trust-bytecode")->enabled);
+        optfree(opts);
+        exit(rc);
+    }
     if (optget(opts, "help")->enabled || !opts->filename) {
         optfree(opts);
         help();
@@ -380,7 +508,7 @@ int main(int argc, char *argv[])
             optfree(opts);
             exit(4);
         }
-        rc = cli_bytecode_prepare2(engine, &bcs, BYTECODE_ENGINE_MASK);
+        rc = cli_bytecode_prepare2(engine, &bcs, BYTECODE_ENGINE_MASK | BYTECODE_INTERP_MASK);
         if (rc != CL_SUCCESS) {
             fprintf(stderr, "Unable to prepare bytecode: %s\n", cl_strerror(rc));
             optfree(opts);
@@ -389,7 +517,7 @@ int main(int argc, char *argv[])
         if (debug_flag)
             printf("[clambc] Bytecode prepared\n");
 
-        ctx = cli_bytecode_context_alloc();
+        ctx = cli_bytecode_context_alloc(engine);
         if (!ctx) {
             fprintf(stderr, "Out of memory\n");
             exit(3);
@@ -499,6 +499,32 @@ int main(int argc, char **argv)
         if (optget(opts, "disable-cache")->enabled)
             cl_engine_set_num(engine, CL_ENGINE_DISABLE_CACHE, 1);
 
+        if ((opt = optget(opts, "MemoryHugePages"))->enabled && strcmp(opt->strarg, "no")) {
+            enum cl_hugepages_mode mode = strcmp(opt->strarg, "explicit") ? CL_HUGEPAGES_TRANSPARENT : CL_HUGEPAGES_EXPLICIT;
+
+            cl_engine_set_num(engine, CL_ENGINE_HUGEPAGES, mode);
+            logg(LOGG_INFO_NF, "Using %s huge pages for the signatures.\n", opt->strarg);
+        }
+
+        if ((opt = optget(opts, "MemoryNUMANode"))->enabled && strcmp(opt->strarg, "default")) {
+            long long node = strcmp(opt->strarg, "interleave") ? atoll(opt->strarg) : CL_NUMA_INTERLEAVE;
+
+            if (cl_engine_set_num(engine, CL_ENGINE_NUMA_NODE, node)) {
+                logg(LOGG_ERROR, "Invalid MemoryNUMANode: %s\n", opt->strarg);
+                ret = 1;
+                break;
+            }
+            logg(LOGG_INFO_NF, "NUMA placement of the signatures: %s.\n", opt->strarg);
+        }
+
+        if (optget(opts, "NUMAEngineReplicas")->enabled && thrmgr_numa_nodes() > 1) {
+            /* the replicas for the other nodes are loaded by recvloop() */
+            if (strcmp(optget(opts, "MemoryNUMANode")->strarg, "default"))
+                logg(LOGG_WARNING, "NUMAEngineReplicas overrides MemoryNUMANode\n");
+            cl_engine_set_num(engine, CL_ENGINE_NUMA_NODE, 0);
+            logg(LOGG_INFO_NF, "Loading one signature replica per NUMA node (%d nodes).\n", thrmgr_numa_nodes());
+        }
+
         /* load the database(s) */
         dbdir = optget(opts, "DatabaseDirectory")->strarg;
         logg(LOGG_INFO_NF, "Reading databases from %s\n", dbdir);
@@ -668,6 +694,29 @@ int main(int argc, char **argv)
             if ((opt = optget(opts, "BytecodeTimeout"))->enabled) {
                 cl_engine_set_num(engine, CL_ENGINE_BYTECODE_TIMEOUT, opt->numarg);
             }
+
+            if (optget(opts, "BytecodeLazyPrepare")->enabled) {
+                cl_engine_set_num(engine, CL_ENGINE_BYTECODE_LAZY, 1);
+                logg(LOGG_INFO_NF, "Bytecode: Preparing bytecodes on first run.\n");
+            }
+
+            if ((opt = optget(opts, "BytecodeCacheDirectory"))->enabled) {
+                if ((ret = cl_engine_set_str(engine, CL_ENGINE_BYTECODE_CACHE_DIR, opt->strarg))) {
+                    logg(LOGG_ERROR, "cl_engine_set_str(BytecodeCacheDirectory) failed: %s\n", cl_strerror(ret));
+                    ret = 1;
+                    break;
+                }
+                logg(LOGG_INFO_NF, "Bytecode: Caching JIT-compiled code in %s\n", opt->strarg);
+            }
+
+            if ((opt = optget(opts, "BytecodeNativeModule"))->enabled) {
+                if ((ret = cl_engine_set_str(engine, CL_ENGINE_BYTECODE_NATIVE, opt->strarg))) {
+                    logg(LOGG_ERROR, "cl_engine_set_str(BytecodeNativeModule) failed: %s\n", cl_strerror(ret));
+                    ret = 1;
+                    break;
+                }
+                logg(LOGG_INFO_NF, "Bytecode: Using precompiled bytecode from %s\n", opt->strarg);
+            }
         } else {
             logg(LOGG_INFO_NF, "Bytecode support disabled.\n");
         }
@@ -734,6 +783,14 @@ int main(int argc, char **argv)
             }
         }
 
+        if ((opt = optget(opts, "ParallelScanThreads"))->active) {
+            if ((ret = cl_engine_set_num(engine, CL_ENGINE_PARALLEL_THREADS, opt->numarg))) {
+                logg(LOGG_ERROR, "cli_engine_set_num(ParallelScanThreads) failed: %s\n", cl_strerror(ret));
+                cl_engine_free(engine);
+                return 1;
+            }
+        }
+
         if ((ret = cl_engine_compile(engine)) != 0) {
             logg(LOGG_ERROR, "Database initialization error: %s\n", cl_strerror(ret));
             ret = 1;
@@ -946,7 +1003,7 @@ int main(int argc, char **argv)
 /*        }*/
 
         /*if (do_local_scan == 0) {*/
-        /*    ret = recvloop(lsockets, nlsockets, engine, dboptions, opts);*/
+        /*    ret = recvloop(lsockets, nlsockets, engine, sigs, dboptions, opts);*/
         /*} else {*/
         /*    /* wait for threadpool to be done? */
         /*}*/
@@ -99,6 +99,253 @@ static struct cl_stat dbstat;
 void *event_wake_recv   = NULL;
 void *event_wake_accept = NULL;
 
+/*
+ * NUMA engine replicas
+ */
+
+#define MAX_ENGINE_REPLICAS 64
+
+/* One read-only copy of an engine per NUMA node, engines[0] is the primary */
+struct engine_replicas {
+    struct cl_engine *engines[MAX_ENGINE_REPLICAS];
+    int nodes;
+    struct engine_replicas *next;
+};
+
+struct replica_th_t {
+    const struct cl_settings *settings;
+    const char *dbdir;
+    unsigned int dboptions;
+    int node;
+    struct cl_engine *engine;
+    unsigned int sigs;
+};
+
+/* Times the replicas are loaded again when the databases change under them */
+#define REPLICA_LOAD_ATTEMPTS 2
+
+static int replica_nodes                = 0;    /* set by recvloop before the first reload */
+static pthread_mutex_t replicas_mutex   = PTHREAD_MUTEX_INITIALIZER;
+static struct engine_replicas *replicas = NULL; /* protected by replicas_mutex */
+
+/**
+ * @brief Thread entry point to load the engine replica for one NUMA node.
+ *
+ * The thread runs on the node so that the loader's own allocations are local too.
+ *
+ * @param arg   A replica_th_t structure, the engine and its signature count are stored in it (NULL on failure).
+ * @return void*
+ */
+static void *replica_th(void *arg)
+{
+    struct replica_th_t *rth = arg;
+    struct cl_engine *engine = NULL;
+    unsigned int sigs        = 0;
+    cl_error_t ret;
+
+    if (thrmgr_numa_pin(rth->node))
+        logg(LOGG_DEBUG, "replica_th: Can't run on NUMA node %d\n", rth->node);
+
+    if (NULL == (engine = cl_engine_new())) {
+        logg(LOGG_ERROR, "replica_th: Can't initialize antivirus engine\n");
+        goto done;
+    }
+
+    if (CL_SUCCESS != (ret = cl_engine_settings_apply(engine, rth->settings)) ||
+        CL_SUCCESS != (ret = cl_engine_set_num(engine, CL_ENGINE_NUMA_NODE, rth->node)) ||
+        CL_SUCCESS != (ret = cl_load(rth->dbdir, engine, &sigs, rth->dboptions)) ||
+        CL_SUCCESS != (ret = cl_engine_compile(engine))) {
+        logg(LOGG_ERROR, "replica_th: Can't load the engine for NUMA node %d: %s\n", rth->node, cl_strerror(ret));
+        cl_engine_free(engine);
+        engine = NULL;
+    }
+
+done:
+    rth->engine = engine;
+    rth->sigs   = sigs;
+    return NULL;
+}
+
+/**
+ * @brief Check that a replica was loaded from the same databases as the primary.
+ *
+ * The databases may have been updated between the two loads.
+ *
+ * @param primary   The primary engine.
+ * @param sigs      The number of signatures in the primary.
+ * @param rth       The replica.
+ * @return int      1 if they match, 0 if not.
+ */
+static int replica_matches(const struct cl_engine *primary, unsigned int sigs, const struct replica_th_t *rth)
+{
+    if (rth->sigs != sigs ||
+        cl_engine_get_num(rth->engine, CL_ENGINE_DB_VERSION, NULL) != cl_engine_get_num(primary, CL_ENGINE_DB_VERSION, NULL) ||
+        cl_engine_get_num(rth->engine, CL_ENGINE_DB_TIME, NULL) != cl_engine_get_num(primary, CL_ENGINE_DB_TIME, NULL)) {
+        logg(LOGG_WARNING, "The engine replica for NUMA node %d doesn't match the primary (%u signatures vs. %u)\n", rth->node, rth->sigs, sigs);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Load a replica of a freshly compiled engine on each NUMA node but the first.
+ *
+ * The engine cannot be copied, so each replica loads the databases again, all nodes in parallel.
+ * A replica which doesn't match the primary, because the databases were updated in the meantime,
+ * is loaded again. On failure the primary is used on all nodes.
+ *
+ * @param primary   The engine, it serves node 0.
+ * @param sigs      The number of signatures in the primary.
+ * @param dbdir     The database directory the primary was loaded from.
+ * @param dboptions The database options the primary was loaded with.
+ */
+static void replicas_build(struct cl_engine *primary, unsigned int sigs, const char *dbdir, unsigned int dboptions)
+{
+    struct replica_th_t rth[MAX_ENGINE_REPLICAS];
+    pthread_t th[MAX_ENGINE_REPLICAS];
+    int running[MAX_ENGINE_REPLICAS];
+    struct cl_settings *settings;
+    struct engine_replicas *set;
+    int nodes = replica_nodes, attempt, i, failed = 0;
+
+    if (nodes < 2)
+        return;
+    if (nodes > MAX_ENGINE_REPLICAS)
+        nodes = MAX_ENGINE_REPLICAS;
+
+    if (NULL == (settings = cl_engine_settings_copy(primary))) {
+        logg(LOGG_WARNING, "Can't copy the engine settings, not loading the NUMA replicas\n");
+        return;
+    }
+
+    memset(rth, 0, sizeof(rth));
+    for (attempt = 0; attempt < REPLICA_LOAD_ATTEMPTS; attempt++) {
+        int mismatch = 0;
+
+        memset(running, 0, sizeof(running));
+        for (i = 1; i < nodes && !failed; i++) {
+            if (rth[i].engine)
+                continue;
+            rth[i].settings  = settings;
+            rth[i].dbdir     = dbdir;
+            rth[i].dboptions = dboptions;
+            rth[i].node      = i;
+            if (pthread_create(&th[i], NULL, replica_th, &rth[i])) {
+                logg(LOGG_ERROR, "Failed to spawn the replica thread for NUMA node %d\n", i);
+                failed = 1;
+                break;
+            }
+            running[i] = 1;
+        }
+        for (i = 1; i < nodes; i++) {
+            if (!running[i])
+                continue;
+            pthread_join(th[i], NULL);
+            if (!rth[i].engine) {
+                failed = 1;
+            } else if (!replica_matches(primary, sigs, &rth[i])) {
+                cl_engine_free(rth[i].engine);
+                rth[i].engine = NULL;
+                mismatch      = 1;
+            }
+        }
+        if (failed || !mismatch)
+            break;
+    }
+    if (attempt == REPLICA_LOAD_ATTEMPTS)
+        failed = 1;
+    cl_engine_settings_free(settings);
+
+    if (!failed && NULL == (set = calloc(1, sizeof(*set))))
+        failed = 1;
+    if (failed) {
+        for (i = 1; i < nodes; i++)
+            if (rth[i].engine)
+                cl_engine_free(rth[i].engine);
+        logg(LOGG_WARNING, "Failed to load the NUMA replicas, all nodes will share one engine\n");
+        return;
+    }
+
+    set->engines[0] = primary;
+    for (i = 1; i < nodes; i++)
+        set->engines[i] = rth[i].engine;
+    set->nodes = nodes;
+
+    pthread_mutex_lock(&replicas_mutex);
+    set->next = replicas;
+    replicas  = set;
+    pthread_mutex_unlock(&replicas_mutex);
+
+    logg(LOGG_INFO, "Loaded the engine replicas for %d NUMA nodes\n", nodes);
+}
+
+/**
+ * @brief Release the replicas of a primary engine which is going away.
+ *
+ * Scans still running on a replica keep their own reference to it.
+ *
+ * @param primary   The engine passed to replicas_build().
+ */
+static void replicas_retire(struct cl_engine *primary)
+{
+    struct engine_replicas **pset, *set = NULL;
+    int i;
+
+    if (!primary)
+        return;
+
+    pthread_mutex_lock(&replicas_mutex);
+    for (pset = &replicas; *pset; pset = &(*pset)->next) {
+        if ((*pset)->engines[0] == primary) {
+            set   = *pset;
+            *pset = set->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&replicas_mutex);
+
+    if (!set)
+        return;
+    for (i = 1; i < set->nodes; i++)
+        cl_engine_free(set->engines[i]);
+    free(set);
+}
+
+/**
+ * @brief Find the replica of an engine for the NUMA node the calling worker runs on.
+ *
+ * @param engine    The primary or any of its replicas.
+ * @return struct cl_engine* A new reference to the local replica, or NULL if the engine is already local.
+ */
+static struct cl_engine *replicas_local(const struct cl_engine *engine)
+{
+    struct engine_replicas *set;
+    struct cl_engine *local = NULL;
+    int node                = thrmgr_numa_node();
+    int i;
+
+    if (node < 0)
+        return NULL;
+
+    pthread_mutex_lock(&replicas_mutex);
+    for (set = replicas; set && !local; set = set->next) {
+        for (i = 0; i < set->nodes; i++) {
+            if (set->engines[i] == engine) {
+                if (node < set->nodes && set->engines[node] != engine) {
+                    local = set->engines[node];
+                    cl_engine_addref(local);
+                }
+                break;
+            }
+        }
+        if (i < set->nodes)
+            break;
+    }
+    pthread_mutex_unlock(&replicas_mutex);
+
+    return local;
+}
+
 /*static void scanner_thread(void *arg)*/
 void scanner_thread(void *arg)
 {
@@ -106,6 +353,7 @@ void scanner_thread(void *arg)
 #ifndef _WIN32
     sigset_t sigset;
 #endif
+    struct cl_engine *local;
     int ret;
     int virus = 0, errors = 0;
 
@@ -124,6 +372,12 @@ void scanner_thread(void *arg)
     sigdelset(&sigset, SIGCONT);
     pthread_sigmask(SIG_SETMASK, &sigset, NULL);
 #endif
+    /* scan with the copy of the signatures on this thread's NUMA node */
+    if ((local = replicas_local(conn->engine))) {
+        cl_engine_free(conn->engine);
+        conn->engine = local;
+    }
+
     /*logg(LOGG_ERROR, "in scanthread, trying to handle command\n");*/
 
     ret = command(conn, &virus);
@@ -260,6 +514,8 @@ static void *reload_th(void *arg)
         goto done;
     }
 
+    replicas_build(engine, sigs, rldata->dbdir, rldata->dboptions);
+
     logg(LOGG_INFO, "Database correctly reloaded (%u signatures)\n", sigs);
     status = CL_SUCCESS;
 
@@ -363,6 +619,7 @@ static cl_error_t reload_db(struct cl_engine **engine, unsigned int dboptions, c
              * It will only actually be free'd once the last scan finishes.
              */
             thrmgr_setactiveengine(NULL);
+            replicas_retire(*engine);
             cl_engine_free(*engine);
             *engine = NULL;
 
@@ -904,7 +1161,7 @@ static int handle_stream(client_conn_t *conn, struct fd_buf *buf, const struct o
     return 0;
 }
 
-int recvloop(int *socketds, unsigned nsockets, struct cl_engine *engine, unsigned int dboptions, const struct optstruct *opts)
+int recvloop(int *socketds, unsigned nsockets, struct cl_engine *engine, unsigned int sigs, unsigned int dboptions, const struct optstruct *opts)
 {
     int max_threads, max_queue, readtimeout, ret = 0;
     struct cl_scan_options options;
@@ -1563,6 +1820,11 @@ int recvloop(int *socketds, unsigned nsockets, struct cl_engine *engine, unsigne
         exit(-1);
     }
 
+    if (optget(opts, "NUMAEngineReplicas")->enabled && (replica_nodes = thrmgr_numa_nodes()) > 1) {
+        thrmgr_setnuma(thr_pool, replica_nodes);
+        replicas_build(engine, sigs, optget(opts, "DatabaseDirectory")->strarg, dboptions);
+    }
+
     if (pthread_create(&accept_th, NULL, acceptloop_th, &acceptdata)) {
         logg(LOGG_ERROR, "pthread_create failed\n");
         exit(-1);
@@ -1786,6 +2048,7 @@ int recvloop(int *socketds, unsigned nsockets, struct cl_engine *engine, unsigne
                     thrmgr_setactiveengine(g_newengine);
                     if (optget(opts, "ConcurrentDatabaseReload")->enabled) {
                         /* If concurrent database reload, we now need to free the old engine. */
+                        replicas_retire(engine);
                         cl_engine_free(engine);
                     }
                     engine      = g_newengine;
@@ -1824,6 +2087,7 @@ int recvloop(int *socketds, unsigned nsockets, struct cl_engine *engine, unsigne
     thrmgr_destroy(thr_pool);
     if (engine) {
         thrmgr_setactiveengine(NULL);
+        replicas_retire(engine);
         cl_engine_free(engine);
     }
 
@@ -42,7 +42,7 @@ struct thrarg {
     const struct cl_engine *engine;
 };
 
-int recvloop(int *socketds, unsigned nsockets, struct cl_engine *engine, unsigned int dboptions, const struct optstruct *opts);
+int recvloop(int *socketds, unsigned nsockets, struct cl_engine *engine, unsigned int sigs, unsigned int dboptions, const struct optstruct *opts);
 int statinidir(const char *dirname);
 void sighandler(int sig);
 void sighandler_th(int sig);
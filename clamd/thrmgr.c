@@ -25,10 +25,15 @@
 #endif
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <pthread.h>
 #include <time.h>
 #include <errno.h>
 #include <string.h>
+#if defined(C_LINUX) && defined(_GNU_SOURCE)
+#include <sched.h>
+#define THRMGR_NUMA 1
+#endif
 
 // libclamav
 #include "clamav.h"
@@ -200,7 +205,8 @@ int thrmgr_printstats(int f, char term)
 {
     struct threadpool_list *l;
     unsigned cnt, pool_cnt = 0;
-    size_t pool_used = 0, pool_total = 0, seen_cnt = 0, error_flag = 0;
+    size_t pool_used = 0, pool_total = 0, pool_huge = 0, seen_cnt = 0, error_flag = 0;
+    unsigned bc_count = 0, bc_prepared = 0;
     float mem_heap = 0, mem_mmap = 0, mem_used = 0, mem_free = 0, mem_releasable = 0;
     const struct cl_engine **seen = NULL;
     int has_libc_memstats         = 0;
@@ -247,7 +253,7 @@ int thrmgr_printstats(int f, char term)
         mdprintf(f, "\n");
         for (task = pool->tasks; task; task = task->nxt) {
             double delta;
-            size_t used, total;
+            size_t used, total, huge;
 
             delta = tv_now.tv_usec - task->tv.tv_usec;
             delta += (tv_now.tv_sec - task->tv.tv_sec) * 1000000.0;
@@ -282,6 +288,10 @@ int thrmgr_printstats(int f, char term)
                         pool_total += total;
                         pool_cnt++;
                     }
+                    if (MPOOL_GETHUGESTATS(task->engine, &huge) != -1)
+                        pool_huge += huge;
+                    bc_count += cl_engine_get_num(task->engine, CL_ENGINE_BYTECODE_COUNT, NULL);
+                    bc_prepared += cl_engine_get_num(task->engine, CL_ENGINE_BYTECODE_PREPARED, NULL);
                 }
             }
         }
@@ -303,12 +313,13 @@ int thrmgr_printstats(int f, char term)
         mdprintf(f, "ERROR: error encountered while formatting statistics\n");
     } else {
         if (has_libc_memstats)
-            mdprintf(f, "MEMSTATS: heap %.3fM mmap %.3fM used %.3fM free %.3fM releasable %.3fM pools %u pools_used %.3fM pools_total %.3fM\n",
+            mdprintf(f, "MEMSTATS: heap %.3fM mmap %.3fM used %.3fM free %.3fM releasable %.3fM pools %u pools_used %.3fM pools_total %.3fM pools_huge %.3fM\n",
                      mem_heap, mem_mmap, mem_used, mem_free, mem_releasable, pool_cnt,
-                     pool_used / (1024 * 1024.0), pool_total / (1024 * 1024.0));
+                     pool_used / (1024 * 1024.0), pool_total / (1024 * 1024.0), pool_huge / (1024 * 1024.0));
         else
-            mdprintf(f, "MEMSTATS: heap N/A mmap N/A used N/A free N/A releasable N/A pools %u pools_used %.3fM pools_total %.3fM\n",
-                     pool_cnt, pool_used / (1024 * 1024.0), pool_total / (1024 * 1024.0));
+            mdprintf(f, "MEMSTATS: heap N/A mmap N/A used N/A free N/A releasable N/A pools %u pools_used %.3fM pools_total %.3fM pools_huge %.3fM\n",
+                     pool_cnt, pool_used / (1024 * 1024.0), pool_total / (1024 * 1024.0), pool_huge / (1024 * 1024.0));
+        mdprintf(f, "BYTECODE: loaded %u prepared %u\n", bc_count, bc_prepared);
     }
     mdprintf(f, "END%c", term);
     pthread_mutex_unlock(&pools_lock);
@@ -440,6 +451,8 @@ threadpool_t *thrmgr_new(int max_threads, int idle_timeout, int max_queue, void
     threadpool->idle_timeout  = idle_timeout;
     threadpool->handler       = handler;
     threadpool->tasks         = NULL;
+    threadpool->numa_nodes    = 0;
+    threadpool->numa_next     = 0;
 
     if (pthread_mutex_init(&(threadpool->pool_mutex), NULL)) {
         free(threadpool->single_queue);
@@ -569,12 +582,119 @@ void thrmgr_setactiveengine(const struct cl_engine *engine)
     desc->engine = engine;
 }
 
+/*
+ * For testing, CLAMD_NUMA_NODES pretends that the host has that many NUMA nodes.
+ * Threads assigned to a node which doesn't exist run wherever the system puts them.
+ */
+static int numa_nodes_forced(void)
+{
+    const char *env = getenv("CLAMD_NUMA_NODES");
+    int nodes       = env ? atoi(env) : 0;
+
+    return nodes > 0 ? nodes : 0;
+}
+
+/* Number of NUMA nodes (highest online node + 1), 0 if unknown */
+int thrmgr_numa_nodes(void)
+{
+#ifdef THRMGR_NUMA
+    FILE *fs;
+    int first, last = -1, c;
+
+    if ((c = numa_nodes_forced()))
+        return c;
+
+    /* a list of ranges such as "0-3,8-11" */
+    if (!(fs = fopen("/sys/devices/system/node/online", "r")))
+        return 0;
+    while (fscanf(fs, "%d", &first) == 1) {
+        last = first;
+        if ((c = fgetc(fs)) == '-') {
+            if (fscanf(fs, "%d", &last) != 1)
+                break;
+            c = fgetc(fs);
+        }
+        if (c != ',')
+            break;
+    }
+    fclose(fs);
+    return last + 1;
+#else
+    return numa_nodes_forced();
+#endif
+}
+
+/* Pin the calling thread to the CPUs of a NUMA node */
+int thrmgr_numa_pin(int node)
+{
+#ifdef THRMGR_NUMA
+    char path[64];
+    FILE *fs;
+    cpu_set_t cpus;
+    int first, last, c, cpu, ret;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    if (!(fs = fopen(path, "r")))
+        return node < numa_nodes_forced() ? 0 : -1;
+    CPU_ZERO(&cpus);
+    while (fscanf(fs, "%d", &first) == 1) {
+        last = first;
+        if ((c = fgetc(fs)) == '-') {
+            if (fscanf(fs, "%d", &last) != 1)
+                break;
+            c = fgetc(fs);
+        }
+        for (cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+            CPU_SET(cpu, &cpus);
+        if (c != ',')
+            break;
+    }
+    fclose(fs);
+    if (!CPU_COUNT(&cpus))
+        return -1;
+
+    if ((ret = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus))) {
+        logg(LOGG_DEBUG_NV, "THRMGR: can't pin thread to NUMA node %d: %s\n", node, strerror(ret));
+        return -1;
+    }
+    return 0;
+#else
+    return node < numa_nodes_forced() ? 0 : -1;
+#endif
+}
+
+/* NUMA node the calling worker thread is pinned to, -1 if none */
+int thrmgr_numa_node(void)
+{
+    struct task_desc *desc;
+    pthread_once(&stats_tls_key_once, stats_tls_key_alloc);
+    desc = pthread_getspecific(stats_tls_key);
+    if (!desc)
+        return -1;
+    return desc->numa_node;
+}
+
+/* Pin the worker threads started from now on round robin to nodes NUMA nodes */
+void thrmgr_setnuma(threadpool_t *threadpool, int nodes)
+{
+    pthread_mutex_lock(&threadpool->pool_mutex);
+    threadpool->numa_nodes = nodes > 1 ? nodes : 0;
+    pthread_mutex_unlock(&threadpool->pool_mutex);
+}
+
 /* thread pool mutex must be held on entry */
 static void stats_init(threadpool_t *pool)
 {
     struct task_desc *desc = calloc(1, sizeof(*desc));
     if (!desc)
         return;
+    desc->numa_node = -1;
+    if (pool->numa_nodes) {
+        int node = pool->numa_next++ % pool->numa_nodes;
+
+        if (!thrmgr_numa_pin(node))
+            desc->numa_node = node;
+    }
     pthread_once(&stats_tls_key_once, stats_tls_key_alloc);
     pthread_setspecific(stats_tls_key, desc);
     if (!pool->tasks)
@@ -57,6 +57,7 @@ struct task_desc {
     struct task_desc *prv;
     struct task_desc *nxt;
     const struct cl_engine *engine;
+    int numa_node; /* node the thread is pinned to, -1 if it isn't */
 };
 
 typedef struct threadpool_tag {
@@ -81,6 +82,9 @@ typedef struct threadpool_tag {
 
     work_queue_t *bulk_queue;
     work_queue_t *single_queue;
+
+    int numa_nodes;        /* pin the workers round robin to this many nodes */
+    unsigned int numa_next; /* node for the next worker */
 } threadpool_t;
 
 typedef struct jobgroup {
@@ -112,5 +116,9 @@ jobgroup_t *thrmgr_group_new(void);
 int thrmgr_printstats(int outfd, char term);
 void thrmgr_setactivetask(const char *filename, const char *command);
 void thrmgr_setactiveengine(const struct cl_engine *engine);
+int thrmgr_numa_nodes(void);
+int thrmgr_numa_pin(int node);
+int thrmgr_numa_node(void);
+void thrmgr_setnuma(threadpool_t *threadpool, int nodes);
 
 #endif
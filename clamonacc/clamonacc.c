@@ -54,9 +54,11 @@
 
 #include "clamonacc.h"
 #include "client/client.h"
+#include "client/pool.h"
 #include "fanotif/fanotif.h"
 #include "inotif/inotif.h"
 #include "scan/onas_queue.h"
+#include "scan/onas_cache.h"
 
 pthread_t ddd_pid        = 0;
 pthread_t scan_queue_pid = 0;
@@ -191,9 +193,23 @@ int main(int argc, char **argv)
             break;
     }
 
+    /* Setup our verdict cache */
+    if (CL_SUCCESS != onas_cache_init(ctx)) {
+        logg(LOGG_ERROR, "Clamonacc: can't setup verdict cache\n");
+        ret = 2;
+        goto done;
+    }
+
     /* Setup our event queue */
     ctx->maxthreads = optget(ctx->clamdopts, "OnAccessMaxThreads")->numarg;
 
+    /* Setup our clamd sessions, one per few scan threads */
+    if (CL_SUCCESS != onas_pool_init(ctx)) {
+        logg(LOGG_ERROR, "Clamonacc: can't setup clamd connection pool\n");
+        ret = 2;
+        goto done;
+    }
+
     switch (onas_scan_queue_start(&ctx)) {
         case CL_SUCCESS:
             break;
@@ -463,6 +479,8 @@ void help(void)
 
 void onas_cleanup(struct onas_context *ctx)
 {
+    onas_pool_destroy();
+    onas_cache_destroy();
     onas_context_cleanup(ctx);
     logg_close();
 }
@@ -66,6 +66,7 @@
 
 #include "communication.h"
 #include "client.h"
+#include "pool.h"
 #include "protocol.h"
 #include "socket.h"
 
@@ -514,6 +515,56 @@ int onas_get_clamd_version(struct onas_context **ctx)
     return 0;
 }
 
+/**
+ * @brief ask clamd for its version, which includes the version of the loaded databases
+ *
+ * @param tcpaddr   string which refers to either the TCPaddress or the local socket to connect to
+ * @param portnum   the port to use in case of TCP connection, set to 0 if connecting to a local socket
+ * @param timeout   time in ms to allow curl before timing out connection attempts
+ * @param version   return buffer for the reply, e.g. "ClamAV 1.4.1/27400/Tue Sep 10 08:35:12 2024"
+ * @param len       size of the version buffer
+ */
+int onas_client_version(const char *tcpaddr, int64_t portnum, int64_t timeout, char *version, size_t len)
+{
+    CURL *curl        = NULL;
+    CURLcode curlcode = CURLE_OK;
+    struct onas_rcvln rcv;
+    char *buff;
+    int ret               = 2;
+    const char zVERSION[] = "zVERSION";
+
+    curlcode = onas_curl_init(&curl, tcpaddr, portnum, timeout);
+    if (CURLE_OK != curlcode) {
+        logg(LOGG_DEBUG, "ClamClient: could not init curl for version check, %s\n", curl_easy_strerror(curlcode));
+        /* curl cleanup done in onas_curl_init on error */
+        return 2;
+    }
+
+    onas_recvlninit(&rcv, curl, 0);
+
+    curlcode = curl_easy_perform(curl);
+    if (CURLE_OK != curlcode) {
+        logg(LOGG_DEBUG, "ClamClient: could not connect to clamd, %s\n", curl_easy_strerror(curlcode));
+        goto done;
+    }
+
+    if (onas_sendln(curl, zVERSION, sizeof(zVERSION), timeout)) {
+        goto done;
+    }
+
+    if (onas_recvln(&rcv, &buff, NULL, timeout) > 0) {
+        strncpy(version, buff, len - 1);
+        version[len - 1] = '\0';
+        ret              = 0;
+    } else {
+        logg(LOGG_DEBUG, "ClamClient: clamd did not respond with version information\n");
+    }
+
+done:
+    curl_easy_cleanup(curl);
+    return ret;
+}
+
 /**
  * @brief kick off scanning and return results
  *
@@ -543,6 +594,10 @@ int onas_client_scan(const char *tcpaddr, int64_t portnum, int32_t scantype, uin
         scantype = STREAM;
     }
 
+    if ((scantype == FILDES || scantype == STREAM) && onas_pool_enabled()) {
+        return onas_pool_scan(tcpaddr, portnum, scantype, maxstream, fname, fd, timeout, infected, err, ret_code);
+    }
+
     curlcode = onas_curl_init(&curl, tcpaddr, portnum, timeout);
     if (CURLE_OK != curlcode) {
         logg(LOGG_ERROR, "ClamClient: could not init curl for scanning, %s\n", curl_easy_strerror(curlcode));
@@ -0,0 +1,637 @@
+/*
+ *  Copyright (C) 2025 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#if HAVE_CONFIG_H
+#include "clamav-config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <curl/curl.h>
+
+// libclamav
+#include "clamav.h"
+
+// common
+#include "optparser.h"
+#include "output.h"
+#include "misc.h"
+#include "clamdcom.h"
+
+#include "communication.h"
+#include "protocol.h"
+#include "client.h"
+#include "pool.h"
+
+/*
+ * Long lived IDSESSION connections to clamd. Requests are pipelined: a
+ * request is written as soon as nobody else is writing to the connection,
+ * and the replies, which clamd sends in whatever order the scans finish, are
+ * matched to their request by the id clamd puts in front of them. The first
+ * waiter that finds nobody reading the connection reads it on behalf of all
+ * of them.
+ */
+struct onas_pool_req {
+    struct onas_pool_req *next;
+    unsigned int id;
+    int done; /* 1 once the reply is in, -1 if the connection went away first */
+    char *reply;
+};
+
+struct onas_pool_conn {
+    pthread_mutex_t mutex;      /* protects everything below but the receive buffer */
+    pthread_cond_t cond;        /* broadcast whenever a reply arrives or the reader steps down */
+    pthread_mutex_t send_mutex; /* held while a request is being written, taken before mutex */
+    CURL *curl;
+    curl_socket_t sockd;
+    unsigned int next_id;
+    uint32_t users; /* requests sent or being sent, and not answered yet */
+    int reading;
+    int broken;
+    time_t last_used;
+    struct onas_pool_req *waiting;
+
+    /* only touched by whoever is reading */
+    char rbuf[PATH_MAX + 1024];
+    size_t rlen;
+};
+
+static pthread_mutex_t onas_pool_lock         = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t onas_pool_released      = PTHREAD_COND_INITIALIZER;
+static struct onas_pool_conn *onas_pool_conns = NULL;
+static uint32_t onas_pool_size                = 0;
+static uint32_t onas_pool_next                = 0;
+static uint32_t onas_pool_holders             = 0; /* scans that may still touch onas_pool_conns */
+static int64_t onas_pool_idle                 = 0;
+static int64_t onas_pool_timeout              = 0;
+static bool onas_pool_disconnected            = false;
+
+cl_error_t onas_pool_init(struct onas_context *ctx)
+{
+    struct onas_pool_conn *conns;
+    uint32_t size, i;
+
+    if (NULL == ctx) {
+        return CL_ENULLARG;
+    }
+
+    /* inside an IDSESSION clamd only takes FILDES and INSTREAM, not the path based scans */
+    if (ctx->scantype != FILDES && ctx->scantype != STREAM) {
+        logg(LOGG_DEBUG, "ClamPool: not pooling connections for path based scans\n");
+        return CL_SUCCESS;
+    }
+
+    size = ctx->maxthreads > 0 ? (ctx->maxthreads + ONAS_POOL_DEPTH - 1) / ONAS_POOL_DEPTH : 1;
+
+    conns = calloc(size, sizeof(struct onas_pool_conn));
+    if (NULL == conns) {
+        logg(LOGG_ERROR, "ClamPool: could not allocate memory for %u connections\n", size);
+        return CL_EMEM;
+    }
+
+    for (i = 0; i < size; i++) {
+        pthread_mutex_init(&conns[i].mutex, NULL);
+        pthread_mutex_init(&conns[i].send_mutex, NULL);
+        pthread_cond_init(&conns[i].cond, NULL);
+        conns[i].sockd = CURL_SOCKET_BAD;
+    }
+
+    pthread_mutex_lock(&onas_pool_lock);
+    onas_pool_conns   = conns;
+    onas_pool_size    = size;
+    onas_pool_next    = 0;
+    onas_pool_idle    = optget(ctx->clamdopts, "CommandReadTimeout")->numarg;
+    onas_pool_timeout = ctx->timeout;
+    pthread_mutex_unlock(&onas_pool_lock);
+
+    logg(LOGG_DEBUG, "ClamPool: keeping up to %u sessions with clamd, %u requests deep\n", size, ONAS_POOL_DEPTH);
+    return CL_SUCCESS;
+}
+
+int onas_pool_enabled(void)
+{
+    int ret;
+
+    pthread_mutex_lock(&onas_pool_lock);
+    ret = onas_pool_size != 0;
+    pthread_mutex_unlock(&onas_pool_lock);
+
+    return ret;
+}
+
+/* conn->mutex must be held and nobody may be using the connection */
+static void onas_pool_close(struct onas_pool_conn *conn, int64_t timeout)
+{
+    const char zEND[] = "zEND";
+
+    if (conn->curl) {
+        if (!conn->broken) {
+            onas_sendln(conn->curl, zEND, sizeof(zEND), timeout);
+        }
+        curl_easy_cleanup(conn->curl);
+    }
+
+    conn->curl    = NULL;
+    conn->sockd   = CURL_SOCKET_BAD;
+    conn->broken  = 0;
+    conn->next_id = 0;
+    conn->rlen    = 0;
+}
+
+static void onas_pool_break(struct onas_pool_conn *conn);
+
+void onas_pool_destroy(void)
+{
+    struct onas_pool_conn *conns;
+    uint32_t size, i;
+
+    /* no new scans from here on */
+    pthread_mutex_lock(&onas_pool_lock);
+    conns           = onas_pool_conns;
+    size            = onas_pool_size;
+    onas_pool_conns = NULL;
+    onas_pool_size  = 0;
+    pthread_mutex_unlock(&onas_pool_lock);
+
+    if (NULL == conns) {
+        return;
+    }
+
+    /* scan threads that outlived the queue give up on their sessions */
+    for (i = 0; i < size; i++) {
+        pthread_mutex_lock(&conns[i].mutex);
+        if (conns[i].users) {
+            onas_pool_break(&conns[i]);
+        }
+        pthread_mutex_unlock(&conns[i].mutex);
+    }
+
+    pthread_mutex_lock(&onas_pool_lock);
+    while (onas_pool_holders) {
+        pthread_cond_wait(&onas_pool_released, &onas_pool_lock);
+    }
+    pthread_mutex_unlock(&onas_pool_lock);
+
+    for (i = 0; i < size; i++) {
+        pthread_mutex_lock(&conns[i].mutex);
+        onas_pool_close(&conns[i], onas_pool_timeout);
+        pthread_mutex_unlock(&conns[i].mutex);
+
+        pthread_mutex_destroy(&conns[i].mutex);
+        pthread_mutex_destroy(&conns[i].send_mutex);
+        pthread_cond_destroy(&conns[i].cond);
+    }
+
+    free(conns);
+}
+
+/* Keeps onas_pool_destroy() from freeing the connections until onas_pool_release()
+ * Returns 0 if there is no pool to use */
+static int onas_pool_hold(void)
+{
+    int ret;
+
+    pthread_mutex_lock(&onas_pool_lock);
+    ret = onas_pool_size != 0;
+    if (ret) {
+        onas_pool_holders++;
+    }
+    pthread_mutex_unlock(&onas_pool_lock);
+
+    return ret;
+}
+
+static void onas_pool_release(void)
+{
+    pthread_mutex_lock(&onas_pool_lock);
+    if (0 == --onas_pool_holders) {
+        pthread_cond_broadcast(&onas_pool_released);
+    }
+    pthread_mutex_unlock(&onas_pool_lock);
+}
+
+/* Returns NULL once the pool is being destroyed
+ * onas_pool_hold() must have succeeded */
+static struct onas_pool_conn *onas_pool_pick(void)
+{
+    struct onas_pool_conn *conn = NULL;
+
+    pthread_mutex_lock(&onas_pool_lock);
+    if (onas_pool_size) {
+        conn = &onas_pool_conns[onas_pool_next++ % onas_pool_size];
+    }
+    pthread_mutex_unlock(&onas_pool_lock);
+
+    return conn;
+}
+
+/* Connects and opens the session
+ * conn->mutex must be held
+ * Returns 0 on success, -1 on failure */
+static int onas_pool_connect(struct onas_pool_conn *conn, const char *tcpaddr, int64_t portnum, int64_t timeout)
+{
+    const char zIDSESSION[] = "zIDSESSION";
+    CURLcode curlcode;
+#if ((LIBCURL_VERSION_MAJOR > 7) || (LIBCURL_VERSION_MAJOR == 7 && LIBCURL_VERSION_MINOR >= 45))
+    curl_socket_t sockd;
+#else
+    long sockd;
+#endif
+
+    curlcode = onas_curl_init(&conn->curl, tcpaddr, portnum, timeout);
+    if (CURLE_OK != curlcode) {
+        logg(LOGG_ERROR, "ClamPool: could not init curl for scanning, %s\n", curl_easy_strerror(curlcode));
+        /* curl cleanup done in onas_curl_init on error */
+        conn->curl = NULL;
+        return -1;
+    }
+
+    curlcode = curl_easy_perform(conn->curl);
+    if (CURLE_OK != curlcode) {
+        pthread_mutex_lock(&onas_pool_lock);
+        if (!onas_pool_disconnected) {
+            logg(LOGG_ERROR, "ClamPool: Connection to clamd failed, %s.\n", curl_easy_strerror(curlcode));
+            onas_pool_disconnected = true;
+        }
+        pthread_mutex_unlock(&onas_pool_lock);
+        goto fail;
+    }
+
+#if ((LIBCURL_VERSION_MAJOR > 7) || (LIBCURL_VERSION_MAJOR == 7 && LIBCURL_VERSION_MINOR >= 45))
+    /* Use new CURLINFO_ACTIVESOCKET option */
+    curlcode = curl_easy_getinfo(conn->curl, CURLINFO_ACTIVESOCKET, &sockd);
+#else
+    /* Use deprecated CURLINFO_LASTSOCKET option */
+    curlcode = curl_easy_getinfo(conn->curl, CURLINFO_LASTSOCKET, &sockd);
+#endif
+    if (CURLE_OK != curlcode) {
+        logg(LOGG_ERROR, "ClamPool: could not get curl active socket info %s\n", curl_easy_strerror(curlcode));
+        goto fail;
+    }
+
+    if (onas_sendln(conn->curl, zIDSESSION, sizeof(zIDSESSION), timeout)) {
+        goto fail;
+    }
+
+    pthread_mutex_lock(&onas_pool_lock);
+    if (onas_pool_disconnected) {
+        logg(LOGG_INFO, "ClamPool: Connection to clamd re-established.\n");
+        onas_pool_disconnected = false;
+    }
+    pthread_mutex_unlock(&onas_pool_lock);
+
+    conn->sockd     = (curl_socket_t)sockd;
+    conn->next_id   = 0;
+    conn->broken    = 0;
+    conn->rlen      = 0;
+    conn->last_used = time(NULL);
+    return 0;
+
+fail:
+    curl_easy_cleanup(conn->curl);
+    conn->curl = NULL;
+    return -1;
+}
+
+/* Makes sure the connection has a usable session, replacing it while idle if clamd may have dropped it
+ * conn->send_mutex and conn->mutex must be held
+ * Returns 0 on success, -1 on failure */
+static int onas_pool_prepare(struct onas_pool_conn *conn, const char *tcpaddr, int64_t portnum, int64_t timeout)
+{
+    struct pollfd pfd;
+    int stopping;
+
+    /* a broken session is replaced once the requests still on it have failed, which
+     * doesn't take long: nobody else can be sending while send_mutex is held here */
+    while (conn->broken && conn->users) {
+        pthread_cond_wait(&conn->cond, &conn->mutex);
+    }
+
+    if (conn->curl && !conn->users) {
+        pfd.fd     = conn->sockd;
+        pfd.events = POLLIN;
+
+        /* clamd hangs up on sessions left idle for CommandReadTimeout, and nothing
+         * should arrive on an idle session but that or a reply nobody waits for anymore */
+        if (conn->broken ||
+            (onas_pool_idle && conn->last_used + onas_pool_idle <= time(NULL) + 1) ||
+            poll(&pfd, 1, 0) != 0) {
+            onas_pool_close(conn, timeout);
+        }
+    }
+
+    if (!conn->curl) {
+        /* don't open a session onas_pool_destroy() has no reason to wait for */
+        pthread_mutex_lock(&onas_pool_lock);
+        stopping = onas_pool_size == 0;
+        pthread_mutex_unlock(&onas_pool_lock);
+        if (stopping) {
+            return -1;
+        }
+        return onas_pool_connect(conn, tcpaddr, portnum, timeout);
+    }
+
+    return 0;
+}
+
+/* conn->mutex must be held */
+static void onas_pool_unlink(struct onas_pool_conn *conn, struct onas_pool_req *req)
+{
+    struct onas_pool_req **prev;
+
+    for (prev = &conn->waiting; *prev; prev = &(*prev)->next) {
+        if (*prev == req) {
+            *prev = req->next;
+            break;
+        }
+    }
+}
+
+/* Fails every outstanding request, the session is replaced once they're all gone
+ * conn->mutex must be held */
+static void onas_pool_break(struct onas_pool_conn *conn)
+{
+    struct onas_pool_req *req;
+
+    if (!conn->broken) {
+        conn->broken = 1;
+        /* wakes up the reader, the socket itself is closed once nobody uses it */
+        shutdown(conn->sockd, SHUT_RDWR);
+    }
+
+    for (req = conn->waiting; req; req = req->next) {
+        req->done = -1;
+    }
+    conn->waiting = NULL;
+
+    pthread_cond_broadcast(&conn->cond);
+}
+
+/* Reads whatever clamd sent, waiting up to timeout_ms, or forever if negative
+ * Returns >0 if something was read, 0 on timeout, -1 if the session is gone */
+static int onas_pool_recv(struct onas_pool_conn *conn, int timeout_ms)
+{
+    struct pollfd pfd;
+    ssize_t got;
+    int ret;
+
+    if (conn->rlen == sizeof(conn->rbuf)) {
+        logg(LOGG_ERROR, "ClamPool: overlong reply from clamd\n");
+        return -1;
+    }
+
+    pfd.fd     = conn->sockd;
+    pfd.events = POLLIN;
+    do {
+        ret = poll(&pfd, 1, timeout_ms);
+    } while (ret < 0 && errno == EINTR);
+    if (ret <= 0) {
+        return ret < 0 ? -1 : 0;
+    }
+
+    do {
+        got = recv(conn->sockd, conn->rbuf + conn->rlen, sizeof(conn->rbuf) - conn->rlen, 0);
+    } while (got < 0 && errno == EINTR);
+    if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return 1;
+    }
+    if (got <= 0) {
+        logg(LOGG_DEBUG, "ClamPool: clamd closed the session\n");
+        return -1;
+    }
+
+    conn->rlen += got;
+    return 1;
+}
+
+/* Hands every complete reply in the receive buffer to the request it answers
+ * conn->mutex must be held */
+static void onas_pool_dispatch(struct onas_pool_conn *conn)
+{
+    struct onas_pool_req **prev, *req;
+    char *bol = conn->rbuf, *eol, *reply;
+    unsigned long id;
+
+    while ((eol = memchr(bol, '\0', conn->rlen - (bol - conn->rbuf)))) {
+        id = strtoul(bol, &reply, 10);
+        if (reply == bol || strncmp(reply, ": ", 2)) {
+            logg(LOGG_DEBUG, "ClamPool: dropping reply without a request id: \"%s\"\n", bol);
+        } else {
+            for (prev = &conn->waiting; (req = *prev); prev = &req->next) {
+                if (req->id == id) {
+                    break;
+                }
+            }
+            if (req) {
+                *prev      = req->next;
+                req->reply = strdup(reply + 2);
+                req->done  = 1;
+            } else {
+                logg(LOGG_DEBUG, "ClamPool: dropping reply to request %lu, nobody waits for it anymore\n", id);
+            }
+        }
+        bol = eol + 1;
+    }
+
+    conn->rlen -= bol - conn->rbuf;
+    memmove(conn->rbuf, bol, conn->rlen);
+}
+
+/* Waits until req is answered or timeout_ms passed, if positive, reading the session when nobody else does
+ * conn->mutex must be held */
+static void onas_pool_wait(struct onas_pool_conn *conn, struct onas_pool_req *req, int64_t timeout_ms)
+{
+    struct timespec deadline, now;
+    int64_t wait_ms = -1;
+    int ret;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    if (timeout_ms > 0) {
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (timeout_ms % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+    }
+
+    while (!req->done) {
+        if (timeout_ms > 0) {
+            clock_gettime(CLOCK_REALTIME, &now);
+            wait_ms = (deadline.tv_sec - now.tv_sec) * 1000 + (deadline.tv_nsec - now.tv_nsec) / 1000000;
+            if (wait_ms <= 0) {
+                break;
+            }
+        }
+
+        if (!conn->reading) {
+            conn->reading = 1;
+            pthread_mutex_unlock(&conn->mutex);
+            ret = onas_pool_recv(conn, (int)wait_ms);
+            pthread_mutex_lock(&conn->mutex);
+            conn->reading = 0;
+
+            if (ret < 0) {
+                onas_pool_break(conn);
+            } else if (ret > 0) {
+                onas_pool_dispatch(conn);
+            }
+            /* wake up the others, for their reply or to take over reading */
+            pthread_cond_broadcast(&conn->cond);
+        } else if (timeout_ms > 0) {
+            pthread_cond_timedwait(&conn->cond, &conn->mutex, &deadline);
+        } else {
+            pthread_cond_wait(&conn->cond, &conn->mutex);
+        }
+    }
+
+    if (!req->done) {
+        /* a late reply is dropped by whoever reads it */
+        onas_pool_unlink(conn, req);
+    }
+}
+
+/**
+ * @brief Scans a file over a pooled clamd session.
+ *
+ * Mirrors onas_client_scan(); scantype must be FILDES or STREAM. If the session
+ * goes away before clamd answered, the request is sent once more on a fresh one.
+ */
+int onas_pool_scan(const char *tcpaddr, int64_t portnum, int32_t scantype, uint64_t maxstream, const char *fname, int fd, int64_t timeout, int *infected, int *err, cl_error_t *ret_code)
+{
+    struct onas_pool_conn *conn;
+    struct onas_pool_req req;
+    int attempt, held, len, sent = -1, printok = 1;
+
+    *infected = 0;
+    memset(&req, 0, sizeof(req));
+
+    held = onas_pool_hold();
+    for (attempt = 0; held && attempt < 2; attempt++) {
+        if (NULL == (conn = onas_pool_pick())) {
+            break;
+        }
+        memset(&req, 0, sizeof(req));
+
+        pthread_mutex_lock(&conn->send_mutex);
+        pthread_mutex_lock(&conn->mutex);
+        if (onas_pool_prepare(conn, tcpaddr, portnum, timeout)) {
+            pthread_mutex_unlock(&conn->mutex);
+            pthread_mutex_unlock(&conn->send_mutex);
+            sent = -1;
+            continue;
+        }
+        req.id        = ++conn->next_id;
+        req.next      = conn->waiting;
+        conn->waiting = &req;
+        conn->users++;
+        pthread_mutex_unlock(&conn->mutex);
+
+        switch (scantype) {
+            case STREAM:
+                /* a retry starts the file over */
+                if (fd >= 0 && attempt) {
+                    lseek(fd, 0, SEEK_SET);
+                }
+                /* NULL filename safe in send_stream() */
+                sent = onas_send_stream(conn->curl, fname, fd, timeout, maxstream);
+                break;
+#ifdef HAVE_FD_PASSING
+            case FILDES:
+                /* NULL filename safe in send_fdpass() */
+                sent = onas_fdpass(fname, fd, conn->sockd);
+                break;
+#endif
+            default:
+                logg(LOGG_ERROR, "ClamPool: scan type %d can't be pooled\n", scantype);
+                sent = 0;
+                break;
+        }
+
+        pthread_mutex_lock(&conn->mutex);
+        if (sent < 0) {
+            onas_pool_break(conn);
+        } else if (sent == 0) {
+            /* nothing went out, so the id can be handed out again */
+            onas_pool_unlink(conn, &req);
+            if (!conn->broken && conn->next_id == req.id) {
+                conn->next_id--;
+            }
+        }
+        pthread_mutex_unlock(&conn->send_mutex);
+
+        if (sent > 0) {
+            /* like onas_recvln(), only streams have a reply timeout */
+            onas_pool_wait(conn, &req, scantype == STREAM ? timeout : 0);
+        }
+        if (0 == --conn->users && conn->broken) {
+            /* whoever waits to replace the session can go ahead */
+            pthread_cond_broadcast(&conn->cond);
+        }
+        conn->last_used = time(NULL);
+        pthread_mutex_unlock(&conn->mutex);
+
+        if (sent >= 0 && req.done != -1) {
+            break;
+        }
+        logg(LOGG_DEBUG, "ClamPool: session with clamd went away, %s\n", attempt ? "giving up" : "retrying");
+    }
+    if (held) {
+        onas_pool_release();
+    }
+
+    if (sent == 0) {
+        /* soft fail, e.g. the file was removed before it could be sent */
+        return CL_CLEAN;
+    }
+
+    if (sent < 0 || req.done <= 0 || NULL == req.reply) {
+        if (sent > 0) {
+            logg(LOGG_INFO, "%s: no reply from clamd\n", fname ? fname : "FD");
+            if (ret_code) {
+                *ret_code = req.done ? CL_EACCES : CL_ETIMEOUT;
+            }
+        }
+        if (err) {
+            (*err)++;
+        }
+        free(req.reply);
+        return CL_ECREAT;
+    }
+
+    if (!fname) {
+        logg(LOGG_INFO, "%s\n", req.reply);
+    }
+    len = strlen(req.reply) + 1;
+    if (onas_dsreply(scantype, fname, req.reply, req.reply + len, len, infected, &printok, err, ret_code) < 0) {
+        free(req.reply);
+        *infected = 0;
+        return CL_ECREAT;
+    }
+    free(req.reply);
+
+    return *infected ? CL_VIRUS : CL_CLEAN;
+}
@@ -0,0 +1,35 @@
+/*
+ *  Copyright (C) 2025 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#ifndef __ONAS_POOL_H
+#define __ONAS_POOL_H
+
+// libclamav
+#include "clamav.h"
+
+#include "../clamonacc.h"
+
+/* outstanding requests each pooled connection is sized for */
+#define ONAS_POOL_DEPTH 4
+
+cl_error_t onas_pool_init(struct onas_context *ctx);
+void onas_pool_destroy(void);
+int onas_pool_enabled(void);
+int onas_pool_scan(const char *tcpaddr, int64_t portnum, int32_t scantype, uint64_t maxstream, const char *fname, int fd, int64_t timeout, int *infected, int *err, cl_error_t *ret_code);
+
+#endif
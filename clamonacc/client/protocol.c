@@ -72,7 +72,7 @@ static const char *scancmd[] = {"CONTSCAN", "MULTISCAN", "INSTREAM", "FILDES", "
 
 /* Issues an INSTREAM command to clamd and streams the given file
  * Returns >0 on success, 0 soft fail, -1 hard fail */
-static int onas_send_stream(CURL *curl, const char *filename, int fd, int64_t timeout, uint64_t maxstream)
+int onas_send_stream(CURL *curl, const char *filename, int fd, int64_t timeout, uint64_t maxstream)
 {
     uint32_t buf[BUFSIZ / sizeof(uint32_t)];
     uint64_t len;
@@ -125,17 +125,17 @@ static int onas_send_stream(CURL *curl, const char *filename, int fd, int64_t ti
     }
 
     while (bytesRead < len) {
-        ssize_t ret = read(fd, buf, sizeof(buf));
-        if (ret < 0) {
+        ssize_t nread = read(fd, buf, sizeof(buf));
+        if (nread < 0) {
             logg(LOGG_ERROR, "Failed to read from %s.\n", filename ? filename : "FD");
             ret = -1;
             goto strm_out;
-        } else if (0 == ret) {
+        } else if (0 == nread) {
             break;
         }
-        bytesRead += ret;
+        bytesRead += nread;
 
-        if (onas_sendln(curl, (const char *)buf, ret, timeout)) {
+        if (onas_sendln(curl, (const char *)buf, nread, timeout)) {
             ret = -1;
             goto strm_out;
         }
@@ -189,7 +189,7 @@ static int onas_send_fdpass(int sockd, int fd)
 
 /* Issues a FILDES command and pass a FD to clamd
  * Returns >0 on success, 0 soft fail, -1 hard fail */
-static int onas_fdpass(const char *filename, int fd, int sockd)
+int onas_fdpass(const char *filename, int fd, int sockd)
 {
     int ret        = 1;
     int close_flag = 0;
@@ -228,6 +228,120 @@ fd_out:
 }
 #endif
 
+/* Parses one reply line from clamd, bol to eol (past the terminator), without the session id
+ * Returns 0 on success, -1 if the reply couldn't be parsed */
+int onas_dsreply(int scantype, const char *filename, char *bol, char *eol, int len, int *infected, int *printok, int *errors, cl_error_t *ret_code)
+{
+    if (len > 7) {
+        char *colon = strrchr(bol, ':');
+
+        if (colon && colon[1] != ' ') {
+            char *br;
+            *colon = 0;
+
+            br = strrchr(bol, '(');
+            if (br) {
+                *br = 0;
+            }
+            colon = strrchr(bol, ':');
+        }
+
+        if (!colon) {
+            char *unkco = "UNKNOWN COMMAND";
+            if (!strncmp(bol, unkco, sizeof(unkco) - 1)) {
+                logg(LOGG_DEBUG, "clamd replied \"UNKNOWN COMMAND\". Command was %s\n",
+                     (scantype < 0 || scantype > MAX_SCANTYPE) ? "unidentified" : scancmd[scantype]);
+            } else {
+                logg(LOGG_DEBUG, "Failed to parse reply: \"%s\"\n", bol);
+            }
+
+            if (ret_code) {
+                *ret_code = CL_EPARSE;
+            }
+            return -1;
+
+        } else if (!memcmp(eol - 7, " FOUND", 6)) {
+            static char last_filename[PATH_MAX + 1] = {'\0'};
+            *(eol - 7)                              = 0;
+            *printok                                = 0;
+
+            if (scantype != ALLMATCH) {
+                (*infected)++;
+            } else {
+                if (filename != NULL && strcmp(filename, last_filename)) {
+                    (*infected)++;
+                    strncpy(last_filename, filename, PATH_MAX);
+                    last_filename[PATH_MAX] = '\0';
+                }
+            }
+
+            if (filename) {
+                if (scantype >= STREAM) {
+                    logg(LOGG_INFO, "%s%s FOUND\n", filename, colon);
+                    if (action) {
+                        action(filename);
+                    }
+                } else {
+                    logg(LOGG_INFO, "%s FOUND\n", bol);
+                    *colon = '\0';
+                    if (action) {
+                        action(bol);
+                    }
+                }
+            }
+
+            if (ret_code) {
+                *ret_code = CL_VIRUS;
+            }
+
+        } else if ((len > 32 && !memcmp(eol - 33, "No such file or directory. ERROR", 32)) ||
+                   (len > 34 && !memcmp(eol - 35, "Can't open file or directory ERROR", 34))) {
+            if (errors) {
+                (*errors)++;
+            }
+            *printok = 0;
+
+            if (filename) {
+                (scantype >= STREAM) ? logg(LOGG_DEBUG, "%s%s\n", filename, colon) : logg(LOGG_DEBUG, "%s\n", bol);
+            }
+
+            if (ret_code) {
+                *ret_code = CL_ESTAT;
+            }
+        } else if ((len > 21 && !memcmp(eol - 22, " Access denied. ERROR", 21)) ||
+                   (len > 23 && !memcmp(eol - 24, "Can't access file ERROR", 23)) ||
+                   (len > 41 && !memcmp(eol - 42, " lstat() failed: Permission denied. ERROR", 41))) {
+            if (errors) {
+                (*errors)++;
+            }
+            *printok = 0;
+
+            if (filename) {
+                (scantype >= STREAM) ? logg(LOGG_INFO, "%s%s\n", filename, colon) : logg(LOGG_INFO, "%s\n", bol);
+            }
+
+            if (ret_code) {
+                *ret_code = CL_EACCES;
+            }
+        } else if (len > 6 && !memcmp(eol - 7, " ERROR", 6)) {
+            if (errors) {
+                (*errors)++;
+            }
+            *printok = 0;
+
+            if (filename) {
+                (scantype >= STREAM) ? logg(LOGG_INFO, "%s%s\n", filename, colon) : logg(LOGG_INFO, "%s\n", bol);
+            }
+
+            if (ret_code) {
+                *ret_code = CL_ERROR;
+            }
+        }
+    }
+
+    return 0;
+}
+
 /* Sends a proper scan request to clamd and parses its replies
  * This is used only in non IDSESSION mode
  * Returns the number of infected files or -1 on error
@@ -321,112 +435,9 @@ int onas_dsresult(CURL *curl, int scantype, uint64_t maxstream, const char *file
         if (!filename) {
             logg(LOGG_INFO, "%s\n", bol);
         }
-        if (len > 7) {
-            char *colon = strrchr(bol, ':');
-
-            if (colon && colon[1] != ' ') {
-                char *br;
-                *colon = 0;
-
-                br = strrchr(bol, '(');
-                if (br) {
-                    *br = 0;
-                }
-                colon = strrchr(bol, ':');
-            }
-
-            if (!colon) {
-                char *unkco = "UNKNOWN COMMAND";
-                if (!strncmp(bol, unkco, sizeof(unkco) - 1)) {
-                    logg(LOGG_DEBUG, "clamd replied \"UNKNOWN COMMAND\". Command was %s\n",
-                         (scantype < 0 || scantype > MAX_SCANTYPE) ? "unidentified" : scancmd[scantype]);
-                } else {
-                    logg(LOGG_DEBUG, "Failed to parse reply: \"%s\"\n", bol);
-                }
-
-                if (ret_code) {
-                    *ret_code = CL_EPARSE;
-                }
-                infected = -1;
-                goto done;
-
-            } else if (!memcmp(eol - 7, " FOUND", 6)) {
-                static char last_filename[PATH_MAX + 1] = {'\0'};
-                *(eol - 7)                              = 0;
-                *printok                                = 0;
-
-                if (scantype != ALLMATCH) {
-                    infected++;
-                } else {
-                    if (filename != NULL && strcmp(filename, last_filename)) {
-                        infected++;
-                        strncpy(last_filename, filename, PATH_MAX);
-                        last_filename[PATH_MAX] = '\0';
-                    }
-                }
-
-                if (filename) {
-                    if (scantype >= STREAM) {
-                        logg(LOGG_INFO, "%s%s FOUND\n", filename, colon);
-                        if (action) {
-                            action(filename);
-                        }
-                    } else {
-                        logg(LOGG_INFO, "%s FOUND\n", bol);
-                        *colon = '\0';
-                        if (action) {
-                            action(bol);
-                        }
-                    }
-                }
-
-                if (ret_code) {
-                    *ret_code = CL_VIRUS;
-                }
-
-            } else if ((len > 32 && !memcmp(eol - 33, "No such file or directory. ERROR", 32)) ||
-                       (len > 34 && !memcmp(eol - 35, "Can't open file or directory ERROR", 34))) {
-                if (errors) {
-                    (*errors)++;
-                }
-                *printok = 0;
-
-                if (filename) {
-                    (scantype >= STREAM) ? logg(LOGG_DEBUG, "%s%s\n", filename, colon) : logg(LOGG_DEBUG, "%s\n", bol);
-                }
-
-                if (ret_code) {
-                    *ret_code = CL_ESTAT;
-                }
-            } else if ((len > 21 && !memcmp(eol - 22, " Access denied. ERROR", 21)) ||
-                       (len > 23 && !memcmp(eol - 24, "Can't access file ERROR", 23)) ||
-                       (len > 41 && !memcmp(eol - 42, " lstat() failed: Permission denied. ERROR", 41))) {
-                if (errors) {
-                    (*errors)++;
-                }
-                *printok = 0;
-
-                if (filename) {
-                    (scantype >= STREAM) ? logg(LOGG_INFO, "%s%s\n", filename, colon) : logg(LOGG_INFO, "%s\n", bol);
-                }
-
-                if (ret_code) {
-                    *ret_code = CL_EACCES;
-                }
-            } else if (len > 6 && !memcmp(eol - 7, " ERROR", 6)) {
-                if (errors) {
-                    (*errors)++;
-                }
-                *printok = 0;
-
-                if (filename) {
-                    (scantype >= STREAM) ? logg(LOGG_INFO, "%s%s\n", filename, colon) : logg(LOGG_INFO, "%s\n", bol);
-                }
-
-                if (ret_code) {
-                    *ret_code = CL_ERROR;
-                }
-            }
+        if (onas_dsreply(scantype, filename, bol, eol, len, &infected, printok, errors, ret_code) < 0) {
+            infected = -1;
+            goto done;
         }
     }
     if (!beenthere) {
@@ -27,5 +27,10 @@
 #include "misc.h"
 #include "../clamonacc.h"
 
+int onas_send_stream(CURL *curl, const char *filename, int fd, int64_t timeout, uint64_t maxstream);
+#ifdef HAVE_FD_PASSING
+int onas_fdpass(const char *filename, int fd, int sockd);
+#endif
+int onas_dsreply(int scantype, const char *filename, char *bol, char *eol, int len, int *infected, int *printok, int *errors, cl_error_t *ret_code);
 int onas_dsresult(CURL *curl, int scantype, uint64_t maxstream, const char *filename, int fd, int64_t timeout, int *printok, int *errors, cl_error_t *ret_code);
 #endif
@@ -54,6 +54,7 @@
 
 #include "../scan/thread.h"
 #include "../scan/onas_queue.h"
+#include "../scan/onas_cache.h"
 
 #include "../misc/utils.h"
 
@@ -231,6 +232,14 @@ int onas_fan_eloop(struct onas_context **ctx)
                     }
                 }
 
+                if (scan && onas_cache_lookup(fmd->fd)) {
+                    /* unchanged since clamd last found it clean, answer right away */
+                    scan = 0;
+#ifdef ONAS_DEBUG
+                    logg(LOGG_DEBUG, "ClamFanotif: %s allowed (cached clean verdict)\n", fname);
+#endif
+                }
+
                 if (scan) {
                     struct onas_scan_event *event_data;
 
@@ -48,7 +48,6 @@
 
 #if defined(HAVE_SYS_FANOTIFY_H)
 
-extern pthread_cond_t onas_scan_queue_empty_cond;
 
 int onas_fan_checkowner(int pid, const struct optstruct *opts)
 {
@@ -110,8 +109,7 @@ int onas_fan_checkowner(int pid, const struct optstruct *opts)
                                     retry += 1;
                                     continue;
                                 } else {
-                                    logg(LOGG_DEBUG, "ClamMisc: fds have been exhausted ... attempting to force the consumer thread to catch up ... (excluding for safety)\n");
-                                    pthread_cond_signal(&onas_scan_queue_empty_cond);
+                                    logg(LOGG_DEBUG, "ClamMisc: fds have been exhausted ... giving the scan threads time to catch up ... (excluding for safety)\n");
                                     sleep(6);
                                     return CHK_FOUND;
                                 }
@@ -0,0 +1,333 @@
+/*
+ *  Copyright (C) 2025 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#if HAVE_CONFIG_H
+#include "clamav-config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <time.h>
+
+// libclamav
+#include "clamav.h"
+
+// common
+#include "optparser.h"
+#include "output.h"
+
+#include "../client/client.h"
+#include "onas_cache.h"
+
+/*
+ * Clean verdicts, keyed by what changes whenever the file content may have
+ * changed. Each entry also carries the generation it was scanned under; a new
+ * clamd database version starts a new generation, which drops all entries at
+ * once.
+ */
+struct onas_cache_entry {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t ctime_sec;
+    int64_t ctime_nsec;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint32_t generation; /* 0 for an empty slot */
+    uint32_t used;       /* onas_cache_clock when last hit, for the replacement */
+};
+
+/* entries per set, the least recently used one is replaced */
+#define ONAS_CACHE_WAYS 4
+
+static pthread_mutex_t onas_cache_lock         = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t onas_cache_version_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct onas_cache_entry *onas_cache_entries = NULL;
+static uint64_t onas_cache_sets                    = 0;
+static uint32_t onas_cache_gen                     = 1;
+static uint32_t onas_cache_clock                   = 0;
+static time_t onas_cache_verified                  = 0;
+static time_t onas_cache_version_ttl               = ONAS_CACHE_VERSION_TTL;
+static char onas_cache_version[128]                = "";
+static struct onas_cache_stats onas_cache_stats;
+
+cl_error_t onas_cache_init(struct onas_context *ctx)
+{
+    if (NULL == ctx) {
+        return CL_ENULLARG;
+    }
+
+    return onas_cache_setup(optget(ctx->clamdopts, "OnAccessVerdictCacheSize")->numarg, ONAS_CACHE_VERSION_TTL);
+}
+
+/**
+ * @brief Allocate the cache.
+ *
+ * @param size          number of verdicts to keep, rounded up to a multiple of the set size; 0 disables the cache
+ * @param version_ttl   seconds the clamd database version is trusted before it's asked for again
+ * @return cl_error_t   CL_SUCCESS, or CL_EMEM
+ */
+cl_error_t onas_cache_setup(uint64_t size, time_t version_ttl)
+{
+    uint64_t sets = 1;
+
+    if (!size) {
+        logg(LOGG_DEBUG, "ClamCache: verdict cache disabled\n");
+        return CL_SUCCESS;
+    }
+
+    while (sets * ONAS_CACHE_WAYS < size) {
+        sets <<= 1;
+    }
+
+    pthread_mutex_lock(&onas_cache_lock);
+    onas_cache_entries = calloc(sets * ONAS_CACHE_WAYS, sizeof(struct onas_cache_entry));
+    if (NULL == onas_cache_entries) {
+        pthread_mutex_unlock(&onas_cache_lock);
+        logg(LOGG_ERROR, "ClamCache: could not allocate memory for %llu cache entries\n", (unsigned long long)(sets * ONAS_CACHE_WAYS));
+        return CL_EMEM;
+    }
+    onas_cache_sets        = sets;
+    onas_cache_version_ttl = version_ttl;
+    memset(&onas_cache_stats, 0, sizeof(onas_cache_stats));
+    pthread_mutex_unlock(&onas_cache_lock);
+
+    logg(LOGG_DEBUG, "ClamCache: caching up to %llu clean verdicts\n", (unsigned long long)(sets * ONAS_CACHE_WAYS));
+    return CL_SUCCESS;
+}
+
+void onas_cache_destroy(void)
+{
+    struct onas_cache_stats stats;
+
+    pthread_mutex_lock(&onas_cache_lock);
+    if (NULL == onas_cache_entries) {
+        pthread_mutex_unlock(&onas_cache_lock);
+        return;
+    }
+    free(onas_cache_entries);
+    onas_cache_entries    = NULL;
+    onas_cache_sets       = 0;
+    onas_cache_verified   = 0;
+    onas_cache_version[0] = '\0';
+    stats                 = onas_cache_stats;
+    pthread_mutex_unlock(&onas_cache_lock);
+
+    logg(LOGG_INFO, "ClamCache: %llu hits, %llu misses, %llu verdicts cached, %llu evicted, %llu invalidations\n",
+         (unsigned long long)stats.hits, (unsigned long long)stats.misses, (unsigned long long)stats.inserts,
+         (unsigned long long)stats.evictions, (unsigned long long)stats.invalidations);
+}
+
+void onas_cache_getstats(struct onas_cache_stats *stats)
+{
+    pthread_mutex_lock(&onas_cache_lock);
+    *stats = onas_cache_stats;
+    pthread_mutex_unlock(&onas_cache_lock);
+}
+
+/* onas_cache_lock must be held */
+static struct onas_cache_entry *onas_cache_set(const STATBUF *sb)
+{
+    uint64_t h = ((uint64_t)sb->st_ino ^ ((uint64_t)sb->st_dev << 32 | (uint64_t)sb->st_dev >> 32)) * 0x9e3779b97f4a7c15ULL;
+
+    h ^= h >> 32;
+    return &onas_cache_entries[(h & (onas_cache_sets - 1)) * ONAS_CACHE_WAYS];
+}
+
+static int onas_cache_match(const struct onas_cache_entry *entry, const STATBUF *sb)
+{
+    return entry->generation == onas_cache_gen &&
+           entry->dev == (uint64_t)sb->st_dev &&
+           entry->ino == (uint64_t)sb->st_ino &&
+           entry->size == (uint64_t)sb->st_size &&
+           entry->ctime_sec == (int64_t)sb->st_ctim.tv_sec &&
+           entry->ctime_nsec == (int64_t)sb->st_ctim.tv_nsec &&
+           entry->mtime_sec == (int64_t)sb->st_mtim.tv_sec &&
+           entry->mtime_nsec == (int64_t)sb->st_mtim.tv_nsec;
+}
+
+/**
+ * @brief Check if the file open on fd is known to be clean.
+ *
+ * Misses while the database version hasn't been confirmed for a while, so that the next
+ * scan gets to ask clamd for it.
+ *
+ * @param fd    the file descriptor fanotify handed us
+ * @return int  1 if the file is unchanged since clamd last found it clean, 0 otherwise
+ */
+int onas_cache_lookup(int fd)
+{
+    STATBUF sb;
+    struct onas_cache_entry *set;
+    int i;
+
+    pthread_mutex_lock(&onas_cache_lock);
+    if (NULL == onas_cache_entries) {
+        pthread_mutex_unlock(&onas_cache_lock);
+        return 0;
+    }
+    pthread_mutex_unlock(&onas_cache_lock);
+
+    if (FSTAT(fd, &sb) || !S_ISREG(sb.st_mode)) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&onas_cache_lock);
+    if (NULL != onas_cache_entries && time(NULL) - onas_cache_verified < onas_cache_version_ttl) {
+        set = onas_cache_set(&sb);
+        for (i = 0; i < ONAS_CACHE_WAYS; i++) {
+            if (onas_cache_match(&set[i], &sb)) {
+                set[i].used = ++onas_cache_clock;
+                onas_cache_stats.hits++;
+                pthread_mutex_unlock(&onas_cache_lock);
+                return 1;
+            }
+        }
+    }
+    onas_cache_stats.misses++;
+    pthread_mutex_unlock(&onas_cache_lock);
+
+    return 0;
+}
+
+/**
+ * @brief Get the generation to cache the verdict of a scan that's about to start under.
+ *
+ * Asks clamd for its version when the last answer is too old and starts a new generation
+ * if the databases changed since.
+ *
+ * @return uint32_t the generation, 0 if the verdict can't be cached
+ */
+uint32_t onas_cache_generation(const char *tcpaddr, int64_t portnum, int64_t timeout)
+{
+    char version[sizeof(onas_cache_version)];
+    uint32_t generation = 0;
+    time_t now          = time(NULL);
+
+    pthread_mutex_lock(&onas_cache_lock);
+    if (NULL == onas_cache_entries) {
+        pthread_mutex_unlock(&onas_cache_lock);
+        return 0;
+    }
+    if (now - onas_cache_verified < onas_cache_version_ttl) {
+        generation = onas_cache_gen;
+        pthread_mutex_unlock(&onas_cache_lock);
+        return generation;
+    }
+    pthread_mutex_unlock(&onas_cache_lock);
+
+    /* one worker asks, the others scan without caching meanwhile */
+    if (pthread_mutex_trylock(&onas_cache_version_lock)) {
+        return 0;
+    }
+
+    if (0 == onas_client_version(tcpaddr, portnum, timeout, version, sizeof(version))) {
+        pthread_mutex_lock(&onas_cache_lock);
+        if (strcmp(version, onas_cache_version)) {
+            if (onas_cache_version[0]) {
+                /* the databases were reloaded, forget everything scanned with the old ones */
+                if (!++onas_cache_gen) {
+                    onas_cache_gen = 1;
+                    if (NULL != onas_cache_entries) {
+                        memset(onas_cache_entries, 0, onas_cache_sets * ONAS_CACHE_WAYS * sizeof(struct onas_cache_entry));
+                    }
+                }
+                onas_cache_stats.invalidations++;
+                onas_cache_stats.entries = 0;
+                logg(LOGG_DEBUG, "ClamCache: clamd databases changed (%s), cached verdicts dropped\n", version);
+            }
+            strcpy(onas_cache_version, version);
+        }
+        onas_cache_verified = now;
+        generation          = onas_cache_gen;
+        pthread_mutex_unlock(&onas_cache_lock);
+    } else {
+        logg(LOGG_DEBUG, "ClamCache: could not get the database version from clamd, not caching\n");
+    }
+
+    pthread_mutex_unlock(&onas_cache_version_lock);
+    return generation;
+}
+
+/**
+ * @brief Remember a clean verdict.
+ *
+ * @param sb            stat info of the file taken before it was scanned
+ * @param generation    what onas_cache_generation() returned before the scan
+ * @param started       when the scan started
+ */
+void onas_cache_insert(const STATBUF *sb, uint32_t generation, time_t started)
+{
+    struct onas_cache_entry *set, *victim = NULL;
+    int i;
+
+    if (!generation || !S_ISREG(sb->st_mode)) {
+        return;
+    }
+    if (sb->st_ctim.tv_sec >= started - ONAS_CACHE_RACY_WINDOW || sb->st_mtim.tv_sec >= started - ONAS_CACHE_RACY_WINDOW) {
+        return;
+    }
+
+    pthread_mutex_lock(&onas_cache_lock);
+    if (NULL == onas_cache_entries || generation != onas_cache_gen) {
+        pthread_mutex_unlock(&onas_cache_lock);
+        return;
+    }
+
+    set = onas_cache_set(sb);
+    for (i = 0; i < ONAS_CACHE_WAYS; i++) {
+        if (set[i].generation != onas_cache_gen) {
+            /* a free slot, unless the file itself is further in the set */
+            if (!victim || victim->generation == onas_cache_gen) {
+                victim = &set[i];
+            }
+            continue;
+        }
+        if (set[i].dev == (uint64_t)sb->st_dev && set[i].ino == (uint64_t)sb->st_ino) {
+            /* same file, the old verdict is for older content */
+            victim = &set[i];
+            break;
+        }
+        if (!victim || (victim->generation == onas_cache_gen && set[i].used < victim->used)) {
+            victim = &set[i];
+        }
+    }
+
+    if (victim->generation != onas_cache_gen) {
+        onas_cache_stats.entries++;
+    } else if (victim->dev != (uint64_t)sb->st_dev || victim->ino != (uint64_t)sb->st_ino) {
+        onas_cache_stats.evictions++;
+    }
+
+    victim->dev        = sb->st_dev;
+    victim->ino        = sb->st_ino;
+    victim->size       = sb->st_size;
+    victim->ctime_sec  = sb->st_ctim.tv_sec;
+    victim->ctime_nsec = sb->st_ctim.tv_nsec;
+    victim->mtime_sec  = sb->st_mtim.tv_sec;
+    victim->mtime_nsec = sb->st_mtim.tv_nsec;
+    victim->generation = onas_cache_gen;
+    victim->used       = ++onas_cache_clock;
+    onas_cache_stats.inserts++;
+    pthread_mutex_unlock(&onas_cache_lock);
+}
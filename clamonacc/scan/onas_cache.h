@@ -0,0 +1,51 @@
+/*
+ *  Copyright (C) 2025 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#ifndef __ONAS_CACHE_H
+#define __ONAS_CACHE_H
+
+#include <time.h>
+
+// libclamav
+#include "clamav.h"
+
+#include "../clamonacc.h"
+
+/* how long a clamd database version is trusted before it's asked for again */
+#define ONAS_CACHE_VERSION_TTL 10
+/* files changed this recently are never cached, timestamps may be too coarse to show the next change */
+#define ONAS_CACHE_RACY_WINDOW 2
+
+struct onas_cache_stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t inserts;
+    uint64_t evictions;
+    uint64_t invalidations;
+    uint64_t entries;
+};
+
+cl_error_t onas_cache_init(struct onas_context *ctx);
+cl_error_t onas_cache_setup(uint64_t size, time_t version_ttl);
+void onas_cache_destroy(void);
+int onas_cache_lookup(int fd);
+uint32_t onas_cache_generation(const char *tcpaddr, int64_t portnum, int64_t timeout);
+void onas_cache_insert(const STATBUF *sb, uint32_t generation, time_t started);
+void onas_cache_getstats(struct onas_cache_stats *stats);
+
+#endif
@@ -30,6 +30,9 @@
 #include <fcntl.h>
 #include <signal.h>
 #include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
+#include <time.h>
 #if defined(__linux__)
 #include <sys/prctl.h>
 #endif
@@ -43,102 +46,329 @@
 #include "output.h"
 
 #include "../misc/utils.h"
-#include "../c-thread-pool/thpool.h"
 #include "thread.h"
 #include "onas_queue.h"
 
-static void onas_scan_queue_exit(void *arg);
-static int onas_consume_event(threadpool thpool);
-static cl_error_t onas_new_event_queue_node(struct onas_event_queue_node **node);
-static void onas_destroy_event_queue_node(struct onas_event_queue_node *node);
+/*
+ * Events go from the fanotify and inotify threads straight to the scan
+ * workers through a bounded multi-producer multi-consumer ring. Each cell
+ * carries a sequence number telling whose turn it is, so claiming a cell is a
+ * single compare-and-swap on the position and nobody takes a lock. The
+ * semaphores only count free and filled cells, so that producers wait while
+ * the ring is full and workers sleep while it's empty.
+ */
+struct onas_queue_cell {
+    uint64_t seq;
+    struct onas_scan_event *event;
+    uint32_t coalesce; /* slot in the coalescing table, or ONAS_QUEUE_NO_SLOT */
+};
+
+/* keeps the producer and the consumer position on cache lines of their own */
+struct onas_queue_pos {
+    uint64_t pos;
+    char pad[64 - sizeof(uint64_t)];
+};
+
+/*
+ * Non-permission events still sitting in the ring, by inode for fanotify and
+ * by path for inotify. Nobody waits on the answer to those, so a repeat can
+ * be dropped for as long as the queued one hasn't been picked up, the scan
+ * sees the latest content either way. Each slot has a lock of its own, so
+ * producers and workers only wait on each other for events in the same slot.
+ */
+struct onas_queue_slot {
+    pthread_mutex_t lock;
+    struct onas_scan_event *event; /* NULL once a worker took it */
+    uint64_t dev;
+    uint64_t ino;
+    time_t queued;
+};
 
-static pthread_mutex_t onas_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+#define ONAS_QUEUE_NO_SLOT ((uint32_t)-1)
+
+static void onas_scan_queue_exit(void *arg);
 
-pthread_cond_t onas_scan_queue_empty_cond = PTHREAD_COND_INITIALIZER;
 extern pthread_t scan_queue_pid;
-static threadpool g_thpool;
 
-static struct onas_event_queue_node *g_onas_event_queue_head = NULL;
-static struct onas_event_queue_node *g_onas_event_queue_tail = NULL;
+static struct onas_queue_cell *g_onas_queue_cells = NULL;
+static struct onas_queue_pos g_onas_queue_enq;
+static struct onas_queue_pos g_onas_queue_deq;
+static sem_t g_onas_queue_free;
+static sem_t g_onas_queue_filled;
+static int g_onas_queue_stop = 0;
+
+static pthread_t *g_onas_queue_workers = NULL;
+static int32_t g_onas_queue_nworkers   = 0;
 
-static struct onas_event_queue g_onas_event_queue;
+static struct onas_queue_slot *g_onas_coalesce_slots = NULL;
+static uint64_t g_onas_queue_events                  = 0;
+static uint64_t g_onas_queue_coalesced               = 0;
 
-static cl_error_t onas_new_event_queue_node(struct onas_event_queue_node **node)
+static cl_error_t onas_init_event_queue(void)
 {
+    uint64_t i;
+    uint32_t j;
 
-    *node = malloc(sizeof(struct onas_event_queue_node));
-    if (NULL == *node) {
+    g_onas_queue_cells = calloc(ONAS_QUEUE_SIZE, sizeof(struct onas_queue_cell));
+    if (NULL == g_onas_queue_cells) {
         return CL_EMEM;
     }
+    for (i = 0; i < ONAS_QUEUE_SIZE; i++) {
+        g_onas_queue_cells[i].seq = i;
+    }
+    g_onas_queue_enq.pos = 0;
+    g_onas_queue_deq.pos = 0;
+    g_onas_queue_stop    = 0;
 
-    **node = (struct onas_event_queue_node){
-        .next = NULL,
-        .prev = NULL,
+    if (sem_init(&g_onas_queue_free, 0, ONAS_QUEUE_SIZE)) {
+        goto fail;
+    }
+    if (sem_init(&g_onas_queue_filled, 0, 0)) {
+        sem_destroy(&g_onas_queue_free);
+        goto fail;
+    }
 
-        .data = NULL};
+    g_onas_coalesce_slots = calloc(ONAS_QUEUE_COALESCE_SLOTS, sizeof(struct onas_queue_slot));
+    if (NULL == g_onas_coalesce_slots) {
+        /* not fatal, repeated events just get scanned again */
+        logg(LOGG_WARNING, "ClamScanQueue: could not allocate memory for event coalescing\n");
+    } else {
+        for (j = 0; j < ONAS_QUEUE_COALESCE_SLOTS; j++) {
+            pthread_mutex_init(&g_onas_coalesce_slots[j].lock, NULL);
+        }
+    }
+    g_onas_queue_events    = 0;
+    g_onas_queue_coalesced = 0;
 
     return CL_SUCCESS;
+
+fail:
+    free(g_onas_queue_cells);
+    g_onas_queue_cells = NULL;
+    return CL_ECREAT;
 }
 
-static void *onas_init_event_queue(void)
+static void onas_destroy_event_queue(void)
 {
+    uint64_t events, coalesced;
+    uint32_t i;
 
-    if (CL_EMEM == onas_new_event_queue_node(&g_onas_event_queue_head)) {
-        return NULL;
+    if (NULL == g_onas_queue_cells) {
+        return;
     }
 
-    if (CL_EMEM == onas_new_event_queue_node(&g_onas_event_queue_tail)) {
-        return NULL;
+    sem_destroy(&g_onas_queue_free);
+    sem_destroy(&g_onas_queue_filled);
+    free(g_onas_queue_cells);
+    g_onas_queue_cells = NULL;
+
+    if (g_onas_coalesce_slots) {
+        for (i = 0; i < ONAS_QUEUE_COALESCE_SLOTS; i++) {
+            pthread_mutex_destroy(&g_onas_coalesce_slots[i].lock);
+        }
+        free(g_onas_coalesce_slots);
+        g_onas_coalesce_slots = NULL;
     }
+    events    = __atomic_load_n(&g_onas_queue_events, __ATOMIC_RELAXED);
+    coalesced = __atomic_load_n(&g_onas_queue_coalesced, __ATOMIC_RELAXED);
 
-    g_onas_event_queue_tail->prev = g_onas_event_queue_head;
-    g_onas_event_queue_head->next = g_onas_event_queue_tail;
+    logg(LOGG_INFO, "ClamScanQueue: %llu events queued, %llu repeated events coalesced\n",
+         (unsigned long long)events, (unsigned long long)coalesced);
+}
 
-    g_onas_event_queue = (struct onas_event_queue){
-        .head = g_onas_event_queue_head,
-        .tail = g_onas_event_queue_tail,
+/* Returns 0 on success, -1 if the cell at the head hasn't been emptied by its worker yet */
+static int onas_queue_push(struct onas_scan_event *event_data, uint32_t coalesce)
+{
+    struct onas_queue_cell *cell;
+    uint64_t pos = __atomic_load_n(&g_onas_queue_enq.pos, __ATOMIC_RELAXED);
+    int64_t diff;
+
+    for (;;) {
+        cell = &g_onas_queue_cells[pos & (ONAS_QUEUE_SIZE - 1)];
+        diff = (int64_t)__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - (int64_t)pos;
+        if (0 == diff) {
+            if (__atomic_compare_exchange_n(&g_onas_queue_enq.pos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return -1;
+        } else {
+            pos = __atomic_load_n(&g_onas_queue_enq.pos, __ATOMIC_RELAXED);
+        }
+    }
 
-        .size = 0};
+    cell->event    = event_data;
+    cell->coalesce = coalesce;
+    __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
 
-    return &g_onas_event_queue;
+    return 0;
 }
 
-static void onas_destroy_event_queue_node(struct onas_event_queue_node *node)
+/* Returns 0 on success, -1 if the cell at the tail hasn't been filled in by its producer yet */
+static int onas_queue_pop(struct onas_scan_event **event_data, uint32_t *coalesce)
 {
-
-    if (NULL == node) {
-        return;
+    struct onas_queue_cell *cell;
+    uint64_t pos = __atomic_load_n(&g_onas_queue_deq.pos, __ATOMIC_RELAXED);
+    int64_t diff;
+
+    for (;;) {
+        cell = &g_onas_queue_cells[pos & (ONAS_QUEUE_SIZE - 1)];
+        diff = (int64_t)__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - (int64_t)(pos + 1);
+        if (0 == diff) {
+            if (__atomic_compare_exchange_n(&g_onas_queue_deq.pos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return -1;
+        } else {
+            pos = __atomic_load_n(&g_onas_queue_deq.pos, __ATOMIC_RELAXED);
+        }
     }
 
-    node->next = NULL;
-    node->prev = NULL;
-    node->data = NULL;
+    *event_data = cell->event;
+    *coalesce   = cell->coalesce;
+    __atomic_store_n(&cell->seq, pos + ONAS_QUEUE_SIZE, __ATOMIC_RELEASE);
 
-    free(node);
-    node = NULL;
+    return 0;
+}
 
-    return;
+/* closes and frees an event which won't be scanned, as onas_scan_worker() would have */
+static void onas_queue_drop_event(struct onas_scan_event *event_data)
+{
+#if defined(HAVE_SYS_FANOTIFY_H)
+    if (NULL != event_data->fmd) {
+        close(event_data->fmd->fd);
+        free(event_data->fmd);
+    }
+#endif
+    free(event_data->pathname);
+    free(event_data);
 }
 
-static void onas_destroy_event_queue(void)
+/* Looks for a queued copy of the event, and otherwise records it as queued in *coalesce
+ * Returns 1 if the event is a repeat and has been dropped, 0 if it needs to be queued */
+static int onas_queue_coalesce(struct onas_scan_event *event_data, uint32_t *coalesce)
 {
+    struct onas_queue_slot *slot;
+    const unsigned char *c;
+    uint64_t dev = 0, ino = 0, h = 0xcbf29ce484222325ULL;
+    uint32_t idx;
+    uint8_t b_fanotify;
+    time_t now;
+    int repeat = 0;
+
+    *coalesce  = ONAS_QUEUE_NO_SLOT;
+    b_fanotify = event_data->bool_opts & ONAS_SCTH_B_FANOTIFY ? 1 : 0;
+
+    if (b_fanotify) {
+#if defined(HAVE_SYS_FANOTIFY_H)
+        STATBUF sb;
+
+        if (NULL == event_data->fmd || (event_data->fmd->mask & FAN_ALL_PERM_EVENTS) || FSTAT(event_data->fmd->fd, &sb)) {
+            /* somebody waits on the answer to this one */
+            return 0;
+        }
+        dev = (uint64_t)sb.st_dev;
+        ino = (uint64_t)sb.st_ino;
+        h   = (ino ^ (dev << 32 | dev >> 32)) * 0x9e3779b97f4a7c15ULL;
+#else
+        return 0;
+#endif
+    } else {
+        if (NULL == event_data->pathname) {
+            return 0;
+        }
+        for (c = (const unsigned char *)event_data->pathname; *c; c++) {
+            h = (h ^ *c) * 0x100000001b3ULL;
+        }
+        h ^= event_data->bool_opts;
+    }
+    h ^= h >> 32;
+    idx = (uint32_t)(h & (ONAS_QUEUE_COALESCE_SLOTS - 1));
+    now = time(NULL);
 
-    if (NULL == g_onas_event_queue_head) {
-        return;
+    if (NULL == g_onas_coalesce_slots) {
+        return 0;
+    }
+    slot = &g_onas_coalesce_slots[idx];
+
+    pthread_mutex_lock(&slot->lock);
+
+    if (slot->event && now - slot->queued < ONAS_QUEUE_COALESCE_WINDOW) {
+        if (b_fanotify) {
+            repeat = (slot->event->bool_opts & ONAS_SCTH_B_FANOTIFY) && slot->dev == dev && slot->ino == ino;
+        } else {
+            repeat = slot->event->bool_opts == event_data->bool_opts && !strcmp(slot->event->pathname, event_data->pathname);
+        }
+    }
+
+    if (!repeat) {
+        slot->event  = event_data;
+        slot->dev    = dev;
+        slot->ino    = ino;
+        slot->queued = now;
+        *coalesce    = idx;
+    }
+    pthread_mutex_unlock(&slot->lock);
+
+    if (repeat) {
+        __atomic_add_fetch(&g_onas_queue_coalesced, 1, __ATOMIC_RELAXED);
+#ifdef ONAS_DEBUG
+        logg(LOGG_DEBUG, "ClamScanQueue: %s is already queued, coalescing\n", event_data->pathname);
+#endif
+        onas_queue_drop_event(event_data);
     }
 
-    struct onas_event_queue_node *curr = g_onas_event_queue_head;
-    struct onas_event_queue_node *next = curr->next;
+    return repeat;
+}
+
+static void *onas_scan_queue_worker(void *arg)
+{
+    /* Set thread name for profiling and debugging */
+    const char thread_name[] = "clamonacc-sw";
+    struct onas_scan_event *event_data;
+    struct onas_queue_slot *slot;
+    uint32_t coalesce;
+
+    UNUSEDPARAM(arg);
+
+#if defined(__linux__)
+    prctl(PR_SET_NAME, thread_name);
+#elif defined(__APPLE__) && defined(__MACH__)
+    pthread_setname_np(thread_name);
+#endif
 
     do {
-        onas_destroy_event_queue_node(curr);
-        curr = next;
-        if (curr) {
-            next = curr->next;
+        while (sem_wait(&g_onas_queue_filled)) {
+            /* interrupted, go back to sleep */
+        }
+
+        while (onas_queue_pop(&event_data, &coalesce)) {
+            if (__atomic_load_n(&g_onas_queue_stop, __ATOMIC_ACQUIRE) &&
+                __atomic_load_n(&g_onas_queue_deq.pos, __ATOMIC_RELAXED) == __atomic_load_n(&g_onas_queue_enq.pos, __ATOMIC_RELAXED)) {
+                /* drained, and woken up to stop */
+                return NULL;
+            }
+            /* a producer claimed the cell, but hasn't filled it in yet */
+            sched_yield();
         }
-    } while (curr);
+        sem_post(&g_onas_queue_free);
+
+        if (ONAS_QUEUE_NO_SLOT != coalesce) {
+            /* from here on a repeat has to be scanned again */
+            slot = &g_onas_coalesce_slots[coalesce];
+            pthread_mutex_lock(&slot->lock);
+            if (slot->event == event_data) {
+                slot->event = NULL;
+            }
+            pthread_mutex_unlock(&slot->lock);
+        }
+
+        /* frees the event */
+        onas_scan_worker(event_data);
+    } while (1);
 
-    return;
+    return NULL;
 }
 
 void *onas_scan_queue_th(void *arg)
@@ -158,6 +388,7 @@ void *onas_scan_queue_th(void *arg)
     /* not a ton of use for context right now, but perhaps in the future we can pass in more options */
     struct onas_context *ctx = (struct onas_context *)arg;
     sigset_t sigset;
+    int32_t nthreads = ctx->maxthreads > 0 ? ctx->maxthreads : 1;
 
     /* ignore all signals except SIGUSR2 */
     sigfillset(&sigset);
@@ -174,70 +405,53 @@ void *onas_scan_queue_th(void *arg)
 #endif
     pthread_sigmask(SIG_SETMASK, &sigset, NULL);
 
-    logg(LOGG_DEBUG, "ClamScanQueue: initializing event queue consumer ... (%d) threads in thread pool\n", ctx->maxthreads);
-    onas_init_event_queue();
-    threadpool thpool = thpool_init(ctx->maxthreads);
-    g_thpool          = thpool;
-
-    /* loop w/ onas_consume_event until we die */
+    /* scan threads inherit the signal mask, and pick events off the queue themselves */
     pthread_cleanup_push(onas_scan_queue_exit, NULL);
-    logg(LOGG_DEBUG, "ClamScanQueue: waiting to consume events ...\n");
+    logg(LOGG_DEBUG, "ClamScanQueue: starting (%d) scan threads\n", nthreads);
+    g_onas_queue_workers = calloc(nthreads, sizeof(pthread_t));
+    if (NULL == g_onas_queue_workers) {
+        logg(LOGG_ERROR, "ClamScanQueue: could not allocate memory for scan threads\n");
+    } else {
+        for (g_onas_queue_nworkers = 0; g_onas_queue_nworkers < nthreads; g_onas_queue_nworkers++) {
+            if (pthread_create(&g_onas_queue_workers[g_onas_queue_nworkers], NULL, onas_scan_queue_worker, NULL)) {
+                logg(LOGG_ERROR, "ClamScanQueue: could not start scan thread, running with (%d)\n", g_onas_queue_nworkers);
+                break;
+            }
+        }
+    }
+
+    /* nothing left to do but wait until we die */
+    logg(LOGG_DEBUG, "ClamScanQueue: waiting for events ...\n");
     do {
-        onas_consume_event(thpool);
+        pause();
     } while (1);
 
     pthread_cleanup_pop(1);
 }
 
-static int onas_queue_is_b_empty(void)
+cl_error_t onas_queue_event(struct onas_scan_event *event_data)
 {
+    uint32_t coalesce;
 
-    if (g_onas_event_queue.head->next == g_onas_event_queue.tail) {
-        return 1;
+    if (NULL == g_onas_queue_cells) {
+        return CL_EARG;
     }
 
-    return 0;
-}
-
-static int onas_consume_event(threadpool thpool)
-{
-    pthread_mutex_lock(&onas_queue_lock);
-
-    while (onas_queue_is_b_empty()) {
-        pthread_cond_wait(&onas_scan_queue_empty_cond, &onas_queue_lock);
+    if (onas_queue_coalesce(event_data, &coalesce)) {
+        /* the queued copy covers this one */
+        return CL_SUCCESS;
     }
 
-    struct onas_event_queue_node *popped_node = g_onas_event_queue_head->next;
-    g_onas_event_queue_head->next             = g_onas_event_queue_head->next->next;
-    g_onas_event_queue_head->next->prev       = g_onas_event_queue_head;
-    g_onas_event_queue.size--;
-
-    pthread_mutex_unlock(&onas_queue_lock);
-
-    thpool_add_work(thpool, (void *)onas_scan_worker, (void *)popped_node->data);
-    onas_destroy_event_queue_node(popped_node);
-
-    return 1;
-}
-
-cl_error_t onas_queue_event(struct onas_scan_event *event_data)
-{
-    struct onas_event_queue_node *node = NULL;
-    if (CL_EMEM == onas_new_event_queue_node(&node))
-        return CL_EMEM;
-
-    pthread_mutex_lock(&onas_queue_lock);
-    node->next                                                            = g_onas_event_queue_tail;
-    node->prev                                                            = g_onas_event_queue_tail->prev;
-    ((struct onas_event_queue_node *)g_onas_event_queue_tail->prev)->next = node;
-    g_onas_event_queue_tail->prev                                         = node;
-
-    node->data = event_data;
-
-    g_onas_event_queue.size++;
+    while (sem_wait(&g_onas_queue_free)) {
+        /* interrupted, keep waiting for room */
+    }
+    while (onas_queue_push(event_data, coalesce)) {
+        /* a worker claimed the cell, but hasn't emptied it yet */
+        sched_yield();
+    }
+    sem_post(&g_onas_queue_filled);
 
-    pthread_cond_signal(&onas_scan_queue_empty_cond);
-    pthread_mutex_unlock(&onas_queue_lock);
+    __atomic_add_fetch(&g_onas_queue_events, 1, __ATOMIC_RELAXED);
 
     return CL_SUCCESS;
 }
@@ -253,6 +467,12 @@ cl_error_t onas_scan_queue_start(struct onas_context **ctx)
         return CL_EARG;
     }
 
+    /* set up before the event loops can feed it */
+    if (CL_SUCCESS != onas_init_event_queue()) {
+        logg(LOGG_DEBUG, "ClamScanQueue: unable to allocate event queue ... \n");
+        return CL_EMEM;
+    }
+
     if (pthread_attr_init(&scan_queue_attr)) {
         return CL_BREAK;
     }
@@ -270,13 +490,23 @@ cl_error_t onas_scan_queue_start(struct onas_context **ctx)
 
 static void onas_scan_queue_exit(void *arg)
 {
+    int32_t i;
+
     UNUSEDPARAM(arg);
 
     logg(LOGG_DEBUG, "ClamScanQueue: onas_scan_queue_exit()\n");
-    if (g_thpool) {
-        thpool_wait(g_thpool);
-        thpool_destroy(g_thpool);
-        g_thpool = NULL;
+    if (g_onas_queue_workers) {
+        /* let the scan threads drain the queue, then wake each of them up once more to stop */
+        __atomic_store_n(&g_onas_queue_stop, 1, __ATOMIC_RELEASE);
+        for (i = 0; i < g_onas_queue_nworkers; i++) {
+            sem_post(&g_onas_queue_filled);
+        }
+        for (i = 0; i < g_onas_queue_nworkers; i++) {
+            pthread_join(g_onas_queue_workers[i], NULL);
+        }
+        free(g_onas_queue_workers);
+        g_onas_queue_workers  = NULL;
+        g_onas_queue_nworkers = 0;
     }
     onas_destroy_event_queue();
     logg(LOGG_INFO, "ClamScanQueue: stopped\n");
@@ -21,19 +21,12 @@
 #ifndef __ONAS_SCQUE_H
 #define __ONAS_SCQUE_H
 
-/* extremely simple event queue implementation w/ obj number tracking in case we want to place limits later */
-struct onas_event_queue {
-    struct onas_event_queue_node *head;
-    struct onas_event_queue_node *tail;
-    uint64_t size;
-};
-
-struct onas_event_queue_node {
-    struct onas_event_queue_node *next;
-    struct onas_event_queue_node *prev;
-
-    struct onas_scan_event *data;
-};
+/* slots in the event ring, must be a power of two */
+#define ONAS_QUEUE_SIZE 4096
+/* slots in the table used to coalesce repeated events, must be a power of two */
+#define ONAS_QUEUE_COALESCE_SLOTS 1024
+/* seconds during which a repeated event is folded into the queued one */
+#define ONAS_QUEUE_COALESCE_WINDOW 2
 
 void *onas_scan_queue_th(void *arg);
 
@@ -40,10 +40,13 @@
 // common
 #include "optparser.h"
 #include "output.h"
+#include "clamdcom.h"
 
 #include "../misc/priv_fts.h"
 #include "../misc/utils.h"
 #include "../client/client.h"
+#include "../client/pool.h"
+#include "onas_cache.h"
 #include "thread.h"
 
 static pthread_mutex_t onas_scan_lock = PTHREAD_MUTEX_INITIALIZER;
@@ -112,8 +115,9 @@ static int onas_scan(struct onas_scan_event *event_data, const char *fname, STAT
 static cl_error_t onas_scan_safe(struct onas_scan_event *event_data, const char *fname, STATBUF sb, int *infected, int *err, cl_error_t *ret_code)
 {
 
-    int ret = 0;
-    int fd  = -1;
+    int ret    = 0;
+    int fd     = -1;
+    int pooled = 0;
 
 #if defined(HAVE_SYS_FANOTIFY_H)
     uint8_t b_fanotify;
@@ -125,12 +129,18 @@ static cl_error_t onas_scan_safe(struct onas_scan_event *event_data, const char
     }
 #endif
 
-    pthread_mutex_lock(&onas_scan_lock);
+    /* pooled sessions serialize their own writes and can have several scans in flight */
+    pooled = onas_pool_enabled();
+    if (!pooled) {
+        pthread_mutex_lock(&onas_scan_lock);
+    }
 
     ret = onas_client_scan(event_data->tcpaddr, event_data->portnum, event_data->scantype, event_data->maxstream,
                            fname, fd, event_data->timeout, sb, infected, err, ret_code);
 
-    pthread_mutex_unlock(&onas_scan_lock);
+    if (!pooled) {
+        pthread_mutex_unlock(&onas_scan_lock);
+    }
 
     return ret;
 }
@@ -148,6 +158,9 @@ static cl_error_t onas_scan_thread_scanfile(struct onas_scan_event *event_data,
     uint8_t b_scan;
     uint8_t b_deny_on_error;
 
+    uint32_t generation = 0;
+    time_t started;
+
     if (NULL == event_data || NULL == fname || NULL == infected || NULL == err || NULL == ret_code) {
         logg(LOGG_ERROR, "ClamWorker: scan failed (NULL arg given)\n");
         return CL_ENULLARG;
@@ -165,8 +178,23 @@ static cl_error_t onas_scan_thread_scanfile(struct onas_scan_event *event_data,
 #endif
 
     if (b_scan) {
+#if defined(HAVE_SYS_FANOTIFY_H)
+        /*
+         * Only cache what clamd read through the event's fd, the one sb comes
+         * from. A scan by path may see another file if it was renamed meanwhile.
+         */
+        if (b_fanotify && (event_data->scantype == FILDES || event_data->scantype == STREAM)) {
+            generation = onas_cache_generation(event_data->tcpaddr, event_data->portnum, event_data->timeout);
+        }
+#endif
+        started = time(NULL);
+
         ret = onas_scan(event_data, fname, sb, infected, err, ret_code);
 
+        if (ret == CL_CLEAN && !*err && !*infected) {
+            onas_cache_insert(&sb, generation, started);
+        }
+
         if (*err && *ret_code != CL_SUCCESS) {
             logg(LOGG_DEBUG, "ClamWorker: scan failed with error code %d\n", *ret_code);
         }
@@ -275,7 +303,16 @@ static cl_error_t onas_scan_thread_handle_file(struct onas_scan_event *event_dat
         return CL_ENULLARG;
     }
 
-    fres = CLAMSTAT(pathname, &sb);
+#if defined(HAVE_SYS_FANOTIFY_H)
+    if (event_data->bool_opts & ONAS_SCTH_B_FANOTIFY) {
+        /* the file fanotify opened, whatever the path leads to by now */
+        fres = FSTAT(event_data->fmd->fd, &sb);
+    } else
+#endif
+        fres = CLAMSTAT(pathname, &sb);
+    if (fres != 0) {
+        memset(&sb, 0, sizeof(sb));
+    }
     if (event_data->sizelimit) {
         if (fres != 0 || (uint64_t)sb.st_size > event_data->sizelimit) {
             /* don't skip so we avoid lockups, but don't scan either;
@@ -302,7 +339,7 @@ static cl_error_t onas_scan_thread_handle_file(struct onas_scan_event *event_dat
 }
 
 /**
- * @brief worker thread designed to work with the lovely c-thread-pool library to handle our scanning jobs after our queue thread consumes an event
+ * @brief handles a single scanning job, called by the scan threads for each event they take off the queue
  *
  * @param arg this should always be an onas_scan_event struct
  */
@@ -359,8 +396,8 @@ void *onas_scan_worker(void *arg)
     }
 #endif
 done:
-    /* our job to cleanup event data: worker queue just kicks us off in a thread pool, drops the event object
-     * from the queue and forgets about us */
+    /* our job to cleanup event data: the scan thread takes the event object off the queue, hands it to us
+     * and forgets about it */
 
     if (NULL != event_data) {
         if (NULL != event_data->pathname) {
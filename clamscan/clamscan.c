@@ -284,6 +284,9 @@ void help(void)
     mprintf(LOGG_INFO, "                                         **Caution**: You should NEVER run bytecode signatures from untrusted sources.\n");
     mprintf(LOGG_INFO, "                                         Doing so may result in arbitrary code execution.\n");
     mprintf(LOGG_INFO, "    --bytecode-timeout=N                 Set bytecode timeout (in milliseconds)\n");
+    mprintf(LOGG_INFO, "    --bytecode-lazy-prepare[=yes/no(*)]  Prepare bytecode signatures on first run\n");
+    mprintf(LOGG_INFO, "    --bytecode-cache-dir=DIRECTORY       Cache the JIT-compiled bytecode in DIRECTORY\n");
+    mprintf(LOGG_INFO, "    --bytecode-native=FILE               Load precompiled bytecode signatures from FILE\n");
     mprintf(LOGG_INFO, "    --statistics[=none(*)/bytecode/pcre] Collect and print execution statistics\n");
     mprintf(LOGG_INFO, "    --detect-pua[=yes/no(*)]             Detect Possibly Unwanted Applications\n");
     mprintf(LOGG_INFO, "    --exclude-pua=CAT                    Skip PUA sigs of category CAT\n");
@@ -341,6 +344,7 @@ void help(void)
     mprintf(LOGG_INFO, "    --pcre-match-limit=#n                Maximum calls to the PCRE match function.\n");
     mprintf(LOGG_INFO, "    --pcre-recmatch-limit=#n             Maximum recursive calls to the PCRE match function.\n");
     mprintf(LOGG_INFO, "    --pcre-max-filesize=#n               Maximum size file to perform PCRE subsig matching.\n");
+    mprintf(LOGG_INFO, "    --parallel-scan-threads=#n           Threads to scan archive members and PDF objects in parallel (0 = disabled)\n");
     mprintf(LOGG_INFO, "    --disable-cache                      Disable caching and cache checks for hash sums of scanned files.\n");
     mprintf(LOGG_INFO, "\n");
     mprintf(LOGG_INFO, "Pass in - as the filename for stdin.\n");
@@ -1205,6 +1205,25 @@ int scanmanager(const struct optstruct *opts)
     if ((opt = optget(opts, "bytecode-timeout"))->enabled)
         cl_engine_set_num(engine, CL_ENGINE_BYTECODE_TIMEOUT, opt->numarg);
 
+    if (optget(opts, "bytecode-lazy-prepare")->enabled)
+        cl_engine_set_num(engine, CL_ENGINE_BYTECODE_LAZY, 1);
+
+    if ((opt = optget(opts, "bytecode-cache-dir"))->enabled) {
+        if ((ret = cl_engine_set_str(engine, CL_ENGINE_BYTECODE_CACHE_DIR, opt->strarg))) {
+            logg(LOGG_ERROR, "cli_engine_set_str(CL_ENGINE_BYTECODE_CACHE_DIR) failed: %s\n", cl_strerror(ret));
+            ret = 2;
+            goto done;
+        }
+    }
+
+    if ((opt = optget(opts, "bytecode-native"))->enabled) {
+        if ((ret = cl_engine_set_str(engine, CL_ENGINE_BYTECODE_NATIVE, opt->strarg))) {
+            logg(LOGG_ERROR, "cli_engine_set_str(CL_ENGINE_BYTECODE_NATIVE) failed: %s\n", cl_strerror(ret));
+            ret = 2;
+            goto done;
+        }
+    }
+
     if (optget(opts, "nocerts")->enabled)
         cl_engine_set_num(engine, CL_ENGINE_DISABLE_PE_CERTS, 1);
 
@@ -1314,6 +1333,14 @@ int scanmanager(const struct optstruct *opts)
         }
     }
 
+    if ((opt = optget(opts, "parallel-scan-threads"))->active) {
+        if ((ret = cl_engine_set_num(engine, CL_ENGINE_PARALLEL_THREADS, opt->numarg))) {
+            logg(LOGG_ERROR, "cli_engine_set_num(CL_ENGINE_PARALLEL_THREADS) failed: %s\n", cl_strerror(ret));
+            ret = 2;
+            goto done;
+        }
+    }
+
     if ((ret = cl_engine_compile(engine)) != 0) {
         logg(LOGG_ERROR, "Database initialization error: %s\n", cl_strerror(ret));
         ret = 2;
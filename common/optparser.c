@@ -183,6 +183,7 @@ const struct clam_option __clam_options[] = {
     {NULL, "compare", 'c', CLOPT_TYPE_STRING, NULL, -1, NULL, 0, OPT_SIGTOOL, "", ""},
     {NULL, "run-cdiff", 'r', CLOPT_TYPE_STRING, NULL, -1, NULL, 0, OPT_SIGTOOL, "", ""},
     {NULL, "verify-cdiff", 0, CLOPT_TYPE_STRING, NULL, -1, NULL, 0, OPT_SIGTOOL, "", ""},
+    {NULL, "compile-bytecode", 0, CLOPT_TYPE_STRING, NULL, -1, NULL, 0, OPT_SIGTOOL, "", ""},
     {NULL, "hybrid", 0, CLOPT_TYPE_BOOL, MATCH_BOOL, 0, NULL, 0, OPT_SIGTOOL, "Create a hybrid (standard and bytecode) database file", ""},
     {NULL, "defaultcolors", 'd', CLOPT_TYPE_BOOL, MATCH_BOOL, 0, NULL, 0, OPT_CLAMDTOP, "", ""},
 
@@ -198,6 +199,7 @@ const struct clam_option __clam_options[] = {
     {NULL, "input", 'r', CLOPT_TYPE_STRING, NULL, -1, NULL, 0, OPT_CLAMBC, "Input file to run the bytecode n", ""},
     {NULL, "trace", 'T', CLOPT_TYPE_NUMBER, MATCH_NUMBER, 7, NULL, 0, OPT_CLAMBC, "bytecode trace level", ""},
     {NULL, "no-trace-showsource", 's', CLOPT_TYPE_BOOL, MATCH_BOOL, 0, NULL, 0, OPT_CLAMBC, "Don't show source line during tracing", ""},
+    {NULL, "benchmark", 'b', CLOPT_TYPE_NUMBER, MATCH_NUMBER, -1, NULL, 0, OPT_CLAMBC, "Time the bytecode in each interpreter mode", ""},
 
     {NULL, "archive-verbose", 'a', CLOPT_TYPE_BOOL, MATCH_BOOL, 0, NULL, 0, OPT_CLAMSCAN, "", ""},
 
@@ -335,6 +337,12 @@ const struct clam_option __clam_options[] = {
 
     {"ConcurrentDatabaseReload", NULL, 0, CLOPT_TYPE_BOOL, MATCH_BOOL, 1, NULL, 0, OPT_CLAMD, "Enable non-blocking (multi-threaded/concurrent) database reloads. This feature \nwill temporarily load a second scanning engine while scanning continues using \nthe first engine. Once loaded, the new engine takes over. The old engine is \nremoved as soon as all scans using the old engine have completed. This feature \nrequires more RAM, so this option is provided in case users are willing to \nblock scans during reload in exchange for lower RAM requirements.", "yes"},
 
+    {"MemoryHugePages", NULL, 0, CLOPT_TYPE_STRING, "^(no|transparent|explicit)$", -1, "no", FLAG_REQUIRED, OPT_CLAMD, "Keep the loaded signatures in huge pages to reduce TLB misses while scanning.\nPossible values:\n\tno - use normal pages\n\ttransparent - ask the kernel for transparent huge pages\n\texplicit - use the huge pages reserved in vm.nr_hugepages, and fall back to\n\ttransparent huge pages when there aren't enough", "transparent"},
+
+    {"MemoryNUMANode", NULL, 0, CLOPT_TYPE_STRING, "^(default|interleave|[0-9]+)$", -1, "default", FLAG_REQUIRED, OPT_CLAMD, "NUMA placement of the loaded signatures.\nPossible values:\n\tdefault - the node of the thread that loads the database\n\tinterleave - spread over all nodes\n\tN - bind to node N", "interleave"},
+
+    {"NUMAEngineReplicas", NULL, 0, CLOPT_TYPE_BOOL, MATCH_BOOL, 0, NULL, 0, OPT_CLAMD, "Load one copy of the signatures on each NUMA node and pin the scanning\nthreads to the nodes, so that every thread scans with node-local memory.\nThe memory used by the signatures is multiplied by the number of nodes.\nIgnored on single node systems.", "yes"},
+
     {"DisableCache", "disable-cache", 0, CLOPT_TYPE_BOOL, MATCH_BOOL, 0, NULL, 0, OPT_CLAMD | OPT_CLAMSCAN, "This option allows you to disable clamd's caching feature.", "no"},
 
     {"VirusEvent", NULL, 0, CLOPT_TYPE_STRING, NULL, -1, NULL, 0, OPT_CLAMD, "Execute a command when virus is found.\nUse the following environment variables to identify the file and virus names:\n- $CLAM_VIRUSEVENT_FILENAME\n- $CLAM_VIRUSEVENT_VIRUSNAME\nIn the command string, '%v' will also be replaced with the virus name.\nNote: The '%f' filename format character has been disabled and will no longer\nbe replaced with the file name, due to command injection security concerns.\nUse the 'CLAM_VIRUSEVENT_FILENAME' environment variable instead.\nFor the same reason, you should NOT use the environment variables in the\ncommand directly, but should use it carefully from your executed script.", "/opt/send_virus_alert_sms.sh"},
@@ -368,6 +376,15 @@ const struct clam_option __clam_options[] = {
     {"BytecodeMode", "bytecode-mode", 0, CLOPT_TYPE_STRING, "^(Auto|ForceJIT|ForceInterpreter|Test)$", -1, "Auto", FLAG_REQUIRED, OPT_CLAMD | OPT_CLAMSCAN,
      "Set bytecode execution mode.\nPossible values:\n\tAuto - automatically choose JIT if possible, fallback to interpreter\nForceJIT - always choose JIT, fail if not possible\nForceInterpreter - always choose interpreter\nTest - run with both JIT and interpreter and compare results. Make all failures fatal.", "Auto"},
 
+    {"BytecodeLazyPrepare", "bytecode-lazy-prepare", 0, CLOPT_TYPE_BOOL, MATCH_BOOL, 0, NULL, 0, OPT_CLAMD | OPT_CLAMSCAN,
+     "Prepare the bytecode signatures that run in the interpreter when they are\nfirst triggered instead of when the database is loaded. This makes loading\nfaster and saves the memory of bytecodes that never run. Bytecodes compiled\nwith the JIT are always prepared at load time.", "no"},
+
+    {"BytecodeCacheDirectory", "bytecode-cache-dir", 0, CLOPT_TYPE_STRING, NULL, -1, NULL, 0, OPT_CLAMD | OPT_CLAMSCAN,
+     "Directory to cache the native code the JIT generates for the bytecode signatures in.\nWhen the same bytecode is loaded again (e.g. on a reload with an unchanged\nbytecode.cvd) the cached code is used instead of compiling it again.\nThe cached code is executed, so the directory must be writable only by the\nuser ClamAV runs as. Only the code of the latest set of bytecodes is kept.\nThis option has no effect if ClamAV was built without LLVM.", "/var/lib/clamav/bytecode-cache"},
+
+    {"BytecodeNativeModule", "bytecode-native", 0, CLOPT_TYPE_STRING, NULL, -1, NULL, 0, OPT_CLAMD | OPT_CLAMSCAN,
+     "Native module with the bytecode signatures compiled ahead of time by\nsigtool --compile-bytecode. The bytecodes found in the module are not compiled\nagain, the others are compiled as usual. The module is only used if it was\nbuilt by the same ClamAV and LLVM versions for the same target. Its code is\nexecuted, so it must come from the same trusted source as the databases.\nThis option has no effect if ClamAV was built without LLVM.", "/var/lib/clamav/bytecode.cbn"},
+
     {"Statistics", "statistics", 0, CLOPT_TYPE_STRING, "^(none|None|bytecode|Bytecode|pcre|PCRE)$", -1, NULL, FLAG_MULTIPLE, OPT_CLAMSCAN | OPT_CLAMBC, "Collect and print execution statistics.\nPossible values:\n\tBytecode - reports bytecode statistics\nPCRE - reports PCRE execution statistics\nNone - reports no statistics", "None"},
 
     {"DetectPUA", "detect-pua", 0, CLOPT_TYPE_BOOL, MATCH_BOOL, 0, NULL, 0, OPT_CLAMD | OPT_CLAMSCAN, "Detect Potentially Unwanted Applications.", "yes"},
@@ -478,6 +495,8 @@ const struct clam_option __clam_options[] = {
 
     {"PCREMaxFileSize", "pcre-max-filesize", 0, CLOPT_TYPE_SIZE, MATCH_SIZE, CLI_DEFAULT_PCRE_MAX_FILESIZE, NULL, 0, OPT_CLAMD | OPT_CLAMSCAN, "This option sets the maximum filesize for which PCRE subsigs will be executed.\nFiles exceeding this limit will not have PCRE subsigs executed unless a subsig is encompassed to a smaller buffer.\nNegative values are not allowed.\nSetting this value to zero disables the limit.\nWARNING: setting this limit too high or disabling it may severely impact performance.", "100M"},
 
+    {"ParallelScanThreads", "parallel-scan-threads", 0, CLOPT_TYPE_NUMBER, MATCH_NUMBER, 0, NULL, 0, OPT_CLAMD | OPT_CLAMSCAN, "This option sets the number of worker threads used to scan the content of a\nsingle file in parallel. This applies to the members of ZIP, 7-Zip and RAR archives\nand to the objects extracted from PDF documents.\nThe results are the same as with serial scanning.\nThe value of 0 disables parallel scanning.", "4"},
+
     /* OnAccess settings */
     {"OnAccessMountPath", NULL, 0, CLOPT_TYPE_STRING, NULL, -1, NULL, FLAG_MULTIPLE, OPT_CLAMD, "This option specifies a directory or mount point which should be scanned on access. The mount point specified, or the mount point containing the specified directory will be watched, but only notifications will occur. If any directories are specified, this option will preempt the DDD system. It can also be used multiple times.", "/\n/home/user"},
 
@@ -507,6 +526,8 @@ const struct clam_option __clam_options[] = {
 
     {"OnAccessDenyOnError", NULL, 0, CLOPT_TYPE_BOOL, MATCH_BOOL, 0, NULL, 0, OPT_CLAMD, "When using prevention, if this option is turned on, any errors that occur during scanning will result in the event attempt being denied. This could potentially lead to unwanted system behaviour with certain configurations, so the client defaults to off and allowing access events in case of error.", "yes"},
 
+    {"OnAccessVerdictCacheSize", NULL, 0, CLOPT_TYPE_NUMBER, MATCH_NUMBER, 65536, NULL, 0, OPT_CLAMD, "Number of clean verdicts the OnAccess client remembers, so that files which didn't change since they were last scanned are allowed without asking clamd again. Files are identified by device, inode, size, change and modification times; all verdicts are dropped when clamd reports a different database version. Only scans that pass clamd the file descriptor or the content (clamonacc --fdpass or --stream) are remembered. Each entry takes 64 bytes. Set to 0 to disable the cache.", "65536"},
+
     /* clamonacc cmdline options */
 
     {NULL, "watch-list", 'W', CLOPT_TYPE_STRING, NULL, -1, NULL, 0, OPT_CLAMONACC, "", ""},
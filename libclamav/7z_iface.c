@@ -30,6 +30,7 @@
 #include "scanners.h"
 #include "others.h"
 #include "fmap.h"
+#include "scanpool.h"
 
 #include "7z/7z.h"
 #include "7z/7zAlloc.h"
@@ -91,6 +92,9 @@ int cli_7unz(cli_ctx *ctx, size_t offset)
     cl_error_t found       = CL_CLEAN;
     Int64 begin_of_archive = offset;
 
+    cli_scan_queue_t *queue = NULL;
+    bool queue_failed       = false;
+
     /* Replacement for
        FileInStream_CreateVTable(&archiveStream); */
     archiveStream.s.Read    = FileInStream_fmap_Read;
@@ -117,7 +121,10 @@ int cli_7unz(cli_ctx *ctx, size_t offset)
         size_t outBufferSize   = 0;
         unsigned int encrypted = 0;
 
-        for (i = 0; i < db.db.NumFiles; i++) {
+        /* The members are decompressed in order, but may be scanned on the scan pool. */
+        found = cli_scan_queue_new(ctx, &queue);
+
+        for (i = 0; found == CL_SUCCESS && i < db.db.NumFiles; i++) {
             size_t offset           = 0;
             size_t outSizeProcessed = 0;
             const CSzFileItem *f    = db.db.Files + i;
@@ -164,6 +171,11 @@ int cli_7unz(cli_ctx *ctx, size_t offset)
             if (res == SZ_ERROR_ENCRYPTED) {
                 encrypted = 1;
                 if (SCAN_HEURISTIC_ENCRYPTED_ARCHIVE) {
+                    // The members in flight are scanned first, to keep the order of the alerts.
+                    if ((found = cli_scan_queue_wait(queue)) != CL_SUCCESS) {
+                        queue_failed = true;
+                        break;
+                    }
                     cli_dbgmsg("cli_7unz: Encrypted files found in archive.\n");
                     found = cli_append_potentially_unwanted(ctx, "Heuristics.Encrypted.7Zip");
                     if (found != CL_SUCCESS) {
@@ -171,6 +183,13 @@ int cli_7unz(cli_ctx *ctx, size_t offset)
                     }
                 }
             }
+            if (ctx->engine->cb_meta || ctx->engine->cdb) {
+                // Same for the metadata signatures, which may alert as well.
+                if ((found = cli_scan_queue_wait(queue)) != CL_SUCCESS) {
+                    queue_failed = true;
+                    break;
+                }
+            }
             if (CL_VIRUS == cli_matchmeta(ctx, name, 0, f->Size, encrypted, i, f->CrcDefined ? f->Crc : 0)) {
                 found = CL_VIRUS;
                 break;
@@ -185,7 +204,24 @@ int cli_7unz(cli_ctx *ctx, size_t offset)
 
                 cli_dbgmsg("cli_7unz: Saving to %s\n", tmp_name);
                 if (cli_writen(fd, outBuffer + offset, outSizeProcessed) != outSizeProcessed) {
+                    // Don't scan a truncated member.
+                    close(fd);
+                    if (!ctx->engine->keeptmp)
+                        cli_unlink(tmp_name);
+                    free(tmp_name);
                     found = CL_EWRITE;
+                    break;
+                }
+
+                if (queue) {
+                    close(fd);
+                    found = cli_scan_queue_file(queue, tmp_name, name, LAYER_ATTRIBUTES_NONE);
+                    if (found != CL_SUCCESS) {
+                        // An earlier member alerted, or exceeded a limit.
+                        queue_failed = true;
+                        break;
+                    }
+                    continue;
                 }
 
                 found = cli_magic_scan_desc(fd, tmp_name, ctx, name, LAYER_ATTRIBUTES_NONE);
@@ -199,6 +235,14 @@ int cli_7unz(cli_ctx *ctx, size_t offset)
                     break;
             }
         }
+
+        if (queue && !queue_failed) {
+            // The members still in flight were found before whatever stopped the loop.
+            cl_error_t queue_ret = cli_scan_queue_wait(queue);
+            if (queue_ret != CL_SUCCESS)
+                found = queue_ret;
+        }
+        cli_scan_queue_free(queue);
         IAlloc_Free(&allocImp, outBuffer);
     }
     SzArEx_Free(&db, &allocImp);
@@ -28,6 +28,9 @@
 #include <string.h>
 #include <assert.h>
 #include <fcntl.h>
+#ifdef CL_THREAD_SAFE
+#include <pthread.h>
+#endif
 
 #include "json.h"
 #include "dconf.h"
@@ -110,14 +113,8 @@ static void bytecode_context_reset(struct cli_bc_ctx *ctx)
 {
     unsigned i;
 
-    free(ctx->opsizes);
-    ctx->opsizes = NULL;
-
-    free(ctx->values);
-    ctx->values = NULL;
-
-    free(ctx->operands);
-    ctx->operands = NULL;
+    /* the parameter buffers (values, operands, opsizes) are kept, so that
+     * cli_bytecode_context_setfuncid() can reuse them for the next run */
 
     if (-1 != ctx->outfd) {
         close(ctx->outfd);
@@ -235,8 +232,23 @@ static void bytecode_context_reset(struct cli_bc_ctx *ctx)
 
 static inline void bytecode_context_initialize(struct cli_bc_ctx *ctx)
 {
+    /* keep the buffers left behind by the previous user of a pooled context */
+    uint16_t *opsizes    = ctx->opsizes;
+    char *values         = ctx->values;
+    operand_t *operands  = ctx->operands;
+    unsigned values_size = ctx->values_size;
+    unsigned params_size = ctx->params_size;
+    void *stack_spare    = ctx->stack_spare;
+
     memset(ctx, 0, sizeof(*ctx));
 
+    ctx->opsizes     = opsizes;
+    ctx->values      = values;
+    ctx->operands    = operands;
+    ctx->values_size = values_size;
+    ctx->params_size = params_size;
+    ctx->stack_spare = stack_spare;
+
     ctx->bytecode_timeout = 60000;
 
     // 0 (aka stdin) is not a valid fd for `outfd`.
@@ -244,23 +256,83 @@ static inline void bytecode_context_initialize(struct cli_bc_ctx *ctx)
     ctx->outfd = -1;
 }
 
-struct cli_bc_ctx *cli_bytecode_context_alloc(void)
+/* free a context that has already been reset */
+static void bytecode_context_free(struct cli_bc_ctx *ctx)
 {
-    struct cli_bc_ctx *ctx = calloc(1, sizeof(*ctx));
-    if (!ctx) {
-        cli_errmsg("Failed to allocate bytecode context\n");
-        return NULL;
+    free(ctx->opsizes);
+    free(ctx->values);
+    free(ctx->operands);
+    free(ctx->stack_spare);
+    free(ctx);
+}
+
+/*
+ * Bytecode hooks run on every file of their kind (BC_PE_ALL on every PE), so
+ * the contexts are recycled through a small per-thread pool instead of being
+ * allocated and initialized for each run. A nested scan started from a hook
+ * just takes another context from the pool.
+ * The pool belongs to the engine: cl_engine_free() releases the contexts of
+ * every thread, see cli_bytecode_context_pool_new().
+ */
+#define BC_CTX_POOL_MAX 8
+
+struct bc_ctx_pool {
+    struct cli_bc_ctx *ctxs[BC_CTX_POOL_MAX];
+    unsigned count;
+};
+
+static void bc_ctx_pool_release(void *ptr)
+{
+    struct bc_ctx_pool *pool = ptr;
+    unsigned i;
+
+    for (i = 0; i < pool->count; i++)
+        bytecode_context_free(pool->ctxs[i]);
+    pool->count = 0;
+}
+
+cli_threadlocal_t *cli_bytecode_context_pool_new(void)
+{
+    return cli_threadlocal_new(sizeof(struct bc_ctx_pool), bc_ctx_pool_release);
+}
+
+struct cli_bc_ctx *cli_bytecode_context_alloc(const struct cl_engine *engine)
+{
+    cli_threadlocal_t *pools = engine ? engine->bc_ctx_pool : NULL;
+    struct bc_ctx_pool *pool = pools ? cli_threadlocal_get(pools) : NULL;
+    struct cli_bc_ctx *ctx;
+
+    if (pool && pool->count) {
+        ctx = pool->ctxs[--pool->count];
+    } else {
+        ctx = calloc(1, sizeof(*ctx));
+        if (!ctx) {
+            cli_errmsg("Failed to allocate bytecode context\n");
+            return NULL;
+        }
     }
 
     bytecode_context_initialize(ctx);
+    ctx->pool = pools;
 
     return ctx;
 }
 
 void cli_bytecode_context_destroy(struct cli_bc_ctx *ctx)
 {
+    struct bc_ctx_pool *pool;
+
+    if (!ctx)
+        return;
+
     bytecode_context_reset(ctx);
-    free(ctx);
+
+    pool = ctx->pool ? cli_threadlocal_get(ctx->pool) : NULL;
+    if (!pool || pool->count == BC_CTX_POOL_MAX) {
+        bytecode_context_free(ctx);
+        return;
+    }
+    pool->ctxs[pool->count++] = ctx;
 }
 
 int cli_bytecode_context_getresult_file(struct cli_bc_ctx *ctx, char **tempfilename)
@@ -333,15 +405,22 @@ cl_error_t cli_bytecode_context_setfuncid(struct cli_bc_ctx *ctx, const struct c
     ctx->numParams   = func->numArgs;
     ctx->funcid      = funcid;
     if (func->numArgs) {
-        ctx->operands = malloc(sizeof(*ctx->operands) * func->numArgs);
-        if (!ctx->operands) {
-            cli_errmsg("bytecode: error allocating memory for parameters\n");
-            return CL_EMEM;
-        }
-        ctx->opsizes = malloc(sizeof(*ctx->opsizes) * func->numArgs);
-        if (!ctx->opsizes) {
-            cli_errmsg("bytecode: error allocating memory for opsizes\n");
-            return CL_EMEM;
+        if (func->numArgs > ctx->params_size) {
+            free(ctx->operands);
+            free(ctx->opsizes);
+            ctx->opsizes     = NULL;
+            ctx->params_size = 0;
+            ctx->operands    = malloc(sizeof(*ctx->operands) * func->numArgs);
+            if (!ctx->operands) {
+                cli_errmsg("bytecode: error allocating memory for parameters\n");
+                return CL_EMEM;
+            }
+            ctx->opsizes = malloc(sizeof(*ctx->opsizes) * func->numArgs);
+            if (!ctx->opsizes) {
+                cli_errmsg("bytecode: error allocating memory for opsizes\n");
+                return CL_EMEM;
+            }
+            ctx->params_size = func->numArgs;
         }
         for (i = 0; i < func->numArgs; i++) {
             unsigned al          = typealign(bc, func->types[i]);
@@ -351,11 +430,16 @@ cl_error_t cli_bytecode_context_setfuncid(struct cli_bc_ctx *ctx, const struct c
         }
     }
     s += 8; /* return value */
-    ctx->bytes  = s;
-    ctx->values = malloc(s);
-    if (!ctx->values) {
-        cli_errmsg("bytecode: error allocating memory for parameters\n");
-        return CL_EMEM;
+    ctx->bytes = s;
+    if (s > ctx->values_size) {
+        free(ctx->values);
+        ctx->values_size = 0;
+        ctx->values      = malloc(s);
+        if (!ctx->values) {
+            cli_errmsg("bytecode: error allocating memory for parameters\n");
+            return CL_EMEM;
+        }
+        ctx->values_size = s;
     }
     return CL_SUCCESS;
 }
@@ -1612,7 +1696,7 @@ void cli_sigperf_events_destroy()
     cli_events_free(g_sigevents);
 }
 
-cl_error_t cli_bytecode_load(struct cli_bc *bc, FILE *f, struct cli_dbio *dbio, int trust, int sigperf)
+static cl_error_t bytecode_load(struct cli_bc *bc, FILE *f, struct cli_dbio *dbio, int trust, int sigperf, void *hashctx)
 {
     unsigned row = 0, current_func = 0, bb = 0;
     char *buffer;
@@ -1634,6 +1718,7 @@ cl_error_t cli_bytecode_load(struct cli_bc *bc, FILE *f, struct cli_dbio *dbio,
         return CL_EMALFDB;
     }
     cli_chomp(firstbuf);
+    cl_update_hash(hashctx, firstbuf, strlen(firstbuf) + 1);
     rc    = parseHeader(bc, (unsigned char *)firstbuf, &linelength);
     state = PARSE_BC_LSIG;
     if (rc == CL_BREAK) {
@@ -1659,6 +1744,7 @@ cl_error_t cli_bytecode_load(struct cli_bc *bc, FILE *f, struct cli_dbio *dbio,
     }
     while (cli_dbgets(buffer, linelength, f, dbio) && !end) {
         cli_chomp(buffer);
+        cl_update_hash(hashctx, buffer, strlen(buffer) + 1);
         row++;
         switch (state) {
             case PARSE_BC_LSIG:
@@ -1782,6 +1868,27 @@ DEAD CODE
     return CL_SUCCESS;
 }
 
+cl_error_t cli_bytecode_load(struct cli_bc *bc, FILE *f, struct cli_dbio *dbio, int trust, int sigperf)
+{
+    cl_error_t rc;
+    void *hashctx;
+
+    /* the digest of the parsed lines identifies the bytecode in a
+     * precompiled native module, see cli_bytecode_prepare_jit() */
+    hashctx = cl_hash_init("sha256");
+    if (!hashctx) {
+        cli_errmsg("Unable to load bytecode (can't initialize hash)\n");
+        return CL_EMEM;
+    }
+    rc = bytecode_load(bc, f, dbio, trust, sigperf, hashctx);
+    if (rc != CL_SUCCESS) {
+        cl_hash_destroy(hashctx);
+        return rc;
+    }
+    cl_finish_hash(hashctx, bc->hash);
+    return CL_SUCCESS;
+}
+
 static struct {
     enum bc_events id;
     const char *name;
@@ -1815,6 +1922,61 @@ static int register_events(cli_events_t *ev)
     return 0;
 }
 
+static cl_error_t cli_bytecode_prepare_interpreter(struct cli_bc *bc, unsigned dconfmask);
+
+#ifdef CL_THREAD_SAFE
+static pthread_mutex_t lazy_prepare_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/* A lazily prepared bytecode leaves bc_loaded once, for good, and only after
+ * everything the interpreter needs has been written. Where the compiler has
+ * atomics the state is published with a release store, and prepare_lazy()
+ * only takes lazy_prepare_mutex while it still reads bc_loaded. */
+#if defined(__GNUC__) || defined(__clang__)
+#define BC_ATOMIC_STATE 1
+#define BC_STATE_LOAD(bc) __atomic_load_n(&(bc)->state, __ATOMIC_ACQUIRE)
+#define BC_STATE_STORE(bc, s) __atomic_store_n(&(bc)->state, (s), __ATOMIC_RELEASE)
+#define BC_PREPARED_INC(bcs) __atomic_add_fetch(&(bcs)->prepared, 1, __ATOMIC_RELAXED)
+#else
+#define BC_STATE_LOAD(bc) ((bc)->state)
+#define BC_STATE_STORE(bc, s) ((bc)->state = (s))
+#define BC_PREPARED_INC(bcs) ((bcs)->prepared++)
+#endif
+
+/* Prepare a bytecode left for lazy preparation by cli_bytecode_prepare2() on
+ * its first run. */
+static cl_error_t prepare_lazy(const struct cli_all_bc *bcs, const struct cli_bc *bc)
+{
+    cl_error_t rc = CL_SUCCESS;
+
+#ifdef BC_ATOMIC_STATE
+    if (BC_STATE_LOAD(bc) != bc_loaded)
+        return CL_SUCCESS;
+#endif
+
+#ifdef CL_THREAD_SAFE
+    pthread_mutex_lock(&lazy_prepare_mutex);
+#endif
+    if (bc->state == bc_loaded) {
+        /* the bytecodes belong to the engine, these are const only to the
+         * scanners */
+        struct cli_bc *lbc = (struct cli_bc *)bc;
+
+        rc = cli_bytecode_prepare_interpreter(lbc, bcs->dconfmask);
+        if (rc != CL_SUCCESS) {
+            BC_STATE_STORE(lbc, bc_disabled);
+            cli_warnmsg("Bytecode: %d failed to prepare for interpreter mode\n", bc->id);
+        } else {
+            BC_PREPARED_INC((struct cli_all_bc *)bcs);
+            cli_dbgmsg("Bytecode: %u prepared on first run\n", bc->id);
+        }
+    }
+#ifdef CL_THREAD_SAFE
+    pthread_mutex_unlock(&lazy_prepare_mutex);
+#endif
+    return rc;
+}
+
 cl_error_t cli_bytecode_run(const struct cli_all_bc *bcs, const struct cli_bc *bc, struct cli_bc_ctx *ctx)
 {
     cl_error_t ret = CL_SUCCESS;
@@ -1833,6 +1995,11 @@ cl_error_t cli_bytecode_run(const struct cli_all_bc *bcs, const struct cli_bc *b
     if (cctx && cctx->engine->bytecode_mode == CL_BYTECODE_MODE_TEST)
         test_mode = true;
 
+    if (bcs->lazy) {
+        ret = prepare_lazy(bcs, bc);
+        if (ret != CL_SUCCESS)
+            return ret;
+    }
     if (bc->state == bc_loaded) {
         cli_errmsg("bytecode has to be prepared either for interpreter or JIT!\n");
         return CL_EARG;
@@ -2121,7 +2288,55 @@ static int calc_gepz(struct cli_bc *bc, struct cli_bc_func *func, uint16_t tid,
     return 1;
 }
 
-static cl_error_t cli_bytecode_prepare_interpreter(struct cli_bc *bc)
+static bool is_icmp_br(const struct cli_bc_inst *inst)
+{
+    return inst[0].opcode >= OP_BC_ICMP_EQ && inst[0].opcode <= OP_BC_ICMP_SLT &&
+           inst[1].opcode == OP_BC_BRANCH && inst[1].u.branch.condition == inst[0].dest;
+}
+
+/**
+ * @brief Fuse common instruction sequences of a function into superinstructions of the interpreter.
+ *
+ * Only the interp_op of the first instruction of a sequence is changed, the
+ * instructions are left in place: the handler of the superinstruction reads
+ * their operands and steps over them. A sequence never crosses the end of a
+ * basic block, so jumps still only land on the start of one.
+ *
+ * Must run after the operands were mapped to offsets.
+ *
+ * @param bcfunc The function.
+ */
+static void fuse_superinstructions(struct cli_bc_func *bcfunc)
+{
+    unsigned i, j;
+
+    for (i = 0; i < bcfunc->numBB; i++) {
+        const struct cli_bc_bb *bb = &bcfunc->BB[i];
+
+        for (j = 0; j < bb->numInsts; j++) {
+            struct cli_bc_inst *inst = &bb->insts[j];
+            unsigned left            = bb->numInsts - j;
+
+            if (left >= 3 && inst->opcode == OP_BC_LOAD && is_icmp_br(&inst[1]) &&
+                (inst[1].u.binop[0] == inst->dest || inst[1].u.binop[1] == inst->dest) &&
+                inst->interp_op % 5 == inst[1].interp_op % 5) {
+                /* load, compare and branch on the loaded value */
+                inst->interp_op = (OP_BC_LOAD_ICMP_EQ_BR + inst[1].opcode - OP_BC_ICMP_EQ) * 5 + inst->interp_op % 5;
+                j += 2;
+            } else if (left >= 2 && is_icmp_br(inst)) {
+                inst->interp_op = (OP_BC_ICMP_EQ_BR + inst->opcode - OP_BC_ICMP_EQ) * 5 + inst->interp_op % 5;
+                j += 1;
+            } else if (left >= 2 && (inst->opcode == OP_BC_GEPZ || inst->opcode == OP_BC_GEP1) &&
+                       inst->interp_op % 5 != 0 /* not an alloca */ &&
+                       inst[1].opcode == OP_BC_LOAD && inst[1].u.unaryop == inst->dest) {
+                inst->interp_op = (inst->opcode == OP_BC_GEPZ ? OP_BC_GEPZ_LOAD : OP_BC_GEP1_LOAD) * 5 + inst[1].interp_op % 5;
+                j += 1;
+            }
+        }
+    }
+}
+
+static cl_error_t cli_bytecode_prepare_interpreter(struct cli_bc *bc, unsigned dconfmask)
 {
     unsigned i, j, k;
     uint64_t *gmap;
@@ -2390,7 +2605,15 @@ static cl_error_t cli_bytecode_prepare_interpreter(struct cli_bc *bc)
             free(map);
     }
     free(gmap);
-    bc->state = bc_interp;
+    if (ret == CL_SUCCESS && (dconfmask & BYTECODE_INTERP_SUPERINST)) {
+        for (i = 0; i < bc->num_func; i++)
+            fuse_superinstructions(&bc->funcs[i]);
+    }
+    bc->interp_flags = dconfmask & BYTECODE_INTERP_MASK;
+    if (ret == CL_SUCCESS) {
+        /* last: prepare_lazy() runs it as soon as it reads this */
+        BC_STATE_STORE(bc, bc_interp);
+    }
     return ret;
 }
 
@@ -2502,7 +2725,7 @@ static cl_error_t run_selfcheck(struct cli_all_bc *bcs)
         cli_errmsg("Failed to prepare selfcheck bytecode\n");
         return CL_EBYTECODE;
     }
-    ctx = cli_bytecode_context_alloc();
+    ctx = cli_bytecode_context_alloc(NULL);
     if (!ctx) {
         cli_errmsg("Failed to allocate bytecode context\n");
         return CL_EMEM;
@@ -2538,10 +2761,10 @@ static cl_error_t selfcheck(bool jit, struct cli_bcengine *engine)
                 cli_dbgmsg("bytecode: JIT disabled\n");
                 rc = CL_BREAK; /* no JIT - not fatal */
             } else {
-                rc = cli_bytecode_prepare_jit(&bcs);
+                rc = cli_bytecode_prepare_jit(&bcs, NULL);
             }
         } else {
-            rc = cli_bytecode_prepare_interpreter(bcs.all_bcs);
+            rc = cli_bytecode_prepare_interpreter(bcs.all_bcs, BYTECODE_INTERP_MASK);
         }
         if (rc == CL_SUCCESS)
             rc = run_selfcheck(&bcs);
@@ -2586,7 +2809,7 @@ static int set_mode(struct cl_engine *engine, enum bytecode_mode mode)
 
 /* runs the first bytecode of the specified kind, or the builtin one if no
  * bytecode of that kind is loaded */
-static cl_error_t run_builtin_or_loaded(struct cli_all_bc *bcs, uint8_t kind, const char *builtin_cbc, struct cli_bc_ctx *ctx, const char *desc)
+static cl_error_t run_builtin_or_loaded(struct cli_all_bc *bcs, uint8_t kind, const char *builtin_cbc, struct cli_bc_ctx *ctx, const char *desc, unsigned dconfmask)
 {
     unsigned i, builtin = 0, rc = 0;
     struct cli_bc *bc = NULL;
@@ -2625,12 +2848,12 @@ static cl_error_t run_builtin_or_loaded(struct cli_all_bc *bcs, uint8_t kind, co
             return rc;
         }
     }
-    rc = cli_bytecode_prepare_interpreter(bc);
+    rc = cli_bytecode_prepare_interpreter(bc, dconfmask);
     if (rc) {
         cli_errmsg("Failed to prepare %s %s bytecode for interpreter: %s\n",
                    builtin ? "builtin" : "loaded", desc, cl_strerror(rc));
     }
-    if (bc->state != bc_interp) {
+    if (!rc && bc->state != bc_interp) {
         cli_errmsg("Failed to prepare %s %s bytecode for interpreter\n",
                    builtin ? "builtin" : "loaded", desc);
         rc = CL_EMALFDB;
@@ -2658,11 +2881,20 @@ cl_error_t cli_bytecode_prepare2(struct cl_engine *engine, struct cli_all_bc *bc
     cl_error_t rc;
     struct cli_bc_ctx *ctx;
 
+    bcs->prepared  = 0;
+    bcs->lazy      = 0;
+    bcs->dconfmask = dconfmask;
+    bcs->native    = 0;
     if (!bcs->count) {
         cli_dbgmsg("No bytecodes loaded, not running builtin test\n");
         return CL_SUCCESS;
     }
 
+    if (!engine->bc_ctx_pool && !(engine->bc_ctx_pool = cli_bytecode_context_pool_new())) {
+        cli_errmsg("Bytecode: failed to allocate bytecode context pool\n");
+        return CL_EMEM;
+    }
+
     engine->bytecode_mode = CL_BYTECODE_MODE_AUTO;
     cli_detect_environment(&bcs->env);
     switch (bcs->env.arch) {
@@ -2697,12 +2929,12 @@ cl_error_t cli_bytecode_prepare2(struct cl_engine *engine, struct cli_all_bc *bc
     }
     cli_dbgmsg("Bytecode: mode is %d\n", engine->bytecode_mode);
 
-    ctx = cli_bytecode_context_alloc();
+    ctx = cli_bytecode_context_alloc(engine);
     if (!ctx) {
         cli_errmsg("Bytecode: failed to allocate bytecode context\n");
         return CL_EMEM;
     }
-    rc = run_builtin_or_loaded(bcs, BC_STARTUP, builtin_bc_startup, ctx, "BC_STARTUP");
+    rc = run_builtin_or_loaded(bcs, BC_STARTUP, builtin_bc_startup, ctx, "BC_STARTUP", dconfmask);
     if (rc != CL_SUCCESS) {
         cli_warnmsg("Bytecode: BC_STARTUP failed to run, disabling ALL bytecodes! Please report to https://github.com/Cisco-Talos/clamav/issues\n");
         ctx->bytecode_disable_status = 2;
@@ -2736,13 +2968,24 @@ cl_error_t cli_bytecode_prepare2(struct cl_engine *engine, struct cli_all_bc *bc
 
     if (engine->bytecode_mode != CL_BYTECODE_MODE_INTERPRETER &&
         engine->bytecode_mode != CL_BYTECODE_MODE_OFF) {
+        struct cli_bc_jit_opts jitopts;
+
+        jitopts.cachedir      = engine->bytecode_cache_dir;
+        jitopts.native_module = engine->bytecode_native_module;
+        jitopts.native_output = engine->bytecode_native_output;
         selfcheck(true, bcs->engine);
-        rc = cli_bytecode_prepare_jit(bcs);
+        rc = cli_bytecode_prepare_jit(bcs, &jitopts);
         if (rc == CL_SUCCESS) {
-            cli_dbgmsg("Bytecode: %u bytecode prepared with JIT\n", bcs->count);
+            cli_dbgmsg("Bytecode: %u bytecode prepared with JIT, %u of them from the native module\n",
+                       bcs->count, bcs->native);
             if (engine->bytecode_mode != CL_BYTECODE_MODE_TEST)
                 return CL_SUCCESS;
         }
+        if (rc && engine->bytecode_native_output) {
+            cli_errmsg("Bytecode: can't compile the bytecodes into native module %s\n",
+                       engine->bytecode_native_output);
+            return CL_EBYTECODE;
+        }
         if (engine->bytecode_mode == CL_BYTECODE_MODE_JIT) {
             cli_errmsg("Bytecode: JIT required, but not all bytecodes could be prepared with JIT\n");
             return CL_EMALFDB;
@@ -2753,6 +2996,10 @@ cl_error_t cli_bytecode_prepare2(struct cl_engine *engine, struct cli_all_bc *bc
         }
     } else {
         cli_bytecode_done_jit(bcs, 0);
+        if (engine->bytecode_native_output) {
+            cli_errmsg("Bytecode: JIT is disabled, can't compile the bytecodes into a native module\n");
+            return CL_EBYTECODE;
+        }
     }
 
     if (!(dconfmask & BYTECODE_INTERPRETER)) {
@@ -2768,6 +3015,11 @@ cl_error_t cli_bytecode_prepare2(struct cl_engine *engine, struct cli_all_bc *bc
         return CL_SUCCESS;
     }
 
+    /* the interpreter form is made on the first run of each bytecode, test
+     * mode compares both forms of every bytecode so it has to prepare all */
+    if (engine->bytecode_lazy && engine->bytecode_mode != CL_BYTECODE_MODE_TEST)
+        bcs->lazy = 1;
+
     for (i = 0; i < bcs->count; i++) {
         struct cli_bc *bc = &bcs->all_bcs[i];
         if (bc->state == bc_jit) {
@@ -2779,7 +3031,9 @@ cl_error_t cli_bytecode_prepare2(struct cl_engine *engine, struct cli_all_bc *bc
             interp++;
             continue;
         }
-        rc = cli_bytecode_prepare_interpreter(bc);
+        if (bcs->lazy)
+            continue;
+        rc = cli_bytecode_prepare_interpreter(bc, dconfmask);
         if (rc != CL_SUCCESS) {
             bc->state = bc_disabled;
             cli_warnmsg("Bytecode: %d failed to prepare for interpreter mode\n", bc->id);
@@ -2787,9 +3041,11 @@ cl_error_t cli_bytecode_prepare2(struct cl_engine *engine, struct cli_all_bc *bc
         }
         interp++;
     }
+    bcs->prepared = jitcount + interp;
     cli_dbgmsg("Bytecode: %u bytecode prepared with JIT, "
-               "%u prepared with interpreter, %u total\n",
-               jitcount, interp, bcs->count);
+               "%u prepared with interpreter, %u total%s\n",
+               jitcount, interp, bcs->count,
+               bcs->lazy ? ", the rest is prepared on first run" : "");
     return CL_SUCCESS;
 }
 
@@ -2823,7 +3079,7 @@ cl_error_t cli_bytecode_runlsig(cli_ctx *cctx, struct cli_target_info *tinfo,
                                 const uint32_t *lsigsuboff, fmap_t *map)
 {
     cl_error_t ret;
-    struct cli_bc_ctx ctx;
+    struct cli_bc_ctx *ctx;
     const struct cli_bc *bc = &bcs->all_bcs[bc_idx - 1];
     struct cli_pe_hook_data pehookdata;
     const char *bc_name = NULL;
@@ -2837,21 +3093,23 @@ cl_error_t cli_bytecode_runlsig(cli_ctx *cctx, struct cli_target_info *tinfo,
         bc_name = bc->hook_name;
     }
 
-    bytecode_context_initialize(&ctx);
-    cli_bytecode_context_setfuncid(&ctx, bc, 0);
-    ctx.hooks.match_counts  = lsigcnt;
-    ctx.hooks.match_offsets = lsigsuboff;
-    cli_bytecode_context_setctx(&ctx, cctx);
-    cli_bytecode_context_setfile(&ctx, map);
+    ctx = cli_bytecode_context_alloc(cctx->engine);
+    if (!ctx)
+        return CL_EMEM;
+    cli_bytecode_context_setfuncid(ctx, bc, 0);
+    ctx->hooks.match_counts  = lsigcnt;
+    ctx->hooks.match_offsets = lsigsuboff;
+    cli_bytecode_context_setctx(ctx, cctx);
+    cli_bytecode_context_setfile(ctx, map);
     if (tinfo && tinfo->status == 1) {
-        ctx.sections = tinfo->exeinfo.sections;
+        ctx->sections = tinfo->exeinfo.sections;
         memset(&pehookdata, 0, sizeof(pehookdata));
         pehookdata.offset    = tinfo->exeinfo.offset;
         pehookdata.ep        = tinfo->exeinfo.ep;
         pehookdata.nsections = tinfo->exeinfo.nsections;
         pehookdata.hdr_size  = tinfo->exeinfo.hdr_size;
-        ctx.hooks.pedata     = &pehookdata;
-        ctx.resaddr          = tinfo->exeinfo.res_addr;
+        ctx->hooks.pedata    = &pehookdata;
+        ctx->resaddr         = tinfo->exeinfo.res_addr;
     }
     if (bc->hook_lsig_id) {
         cli_dbgmsg("hook lsig id %d matched (bc %d)\n", bc->hook_lsig_id, bc->id);
@@ -2860,17 +3118,17 @@ cl_error_t cli_bytecode_runlsig(cli_ctx *cctx, struct cli_target_info *tinfo,
         if (cctx->hook_lsig_matches)
             cli_bitset_set(cctx->hook_lsig_matches, bc->hook_lsig_id - 1);
         /* save match counts */
-        memcpy(&ctx.lsigcnt, lsigcnt, 64 * 4);
-        memcpy(&ctx.lsigoff, lsigsuboff, 64 * 4);
-        bytecode_context_reset(&ctx);
+        memcpy(&ctx->lsigcnt, lsigcnt, 64 * 4);
+        memcpy(&ctx->lsigoff, lsigsuboff, 64 * 4);
+        cli_bytecode_context_destroy(ctx);
         return CL_SUCCESS;
     }
 
     cli_dbgmsg("Running bytecode '%s' (id: %u) for logical signature match.\n", bc_name, bc->id);
-    ret = cli_bytecode_run(bcs, bc, &ctx);
+    ret = cli_bytecode_run(bcs, bc, ctx);
     if (ret != CL_SUCCESS) {
         cli_warnmsg("Bytecode '%s' (id: %u) failed to run: %s\n", bc_name, bc->id, cl_strerror(ret));
-        bytecode_context_reset(&ctx);
+        cli_bytecode_context_destroy(ctx);
 
         if (cli_checktimelimit(cctx) != CL_SUCCESS) {
             cli_dbgmsg("Exceeded scan timeout during bytecode run (max: %u)\n", cctx->engine->maxscantime);
@@ -2879,18 +3137,18 @@ cl_error_t cli_bytecode_runlsig(cli_ctx *cctx, struct cli_target_info *tinfo,
 
         return CL_SUCCESS;
     }
-    if (ctx.virname) {
+    if (ctx->virname) {
         cl_error_t rc;
-        cli_dbgmsg("Bytecode found virus: %s\n", ctx.virname);
+        cli_dbgmsg("Bytecode found virus: %s\n", ctx->virname);
 
-        rc = cli_append_virus(cctx, ctx.virname);
+        rc = cli_append_virus(cctx, ctx->virname);
 
-        bytecode_context_reset(&ctx);
+        cli_bytecode_context_destroy(ctx);
         return rc;
     }
-    ret = cli_bytecode_context_getresult_int(&ctx);
+    ret = cli_bytecode_context_getresult_int(ctx);
     cli_dbgmsg("Bytecode '%s' (id: %u) returned code: %u\n", bc_name, bc->id, ret);
-    bytecode_context_reset(&ctx);
+    cli_bytecode_context_destroy(ctx);
     return CL_SUCCESS;
 }
 
@@ -28,6 +28,7 @@
 #include "fmap.h"
 #include "bytecode_detect.h"
 #include "platform.h"
+#include "threadlocal.h"
 
 struct cli_dbio;
 struct cli_bc_ctx;
@@ -74,6 +75,8 @@ struct cli_bc {
     uint8_t *globalBytes;
     uint32_t sigtime_id, sigmatch_id;
     char *hook_name;
+    uint32_t interp_flags; /* BYTECODE_INTERP_* options it was prepared with */
+    uint8_t hash[32];      /* SHA-256 of the bytecode as loaded (without source) */
 };
 
 struct cli_all_bc {
@@ -82,12 +85,20 @@ struct cli_all_bc {
     struct cli_bcengine *engine;
     struct cli_environment env;
     int inited;
+    unsigned prepared;  /* bytecodes prepared for running so far */
+    unsigned lazy;      /* prepare interpreted bytecodes on their first run */
+    unsigned dconfmask; /* dconf mask to prepare bytecodes lazily with */
+    unsigned native;    /* bytecodes taken from a native module instead of compiled */
 };
 
 struct cli_pe_hook_data;
 struct cli_exe_section;
 struct pdf_obj;
-struct cli_bc_ctx *cli_bytecode_context_alloc(void);
+/* contexts come from the per-thread pool of the engine (none if NULL),
+ * cli_bytecode_context_destroy() returns them there */
+struct cli_bc_ctx *cli_bytecode_context_alloc(const struct cl_engine *engine);
+/* the pool of an engine, created by cli_bytecode_prepare2() and freed with the engine */
+cli_threadlocal_t *cli_bytecode_context_pool_new(void);
 /* FIXME: we can't include others.h because others.h includes us...*/
 void cli_bytecode_context_setctx(struct cli_bc_ctx *ctx, void *cctx);
 cl_error_t cli_bytecode_context_setfuncid(struct cli_bc_ctx *ctx, const struct cli_bc *bc, unsigned funcid);
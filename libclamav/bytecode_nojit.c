@@ -29,9 +29,11 @@
 #include "clamav.h"
 #include "others.h"
 
-cl_error_t cli_bytecode_prepare_jit(struct cli_all_bc *bcs)
+cl_error_t cli_bytecode_prepare_jit(struct cli_all_bc *bcs, const struct cli_bc_jit_opts *opts)
 {
     unsigned i;
+
+    UNUSEDPARAM(opts);
     for (i = 0; i < bcs->count; i++) {
         if (bcs->all_bcs[i].state == bc_skip)
             continue;
@@ -57,7 +57,39 @@ struct cli_bc_cast {
     uint8_t size; /* 0: 1-bit, 1: 8b, 2: 16b, 3: 32b, 4: 64b */
 };
 
-typedef uint8_t interp_op_t;
+/* Superinstructions of the interpreter, see fuse_superinstructions().
+ * They only appear in interp_op, which is 5 * opcode + operand width
+ * like for the regular opcodes. */
+enum bc_interp_superop {
+    /* icmp, then a branch on its result */
+    OP_BC_ICMP_EQ_BR = OP_BC_INVALID + 1,
+    OP_BC_ICMP_NE_BR,
+    OP_BC_ICMP_UGT_BR,
+    OP_BC_ICMP_UGE_BR,
+    OP_BC_ICMP_ULT_BR,
+    OP_BC_ICMP_ULE_BR,
+    OP_BC_ICMP_SGT_BR,
+    OP_BC_ICMP_SGE_BR,
+    OP_BC_ICMP_SLE_BR,
+    OP_BC_ICMP_SLT_BR,
+    /* load, then an icmp of the loaded value and a branch on its result */
+    OP_BC_LOAD_ICMP_EQ_BR,
+    OP_BC_LOAD_ICMP_NE_BR,
+    OP_BC_LOAD_ICMP_UGT_BR,
+    OP_BC_LOAD_ICMP_UGE_BR,
+    OP_BC_LOAD_ICMP_ULT_BR,
+    OP_BC_LOAD_ICMP_ULE_BR,
+    OP_BC_LOAD_ICMP_SGT_BR,
+    OP_BC_LOAD_ICMP_SGE_BR,
+    OP_BC_LOAD_ICMP_SLE_BR,
+    OP_BC_LOAD_ICMP_SLT_BR,
+    /* gep of a pointer value, then a load from the result */
+    OP_BC_GEPZ_LOAD,
+    OP_BC_GEP1_LOAD,
+    OP_BC_SUPER_INVALID /* last */
+};
+
+typedef uint16_t interp_op_t;
 struct cli_bc_inst {
     enum bc_opcode opcode;
     uint16_t type;
@@ -173,6 +205,11 @@ struct cli_bc_ctx {
     uint16_t *opsizes;
     char *values;
     operand_t *operands;
+    /* kept across runs when the context is reused, see cli_bytecode_context_alloc() */
+    unsigned values_size;
+    unsigned params_size;
+    void *stack_spare;
+    cli_threadlocal_t *pool; /* where cli_bytecode_context_destroy() puts the context */
     uint32_t file_size;
     int outfd;
     off_t off;
@@ -243,7 +280,12 @@ extern "C" {
 #endif
 
 cl_error_t cli_vm_execute_jit(const struct cli_all_bc *bcs, struct cli_bc_ctx *ctx, const struct cli_bc_func *func);
-cl_error_t cli_bytecode_prepare_jit(struct cli_all_bc *bc);
+struct cli_bc_jit_opts {
+    const char *cachedir;      /* on-disk object cache, NULL to always compile */
+    const char *native_module; /* precompiled native module to load, or NULL */
+    const char *native_output; /* compile all bytecodes into this native module */
+};
+cl_error_t cli_bytecode_prepare_jit(struct cli_all_bc *bc, const struct cli_bc_jit_opts *opts);
 cl_error_t cli_bytecode_init_jit(struct cli_all_bc *bc, unsigned dconfmask);
 cl_error_t cli_bytecode_done_jit(struct cli_all_bc *bc, int partial);
 
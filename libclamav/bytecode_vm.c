@@ -30,6 +30,7 @@
 #include "bytecode_priv.h"
 #include "type_desc.h"
 #include "readdb.h"
+#include "dconf.h"
 #include <string.h>
 #ifndef _WIN32
 #include <sys/time.h>
@@ -137,6 +138,7 @@ struct stack_chunk {
 
 struct stack {
     struct stack_chunk *chunk;
+    struct stack_chunk *spare; /* emptied chunk kept for reuse */
     uint16_t last_size;
 };
 
@@ -171,10 +173,15 @@ static always_inline void *cli_stack_alloc(struct stack *stack, unsigned bytes)
         return NULL;
     }
     /* not enough room here, allocate new chunk */
-    chunk = malloc(sizeof(*stack->chunk));
-    if (!chunk) {
-        cli_warnmsg("cli_stack_alloc: Unable to allocate memory for stack-chunk: bytes: %zu!\n", sizeof(*stack->chunk));
-        return NULL;
+    if (stack->spare) {
+        chunk        = stack->spare;
+        stack->spare = NULL;
+    } else {
+        chunk = malloc(sizeof(*stack->chunk));
+        if (!chunk) {
+            cli_warnmsg("cli_stack_alloc: Unable to allocate memory for stack-chunk: bytes: %zu!\n", sizeof(*stack->chunk));
+            return NULL;
+        }
     }
 
     *(uint16_t *)&chunk->u.data[last_size_off] = stack->last_size;
@@ -208,7 +215,10 @@ static always_inline void cli_stack_free(struct stack *stack, void *data)
     stack->last_size = last_size;
     if (!chunk->used) {
         stack->chunk = chunk->prev;
-        free(chunk);
+        if (!stack->spare)
+            stack->spare = chunk;
+        else
+            free(chunk);
     }
 }
 
@@ -220,6 +230,8 @@ static void cli_stack_destroy(struct stack *stack)
         free(chunk);
         chunk = stack->chunk;
     }
+    free(stack->spare);
+    stack->spare = NULL;
 }
 
 struct stack_entry {
@@ -378,10 +390,62 @@ static always_inline struct stack_entry *pop_stack(struct stack *stack,
     x = *(uint64_t *)&old_values[p]; \
     TRACE_R(x)
 
+/*
+ * Every handler ends with NEXT, to go on with the next instruction of the
+ * basic block, or with CONTINUE once inst was set by a jump, call or return.
+ * Errors leave the handler with a plain break.
+ *
+ * For the switch interpreter, NEXT and CONTINUE go back to the loop in
+ * cli_vm_execute(), which checks for the timeout and dispatches the next
+ * instruction. With compilers that support labels as values, the handlers
+ * of a direct-threaded interpreter instead jump straight to the handler of
+ * the next instruction through dispatch_table, so that each handler gets an
+ * indirect branch of its own for the branch predictor.
+ */
+#ifdef __GNUC__
+#define BC_THREADED_DISPATCH
+#endif
+
+#ifdef BC_THREADED_DISPATCH
+#define CASE(opc, n)  \
+    case opc * 5 + n: \
+    op_##opc##_##n
+
+#define DISPATCH                                                      \
+    do {                                                              \
+        if (UNLIKELY(!(++pc % 5000)) && vm_timed_out(&timeout, pc)) { \
+            stop = CL_ETIMEOUT;                                       \
+            goto done;                                                \
+        }                                                             \
+        TRACE_INST(inst);                                             \
+        goto *dispatch_table[inst->interp_op];                        \
+    } while (0)
+
+#define NEXT                                 \
+    if (threaded) {                          \
+        bb_inst++;                           \
+        inst++;                              \
+        if (bb) {                            \
+            CHECK_GT(bb->numInsts, bb_inst); \
+        }                                    \
+        DISPATCH;                            \
+    }                                        \
+    break
+
+#define CONTINUE                        \
+    if (threaded && stop == CL_SUCCESS) \
+        DISPATCH;                       \
+    continue
+#else
+#define CASE(opc, n) case opc * 5 + n
+#define NEXT break
+#define CONTINUE continue
+#endif
+
 #define BINOP(i) inst->u.binop[i]
 
 #define DEFINE_BINOP_BC_HELPER(opc, OP, W0, W1, W2, W3, W4) \
-    case opc * 5: {                                         \
+    CASE(opc, 0): {                                         \
         uint8_t op0, op1, res;                              \
         int8_t sop0, sop1;                                  \
         READ1(op0, BINOP(0));                               \
@@ -394,7 +458,7 @@ static always_inline struct stack_entry *pop_stack(struct stack *stack,
         W0(inst->dest, res);                                \
         break;                                              \
     }                                                       \
-    case opc * 5 + 1: {                                     \
+    CASE(opc, 1): {                                         \
         uint8_t op0, op1, res;                              \
         int8_t sop0, sop1;                                  \
         READ8(op0, BINOP(0));                               \
@@ -407,7 +471,7 @@ static always_inline struct stack_entry *pop_stack(struct stack *stack,
         W1(inst->dest, res);                                \
         break;                                              \
     }                                                       \
-    case opc * 5 + 2: {                                     \
+    CASE(opc, 2): {                                         \
         uint16_t op0, op1, res;                             \
         int16_t sop0, sop1;                                 \
         READ16(op0, BINOP(0));                              \
@@ -420,7 +484,7 @@ static always_inline struct stack_entry *pop_stack(struct stack *stack,
         W2(inst->dest, res);                                \
         break;                                              \
     }                                                       \
-    case opc * 5 + 3: {                                     \
+    CASE(opc, 3): {                                         \
         uint32_t op0, op1, res;                             \
         int32_t sop0, sop1;                                 \
         READ32(op0, BINOP(0));                              \
@@ -433,7 +497,7 @@ static always_inline struct stack_entry *pop_stack(struct stack *stack,
         W3(inst->dest, res);                                \
         break;                                              \
     }                                                       \
-    case opc * 5 + 4: {                                     \
+    CASE(opc, 4): {                                         \
         uint64_t op0, op1, res;                             \
         int64_t sop0, sop1;                                 \
         READ64(op0, BINOP(0));                              \
@@ -458,35 +522,35 @@ static always_inline struct stack_entry *pop_stack(struct stack *stack,
     }
 
 #define DEFINE_SCASTOP(opc, OP)   \
-    case opc * 5: {               \
+    CASE(opc, 0): {               \
         uint8_t res;              \
         int8_t sres;              \
         OP;                       \
         WRITE8(inst->dest, res);  \
         break;                    \
     }                             \
-    case opc * 5 + 1: {           \
+    CASE(opc, 1): {               \
         uint8_t res;              \
         int8_t sres;              \
         OP;                       \
         WRITE8(inst->dest, res);  \
         break;                    \
     }                             \
-    case opc * 5 + 2: {           \
+    CASE(opc, 2): {               \
         uint16_t res;             \
         int16_t sres;             \
         OP;                       \
         WRITE16(inst->dest, res); \
         break;                    \
     }                             \
-    case opc * 5 + 3: {           \
+    CASE(opc, 3): {               \
         uint32_t res;             \
         int32_t sres;             \
         OP;                       \
         WRITE32(inst->dest, res); \
         break;                    \
     }                             \
-    case opc * 5 + 4: {           \
+    CASE(opc, 4): {               \
         uint64_t res;             \
         int64_t sres;             \
         OP;                       \
@@ -495,12 +559,12 @@ static always_inline struct stack_entry *pop_stack(struct stack *stack,
     }
 #define DEFINE_CASTOP(opc, OP) DEFINE_SCASTOP(opc, OP; (void)sres)
 
-#define DEFINE_OP(opc)                   \
-    case opc * 5:     /* fall-through */ \
-    case opc * 5 + 1: /* fall-through */ \
-    case opc * 5 + 2: /* fall-through */ \
-    case opc * 5 + 3: /* fall-through */ \
-    case opc * 5 + 4:
+#define DEFINE_OP(opc)               \
+    CASE(opc, 0): /* fall-through */ \
+    CASE(opc, 1): /* fall-through */ \
+    CASE(opc, 2): /* fall-through */ \
+    CASE(opc, 3): /* fall-through */ \
+    CASE(opc, 4):
 
 #define CHOOSE(OP0, OP1, OP2, OP3, OP4) \
     switch (inst->u.cast.size) {        \
@@ -523,8 +587,8 @@ static always_inline struct stack_entry *pop_stack(struct stack *stack,
             CHECK_UNREACHABLE;          \
     }
 
-#define DEFINE_OP_BC_RET_N(OP, T, R0, W0)                                         \
-    case OP: {                                                                    \
+#define DEFINE_OP_BC_RET_N(n, T, R0, W0)                                          \
+    CASE(OP_BC_RET, n): {                                                         \
         operand_t ret;                                                            \
         T tmp;                                                                    \
         R0(tmp, inst->u.unaryop);                                                 \
@@ -544,8 +608,8 @@ static always_inline struct stack_entry *pop_stack(struct stack *stack,
         break;                                                                    \
     }
 
-#define DEFINE_OP_BC_RET_VOID(OP, T)                                              \
-    case OP: {                                                                    \
+#define DEFINE_OP_BC_RET_VOID(n, T)                                               \
+    CASE(OP_BC_RET_VOID, n): {                                                    \
         operand_t ret;                                                            \
         CHECK_GT(stack_depth, 0);                                                 \
         stack_depth--;                                                            \
@@ -562,6 +626,101 @@ static always_inline struct stack_entry *pop_stack(struct stack *stack,
         break;                                                                    \
     }
 
+#define BRANCH_BODY                                                                                              \
+    stop = jump(func, (values[inst->u.branch.condition] & 1) ? inst->u.branch.br_true : inst->u.branch.br_false, \
+                &bb, &inst, &bb_inst)
+
+#define LOAD_BODY(T, size, V, W)             \
+    {                                        \
+        const T *ptr;                        \
+        READPOP(ptr, inst->u.unaryop, size); \
+        W(inst->dest, (V));                  \
+    }
+#define LOAD0_BODY LOAD_BODY(uint8_t, 1, *ptr, WRITE8)
+#define LOAD1_BODY LOAD_BODY(uint8_t, 1, *ptr, WRITE8)
+#define LOAD2_BODY LOAD_BODY(union unaligned_16, 2, ptr->una_u16, WRITE16)
+#define LOAD3_BODY LOAD_BODY(union unaligned_32, 4, ptr->una_u32, WRITE32)
+#define LOAD4_BODY LOAD_BODY(union unaligned_64, 8, ptr->una_u64, WRITE64)
+
+/*
+ * Superinstructions, see fuse_superinstructions() in bytecode.c.
+ * The handler runs the fused instructions one after the other without
+ * dispatching in between. All their results are still written, as they may
+ * be used further on.
+ */
+#define ICMP_BODY(T, ST, R, OP)  \
+    {                            \
+        T op0, op1;              \
+        ST sop0, sop1;           \
+        uint8_t res;             \
+        R(op0, BINOP(0));        \
+        R(op1, BINOP(1));        \
+        sop0 = op0;              \
+        sop1 = op1;              \
+        (void)sop0;              \
+        (void)sop1;              \
+        OP;                      \
+        WRITE8(inst->dest, res); \
+    }
+
+/* gep of a pointer value, the gep of an alloca isn't fused */
+#define GEP_BODY(scale)                                                                \
+    {                                                                                  \
+        int64_t ptr, iptr;                                                             \
+        int32_t off;                                                                   \
+        READ32(off, inst->u.three[2]);                                                 \
+        if (off < 0) {                                                                 \
+            cli_dbgmsg("bytecode warning: found GEP with negative offset %d!\n", off); \
+        }                                                                              \
+        READ64(ptr, inst->u.three[1]);                                                 \
+        off *= (scale);                                                                \
+        off += (ptr & 0x00000000ffffffffULL);                                          \
+        iptr = (ptr & 0xffffffff00000000ULL) + (uint64_t)(off);                        \
+        WRITE64(inst->dest, iptr);                                                     \
+    }
+
+#define DEFINE_ICMP_BR_N(sop, lsop, n, T, ST, R, OP) \
+    CASE(sop, n): {                                  \
+        ICMP_BODY(T, ST, R, OP);                     \
+        bb_inst++;                                   \
+        inst++;                                      \
+        BRANCH_BODY;                                 \
+        CONTINUE;                                    \
+    }                                                \
+    CASE(lsop, n): {                                 \
+        LOAD##n##_BODY;                              \
+        bb_inst++;                                   \
+        inst++;                                      \
+        ICMP_BODY(T, ST, R, OP);                     \
+        bb_inst++;                                   \
+        inst++;                                      \
+        BRANCH_BODY;                                 \
+        CONTINUE;                                    \
+    }
+
+#define DEFINE_ICMP_BR(sop, lsop, OP)                             \
+    DEFINE_ICMP_BR_N(sop, lsop, 0, uint8_t, int8_t, READ1, OP)    \
+    DEFINE_ICMP_BR_N(sop, lsop, 1, uint8_t, int8_t, READ8, OP)    \
+    DEFINE_ICMP_BR_N(sop, lsop, 2, uint16_t, int16_t, READ16, OP) \
+    DEFINE_ICMP_BR_N(sop, lsop, 3, uint32_t, int32_t, READ32, OP) \
+    DEFINE_ICMP_BR_N(sop, lsop, 4, uint64_t, int64_t, READ64, OP)
+
+#define DEFINE_GEP_LOAD_N(sop, n, scale) \
+    CASE(sop, n): {                      \
+        GEP_BODY(scale);                 \
+        bb_inst++;                       \
+        inst++;                          \
+        LOAD##n##_BODY;                  \
+        NEXT;                            \
+    }
+
+#define DEFINE_GEP_LOAD(sop, scale)  \
+    DEFINE_GEP_LOAD_N(sop, 0, scale) \
+    DEFINE_GEP_LOAD_N(sop, 1, scale) \
+    DEFINE_GEP_LOAD_N(sop, 2, scale) \
+    DEFINE_GEP_LOAD_N(sop, 3, scale) \
+    DEFINE_GEP_LOAD_N(sop, 4, scale)
+
 struct ptr_info {
     uint8_t *base;
     uint32_t size;
@@ -704,6 +863,20 @@ static unsigned globaltypesize(uint16_t id)
     }
 }
 
+static int vm_timed_out(const struct timeval *timeout, unsigned pc)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    if (tv.tv_sec > timeout->tv_sec ||
+        (tv.tv_sec == timeout->tv_sec &&
+         tv.tv_usec > timeout->tv_usec)) {
+        cli_warnmsg("Bytecode run timed out in interpreter after %u opcodes\n", pc);
+        return 1;
+    }
+    return 0;
+}
+
 /* TODO: fix the APIs too */
 static struct {
     cli_apicall_pointer api;
@@ -727,9 +900,42 @@ cl_error_t cli_vm_execute(const struct cli_bc *bc, struct cli_bc_ctx *ctx, const
     struct ptr_infos ptrinfos;
     struct timeval tv0, tv1, timeout;
     int stackid = 0;
+#ifdef BC_THREADED_DISPATCH
+#define OPS5(opc) &&op_##opc##_0, &&op_##opc##_1, &&op_##opc##_2, &&op_##opc##_3, &&op_##opc##_4
+#define NOOPS5 &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid
+    /* the handler of each interp_op, in the order of enum bc_opcode and enum bc_interp_superop */
+    static const void *const dispatch_table[OP_BC_SUPER_INVALID * 5] = {
+        NOOPS5,
+        OPS5(OP_BC_ADD), OPS5(OP_BC_SUB), OPS5(OP_BC_MUL), OPS5(OP_BC_UDIV), OPS5(OP_BC_SDIV),
+        OPS5(OP_BC_UREM), OPS5(OP_BC_SREM), OPS5(OP_BC_SHL), OPS5(OP_BC_LSHR), OPS5(OP_BC_ASHR),
+        OPS5(OP_BC_AND), OPS5(OP_BC_OR), OPS5(OP_BC_XOR),
+        OPS5(OP_BC_TRUNC), OPS5(OP_BC_SEXT), OPS5(OP_BC_ZEXT),
+        OPS5(OP_BC_BRANCH), OPS5(OP_BC_JMP), OPS5(OP_BC_RET), OPS5(OP_BC_RET_VOID),
+        OPS5(OP_BC_ICMP_EQ), OPS5(OP_BC_ICMP_NE), OPS5(OP_BC_ICMP_UGT), OPS5(OP_BC_ICMP_UGE), OPS5(OP_BC_ICMP_ULT),
+        OPS5(OP_BC_ICMP_ULE), OPS5(OP_BC_ICMP_SGT), OPS5(OP_BC_ICMP_SGE), OPS5(OP_BC_ICMP_SLE), OPS5(OP_BC_ICMP_SLT),
+        OPS5(OP_BC_SELECT), OPS5(OP_BC_CALL_DIRECT), OPS5(OP_BC_CALL_API), OPS5(OP_BC_COPY),
+        OPS5(OP_BC_GEP1), OPS5(OP_BC_GEPZ), NOOPS5 /* OP_BC_GEPN */, OPS5(OP_BC_STORE), OPS5(OP_BC_LOAD),
+        OPS5(OP_BC_MEMSET), OPS5(OP_BC_MEMCPY), OPS5(OP_BC_MEMMOVE), OPS5(OP_BC_MEMCMP),
+        OPS5(OP_BC_ISBIGENDIAN), NOOPS5 /* OP_BC_ABORT */,
+        OPS5(OP_BC_BSWAP16), OPS5(OP_BC_BSWAP32), OPS5(OP_BC_BSWAP64), OPS5(OP_BC_PTRDIFF32), OPS5(OP_BC_PTRTOINT64),
+        NOOPS5 /* OP_BC_INVALID */,
+        OPS5(OP_BC_ICMP_EQ_BR), OPS5(OP_BC_ICMP_NE_BR), OPS5(OP_BC_ICMP_UGT_BR), OPS5(OP_BC_ICMP_UGE_BR),
+        OPS5(OP_BC_ICMP_ULT_BR), OPS5(OP_BC_ICMP_ULE_BR), OPS5(OP_BC_ICMP_SGT_BR), OPS5(OP_BC_ICMP_SGE_BR),
+        OPS5(OP_BC_ICMP_SLE_BR), OPS5(OP_BC_ICMP_SLT_BR),
+        OPS5(OP_BC_LOAD_ICMP_EQ_BR), OPS5(OP_BC_LOAD_ICMP_NE_BR), OPS5(OP_BC_LOAD_ICMP_UGT_BR), OPS5(OP_BC_LOAD_ICMP_UGE_BR),
+        OPS5(OP_BC_LOAD_ICMP_ULT_BR), OPS5(OP_BC_LOAD_ICMP_ULE_BR), OPS5(OP_BC_LOAD_ICMP_SGT_BR), OPS5(OP_BC_LOAD_ICMP_SGE_BR),
+        OPS5(OP_BC_LOAD_ICMP_SLE_BR), OPS5(OP_BC_LOAD_ICMP_SLT_BR),
+        OPS5(OP_BC_GEPZ_LOAD), OPS5(OP_BC_GEP1_LOAD)};
+#undef OPS5
+#undef NOOPS5
+    const int threaded = bc->interp_flags & BYTECODE_INTERP_THREADED;
+#endif
 
     memset(&ptrinfos, 0, sizeof(ptrinfos));
     memset(&stack, 0, sizeof(stack));
+    /* reuse the stack chunk of the previous run with this context */
+    stack.spare      = ctx->stack_spare;
+    ctx->stack_spare = NULL;
     for (i = 0; i < (size_t)cli_apicall_maxglobal - _FIRST_GLOBAL; i++) {
         void *apiptr;
         uint32_t size;
@@ -751,19 +957,17 @@ cl_error_t cli_vm_execute(const struct cli_bc *bc, struct cli_bc_ctx *ctx, const
 
     do {
         pc++;
-        if (!(pc % 5000)) {
-            gettimeofday(&tv1, NULL);
-            if (tv1.tv_sec > timeout.tv_sec ||
-                (tv1.tv_sec == timeout.tv_sec &&
-                 tv1.tv_usec > timeout.tv_usec)) {
-                cli_warnmsg("Bytecode run timed out in interpreter after %u opcodes\n", pc);
-                stop = CL_ETIMEOUT;
-                break;
-            }
+        if (UNLIKELY(!(pc % 5000)) && vm_timed_out(&timeout, pc)) {
+            stop = CL_ETIMEOUT;
+            break;
         }
 
         TRACE_INST(inst);
 
+#ifdef BC_THREADED_DISPATCH
+        if (threaded)
+            goto *dispatch_table[inst->interp_op];
+#endif
         switch (inst->interp_op) {
             DEFINE_BINOP(OP_BC_ADD, res = op0 + op1);
             DEFINE_BINOP(OP_BC_SUB, res = op0 - op1);
@@ -811,25 +1015,24 @@ cl_error_t cli_vm_execute(const struct cli_bc *bc, struct cli_bc_ctx *ctx, const
                                  READ64(res, inst->u.cast.source)));
 
             DEFINE_OP(OP_BC_BRANCH)
-            stop = jump(func, (values[inst->u.branch.condition] & 1) ? inst->u.branch.br_true : inst->u.branch.br_false,
-                        &bb, &inst, &bb_inst);
-            continue;
+            BRANCH_BODY;
+            CONTINUE;
 
             DEFINE_OP(OP_BC_JMP)
             stop = jump(func, inst->u.jump, &bb, &inst, &bb_inst);
-            continue;
+            CONTINUE;
 
-            DEFINE_OP_BC_RET_N(OP_BC_RET * 5, uint8_t, READ1, WRITE8);
-            DEFINE_OP_BC_RET_N(OP_BC_RET * 5 + 1, uint8_t, READ8, WRITE8);
-            DEFINE_OP_BC_RET_N(OP_BC_RET * 5 + 2, uint16_t, READ16, WRITE16);
-            DEFINE_OP_BC_RET_N(OP_BC_RET * 5 + 3, uint32_t, READ32, WRITE32);
-            DEFINE_OP_BC_RET_N(OP_BC_RET * 5 + 4, uint64_t, READ64, WRITE64);
+            DEFINE_OP_BC_RET_N(0, uint8_t, READ1, WRITE8);
+            DEFINE_OP_BC_RET_N(1, uint8_t, READ8, WRITE8);
+            DEFINE_OP_BC_RET_N(2, uint16_t, READ16, WRITE16);
+            DEFINE_OP_BC_RET_N(3, uint32_t, READ32, WRITE32);
+            DEFINE_OP_BC_RET_N(4, uint64_t, READ64, WRITE64);
 
-            DEFINE_OP_BC_RET_VOID(OP_BC_RET_VOID * 5, uint8_t);
-            DEFINE_OP_BC_RET_VOID(OP_BC_RET_VOID * 5 + 1, uint8_t);
-            DEFINE_OP_BC_RET_VOID(OP_BC_RET_VOID * 5 + 2, uint8_t);
-            DEFINE_OP_BC_RET_VOID(OP_BC_RET_VOID * 5 + 3, uint8_t);
-            DEFINE_OP_BC_RET_VOID(OP_BC_RET_VOID * 5 + 4, uint8_t);
+            DEFINE_OP_BC_RET_VOID(0, uint8_t);
+            DEFINE_OP_BC_RET_VOID(1, uint8_t);
+            DEFINE_OP_BC_RET_VOID(2, uint8_t);
+            DEFINE_OP_BC_RET_VOID(3, uint8_t);
+            DEFINE_OP_BC_RET_VOID(4, uint8_t);
 
             DEFINE_ICMPOP(OP_BC_ICMP_EQ, res = (op0 == op1));
             DEFINE_ICMPOP(OP_BC_ICMP_NE, res = (op0 != op1));
@@ -842,48 +1045,48 @@ cl_error_t cli_vm_execute(const struct cli_bc *bc, struct cli_bc_ctx *ctx, const
             DEFINE_ICMPOP(OP_BC_ICMP_SLE, res = (sop0 <= sop1));
             DEFINE_ICMPOP(OP_BC_ICMP_SLT, res = (sop0 < sop1));
 
-            case OP_BC_SELECT * 5: {
+            CASE(OP_BC_SELECT, 0): {
                 uint8_t t0, t1, t2;
                 READ1(t0, inst->u.three[0]);
                 READ1(t1, inst->u.three[1]);
                 READ1(t2, inst->u.three[2]);
                 WRITE8(inst->dest, t0 ? t1 : t2);
-                break;
+                NEXT;
             }
-            case OP_BC_SELECT * 5 + 1: {
+            CASE(OP_BC_SELECT, 1): {
                 uint8_t t0, t1, t2;
                 READ1(t0, inst->u.three[0]);
                 READ8(t1, inst->u.three[1]);
                 READ8(t2, inst->u.three[2]);
                 WRITE8(inst->dest, t0 ? t1 : t2);
-                break;
+                NEXT;
             }
-            case OP_BC_SELECT * 5 + 2: {
+            CASE(OP_BC_SELECT, 2): {
                 uint8_t t0;
                 uint16_t t1, t2;
                 READ1(t0, inst->u.three[0]);
                 READ16(t1, inst->u.three[1]);
                 READ16(t2, inst->u.three[2]);
                 WRITE16(inst->dest, t0 ? t1 : t2);
-                break;
+                NEXT;
             }
-            case OP_BC_SELECT * 5 + 3: {
+            CASE(OP_BC_SELECT, 3): {
                 uint8_t t0;
                 uint32_t t1, t2;
                 READ1(t0, inst->u.three[0]);
                 READ32(t1, inst->u.three[1]);
                 READ32(t2, inst->u.three[2]);
                 WRITE32(inst->dest, t0 ? t1 : t2);
-                break;
+                NEXT;
             }
-            case OP_BC_SELECT * 5 + 4: {
+            CASE(OP_BC_SELECT, 4): {
                 uint8_t t0;
                 uint64_t t1, t2;
                 READ1(t0, inst->u.three[0]);
                 READ64(t1, inst->u.three[1]);
                 READ64(t2, inst->u.three[2]);
                 WRITE64(inst->dest, t0 ? t1 : t2);
-                break;
+                NEXT;
             }
 
                 DEFINE_OP(OP_BC_CALL_API)
@@ -1067,109 +1270,97 @@ cl_error_t cli_vm_execute(const struct cli_bc *bc, struct cli_bc_ctx *ctx, const
                 CHECK_GT(func->numBB, 0);
                 stop = jump(func, 0, &bb, &inst, &bb_inst);
                 stack_depth++;
-                continue;
+                CONTINUE;
 
-            case OP_BC_COPY * 5: {
+            CASE(OP_BC_COPY, 0): {
                 uint8_t op;
                 READ1(op, BINOP(0));
                 WRITE8(BINOP(1), op);
-                break;
+                NEXT;
             }
-            case OP_BC_COPY * 5 + 1: {
+            CASE(OP_BC_COPY, 1): {
                 uint8_t op;
                 READ8(op, BINOP(0));
                 WRITE8(BINOP(1), op);
-                break;
+                NEXT;
             }
-            case OP_BC_COPY * 5 + 2: {
+            CASE(OP_BC_COPY, 2): {
                 uint16_t op;
                 READ16(op, BINOP(0));
                 WRITE16(BINOP(1), op);
-                break;
+                NEXT;
             }
-            case OP_BC_COPY * 5 + 3: {
+            CASE(OP_BC_COPY, 3): {
                 uint32_t op;
                 READ32(op, BINOP(0));
                 WRITE32(BINOP(1), op);
-                break;
+                NEXT;
             }
-            case OP_BC_COPY * 5 + 4: {
+            CASE(OP_BC_COPY, 4): {
                 uint64_t op;
                 READ64(op, BINOP(0));
                 WRITE64(BINOP(1), op);
-                break;
-            }
-
-            case OP_BC_LOAD * 5:
-            case OP_BC_LOAD * 5 + 1: {
-                uint8_t *ptr;
-                READPOP(ptr, inst->u.unaryop, 1);
-                WRITE8(inst->dest, (*ptr));
-                break;
-            }
-            case OP_BC_LOAD * 5 + 2: {
-                const union unaligned_16 *ptr;
-                READPOP(ptr, inst->u.unaryop, 2);
-                WRITE16(inst->dest, (ptr->una_u16));
-                break;
-            }
-            case OP_BC_LOAD * 5 + 3: {
-                const union unaligned_32 *ptr;
-                READPOP(ptr, inst->u.unaryop, 4);
-                WRITE32(inst->dest, (ptr->una_u32));
-                break;
-            }
-            case OP_BC_LOAD * 5 + 4: {
-                const union unaligned_64 *ptr;
-                READPOP(ptr, inst->u.unaryop, 8);
-                WRITE64(inst->dest, (ptr->una_u64));
-                break;
+                NEXT;
             }
 
-            case OP_BC_STORE * 5: {
+            CASE(OP_BC_LOAD, 0):
+            CASE(OP_BC_LOAD, 1):
+                LOAD1_BODY;
+                NEXT;
+            CASE(OP_BC_LOAD, 2):
+                LOAD2_BODY;
+                NEXT;
+            CASE(OP_BC_LOAD, 3):
+                LOAD3_BODY;
+                NEXT;
+            CASE(OP_BC_LOAD, 4):
+                LOAD4_BODY;
+                NEXT;
+
+            CASE(OP_BC_STORE, 0): {
                 uint8_t *ptr;
                 uint8_t v;
                 READP(ptr, BINOP(1), 1);
                 READ1(v, BINOP(0));
                 *ptr = v;
-                break;
+                NEXT;
             }
-            case OP_BC_STORE * 5 + 1: {
+            CASE(OP_BC_STORE, 1): {
                 uint8_t *ptr;
                 uint8_t v;
                 READP(ptr, BINOP(1), 1);
                 READ8(v, BINOP(0));
                 *ptr = v;
-                break;
+                NEXT;
             }
-            case OP_BC_STORE * 5 + 2: {
+            CASE(OP_BC_STORE, 2): {
                 union unaligned_16 *ptr;
                 uint16_t v;
                 READP(ptr, BINOP(1), 2);
                 READ16(v, BINOP(0));
                 ptr->una_s16 = v;
-                break;
+                NEXT;
             }
-            case OP_BC_STORE * 5 + 3: {
+            CASE(OP_BC_STORE, 3): {
                 union unaligned_32 *ptr;
                 uint32_t v;
                 READP(ptr, BINOP(1), 4);
                 READ32(v, BINOP(0));
                 ptr->una_u32 = v;
-                break;
+                NEXT;
             }
-            case OP_BC_STORE * 5 + 4: {
+            CASE(OP_BC_STORE, 4): {
                 union unaligned_64 *ptr;
                 uint64_t v;
                 READP(ptr, BINOP(1), 8);
                 READ64(v, BINOP(0));
                 ptr->una_u64 = v;
-                break;
+                NEXT;
             }
                 DEFINE_OP(OP_BC_ISBIGENDIAN)
                 {
                     WRITE8(inst->dest, WORDS_BIGENDIAN);
-                    break;
+                    NEXT;
                 }
                 DEFINE_OP(OP_BC_GEPZ)
                 {
@@ -1192,7 +1383,7 @@ cl_error_t cli_vm_execute(const struct cli_bc *bc, struct cli_bc_ctx *ctx, const
                         iptr = (ptr & 0xffffffff00000000ULL) + (uint64_t)(off);
                         WRITE64(inst->dest, iptr);
                     }
-                    break;
+                    NEXT;
                 }
                 DEFINE_OP(OP_BC_MEMCMP)
                 {
@@ -1202,7 +1393,7 @@ cl_error_t cli_vm_execute(const struct cli_bc *bc, struct cli_bc_ctx *ctx, const
                     READPOP(arg1, inst->u.three[0], arg3);
                     READPOP(arg2, inst->u.three[1], arg3);
                     WRITE32(inst->dest, memcmp(arg1, arg2, arg3));
-                    break;
+                    NEXT;
                 }
                 DEFINE_OP(OP_BC_MEMCPY)
                 {
@@ -1213,7 +1404,7 @@ cl_error_t cli_vm_execute(const struct cli_bc *bc, struct cli_bc_ctx *ctx, const
                     READPOP(arg1, inst->u.three[0], arg3);
                     READPOP(arg2, inst->u.three[1], arg3);
                     memcpy(arg1, arg2, (int32_t)arg3);
-                    break;
+                    NEXT;
                 }
                 DEFINE_OP(OP_BC_MEMMOVE)
                 {
@@ -1224,7 +1415,7 @@ cl_error_t cli_vm_execute(const struct cli_bc *bc, struct cli_bc_ctx *ctx, const
                     READPOP(arg1, inst->u.three[0], arg3);
                     READPOP(arg2, inst->u.three[1], arg3);
                     memmove(arg1, arg2, (int32_t)arg3);
-                    break;
+                    NEXT;
                 }
                 DEFINE_OP(OP_BC_MEMSET)
                 {
@@ -1236,28 +1427,28 @@ cl_error_t cli_vm_execute(const struct cli_bc *bc, struct cli_bc_ctx *ctx, const
                     READPOP(arg1, inst->u.three[0], arg3);
                     READ32(arg2, inst->u.three[1]);
                     memset(arg1, arg2, (int32_t)arg3);
-                    break;
+                    NEXT;
                 }
                 DEFINE_OP(OP_BC_BSWAP16)
                 {
                     int16_t arg1;
                     READ16(arg1, inst->u.unaryop);
                     WRITE16(inst->dest, cbswap16(arg1));
-                    break;
+                    NEXT;
                 }
                 DEFINE_OP(OP_BC_BSWAP32)
                 {
                     int32_t arg1;
                     READ32(arg1, inst->u.unaryop);
                     WRITE32(inst->dest, cbswap32(arg1));
-                    break;
+                    NEXT;
                 }
                 DEFINE_OP(OP_BC_BSWAP64)
                 {
                     int64_t arg1;
                     READ64(arg1, inst->u.unaryop);
                     WRITE64(inst->dest, cbswap64(arg1));
-                    break;
+                    NEXT;
                 }
                 DEFINE_OP(OP_BC_PTRDIFF32)
                 {
@@ -1271,7 +1462,7 @@ cl_error_t cli_vm_execute(const struct cli_bc *bc, struct cli_bc_ctx *ctx, const
                     else
                         READ64(ptr2, BINOP(1));
                     WRITE32(inst->dest, ptr_diff32(ptr1, ptr2));
-                    break;
+                    NEXT;
                 }
                 DEFINE_OP(OP_BC_PTRTOINT64)
                 {
@@ -1281,7 +1472,7 @@ cl_error_t cli_vm_execute(const struct cli_bc *bc, struct cli_bc_ctx *ctx, const
                     else
                         READ64(ptr, BINOP(0));
                     WRITE64(inst->dest, ptr);
-                    break;
+                    NEXT;
                 }
                 DEFINE_OP(OP_BC_GEP1)
                 {
@@ -1307,10 +1498,28 @@ cl_error_t cli_vm_execute(const struct cli_bc *bc, struct cli_bc_ctx *ctx, const
                         iptr = (ptr & 0xffffffff00000000ULL) + (uint64_t)(off);
                         WRITE64(inst->dest, iptr);
                     }
-                    break;
+                    NEXT;
                 }
+
+                DEFINE_ICMP_BR(OP_BC_ICMP_EQ_BR, OP_BC_LOAD_ICMP_EQ_BR, res = (op0 == op1));
+                DEFINE_ICMP_BR(OP_BC_ICMP_NE_BR, OP_BC_LOAD_ICMP_NE_BR, res = (op0 != op1));
+                DEFINE_ICMP_BR(OP_BC_ICMP_UGT_BR, OP_BC_LOAD_ICMP_UGT_BR, res = (op0 > op1));
+                DEFINE_ICMP_BR(OP_BC_ICMP_UGE_BR, OP_BC_LOAD_ICMP_UGE_BR, res = (op0 >= op1));
+                DEFINE_ICMP_BR(OP_BC_ICMP_ULT_BR, OP_BC_LOAD_ICMP_ULT_BR, res = (op0 < op1));
+                DEFINE_ICMP_BR(OP_BC_ICMP_ULE_BR, OP_BC_LOAD_ICMP_ULE_BR, res = (op0 <= op1));
+                DEFINE_ICMP_BR(OP_BC_ICMP_SGT_BR, OP_BC_LOAD_ICMP_SGT_BR, res = (sop0 > sop1));
+                DEFINE_ICMP_BR(OP_BC_ICMP_SGE_BR, OP_BC_LOAD_ICMP_SGE_BR, res = (sop0 >= sop1));
+                DEFINE_ICMP_BR(OP_BC_ICMP_SLE_BR, OP_BC_LOAD_ICMP_SLE_BR, res = (sop0 <= sop1));
+                DEFINE_ICMP_BR(OP_BC_ICMP_SLT_BR, OP_BC_LOAD_ICMP_SLT_BR, res = (sop0 < sop1));
+
+                DEFINE_GEP_LOAD(OP_BC_GEPZ_LOAD, 1);
+                DEFINE_GEP_LOAD(OP_BC_GEP1_LOAD, inst->u.three[0]);
+
             /* TODO: implement OP_BC_GEP1, OP_BC_GEP2, OP_BC_GEPN */
             default:
+#ifdef BC_THREADED_DISPATCH
+            op_invalid:
+#endif
                 cli_errmsg("Opcode %u of type %u is not implemented yet!\n",
                            inst->interp_op / 5, inst->interp_op % 5);
                 stop = CL_EARG;
@@ -1322,6 +1531,9 @@ cl_error_t cli_vm_execute(const struct cli_bc *bc, struct cli_bc_ctx *ctx, const
             CHECK_GT(bb->numInsts, bb_inst);
         }
     } while (stop == CL_SUCCESS);
+#ifdef BC_THREADED_DISPATCH
+done:
+#endif
     if (cli_debug_flag) {
         gettimeofday(&tv1, NULL);
         tv1.tv_sec -= tv0.tv_sec;
@@ -1334,6 +1546,8 @@ cl_error_t cli_vm_execute(const struct cli_bc *bc, struct cli_bc_ctx *ctx, const
         cli_dbgmsg("interpreter finished with error\n");
     }
 
+    ctx->stack_spare = stack.spare;
+    stack.spare      = NULL;
     cli_stack_destroy(&stack);
     free(ptrinfos.stack_infos);
     free(ptrinfos.glob_infos);
@@ -48,6 +48,7 @@
 #include "llvm/IR/AutoUpgrade.h"
 #include "llvm/ExecutionEngine/ExecutionEngine.h"
 #include "llvm/ExecutionEngine/MCJIT.h"
+#include "llvm/ExecutionEngine/ObjectCache.h"
 #include "llvm/Support/DynamicLibrary.h"
 #include "llvm/Object/ObjectFile.h"
 #include "llvm/ExecutionEngine/JITEventListener.h"
@@ -68,6 +69,7 @@
 #include "llvm/Support/Host.h"
 #include "llvm/Support/Memory.h"
 #include "llvm/Support/Mutex.h"
+#include "llvm/Support/Path.h"
 #include "llvm/Support/Signals.h"
 #include "llvm/Support/Threading.h"
 #include "llvm/Support/ThreadLocal.h"
@@ -166,6 +168,7 @@ typedef DenseMap<const struct cli_bc_func *, void *> FunctionMapTy;
 struct cli_bcengine {
     ExecutionEngine *EE;
     JITEventListener *Listener;
+    ObjectCache *Cache;
     LLVMContext Context;
     FunctionMapTy compiledFunctions;
     union {
@@ -404,6 +407,323 @@ class NotifyListener : public JITEventListener
     }
 };
 
+/*
+ * On-disk cache of the object code generated for the bytecode module, so that
+ * loading the same set of bytecodes again (e.g. on a clamd reload with an
+ * unchanged bytecode.cvd) skips the native code generation.
+ *
+ * All bytecodes are compiled into a single module, so there is one object for
+ * a set of bytecodes. It is keyed by the hashes of the bytecodes going into
+ * the module, the ClamAV and LLVM versions and the target, see
+ * getObjectCacheKey(). What the JIT adds to the bytecodes (API mappings,
+ * runtime checks) only depends on the ClamAV version.
+ *
+ * When a new object is stored the objects that were last written before this
+ * cache was set up are removed, they belong to a previous set of bytecodes.
+ * Temporary files are left alone, they may be another process' object in
+ * the making. Processes loading different sets of bytecodes at the same
+ * time should still use separate directories.
+ */
+class BytecodeObjectCache : public ObjectCache
+{
+  private:
+    std::string Dir;
+    std::string Path;
+    sys::TimePoint<> Created;
+
+  public:
+    BytecodeObjectCache(StringRef CacheDir, StringRef Key)
+        : Dir(CacheDir.str()), Created(std::chrono::system_clock::now())
+    {
+        SmallString<256> P(CacheDir);
+        sys::path::append(P, "clambc-" + Key + ".o");
+        Path = P.str().str();
+    }
+
+    void notifyObjectCompiled(const Module *M, MemoryBufferRef Obj) override
+    {
+        SmallString<256> TmpPath;
+        int FD;
+
+        if (std::error_code EC = sys::fs::create_directories(Dir, true, sys::fs::owner_all)) {
+            cli_warnmsg("[Bytecode JIT]: can't create object cache directory %s: %s\n",
+                        Dir.c_str(), EC.message().c_str());
+            return;
+        }
+        // write to a temporary file and rename it, so that a concurrent
+        // reader never sees a partial object
+        if (sys::fs::createUniqueFile(Path + ".%%%%%%.tmp", FD, TmpPath)) {
+            cli_warnmsg("[Bytecode JIT]: can't create object cache file in %s\n", Dir.c_str());
+            return;
+        }
+        {
+            raw_fd_ostream OS(FD, true);
+            OS << Obj.getBuffer();
+            OS.close();
+            if (OS.has_error()) {
+                OS.clear_error();
+                cli_warnmsg("[Bytecode JIT]: can't write object cache file %s\n", TmpPath.c_str());
+                sys::fs::remove(TmpPath);
+                return;
+            }
+        }
+        if (sys::fs::rename(TmpPath, Path)) {
+            sys::fs::remove(TmpPath);
+            return;
+        }
+        cli_dbgmsg_no_inline("[Bytecode JIT]: stored %zu bytes of object code in %s\n",
+                             Obj.getBufferSize(), Path.c_str());
+
+        std::error_code EC;
+        for (sys::fs::directory_iterator I(Dir, EC), E; !EC && I != E; I.increment(EC)) {
+            StringRef Name = sys::path::filename(I->path());
+            sys::fs::file_status Status;
+
+            if (!Name.startswith("clambc-") || !Name.endswith(".o") || I->path() == Path)
+                continue;
+            if (sys::fs::status(I->path(), Status) || Status.getLastModificationTime() >= Created)
+                continue;
+            cli_dbgmsg_no_inline("[Bytecode JIT]: removing stale object cache file %s\n", I->path().c_str());
+            sys::fs::remove(I->path());
+        }
+    }
+
+    std::unique_ptr<MemoryBuffer> getObject(const Module *M) override
+    {
+        ErrorOr<std::unique_ptr<MemoryBuffer>> Buffer = MemoryBuffer::getFile(Path);
+        if (!Buffer)
+            return nullptr;
+        cli_dbgmsg_no_inline("[Bytecode JIT]: loaded object code from %s\n", Path.c_str());
+        return std::move(*Buffer);
+    }
+};
+
+static std::string toHex(const unsigned char *Data, size_t Len)
+{
+    static const char hex[] = "0123456789abcdef";
+    std::string Str;
+
+    for (size_t i = 0; i < Len; i++) {
+        Str += hex[Data[i] >> 4];
+        Str += hex[Data[i] & 0xf];
+    }
+    return Str;
+}
+
+static std::string sha256Hex(StringRef Data)
+{
+    unsigned char digest[32];
+
+    if (!cl_hash_data((char *)"sha256", (void *)Data.data(), Data.size(), digest, NULL))
+        return std::string();
+    return toHex(digest, sizeof(digest));
+}
+
+/*
+ * The key only needs what goes into the module: the SHA-256 of each bytecode
+ * compiled into it, as loaded, with its id (function names are derived from
+ * it) and trust flag (untrusted bytecodes get extra runtime checks). It is
+ * computed before any IR is generated.
+ */
+static std::string getObjectCacheKey(const struct cli_all_bc *bcs, const bool *Compiled, StringRef Triple)
+{
+    SmallVector<char, 0> Buffer;
+    raw_svector_ostream OS(Buffer);
+
+    OS << "ClamAV " << cl_retver() << '\0'
+       << "LLVM " << LLVM_VERSION_STRING << '\0'
+       << Triple << '\0'
+       << sys::getHostCPUName() << '\0';
+    for (unsigned i = 0; i < bcs->count; i++) {
+        const struct cli_bc *bc = &bcs->all_bcs[i];
+
+        if (!Compiled[i])
+            continue;
+        OS << i << ':' << bc->id << ':' << (bc->trusted ? 1 : 0) << ':'
+           << toHex(bc->hash, sizeof(bc->hash)) << '\0';
+    }
+    return sha256Hex(StringRef(Buffer.data(), Buffer.size()));
+}
+
+/*
+ * Native bytecode modules: the object code of all bytecodes of a database,
+ * compiled once ahead of time (sigtool --compile-bytecode) and loaded by the
+ * scanners in place of generating code for those bytecodes themselves.
+ *
+ * The file starts with a text manifest, followed by the object:
+ *   ClamBC-native:1
+ *   clamav:<version>
+ *   llvm:<version>
+ *   target:<triple>
+ *   object:<size>:<sha256>
+ *   bc:<bytecode sha256>:<trusted>:<entry point symbol>   (one per bytecode)
+ *   end
+ *
+ * Bytecodes are matched by the hash of their text (struct cli_bc hash) and
+ * trust, bytecodes that are not listed are compiled as usual. The object is
+ * generic code for the target, it is linked against the API and the runtime
+ * of the loading process by the JIT, so it is only valid for the exact ClamAV
+ * and LLVM versions that produced it.
+ */
+#define NATIVE_MODULE_MAGIC "ClamBC-native:1"
+#define NATIVE_SYMBOL_PREFIX "clambc_native_"
+
+static std::string nativeModuleKey(const struct cli_bc *bc)
+{
+    return toHex(bc->hash, sizeof(bc->hash)) + (bc->trusted ? ":1" : ":0");
+}
+
+class NativeModuleWriter : public ObjectCache
+{
+  private:
+    std::string Path;
+    std::string Target;
+    std::string Entries;
+    unsigned NumEntries;
+
+  public:
+    bool Written;
+
+    NativeModuleWriter(StringRef Path, StringRef Target)
+        : Path(Path.str()), Target(Target.str()), NumEntries(0), Written(false)
+    {
+    }
+
+    void addEntry(const struct cli_bc *bc, StringRef Symbol)
+    {
+        Entries += "bc:" + nativeModuleKey(bc) + ":" + Symbol.str() + "\n";
+        NumEntries++;
+    }
+
+    void notifyObjectCompiled(const Module *M, MemoryBufferRef Obj) override
+    {
+        std::string Hash = sha256Hex(Obj.getBuffer());
+        SmallString<256> TmpPath;
+        int FD;
+
+        if (Hash.empty()) {
+            cli_errmsg("[Bytecode JIT]: can't hash native module object\n");
+            return;
+        }
+        if (sys::fs::createUniqueFile(Path + ".%%%%%%.tmp", FD, TmpPath)) {
+            cli_errmsg("[Bytecode JIT]: can't create native module %s\n", Path.c_str());
+            return;
+        }
+        {
+            raw_fd_ostream OS(FD, true);
+            OS << NATIVE_MODULE_MAGIC << "\n"
+               << "clamav:" << cl_retver() << "\n"
+               << "llvm:" << LLVM_VERSION_STRING << "\n"
+               << "target:" << Target << "\n"
+               << "object:" << Obj.getBufferSize() << ":" << Hash << "\n"
+               << Entries
+               << "end\n"
+               << Obj.getBuffer();
+            OS.close();
+            if (OS.has_error()) {
+                OS.clear_error();
+                cli_errmsg("[Bytecode JIT]: can't write native module %s\n", TmpPath.c_str());
+                sys::fs::remove(TmpPath);
+                return;
+            }
+        }
+        if (sys::fs::rename(TmpPath, Path)) {
+            cli_errmsg("[Bytecode JIT]: can't rename %s to %s\n", TmpPath.c_str(), Path.c_str());
+            sys::fs::remove(TmpPath);
+            return;
+        }
+        cli_dbgmsg_no_inline("[Bytecode JIT]: wrote %u bytecodes (%zu bytes of object code) to %s\n",
+                             NumEntries, Obj.getBufferSize(), Path.c_str());
+        Written = true;
+    }
+
+    std::unique_ptr<MemoryBuffer> getObject(const Module *M) override
+    {
+        return nullptr;
+    }
+};
+
+/*
+ * Verify the native module at Path and add its object to the execution
+ * engine. Fills Symbols with the entry point of every bytecode it provides,
+ * keyed by nativeModuleKey().
+ */
+static bool loadNativeModule(ExecutionEngine *EE, const char *Path, StringRef Target,
+                             StringMap<std::string> &Symbols)
+{
+    ErrorOr<std::unique_ptr<MemoryBuffer>> Buffer = MemoryBuffer::getFile(Path);
+    StringRef Data, Line;
+    uint64_t ObjSize = 0;
+    std::string ObjHash;
+
+    if (!Buffer) {
+        cli_errmsg("[Bytecode JIT]: can't read native module %s: %s\n",
+                   Path, Buffer.getError().message().c_str());
+        return false;
+    }
+    Data = (*Buffer)->getBuffer();
+
+    std::tie(Line, Data) = Data.split('\n');
+    if (Line != NATIVE_MODULE_MAGIC) {
+        cli_errmsg("[Bytecode JIT]: %s is not a native bytecode module\n", Path);
+        return false;
+    }
+    for (;;) {
+        StringRef Field, Value;
+
+        if (Data.empty()) {
+            cli_errmsg("[Bytecode JIT]: truncated native module %s\n", Path);
+            return false;
+        }
+        std::tie(Line, Data) = Data.split('\n');
+        if (Line == "end")
+            break;
+        std::tie(Field, Value) = Line.split(':');
+        if (Field == "clamav" || Field == "llvm" || Field == "target") {
+            StringRef Want = Field == "clamav" ? StringRef(cl_retver()) : Field == "llvm" ? StringRef(LLVM_VERSION_STRING) : Target;
+            if (Value != Want) {
+                cli_warnmsg("[Bytecode JIT]: native module %s was built for %s %s, not %s\n",
+                            Path, Field.str().c_str(), Value.str().c_str(), Want.str().c_str());
+                return false;
+            }
+        } else if (Field == "object") {
+            StringRef Size;
+            std::tie(Size, Value) = Value.split(':');
+            if (Size.getAsInteger(10, ObjSize) || Value.size() != 64) {
+                cli_errmsg("[Bytecode JIT]: malformed object line in native module %s\n", Path);
+                return false;
+            }
+            ObjHash = Value.str();
+        } else if (Field == "bc") {
+            // <hash>:<trusted>:<symbol>
+            size_t Sep = Value.rfind(':');
+            if (Sep == StringRef::npos || Sep != 66 || !Value.substr(Sep + 1).startswith(NATIVE_SYMBOL_PREFIX)) {
+                cli_errmsg("[Bytecode JIT]: malformed bytecode line in native module %s\n", Path);
+                return false;
+            }
+            Symbols.insert(std::make_pair(Value.substr(0, Sep), Value.substr(Sep + 1).str()));
+        }
+        // unknown fields are ignored
+    }
+    if (ObjHash.empty() || ObjSize != Data.size() || sha256Hex(Data) != ObjHash) {
+        cli_errmsg("[Bytecode JIT]: object code of native module %s is corrupted\n", Path);
+        return false;
+    }
+
+    std::unique_ptr<MemoryBuffer> ObjBuffer = MemoryBuffer::getMemBufferCopy(Data, Path);
+    Expected<std::unique_ptr<object::ObjectFile>> Obj =
+        object::ObjectFile::createObjectFile(ObjBuffer->getMemBufferRef());
+    if (!Obj) {
+        cli_errmsg("[Bytecode JIT]: can't parse object code of native module %s: %s\n",
+                   Path, toString(Obj.takeError()).c_str());
+        return false;
+    }
+    EE->addObjectFile(object::OwningBinary<object::ObjectFile>(std::move(*Obj), std::move(ObjBuffer)));
+    cli_dbgmsg_no_inline("[Bytecode JIT]: loaded native module %s with %u bytecodes\n",
+                         Path, Symbols.size());
+    return true;
+}
+
 class TimerWrapper
 {
   private:
@@ -2124,7 +2444,7 @@ static void addFPasses(legacy::FunctionPassManager &FPM, bool trusted, Module *M
     FPM.add(createDeadCodeEliminationPass());
 }
 
-cl_error_t cli_bytecode_prepare_jit(struct cli_all_bc *bcs)
+cl_error_t cli_bytecode_prepare_jit(struct cli_all_bc *bcs, const struct cli_bc_jit_opts *opts)
 {
     if (!bcs->engine)
         return CL_EBYTECODE;
@@ -2244,11 +2564,49 @@ cl_error_t cli_bytecode_prepare_jit(struct cli_all_bc *bcs)
                 sys::DynamicLibrary::AddSymbol(SFail->getName(), (void *)(intptr_t)jit_ssp_handler);
                 EE->getPointerToFunction(SFail);
 
+                NativeModuleWriter *Writer = 0;
+                StringMap<std::string> NativeSymbols;
+                if (opts && opts->native_output) {
+                    Writer = new NativeModuleWriter(opts->native_output, M->getTargetTriple());
+                } else if (opts && opts->native_module) {
+                    if (!loadNativeModule(EE, opts->native_module, M->getTargetTriple(), NativeSymbols)) {
+                        cli_warnmsg("[Bytecode JIT]: not using native module %s, compiling all bytecodes\n",
+                                    opts->native_module);
+                        NativeSymbols.clear();
+                    }
+                }
+
                 llvm::Function **Functions = new Function *[bcs->count];
+                std::string *NativeFunctions = new std::string[bcs->count];
+                bool *Compiled               = new bool[bcs->count];
                 for (unsigned i = 0; i < bcs->count; i++) {
                     const struct cli_bc *bc = &bcs->all_bcs[i];
+                    Functions[i] = 0;
+                    Compiled[i]  = false;
                     if (bc->state == bc_skip || bc->state == bc_interp) {
-                        Functions[i] = 0;
+                        continue;
+                    }
+                    if (!NativeSymbols.empty()) {
+                        StringMap<std::string>::iterator I = NativeSymbols.find(nativeModuleKey(bc));
+                        if (I != NativeSymbols.end()) {
+                            NativeFunctions[i] = I->getValue();
+                            continue;
+                        }
+                        cli_dbgmsg_no_inline("[Bytecode JIT]: bytecode %u not in native module, compiling it\n", bc->id);
+                    }
+                    Compiled[i] = true;
+                }
+
+                BytecodeObjectCache *Cache = 0;
+                if (!Writer && opts && opts->cachedir && *opts->cachedir) {
+                    std::string Key = getObjectCacheKey(bcs, Compiled, M->getTargetTriple());
+                    if (!Key.empty())
+                        Cache = new BytecodeObjectCache(opts->cachedir, Key);
+                }
+
+                for (unsigned i = 0; i < bcs->count; i++) {
+                    const struct cli_bc *bc = &bcs->all_bcs[i];
+                    if (!Compiled[i]) {
                         continue;
                     }
                     LLVMCodegen Codegen(bc, M, &CF, bcs->engine->compiledFunctions, EE,
@@ -2261,11 +2619,21 @@ cl_error_t cli_bytecode_prepare_jit(struct cli_all_bc *bcs)
                             delete Functions[z];
                         }
                         delete[] Functions;
+                        delete[] NativeFunctions;
+                        delete[] Compiled;
+                        delete Writer;
+                        delete Cache;
                         return CL_EBYTECODE;
                     }
+                    if (Writer) {
+                        // the entry point is looked up by name when loading
+                        F->setName(NATIVE_SYMBOL_PREFIX + toHex(bc->hash, sizeof(bc->hash)));
+                        Writer->addEntry(bc, F->getName());
+                    }
                     Functions[i] = F;
                 }
                 delete[] apiFuncs;
+                delete[] Compiled;
 
                 legacy::PassManager PM;
 
@@ -2289,6 +2657,16 @@ cl_error_t cli_bytecode_prepare_jit(struct cli_all_bc *bcs)
                 PM.run(*M);
                 pmTimer2.stopTimer();
 
+                if (Writer) {
+                    delete bcs->engine->Cache;
+                    bcs->engine->Cache = Writer;
+                    EE->setObjectCache(Writer);
+                } else if (Cache) {
+                    delete bcs->engine->Cache;
+                    bcs->engine->Cache = Cache;
+                    EE->setObjectCache(Cache);
+                }
+
                 EE->finalizeObject();
                 PrettyStackTraceString CrashInfo2("Native machine codegen");
                 TimerWrapper codegenTimer("Native codegen");
@@ -2302,14 +2680,35 @@ cl_error_t cli_bytecode_prepare_jit(struct cli_all_bc *bcs)
                 }
                 codegenTimer.stopTimer();
 
+                if (Writer && !Writer->Written) {
+                    delete[] Functions;
+                    delete[] NativeFunctions;
+                    return CL_EBYTECODE;
+                }
+
                 for (unsigned i = 0; i < bcs->count; i++) {
                     const struct cli_bc_func *func = &bcs->all_bcs[i].funcs[0];
+                    if (!NativeFunctions[i].empty()) {
+                        void *Fn = (void *)(intptr_t)EE->getFunctionAddress(NativeFunctions[i]);
+                        if (!Fn) {
+                            cli_errmsg("[Bytecode JIT]: native module has no entry point %s\n",
+                                       NativeFunctions[i].c_str());
+                            delete[] Functions;
+                            delete[] NativeFunctions;
+                            return CL_EBYTECODE;
+                        }
+                        bcs->engine->compiledFunctions[func] = Fn;
+                        bcs->all_bcs[i].state                = bc_jit;
+                        bcs->native++;
+                        continue;
+                    }
                     if (!Functions[i])
                         continue; // not JITed
                     bcs->engine->compiledFunctions[func] = EE->getPointerToFunction(Functions[i]);
                     bcs->all_bcs[i].state                = bc_jit;
                 }
                 delete[] Functions;
+                delete[] NativeFunctions;
             }
             return CL_SUCCESS;
         } catch (std::bad_alloc &badalloc) {
@@ -2371,6 +2770,7 @@ cl_error_t cli_bytecode_init_jit(struct cli_all_bc *bcs, unsigned dconfmask)
         return CL_EMEM;
     bcs->engine->EE       = 0;
     bcs->engine->Listener = 0;
+    bcs->engine->Cache    = 0;
     return CL_SUCCESS;
 }
 
@@ -2386,6 +2786,8 @@ cl_error_t cli_bytecode_done_jit(struct cli_all_bc *bcs, int partial)
         }
         delete bcs->engine->Listener;
         bcs->engine->Listener = 0;
+        delete bcs->engine->Cache;
+        bcs->engine->Cache = 0;
         if (!partial) {
             delete bcs->engine;
             bcs->engine = 0;
@@ -330,6 +330,15 @@ enum cl_engine_field {
     CL_ENGINE_PCRE_MAX_FILESIZE,   /* uint64_t */
     CL_ENGINE_DISABLE_PE_CERTS,    /* uint32_t */
     CL_ENGINE_PE_DUMPCERTS,        /* uint32_t */
+    CL_ENGINE_PARALLEL_THREADS,    /* uint32_t */
+    CL_ENGINE_BYTECODE_CACHE_DIR,  /* (char *) */
+    CL_ENGINE_BYTECODE_NATIVE,     /* (char *) */
+    CL_ENGINE_BYTECODE_NATIVE_OUT, /* (char *) */
+    CL_ENGINE_BYTECODE_LAZY,       /* uint32_t */
+    CL_ENGINE_BYTECODE_COUNT,      /* uint32_t, read only */
+    CL_ENGINE_BYTECODE_PREPARED,   /* uint32_t, read only */
+    CL_ENGINE_HUGEPAGES,           /* uint32_t */
+    CL_ENGINE_NUMA_NODE,           /* int32_t */
 };
 
 enum bytecode_security {
@@ -346,6 +355,17 @@ enum bytecode_mode {
     CL_BYTECODE_MODE_OFF          /* for query only, not settable */
 };
 
+/* Page size of the memory pool holding the loaded signatures (CL_ENGINE_HUGEPAGES) */
+enum cl_hugepages_mode {
+    CL_HUGEPAGES_NONE = 0,    /* default */
+    CL_HUGEPAGES_TRANSPARENT, /* ask for transparent huge pages with MADV_HUGEPAGE */
+    CL_HUGEPAGES_EXPLICIT     /* MAP_HUGETLB, falls back to transparent huge pages */
+};
+
+/* CL_ENGINE_NUMA_NODE: a node number to bind the memory pool to, or one of these */
+#define CL_NUMA_DEFAULT -1    /* the kernel's default (first touch) policy */
+#define CL_NUMA_INTERLEAVE -2 /* interleave over all online nodes */
+
 struct cli_section_hash {
     unsigned char md5[16];
     size_t len;
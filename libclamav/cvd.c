@@ -41,6 +41,9 @@
 #include "zlib.h"
 #include <time.h>
 #include <errno.h>
+#ifdef CL_THREAD_SAFE
+#include <pthread.h>
+#endif
 
 #include "clamav.h"
 #include "others.h"
@@ -52,6 +55,10 @@
 
 #define TAR_BLOCKSIZE 512
 
+#ifndef MIN
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#endif
+
 static void cli_untgz_cleanup(char *path, gzFile infile, FILE *outfile, int fdd)
 {
     UNUSEDPARAM(fdd);
@@ -187,12 +194,289 @@ static int cli_untgz(int fd, const char *destdir)
     return 0;
 }
 
+#ifdef CL_THREAD_SAFE
+/*
+ * Inflate pipeline for cli_tgzload(): a helper thread runs gzread() over the
+ * whole tar stream into large blocks and hashes each member as it goes, so the
+ * loading thread only has to split lines and parse. Blocks are handed over
+ * through a bounded ring; the per-member SHA-256 digests are published before
+ * the block holding the last byte of that member.
+ */
+#define CVD_PIPE_BLOCKSIZE (1024 * 1024)
+#define CVD_PIPE_DEPTH 4
+
+struct cli_dbio_pipe {
+    gzFile gzs;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t filled;  /* a block was queued, or the inflater is done */
+    pthread_cond_t drained; /* a block was released, or we're stopping */
+    char *blocks[CVD_PIPE_DEPTH];
+    unsigned int blocklen[CVD_PIPE_DEPTH];
+    unsigned int head, count;
+    int eof, error, stop;
+
+    /* inflater side: tar walk state */
+    char header[TAR_BLOCKSIZE];
+    unsigned int hdrfill, walkdone;
+    unsigned int data_left, pad_left;
+    void *hashctx;
+    unsigned char (*digests)[32];
+    unsigned int ndigests, digests_size;
+
+    /* loader side */
+    char *cur;
+    unsigned int curlen, curpos;
+    size_t consumed;
+};
+
+static int cvd_pipe_digest_add(struct cli_dbio_pipe *pipe)
+{
+    unsigned char hash[32];
+
+    cl_finish_hash(pipe->hashctx, hash);
+    pipe->hashctx = NULL;
+
+    pthread_mutex_lock(&pipe->mutex);
+    if (pipe->ndigests == pipe->digests_size) {
+        unsigned int newsize = pipe->digests_size ? pipe->digests_size * 2 : 32;
+        void *newdigests     = cli_max_realloc(pipe->digests, newsize * sizeof(*pipe->digests));
+
+        if (!newdigests) {
+            pthread_mutex_unlock(&pipe->mutex);
+            return -1;
+        }
+        pipe->digests      = newdigests;
+        pipe->digests_size = newsize;
+    }
+    memcpy(pipe->digests[pipe->ndigests++], hash, 32);
+    pthread_mutex_unlock(&pipe->mutex);
+    return 0;
+}
+
+/* Follow the tar layout across blocks and hash the data of every member */
+static int cvd_pipe_hash(struct cli_dbio_pipe *pipe, const char *data, unsigned int len)
+{
+    unsigned int n, size;
+    char osize[13];
+
+    while (len && !pipe->walkdone) {
+        if (pipe->data_left) {
+            n = MIN(len, pipe->data_left);
+            cl_update_hash(pipe->hashctx, data, n);
+            pipe->data_left -= n;
+            if (!pipe->data_left && cvd_pipe_digest_add(pipe))
+                return -1;
+        } else if (pipe->pad_left) {
+            n = MIN(len, pipe->pad_left);
+            pipe->pad_left -= n;
+        } else {
+            n = MIN(len, TAR_BLOCKSIZE - pipe->hdrfill);
+            memcpy(pipe->header + pipe->hdrfill, data, n);
+            pipe->hdrfill += n;
+            if (pipe->hdrfill == TAR_BLOCKSIZE) {
+                pipe->hdrfill = 0;
+                strncpy(osize, pipe->header + 124, 12);
+                osize[12] = '\0';
+                if (pipe->header[0] == '\0' || sscanf(osize, "%o", &size) != 1) {
+                    /* end of archive; a bad header is reported by the loader */
+                    pipe->walkdone = 1;
+                    break;
+                }
+                if (!(pipe->hashctx = cl_hash_init("sha256")))
+                    return -1;
+                pipe->data_left = size;
+                pipe->pad_left  = size % TAR_BLOCKSIZE ? (TAR_BLOCKSIZE - (size % TAR_BLOCKSIZE)) : 0;
+                if (!size && cvd_pipe_digest_add(pipe))
+                    return -1;
+            }
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static void *cvd_pipe_inflate(void *arg)
+{
+    struct cli_dbio_pipe *pipe = (struct cli_dbio_pipe *)arg;
+    unsigned int tail;
+    int nread;
+
+    while (1) {
+        pthread_mutex_lock(&pipe->mutex);
+        while (pipe->count == CVD_PIPE_DEPTH && !pipe->stop)
+            pthread_cond_wait(&pipe->drained, &pipe->mutex);
+        if (pipe->stop) {
+            pthread_mutex_unlock(&pipe->mutex);
+            break;
+        }
+        tail = (pipe->head + pipe->count) % CVD_PIPE_DEPTH;
+        pthread_mutex_unlock(&pipe->mutex);
+
+        /* the loader never touches the tail block until it's queued */
+        nread = gzread(pipe->gzs, pipe->blocks[tail], CVD_PIPE_BLOCKSIZE);
+        if (nread > 0 && cvd_pipe_hash(pipe, pipe->blocks[tail], nread)) {
+            cli_errmsg("cvd_pipe_inflate: Can't hash database data\n");
+            nread = -1;
+        }
+
+        pthread_mutex_lock(&pipe->mutex);
+        if (nread < 0) {
+            pipe->error = 1;
+        } else if (!nread) {
+            pipe->eof = 1;
+        } else {
+            pipe->blocklen[tail] = nread;
+            pipe->count++;
+        }
+        pthread_cond_signal(&pipe->filled);
+        pthread_mutex_unlock(&pipe->mutex);
+
+        if (nread <= 0)
+            break;
+    }
+    return NULL;
+}
+
+static void cvd_pipe_destroy(struct cli_dbio_pipe *pipe)
+{
+    unsigned int i;
+
+    pthread_mutex_lock(&pipe->mutex);
+    pipe->stop = 1;
+    pthread_cond_signal(&pipe->drained);
+    pthread_mutex_unlock(&pipe->mutex);
+    pthread_join(pipe->thread, NULL);
+
+    pthread_cond_destroy(&pipe->drained);
+    pthread_cond_destroy(&pipe->filled);
+    pthread_mutex_destroy(&pipe->mutex);
+    for (i = 0; i < CVD_PIPE_DEPTH; i++)
+        free(pipe->blocks[i]);
+    if (pipe->hashctx)
+        cl_hash_destroy(pipe->hashctx);
+    free(pipe->digests);
+    gzclose(pipe->gzs);
+    free(pipe);
+}
+
+/*
+ * Takes over gzs on success. Returns NULL if the pipeline can't be set up, in
+ * which case the caller keeps reading gzs directly.
+ */
+static struct cli_dbio_pipe *cvd_pipe_create(gzFile gzs)
+{
+    struct cli_dbio_pipe *pipe;
+    unsigned int i;
+
+    pipe = calloc(1, sizeof(*pipe));
+    if (!pipe)
+        return NULL;
+
+    for (i = 0; i < CVD_PIPE_DEPTH; i++) {
+        if (!(pipe->blocks[i] = malloc(CVD_PIPE_BLOCKSIZE))) {
+            while (i--)
+                free(pipe->blocks[i]);
+            free(pipe);
+            return NULL;
+        }
+    }
+    pipe->gzs = gzs;
+    pthread_mutex_init(&pipe->mutex, NULL);
+    pthread_cond_init(&pipe->filled, NULL);
+    pthread_cond_init(&pipe->drained, NULL);
+
+    if (pthread_create(&pipe->thread, NULL, cvd_pipe_inflate, pipe)) {
+        cli_dbgmsg("cvd_pipe_create: Can't start inflate thread, loading inline\n");
+        pthread_cond_destroy(&pipe->drained);
+        pthread_cond_destroy(&pipe->filled);
+        pthread_mutex_destroy(&pipe->mutex);
+        for (i = 0; i < CVD_PIPE_DEPTH; i++)
+            free(pipe->blocks[i]);
+        free(pipe);
+        return NULL;
+    }
+    return pipe;
+}
+
+int cli_dbio_pipe_read(struct cli_dbio_pipe *pipe, void *buf, unsigned int len)
+{
+    unsigned int done = 0, n;
+    int error;
+
+    while (done < len) {
+        if (!pipe->cur) {
+            pthread_mutex_lock(&pipe->mutex);
+            while (!pipe->count && !pipe->eof && !pipe->error)
+                pthread_cond_wait(&pipe->filled, &pipe->mutex);
+            if (!pipe->count) {
+                error = pipe->error;
+                pthread_mutex_unlock(&pipe->mutex);
+                if (error)
+                    return -1;
+                break;
+            }
+            pipe->cur    = pipe->blocks[pipe->head];
+            pipe->curlen = pipe->blocklen[pipe->head];
+            pipe->curpos = 0;
+            pthread_mutex_unlock(&pipe->mutex);
+        }
+
+        n = MIN(len - done, pipe->curlen - pipe->curpos);
+        if (buf)
+            memcpy((char *)buf + done, pipe->cur + pipe->curpos, n);
+        done += n;
+        pipe->curpos += n;
+        pipe->consumed += n;
+
+        if (pipe->curpos == pipe->curlen) {
+            pthread_mutex_lock(&pipe->mutex);
+            pipe->head = (pipe->head + 1) % CVD_PIPE_DEPTH;
+            pipe->count--;
+            pipe->cur = NULL;
+            pthread_cond_signal(&pipe->drained);
+            pthread_mutex_unlock(&pipe->mutex);
+        }
+    }
+    return done;
+}
+
+static int cvd_pipe_digest(struct cli_dbio_pipe *pipe, unsigned int member, char *hash)
+{
+    int ret = -1;
+
+    pthread_mutex_lock(&pipe->mutex);
+    if (member < pipe->ndigests) {
+        memcpy(hash, pipe->digests[member], 32);
+        ret = 0;
+    }
+    pthread_mutex_unlock(&pipe->mutex);
+    return ret;
+}
+#else
+int cli_dbio_pipe_read(struct cli_dbio_pipe *pipe, void *buf, unsigned int len)
+{
+    UNUSEDPARAM(pipe);
+    UNUSEDPARAM(buf);
+    UNUSEDPARAM(len);
+    return -1;
+}
+#endif
+
 static void cli_tgzload_cleanup(int comp, struct cli_dbio *dbio, int fdd)
 {
     UNUSEDPARAM(fdd);
     cli_dbgmsg("in cli_tgzload_cleanup()\n");
+#ifdef CL_THREAD_SAFE
+    if (dbio->pipe) {
+        cvd_pipe_destroy(dbio->pipe);
+        dbio->pipe = NULL;
+    }
+#endif
     if (comp) {
-        gzclose(dbio->gzs);
+        if (dbio->gzs)
+            gzclose(dbio->gzs);
         dbio->gzs = NULL;
     } else {
         fclose(dbio->fs);
@@ -214,7 +498,7 @@ static int cli_tgzload(int fd, struct cl_engine *engine, unsigned int *signo, un
     char osize[13], name[101];
     char block[TAR_BLOCKSIZE];
     int nread, fdd, ret;
-    unsigned int type, size, pad, compr = 1;
+    unsigned int type, size, pad, compr = 1, member = 0;
     off_t off;
     struct cli_dbinfo *db;
     char hash[32];
@@ -247,7 +531,13 @@ static int cli_tgzload(int fd, struct cl_engine *engine, unsigned int *signo, un
                 close(fdd);
             return CL_EOPEN;
         }
-        dbio->fs = NULL;
+        dbio->fs   = NULL;
+        dbio->pipe = NULL;
+#ifdef CL_THREAD_SAFE
+        /* only the second pass has real databases to load */
+        if (dbinfo && (dbio->pipe = cvd_pipe_create(dbio->gzs)))
+            dbio->gzs = NULL;
+#endif
     } else {
         if ((dbio->fs = fdopen(fdd, "rb")) == NULL) {
             cli_errmsg("cli_tgzload: Can't fdopen() descriptor %d, errno = %d\n", fdd, errno);
@@ -255,7 +545,8 @@ static int cli_tgzload(int fd, struct cl_engine *engine, unsigned int *signo, un
                 close(fdd);
             return CL_EOPEN;
         }
-        dbio->gzs = NULL;
+        dbio->gzs  = NULL;
+        dbio->pipe = NULL;
     }
 
     dbio->bufsize = CLI_DEFAULT_DBIO_BUFSIZE;
@@ -271,6 +562,11 @@ static int cli_tgzload(int fd, struct cl_engine *engine, unsigned int *signo, un
 
     while (1) {
 
+#ifdef CL_THREAD_SAFE
+        if (dbio->pipe)
+            nread = cli_dbio_pipe_read(dbio->pipe, block, TAR_BLOCKSIZE);
+        else
+#endif
         if (compr)
             nread = gzread(dbio->gzs, block, TAR_BLOCKSIZE);
         else
@@ -325,7 +621,8 @@ static int cli_tgzload(int fd, struct cl_engine *engine, unsigned int *signo, un
         dbio->readsize = dbio->size < dbio->bufsize ? dbio->size : dbio->bufsize - 1;
         dbio->bufpt    = NULL;
         dbio->readpt   = dbio->buf;
-        if (!(dbio->hashctx)) {
+        /* with the inflate pipeline, hashing is done by the inflate thread */
+        if (!(dbio->hashctx) && !dbio->pipe) {
             dbio->hashctx = cl_hash_init("sha256");
             if (!(dbio->hashctx)) {
                 cli_tgzload_cleanup(compr, dbio, fdd);
@@ -335,6 +632,11 @@ static int cli_tgzload(int fd, struct cl_engine *engine, unsigned int *signo, un
         dbio->bread = 0;
 
         /* cli_dbgmsg("cli_tgzload: Loading %s, size: %u\n", name, size); */
+#ifdef CL_THREAD_SAFE
+        if (dbio->pipe)
+            off = (off_t)dbio->pipe->consumed;
+        else
+#endif
         if (compr)
             off = (off_t)gzseek(dbio->gzs, 0, SEEK_CUR);
         else
@@ -365,11 +667,22 @@ static int cli_tgzload(int fd, struct cl_engine *engine, unsigned int *signo, un
                         cli_tgzload_cleanup(compr, dbio, fdd);
                         return CL_EMALFDB;
                     }
-                    cl_finish_hash(dbio->hashctx, hash);
-                    dbio->hashctx = cl_hash_init("sha256");
-                    if (!(dbio->hashctx)) {
-                        cli_tgzload_cleanup(compr, dbio, fdd);
-                        return CL_EMALFDB;
+#ifdef CL_THREAD_SAFE
+                    if (dbio->pipe) {
+                        if (cvd_pipe_digest(dbio->pipe, member, hash)) {
+                            cli_errmsg("cli_tgzload: No checksum computed for file %s\n", name);
+                            cli_tgzload_cleanup(compr, dbio, fdd);
+                            return CL_EMALFDB;
+                        }
+                    } else
+#endif
+                    {
+                        cl_finish_hash(dbio->hashctx, hash);
+                        dbio->hashctx = cl_hash_init("sha256");
+                        if (!(dbio->hashctx)) {
+                            cli_tgzload_cleanup(compr, dbio, fdd);
+                            return CL_EMALFDB;
+                        }
                     }
                     if (memcmp(db->hash, hash, 32)) {
                         cli_errmsg("cli_tgzload: Invalid checksum for file %s\n", name);
@@ -380,6 +693,15 @@ static int cli_tgzload(int fd, struct cl_engine *engine, unsigned int *signo, un
             }
         }
         pad = size % TAR_BLOCKSIZE ? (TAR_BLOCKSIZE - (size % TAR_BLOCKSIZE)) : 0;
+        member++;
+#ifdef CL_THREAD_SAFE
+        if (dbio->pipe) {
+            if (off == (off_t)dbio->pipe->consumed)
+                cli_dbio_pipe_read(dbio->pipe, NULL, size + pad);
+            else if (pad)
+                cli_dbio_pipe_read(dbio->pipe, NULL, pad);
+        } else
+#endif
         if (compr) {
             if (off == gzseek(dbio->gzs, 0, SEEK_CUR))
                 gzseek(dbio->gzs, size + pad, SEEK_CUR);
@@ -527,11 +849,42 @@ void cl_cvdfree(struct cl_cvd *cvd)
  * @param skipsig       If non-zero, skip the signature verification.
  * @return cl_error_t   CL_SUCCESS on success. CL_ECVD, CL_EMEM, or CL_EVERIFY on error.
  */
+/* Parse the 512 byte header block of a CVD */
+static struct cl_cvd *cli_cvdparse_block(const char *block)
+{
+    char head[513];
+    int i;
+
+    memcpy(head, block, 512);
+    head[512] = 0;
+    for (i = 511; i > 0 && (head[i] == ' ' || head[i] == 10); head[i] = 0, i--)
+        ;
+
+    return cl_cvdparse(head);
+}
+
+static cl_error_t cli_cvdverify_md5(const struct cl_cvd *cvd, const char *md5)
+{
+    cli_dbgmsg("MD5(.tar.gz) = %s\n", md5);
+
+    if (strncmp(md5, cvd->md5, 32)) {
+        cli_dbgmsg("cli_cvdverify: MD5 verification error\n");
+        return CL_EVERIFY;
+    }
+
+    if (cli_versig(md5, cvd->dsig)) {
+        cli_dbgmsg("cli_cvdverify: Digital signature verification error\n");
+        return CL_EVERIFY;
+    }
+
+    return CL_SUCCESS;
+}
+
 static cl_error_t cli_cvdverify(FILE *fs, struct cl_cvd *cvdpt, unsigned int skipsig)
 {
     struct cl_cvd *cvd;
-    char *md5, head[513];
-    int i;
+    char *md5, head[512];
+    cl_error_t ret;
 
     fseek(fs, 0, SEEK_SET);
     if (fread(head, 1, 512, fs) != 512) {
@@ -539,11 +892,7 @@ static cl_error_t cli_cvdverify(FILE *fs, struct cl_cvd *cvdpt, unsigned int ski
         return CL_ECVD;
     }
 
-    head[512] = 0;
-    for (i = 511; i > 0 && (head[i] == ' ' || head[i] == 10); head[i] = 0, i--)
-        ;
-
-    if ((cvd = cl_cvdparse(head)) == NULL)
+    if ((cvd = cli_cvdparse_block(head)) == NULL)
         return CL_ECVD;
 
     if (cvdpt)
@@ -560,26 +909,119 @@ static cl_error_t cli_cvdverify(FILE *fs, struct cl_cvd *cvdpt, unsigned int ski
         cl_cvdfree(cvd);
         return CL_EMEM;
     }
-    cli_dbgmsg("MD5(.tar.gz) = %s\n", md5);
 
-    if (strncmp(md5, cvd->md5, 32)) {
-        cli_dbgmsg("cli_cvdverify: MD5 verification error\n");
-        free(md5);
+    ret = cli_cvdverify_md5(cvd, md5);
+
+    free(md5);
+    cl_cvdfree(cvd);
+    return ret;
+}
+
+#ifdef CL_THREAD_SAFE
+/*
+ * Background verification for check-only loads (cl_cvdverify()): the MD5 of
+ * the archive is computed from a map of the file on a separate thread while
+ * the databases are being parsed into a throwaway engine, instead of in a
+ * separate pass over the file before.
+ */
+struct cvd_verify {
+    pthread_t thread;
+    fmap_t *map;
+    cl_error_t ret;
+};
+
+static void *cvd_verify_hash(void *arg)
+{
+    struct cvd_verify *verify = (struct cvd_verify *)arg;
+    struct cl_cvd *cvd;
+    unsigned char digest[16];
+    char md5[33];
+    const void *data;
+    size_t at = 512, len;
+    void *ctx;
+    int i;
+
+    verify->ret = CL_ECVD;
+    if (!(data = fmap_need_off_once(verify->map, 0, 512)) || !(cvd = cli_cvdparse_block(data)))
+        return NULL;
+
+    verify->ret = CL_EMEM;
+    if (!(ctx = cl_hash_init("md5"))) {
         cl_cvdfree(cvd);
-        return CL_EVERIFY;
+        return NULL;
     }
 
-    if (cli_versig(md5, cvd->dsig)) {
-        cli_dbgmsg("cli_cvdverify: Digital signature verification error\n");
-        free(md5);
-        cl_cvdfree(cvd);
-        return CL_EVERIFY;
+    while (at < verify->map->len) {
+        if (!(data = fmap_need_off_once_len(verify->map, at, FILEBUFF, &len)) || !len) {
+            cli_errmsg("cvd_verify_hash: Can't read %s\n", verify->map->name);
+            cl_hash_destroy(ctx);
+            cl_cvdfree(cvd);
+            verify->ret = CL_EREAD;
+            return NULL;
+        }
+        cl_update_hash(ctx, data, len);
+        at += len;
     }
+    cl_finish_hash(ctx, digest);
 
-    free(md5);
+    for (i = 0; i < 16; i++)
+        sprintf(md5 + i * 2, "%02x", digest[i]);
+
+    verify->ret = cli_cvdverify_md5(cvd, md5);
     cl_cvdfree(cvd);
+    return NULL;
+}
+
+static struct cvd_verify *cvd_verify_start(int fd, const char *filename)
+{
+    struct cvd_verify *verify;
+
+    verify = calloc(1, sizeof(*verify));
+    if (!verify)
+        return NULL;
+
+    if (!(verify->map = fmap(fd, 0, 0, filename)) || verify->map->len <= 512) {
+        if (verify->map)
+            funmap(verify->map);
+        free(verify);
+        return NULL;
+    }
+
+    if (pthread_create(&verify->thread, NULL, cvd_verify_hash, verify)) {
+        funmap(verify->map);
+        free(verify);
+        return NULL;
+    }
+    return verify;
+}
+
+static cl_error_t cvd_verify_finish(struct cvd_verify *verify)
+{
+    cl_error_t ret;
+
+    pthread_join(verify->thread, NULL);
+    ret = verify->ret;
+
+    funmap(verify->map);
+    free(verify);
+    return ret;
+}
+#else
+struct cvd_verify;
+
+static struct cvd_verify *cvd_verify_start(int fd, const char *filename)
+{
+    UNUSEDPARAM(fd);
+    UNUSEDPARAM(filename);
+    return NULL;
+}
+
+static cl_error_t cvd_verify_finish(struct cvd_verify *verify)
+{
+    UNUSEDPARAM(verify);
     return CL_SUCCESS;
 }
+#endif
 
 cl_error_t cl_cvdverify(const char *file)
 {
@@ -621,14 +1063,16 @@ cl_error_t cli_cvdload(FILE *fs, struct cl_engine *engine, unsigned int *signo,
     int cfd;
     struct cli_dbio dbio;
     struct cli_dbinfo *dbinfo = NULL;
+    struct cvd_verify *verify = NULL;
     char *dupname;
 
     dbio.hashctx = NULL;
+    dbio.pipe    = NULL;
 
     cli_dbgmsg("in cli_cvdload()\n");
 
-    /* verify */
-    if ((ret = cli_cvdverify(fs, &cvd, dbtype)))
+    /* header only, the digital signature is verified while loading */
+    if ((ret = cli_cvdverify(fs, &cvd, 1)))
         return ret;
 
     if (dbtype <= 1) {
@@ -683,30 +1127,51 @@ cl_error_t cli_cvdload(FILE *fs, struct cl_engine *engine, unsigned int *signo,
         cli_warnmsg("*******************************************************************\n");
     }
 
-    cfd          = fileno(fs);
+    cfd = fileno(fs);
+    if (!dbtype) {
+        /*
+         * Content loaded from here on is trusted as official, so it must be
+         * verified first. Only a check-only load into a private engine that
+         * is thrown away afterwards (cl_cvdverify()) may hash the file in the
+         * background while it parses.
+         */
+        if (chkonly)
+            verify = cvd_verify_start(cfd, filename);
+        if (!verify && (ret = cli_cvdverify(fs, NULL, 0)))
+            return ret;
+    }
+
+    /*
+     * Until the background verification is done, nothing read from the file
+     * is treated as official or signed.
+     */
     dbio.chkonly = 0;
     if (dbtype == 2)
         ret = cli_tgzload(cfd, engine, signo, options | CL_DB_UNSIGNED, &dbio, NULL);
+    else if (verify)
+        ret = cli_tgzload(cfd, engine, signo, options, &dbio, NULL);
     else
         ret = cli_tgzload(cfd, engine, signo, options | CL_DB_OFFICIAL, &dbio, NULL);
     if (ret != CL_SUCCESS)
-        return ret;
+        goto done;
 
     dbinfo = engine->dbinfo;
     if (!dbinfo || !dbinfo->cvd || (dbinfo->cvd->version != cvd.version) || (dbinfo->cvd->sigs != cvd.sigs) || (dbinfo->cvd->fl != cvd.fl) || (dbinfo->cvd->stime != cvd.stime)) {
         cli_errmsg("cli_cvdload: Corrupted CVD header\n");
-        return CL_EMALFDB;
+        ret = CL_EMALFDB;
+        goto done;
     }
     dbinfo = engine->dbinfo ? engine->dbinfo->next : NULL;
     if (!dbinfo) {
         cli_errmsg("cli_cvdload: dbinfo error\n");
-        return CL_EMALFDB;
+        ret = CL_EMALFDB;
+        goto done;
     }
 
     dbio.chkonly = chkonly;
     if (dbtype == 2)
         options |= CL_DB_UNSIGNED;
-    else
+    else if (!verify)
         options |= CL_DB_SIGNED | CL_DB_OFFICIAL;
 
     ret = cli_tgzload(cfd, engine, signo, options, &dbio, dbinfo);
@@ -721,6 +1186,17 @@ cl_error_t cli_cvdload(FILE *fs, struct cl_engine *engine, unsigned int *signo,
         MPOOL_FREE(engine->mempool, dbinfo);
     }
 
+done:
+    if (verify) {
+        cl_error_t vret = cvd_verify_finish(verify);
+
+        if (vret != CL_SUCCESS) {
+            /* the engine is private to cl_cvdverify() and freed right after */
+            cli_errmsg("cli_cvdload: Can't verify %s\n", filename);
+            ret = vret;
+        }
+    }
+
     return ret;
 }
 
@@ -31,6 +31,8 @@
 #include <zlib.h>
 #include "clamav.h"
 
+struct cli_dbio_pipe;
+
 struct cli_dbio {
     gzFile gzs;
     FILE *fs;
@@ -39,8 +41,16 @@ struct cli_dbio {
     unsigned int usebuf, bufsize, readsize;
     unsigned int chkonly;
     void *hashctx;
+    struct cli_dbio_pipe *pipe; /* inflate thread feeding the loader, if any */
 };
 
+/*
+ * Read up to len bytes of the inflated stream from the pipeline (buf may be
+ * NULL to skip). Returns the number of bytes read, 0 at the end of the stream
+ * or -1 if inflating failed.
+ */
+int cli_dbio_pipe_read(struct cli_dbio_pipe *pipe, void *buf, unsigned int len);
+
 cl_error_t cli_cvdload(FILE *fs, struct cl_engine *engine, unsigned int *signo, unsigned int options, unsigned int dbtype, const char *filename, unsigned int chkonly);
 
 #endif
@@ -140,6 +140,7 @@ static struct dconf_module modules[] = {
     {"OTHER", "PNG", OTHER_CONF_PNG, 1},
     {"OTHER", "TIFF", OTHER_CONF_TIFF, 1},
     {"OTHER", "IMAGE FUZZY HASH", OTHER_CONF_IMAGE_FUZZY_HASH, 1},
+    {"OTHER", "PARALLEL BUILD", OTHER_CONF_PARALLEL_BUILD, 1},
 
     {"PHISHING", "ENGINE", PHISHING_CONF_ENGINE, 1},
     {"PHISHING", "ENTCONV", PHISHING_CONF_ENTCONV, 1},
@@ -148,6 +149,8 @@ static struct dconf_module modules[] = {
     {"BYTECODE", "JIT X86", BYTECODE_JIT_X86, 1},
     {"BYTECODE", "JIT PPC", BYTECODE_JIT_PPC, 1},
     {"BYTECODE", "JIT ARM", BYTECODE_JIT_ARM, 0},
+    {"BYTECODE", "THREADED", BYTECODE_INTERP_THREADED, 1},
+    {"BYTECODE", "SUPERINST", BYTECODE_INTERP_SUPERINST, 1},
 
     {"STATS", "DISABLED", DCONF_STATS_DISABLED, 0},
     {"STATS", "PESECTION DISABLED", DCONF_STATS_PE_SECTION_DISABLED, 0},
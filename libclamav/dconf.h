@@ -133,16 +133,19 @@ struct cli_dconf {
 #define OTHER_CONF_GIF              0x1000
 #define OTHER_CONF_TIFF             0x2000
 #define OTHER_CONF_IMAGE_FUZZY_HASH 0x4000
+#define OTHER_CONF_PARALLEL_BUILD   0x8000
 
 /* Phishing flags */
 #define PHISHING_CONF_ENGINE  0x1
 #define PHISHING_CONF_ENTCONV 0x2
 
 /* Bytecode flags */
-#define BYTECODE_INTERPRETER 0x1
-#define BYTECODE_JIT_X86     0x2
-#define BYTECODE_JIT_PPC     0x4
-#define BYTECODE_JIT_ARM     0x8
+#define BYTECODE_INTERPRETER      0x1
+#define BYTECODE_JIT_X86          0x2
+#define BYTECODE_JIT_PPC          0x4
+#define BYTECODE_JIT_ARM          0x8
+#define BYTECODE_INTERP_THREADED  0x10
+#define BYTECODE_INTERP_SUPERINST 0x20
 
 /* Stats/Intel flags */
 #define DCONF_STATS_DISABLED            0x1
@@ -156,6 +159,7 @@ struct cli_dconf {
 // clang-format on
 
 #define BYTECODE_ENGINE_MASK (BYTECODE_INTERPRETER | BYTECODE_JIT_X86 | BYTECODE_JIT_PPC | BYTECODE_JIT_ARM)
+#define BYTECODE_INTERP_MASK (BYTECODE_INTERP_THREADED | BYTECODE_INTERP_SUPERINST)
 
 #ifdef USE_MPOOL
 struct cli_dconf *
@@ -846,7 +846,7 @@ cl_error_t cli_unpackelf(cli_ctx *ctx)
     struct cli_bc_ctx *bc_ctx;
 
     /* Bytecode BC_ELF_UNPACKER hook */
-    bc_ctx = cli_bytecode_context_alloc();
+    bc_ctx = cli_bytecode_context_alloc(ctx->engine);
     if (!bc_ctx) {
         cli_errmsg("cli_scanelf: can't allocate memory for bc_ctx\n");
         ret = CL_EMEM;
@@ -45,6 +45,7 @@
 #include "filtering.h"
 
 #include "mpool.h"
+#include "threadlocal.h"
 
 // clang-format off
 
@@ -624,8 +625,62 @@ static int ac_maketrans(struct cli_matcher *root)
     return CL_SUCCESS;
 }
 
+static cl_error_t ac_data_pool_new(struct cli_matcher *root);
+static void ac_data_pool_free(struct cli_matcher *root);
+
+/*
+ * Logical signatures are only evaluated once one of their subsigs matched,
+ * except for those whose expression holds with no matches at all.
+ * Find these once at load time, rather than evaluating every lsig for every scan.
+ */
+static bool ac_lsig_evalalways(const struct cli_ac_lsig *ac_lsig)
+{
+    uint32_t zero_cnt[64] = {0};
+    unsigned int evalcnt  = 0;
+    uint64_t evalids      = 0;
+
+    if (ac_lsig->type != CLI_LSIG_NORMAL) {
+        /* yara conditions may not refer to any string */
+        return true;
+    }
+
+    return cli_ac_lsig_check(ac_lsig, zero_cnt, &evalcnt, &evalids) == 1;
+}
+
+static cl_error_t ac_build_lsig_evalmap(struct cli_matcher *root)
+{
+    uint32_t i, always = 0;
+
+    if (root->ac_lsig_evalmap) {
+        MPOOL_FREE(root->mempool, root->ac_lsig_evalmap);
+        root->ac_lsig_evalmap = NULL;
+    }
+
+    if (!root->ac_lsigs)
+        return CL_SUCCESS;
+
+    root->ac_lsig_evalmap = (uint64_t *)MPOOL_CALLOC(root->mempool, (root->ac_lsigs + 63) / 64, sizeof(uint64_t));
+    if (!root->ac_lsig_evalmap) {
+        cli_errmsg("cli_ac_buildtrie: Can't allocate memory for ac_lsig_evalmap\n");
+        return CL_EMEM;
+    }
+
+    for (i = 0; i < root->ac_lsigs; i++) {
+        if (ac_lsig_evalalways(root->ac_lsigtable[i])) {
+            root->ac_lsig_evalmap[i / 64] |= (uint64_t)1 << (i % 64);
+            always++;
+        }
+    }
+
+    cli_dbgmsg("cli_ac_buildtrie: %u of %u logical signatures are evaluated without a subsig match\n", always, root->ac_lsigs);
+
+    return CL_SUCCESS;
+}
+
 cl_error_t cli_ac_buildtrie(struct cli_matcher *root)
 {
+    cl_error_t ret;
+
     if (!root)
         return CL_EMALFDB;
 
@@ -639,7 +694,13 @@ cl_error_t cli_ac_buildtrie(struct cli_matcher *root)
 
     link_lists(root);
 
-    return ac_maketrans(root);
+    if ((ret = ac_maketrans(root)) != CL_SUCCESS)
+        return ret;
+
+    if ((ret = ac_build_lsig_evalmap(root)) != CL_SUCCESS)
+        return ret;
+
+    return ac_data_pool_new(root);
 }
 
 cl_error_t cli_ac_init(struct cli_matcher *root, uint8_t mindepth, uint8_t maxdepth, uint8_t dconf_prefiltering)
@@ -743,6 +804,12 @@ void cli_ac_free(struct cli_matcher *root)
         MPOOL_FREE(root->mempool, root->ac_reloff);
     }
 
+    if (root->ac_lsig_evalmap) {
+        MPOOL_FREE(root->mempool, root->ac_lsig_evalmap);
+    }
+
+    ac_data_pool_free(root);
+
     for (i = 0; i < root->ac_lists; i++) {
         MPOOL_FREE(root->mempool, root->ac_listtable[i]);
     }
@@ -772,16 +839,32 @@ void cli_ac_free(struct cli_matcher *root)
 }
 
 /*
- * In parse_only mode this function returns -1 on error or the max subsig id
+ * Result of scanning one level of a logical expression, see ac_chklsig_scan().
  */
-int cli_ac_chklsig(const char *expr, const char *end, uint32_t *lsigcnt, unsigned int *cnt, uint64_t *ids, unsigned int parse_only)
+struct lsig_expr_scan {
+    char op;              /* top level operator ('&' or '|'), splits the expression in two */
+    char op1;             /* operator at the first nesting level, for a block like "(0|1)>2" */
+    char mod;             /* last modifier ('=', '<' or '>') of a single subsig, e.g. "0>2" */
+    char blkmod;          /* modifier of a block */
+    unsigned int opoff;   /* offset of op */
+    unsigned int op1off;  /* offset of op1 */
+    unsigned int modoff;  /* offset of mod */
+    unsigned int blkend;  /* offset of the closing parenthesis of the block */
+    unsigned int modval1; /* count for the block modifier */
+    unsigned int modval2; /* number of different subsigs for the block modifier, 0 if not given */
+};
+
+/*
+ * Find the operator to split a logical expression at, or the modifiers of a
+ * single subsig or a block. Shared by the text evaluation and the compiler,
+ * so that both read an expression exactly the same way.
+ */
+static int ac_chklsig_scan(const char *expr, const char *end, struct lsig_expr_scan *scan)
 {
-    unsigned int i, len = end - expr, pth = 0, opoff = 0, op1off = 0, val;
-    unsigned int blkend = 0, id, modval1, modval2 = 0, lcnt = 0, rcnt = 0, tcnt, modoff = 0;
-    uint64_t lids = 0, rids = 0, tids;
-    int ret, lval, rval;
-    char op = 0, op1 = 0, mod = 0, blkmod = 0;
-    const char *lstart = expr, *lend = NULL, *rstart = NULL, *rend = end, *pt;
+    unsigned int i, len = end - expr, pth = 0;
+    int ret;
+
+    memset(scan, 0, sizeof(*scan));
 
     for (i = 0; i < len; i++) {
         switch (expr[i]) {
@@ -800,33 +883,33 @@ int cli_ac_chklsig(const char *expr, const char *end, uint32_t *lsigcnt, unsigne
             case '>':
             case '<':
             case '=':
-                mod    = expr[i];
-                modoff = i;
+                scan->mod    = expr[i];
+                scan->modoff = i;
                 break;
 
             default:
                 if (strchr("&|", expr[i])) {
                     if (!pth) {
-                        op    = expr[i];
-                        opoff = i;
+                        scan->op    = expr[i];
+                        scan->opoff = i;
                     } else if (pth == 1) {
-                        op1    = expr[i];
-                        op1off = i;
+                        scan->op1    = expr[i];
+                        scan->op1off = i;
                     }
                 }
         }
 
-        if (op)
+        if (scan->op)
             break;
 
-        if (op1 && !pth) {
-            blkend = i;
+        if (scan->op1 && !pth) {
+            scan->blkend = i;
             if (expr[i + 1] == '>' || expr[i + 1] == '<' || expr[i + 1] == '=') {
-                blkmod = expr[i + 1];
+                scan->blkmod = expr[i + 1];
 
-                ret = sscanf(&expr[i + 2], "%u,%u", &modval1, &modval2);
+                ret = sscanf(&expr[i + 2], "%u,%u", &scan->modval1, &scan->modval2);
                 if (ret != 2)
-                    ret = sscanf(&expr[i + 2], "%u", &modval1);
+                    ret = sscanf(&expr[i + 2], "%u", &scan->modval1);
 
                 if (!ret || ret == EOF) {
                     cli_errmsg("chklexpr: Syntax error: Missing number after '%c'\n", expr[i + 1]);
@@ -837,10 +920,10 @@ int cli_ac_chklsig(const char *expr, const char *end, uint32_t *lsigcnt, unsigne
                     ;
             }
 
-            if (&expr[i + 1] == rend)
+            if (&expr[i + 1] == end)
                 break;
             else
-                blkmod = 0;
+                scan->blkmod = 0;
         }
     }
 
@@ -849,6 +932,36 @@ int cli_ac_chklsig(const char *expr, const char *end, uint32_t *lsigcnt, unsigne
         return -1;
     }
 
+    return 0;
+}
+
+/*
+ * In parse_only mode this function returns -1 on error or the max subsig id
+ */
+int cli_ac_chklsig(const char *expr, const char *end, uint32_t *lsigcnt, unsigned int *cnt, uint64_t *ids, unsigned int parse_only)
+{
+    unsigned int len = end - expr, opoff, op1off, val;
+    unsigned int blkend, id, modval1, modval2, lcnt = 0, rcnt = 0, tcnt, modoff;
+    uint64_t lids = 0, rids = 0, tids;
+    int ret, lval, rval;
+    char op, op1, mod, blkmod;
+    const char *lstart = expr, *lend = NULL, *rstart = NULL, *rend = end, *pt;
+    struct lsig_expr_scan scan;
+
+    if (ac_chklsig_scan(expr, end, &scan) == -1)
+        return -1;
+
+    op      = scan.op;
+    op1     = scan.op1;
+    mod     = scan.mod;
+    blkmod  = scan.blkmod;
+    opoff   = scan.opoff;
+    op1off  = scan.op1off;
+    modoff  = scan.modoff;
+    blkend  = scan.blkend;
+    modval1 = scan.modval1;
+    modval2 = scan.modval2;
+
     if (!op && !op1) {
         if (expr[0] == '(')
             return cli_ac_chklsig(++expr, --end, lsigcnt, cnt, ids, parse_only);
@@ -1013,6 +1126,272 @@ int cli_ac_chklsig(const char *expr, const char *end, uint32_t *lsigcnt, unsigne
     }
 }
 
+/*
+ * Logical expressions are compiled in two steps: ac_lsig_parse() builds the
+ * expression tree, reading the text exactly as cli_ac_chklsig() does, and
+ * ac_lsig_emit() flattens it to postfix. Both operands of '&' and '|' are
+ * always evaluated and the operators are commutative, so the deeper operand
+ * is emitted first to keep the evaluation stack small.
+ */
+#define LSIG_PROG_MAX_DEPTH 64
+
+struct lsig_expr_node {
+    struct cli_lsig_op op;
+    int left, right;    /* operands, the block modifier only has left */
+    unsigned int depth; /* evaluation stack needed for this node */
+};
+
+struct lsig_expr_tree {
+    struct lsig_expr_node *nodes;
+    unsigned int count, max;
+};
+
+static int ac_lsig_node(struct lsig_expr_tree *tree, uint8_t code, int left, int right)
+{
+    struct lsig_expr_node *node;
+
+    if (tree->count >= tree->max)
+        return -1;
+
+    node = &tree->nodes[tree->count];
+    memset(node, 0, sizeof(*node));
+    node->op.code = code;
+    node->left    = left;
+    node->right   = right;
+
+    if (left < 0) {
+        node->depth = 1;
+    } else if (right < 0) {
+        node->depth = tree->nodes[left].depth;
+    } else if (tree->nodes[left].depth == tree->nodes[right].depth) {
+        node->depth = tree->nodes[left].depth + 1;
+    } else {
+        node->depth = MAX(tree->nodes[left].depth, tree->nodes[right].depth);
+    }
+
+    return tree->count++;
+}
+
+/*
+ * Returns the index of the root node of the expression, or -1 if it can't be compiled.
+ */
+static int ac_lsig_parse(const char *expr, const char *end, struct lsig_expr_tree *tree)
+{
+    unsigned int len = end - expr, id, val;
+    const char *lstart = expr, *rend = end;
+    struct lsig_expr_scan scan;
+    int left, right, node;
+
+    if (!len || ac_chklsig_scan(expr, end, &scan) == -1)
+        return -1;
+
+    if (!scan.op && !scan.op1) {
+        if (expr[0] == '(')
+            return ac_lsig_parse(expr + 1, end - 1, tree);
+
+        if (sscanf(expr, "%u", &id) != 1 || id >= 64)
+            return -1;
+
+        if (!scan.mod) {
+            node = ac_lsig_node(tree, CLI_LSIG_OP_SUB, -1, -1);
+            if (node >= 0)
+                tree->nodes[node].op.id = id;
+            return node;
+        }
+
+        if (!strchr("=<>", scan.mod) || sscanf(expr + scan.modoff + 1, "%u", &val) != 1)
+            return -1;
+
+        node = ac_lsig_node(tree, CLI_LSIG_OP_SUBCNT, -1, -1);
+        if (node >= 0) {
+            tree->nodes[node].op.id   = id;
+            tree->nodes[node].op.mod  = scan.mod;
+            tree->nodes[node].op.val1 = val;
+        }
+        return node;
+    }
+
+    if (!scan.op) {
+        scan.op    = scan.op1;
+        scan.opoff = scan.op1off;
+        lstart++;
+        rend = &expr[scan.blkend];
+    }
+
+    if (!scan.opoff || scan.opoff + 1 == len)
+        return -1;
+
+    if ((left = ac_lsig_parse(lstart, &expr[scan.opoff], tree)) < 0)
+        return -1;
+    if ((right = ac_lsig_parse(&expr[scan.opoff + 1], rend, tree)) < 0)
+        return -1;
+
+    node = ac_lsig_node(tree, scan.op == '&' ? CLI_LSIG_OP_AND : CLI_LSIG_OP_OR, left, right);
+    if (node < 0 || !scan.blkmod)
+        return node;
+
+    node = ac_lsig_node(tree, CLI_LSIG_OP_BLOCK, node, -1);
+    if (node >= 0) {
+        tree->nodes[node].op.mod  = scan.blkmod;
+        tree->nodes[node].op.val1 = scan.modval1;
+        tree->nodes[node].op.val2 = scan.modval2;
+    }
+    return node;
+}
+
+static void ac_lsig_emit(const struct lsig_expr_tree *tree, int idx, struct cli_lsig_op *prog, uint32_t *len)
+{
+    const struct lsig_expr_node *node = &tree->nodes[idx];
+
+    if (node->left >= 0 && node->right >= 0) {
+        if (tree->nodes[node->right].depth > tree->nodes[node->left].depth) {
+            ac_lsig_emit(tree, node->right, prog, len);
+            ac_lsig_emit(tree, node->left, prog, len);
+        } else {
+            ac_lsig_emit(tree, node->left, prog, len);
+            ac_lsig_emit(tree, node->right, prog, len);
+        }
+    } else if (node->left >= 0) {
+        ac_lsig_emit(tree, node->left, prog, len);
+    }
+
+    prog[(*len)++] = node->op;
+}
+
+cl_error_t cli_ac_lsig_compile(struct cli_matcher *root, struct cli_ac_lsig *ac_lsig)
+{
+    struct lsig_expr_tree tree;
+    const char *logic;
+    uint32_t len = 0;
+    int top;
+
+    if (ac_lsig->type != CLI_LSIG_NORMAL || !ac_lsig->u.logic)
+        return CL_SUCCESS;
+
+    logic      = ac_lsig->u.logic;
+    tree.max   = 2 * strlen(logic) + 1;
+    tree.count = 0;
+    tree.nodes = (struct lsig_expr_node *)cli_max_malloc(tree.max * sizeof(struct lsig_expr_node));
+    if (!tree.nodes) {
+        cli_errmsg("cli_ac_lsig_compile: Can't allocate memory for the expression tree\n");
+        return CL_EMEM;
+    }
+
+    top = ac_lsig_parse(logic, logic + strlen(logic), &tree);
+    if (top < 0 || tree.nodes[top].depth > LSIG_PROG_MAX_DEPTH) {
+        /* Not an error, the expression is evaluated from the text. */
+        cli_dbgmsg("cli_ac_lsig_compile: Can't compile %s\n", logic);
+        free(tree.nodes);
+        return CL_SUCCESS;
+    }
+
+    ac_lsig->prog = (struct cli_lsig_op *)MPOOL_MALLOC(root->mempool, tree.count * sizeof(struct cli_lsig_op));
+    if (!ac_lsig->prog) {
+        cli_errmsg("cli_ac_lsig_compile: Can't allocate memory for the program\n");
+        free(tree.nodes);
+        return CL_EMEM;
+    }
+
+    ac_lsig_emit(&tree, top, ac_lsig->prog, &len);
+    ac_lsig->prog_len = len;
+
+    free(tree.nodes);
+    return CL_SUCCESS;
+}
+
+static inline int ac_lsig_cmp(char mod, uint32_t val, uint32_t ref)
+{
+    switch (mod) {
+        case '=':
+            return val == ref;
+        case '<':
+            return val < ref;
+        case '>':
+            return val > ref;
+        default:
+            return 0;
+    }
+}
+
+static int ac_lsig_exec(const struct cli_lsig_op *prog, uint32_t prog_len, const uint32_t *lsigcnt, unsigned int *cnt, uint64_t *ids)
+{
+    struct {
+        uint64_t ids;
+        uint32_t cnt;
+        int ret;
+    } stack[LSIG_PROG_MAX_DEPTH];
+    unsigned int sp = 0, val;
+    uint32_t pc;
+    uint64_t tids;
+
+    for (pc = 0; pc < prog_len; pc++) {
+        const struct cli_lsig_op *op = &prog[pc];
+
+        switch (op->code) {
+            case CLI_LSIG_OP_SUB:
+            case CLI_LSIG_OP_SUBCNT:
+                val = lsigcnt[op->id];
+                if (op->code == CLI_LSIG_OP_SUB ? val != 0 : ac_lsig_cmp(op->mod, val, op->val1)) {
+                    stack[sp].ret = 1;
+                    stack[sp].cnt = val;
+                    stack[sp].ids = (uint64_t)1 << op->id;
+                } else {
+                    stack[sp].ret = 0;
+                    stack[sp].cnt = 0;
+                    stack[sp].ids = 0;
+                }
+                sp++;
+                break;
+
+            case CLI_LSIG_OP_AND:
+            case CLI_LSIG_OP_OR:
+                sp--;
+                if (op->code == CLI_LSIG_OP_AND ? (stack[sp - 1].ret && stack[sp].ret) : (stack[sp - 1].ret || stack[sp].ret)) {
+                    stack[sp - 1].ret = 1;
+                    stack[sp - 1].cnt += stack[sp].cnt;
+                    stack[sp - 1].ids |= stack[sp].ids;
+                } else {
+                    stack[sp - 1].ret = 0;
+                    stack[sp - 1].cnt = 0;
+                    stack[sp - 1].ids = 0;
+                }
+                break;
+
+            case CLI_LSIG_OP_BLOCK:
+                /* The count of a failed operation is 0, which may still satisfy e.g. "(0|1)<1". */
+                stack[sp - 1].ret = ac_lsig_cmp(op->mod, stack[sp - 1].cnt, op->val1);
+                if (stack[sp - 1].ret && op->val2) {
+                    val  = 0;
+                    tids = stack[sp - 1].ids;
+                    while (tids) {
+                        val += tids & (uint64_t)1;
+                        tids >>= 1;
+                    }
+                    stack[sp - 1].ret = val >= op->val2;
+                }
+                if (!stack[sp - 1].ret)
+                    stack[sp - 1].cnt = 0;
+                /* The subsigs of a block aren't passed on to the enclosing operation. */
+                stack[sp - 1].ids = 0;
+                break;
+        }
+    }
+
+    if (stack[0].ret) {
+        *cnt += stack[0].cnt;
+        *ids |= stack[0].ids;
+    }
+    return stack[0].ret;
+}
+
+int cli_ac_lsig_check(const struct cli_ac_lsig *ac_lsig, uint32_t *lsigcnt, unsigned int *cnt, uint64_t *ids)
+{
+    if (ac_lsig->prog)
+        return ac_lsig_exec(ac_lsig->prog, ac_lsig->prog_len, lsigcnt, cnt, ids);
+
+    return cli_ac_chklsig(ac_lsig->u.logic, ac_lsig->u.logic + strlen(ac_lsig->u.logic), lsigcnt, cnt, ids, 0);
+}
+
 inline static int ac_findmatch_special(const unsigned char *buffer, uint32_t offset, uint32_t bp, uint32_t fileoffset, uint32_t length,
                                        const struct cli_ac_patt *pattern, uint32_t pp, uint16_t specialcnt, uint32_t *start, uint32_t *end, int rev);
 static int ac_backward_match_branch(const unsigned char *buffer, uint32_t bp, uint32_t offset, uint32_t length, uint32_t fileoffset,
@@ -1398,9 +1777,36 @@ inline static int ac_findmatch(const unsigned char *buffer, uint32_t offset, uin
     return 0;
 }
 
+/*
+ * The match state of a logical signature (subsig counts, first and last
+ * offsets) is only allocated once one of its subsigs matched, see
+ * lsig_touch(). Until then lsigcnt[i], lsigsuboff_first[i] and
+ * lsigsuboff_last[i] point to a shared read-only row of zeros or
+ * CLI_OFF_NONE, so initialising the match data costs a few pointers per lsig
+ * instead of 768 bytes.
+ */
+#define AC_LSIG_ROW_SIZE (3 * 64) /* counts, first offsets, last offsets */
+#define AC_LSIG_CHUNK_ROWS 16
+
+/*
+ * The released match data is kept per thread, so that the scanning threads
+ * don't contend for it: taking and returning it is a few pointer
+ * comparisons instead of a lock round trip per scanned buffer and root.
+ */
+struct ac_data_stash {
+    unsigned int count;
+    struct cli_ac_data entries[CLI_AC_DATA_POOL_MAX];
+};
+
+struct cli_ac_data_pool {
+    cli_threadlocal_t *stashes; /* a struct ac_data_stash per scanning thread */
+};
+
+static void ac_data_destroy(struct cli_ac_data *data);
+
 cl_error_t cli_ac_initdata(struct cli_ac_data *data, uint32_t partsigs, uint32_t lsigs, uint32_t reloffsigs, uint8_t tracklen)
 {
-    unsigned int i, j;
+    unsigned int i;
 
     UNUSEDPARAM(tracklen);
 
@@ -1415,7 +1821,7 @@ cl_error_t cli_ac_initdata(struct cli_ac_data *data, uint32_t partsigs, uint32_t
         data->offset = (uint32_t *)malloc(reloffsigs * 2 * sizeof(uint32_t));
         if (!data->offset) {
             cli_errmsg("cli_ac_init: Can't allocate memory for data->offset\n");
-            return CL_EMEM;
+            goto mem_error;
         }
         for (i = 0; i < reloffsigs * 2; i += 2)
             data->offset[i] = CLI_OFF_NONE;
@@ -1423,128 +1829,121 @@ cl_error_t cli_ac_initdata(struct cli_ac_data *data, uint32_t partsigs, uint32_t
 
     data->partsigs = partsigs;
     if (partsigs) {
-        data->offmatrix = (uint32_t ***)calloc(partsigs, sizeof(uint32_t **));
-        if (!data->offmatrix) {
+        data->offmatrix     = (uint32_t ***)calloc(partsigs, sizeof(uint32_t **));
+        data->partsig_dirty = (uint64_t *)calloc((partsigs + 63) / 64, sizeof(uint64_t));
+        if (!data->offmatrix || !data->partsig_dirty) {
             cli_errmsg("cli_ac_init: Can't allocate memory for data->offmatrix\n");
-
-            if (reloffsigs)
-                free(data->offset);
-
-            return CL_EMEM;
+            goto mem_error;
         }
     }
 
     data->lsigs = lsigs;
     if (lsigs) {
-        data->lsigcnt = (uint32_t **)malloc(lsigs * sizeof(uint32_t *));
-        if (!data->lsigcnt) {
-            if (partsigs)
-                free(data->offmatrix);
-
-            if (reloffsigs)
-                free(data->offset);
-
-            cli_errmsg("cli_ac_init: Can't allocate memory for data->lsigcnt\n");
-            return CL_EMEM;
+        data->lsigcnt          = (uint32_t **)malloc(lsigs * sizeof(uint32_t *));
+        data->lsigsuboff_last  = (uint32_t **)malloc(lsigs * sizeof(uint32_t *));
+        data->lsigsuboff_first = (uint32_t **)malloc(lsigs * sizeof(uint32_t *));
+        data->lsig_shared      = (uint32_t *)malloc(2 * 64 * sizeof(uint32_t));
+        data->lsig_dirty       = (uint64_t *)calloc((lsigs + 63) / 64, sizeof(uint64_t));
+        data->yr_matches       = (uint8_t *)calloc(lsigs, sizeof(uint8_t));
+        /* subsig offsets */
+        data->lsig_matches = (struct cli_lsig_matches **)calloc(lsigs, sizeof(struct cli_lsig_matches *));
+        if (!data->lsigcnt || !data->lsigsuboff_last || !data->lsigsuboff_first || !data->lsig_shared ||
+            !data->lsig_dirty || !data->yr_matches || !data->lsig_matches) {
+            cli_errmsg("cli_ac_init: Can't allocate memory for the logical signature match data\n");
+            goto mem_error;
         }
-        data->lsigcnt[0] = (uint32_t *)calloc(lsigs * 64, sizeof(uint32_t));
-        if (!data->lsigcnt[0]) {
-            free(data->lsigcnt);
-            if (partsigs)
-                free(data->offmatrix);
 
-            if (reloffsigs)
-                free(data->offset);
-
-            cli_errmsg("cli_ac_init: Can't allocate memory for data->lsigcnt[0]\n");
-            return CL_EMEM;
+        for (i = 0; i < 64; i++) {
+            data->lsig_shared[i]      = 0;
+            data->lsig_shared[64 + i] = CLI_OFF_NONE;
         }
-        for (i = 1; i < lsigs; i++)
-            data->lsigcnt[i] = data->lsigcnt[0] + 64 * i;
-        data->yr_matches = (uint8_t *)calloc(lsigs, sizeof(uint8_t));
-        if (data->yr_matches == NULL) {
-            free(data->lsigcnt[0]);
-            free(data->lsigcnt);
-            if (partsigs)
-                free(data->offmatrix);
-
-            if (reloffsigs)
-                free(data->offset);
-            return CL_EMEM;
+        for (i = 0; i < lsigs; i++) {
+            data->lsigcnt[i]          = data->lsig_shared;
+            data->lsigsuboff_first[i] = data->lsig_shared + 64;
+            data->lsigsuboff_last[i]  = data->lsig_shared + 64;
         }
+    }
+    for (i = 0; i < 32; i++)
+        data->macro_lastmatch[i] = CLI_OFF_NONE;
 
-        /* subsig offsets */
-        data->lsig_matches = (struct cli_lsig_matches **)calloc(lsigs, sizeof(struct cli_lsig_matches *));
-        if (!data->lsig_matches) {
-            free(data->yr_matches);
-            free(data->lsigcnt[0]);
-            free(data->lsigcnt);
-            if (partsigs)
-                free(data->offmatrix);
+    data->min_partno = 1;
 
-            if (reloffsigs)
-                free(data->offset);
+    return CL_SUCCESS;
 
-            cli_errmsg("cli_ac_init: Can't allocate memory for data->lsig_matches\n");
-            return CL_EMEM;
-        }
-        data->lsigsuboff_last  = (uint32_t **)malloc(lsigs * sizeof(uint32_t *));
-        data->lsigsuboff_first = (uint32_t **)malloc(lsigs * sizeof(uint32_t *));
-        if (!data->lsigsuboff_last || !data->lsigsuboff_first) {
-            free(data->lsig_matches);
-            free(data->lsigsuboff_last);
-            free(data->lsigsuboff_first);
-            free(data->yr_matches);
-            free(data->lsigcnt[0]);
-            free(data->lsigcnt);
-            if (partsigs)
-                free(data->offmatrix);
-
-            if (reloffsigs)
-                free(data->offset);
-
-            cli_errmsg("cli_ac_init: Can't allocate memory for data->lsigsuboff_(last|first)\n");
-            return CL_EMEM;
-        }
-        data->lsigsuboff_last[0]  = (uint32_t *)calloc(lsigs * 64, sizeof(uint32_t));
-        data->lsigsuboff_first[0] = (uint32_t *)calloc(lsigs * 64, sizeof(uint32_t));
-        if (!data->lsigsuboff_last[0] || !data->lsigsuboff_first[0]) {
-            free(data->lsig_matches);
-            free(data->lsigsuboff_last[0]);
-            free(data->lsigsuboff_first[0]);
-            free(data->lsigsuboff_last);
-            free(data->lsigsuboff_first);
-            free(data->yr_matches);
-            free(data->lsigcnt[0]);
-            free(data->lsigcnt);
-            if (partsigs)
-                free(data->offmatrix);
-
-            if (reloffsigs)
-                free(data->offset);
-
-            cli_errmsg("cli_ac_init: Can't allocate memory for data->lsigsuboff_(last|first)[0]\n");
-            return CL_EMEM;
-        }
-        for (j = 0; j < 64; j++) {
-            data->lsigsuboff_last[0][j]  = CLI_OFF_NONE;
-            data->lsigsuboff_first[0][j] = CLI_OFF_NONE;
+mem_error:
+    ac_data_destroy(data);
+    return CL_EMEM;
+}
+
+/*
+ * Clear what the last scan left in the match data, touching only the
+ * signatures that matched, so that it can be reused for the next one.
+ */
+static void ac_data_reset(struct cli_ac_data *data)
+{
+    uint32_t w, i, j;
+    uint64_t dirty;
+
+    for (w = 0; w < (data->partsigs + 63) / 64; w++) {
+        for (dirty = data->partsig_dirty[w], i = w * 64; dirty; dirty >>= 1, i++) {
+            if ((dirty & 1) && data->offmatrix[i]) {
+                free(data->offmatrix[i][0]);
+                free(data->offmatrix[i]);
+                data->offmatrix[i] = NULL;
+            }
         }
-        for (i = 1; i < lsigs; i++) {
-            data->lsigsuboff_last[i]  = data->lsigsuboff_last[0] + 64 * i;
-            data->lsigsuboff_first[i] = data->lsigsuboff_first[0] + 64 * i;
-            for (j = 0; j < 64; j++) {
-                data->lsigsuboff_last[i][j]  = CLI_OFF_NONE;
-                data->lsigsuboff_first[i][j] = CLI_OFF_NONE;
+        data->partsig_dirty[w] = 0;
+    }
+
+    for (w = 0; w < (data->lsigs + 63) / 64; w++) {
+        for (dirty = data->lsig_dirty[w], i = w * 64; dirty; dirty >>= 1, i++) {
+            if (!(dirty & 1))
+                continue;
+
+            data->lsigcnt[i]          = data->lsig_shared;
+            data->lsigsuboff_first[i] = data->lsig_shared + 64;
+            data->lsigsuboff_last[i]  = data->lsig_shared + 64;
+
+            if (data->lsig_matches[i]) {
+                for (j = 0; j < data->lsig_matches[i]->subsigs; j++)
+                    free(data->lsig_matches[i]->matches[j]);
+                free(data->lsig_matches[i]);
+                data->lsig_matches[i] = NULL;
             }
         }
+        data->lsig_dirty[w] = 0;
     }
+    data->lsig_rows_used = 0;
+    if (data->lsigs)
+        memset(data->yr_matches, 0, data->lsigs);
+
+    for (i = 0; i < data->reloffsigs * 2; i += 2)
+        data->offset[i] = CLI_OFF_NONE;
+
     for (i = 0; i < 32; i++)
         data->macro_lastmatch[i] = CLI_OFF_NONE;
 
+    data->vinfo      = NULL;
     data->min_partno = 1;
+}
 
-    return CL_SUCCESS;
+cl_error_t cli_ac_initdata_pool(struct cli_matcher *root, struct cli_ac_data *data)
+{
+    struct cli_ac_data_pool *pool = root->ac_data_pool;
+    struct ac_data_stash *stash;
+    cl_error_t ret;
+
+    if (pool && (stash = cli_threadlocal_get(pool->stashes)) && stash->count) {
+        stash->count--;
+        memcpy(data, &stash->entries[stash->count], sizeof(struct cli_ac_data));
+        return CL_SUCCESS;
+    }
+
+    ret = cli_ac_initdata(data, root->ac_partsigs, root->ac_lsigs, root->ac_reloff_num, CLI_DEFAULT_AC_TRACKLEN);
+    if (CL_SUCCESS == ret)
+        data->pool = pool;
+
+    return ret;
 }
 
 cl_error_t cli_ac_caloff(const struct cli_matcher *root, struct cli_ac_data *data, const struct cli_target_info *info)
@@ -1571,58 +1970,106 @@ cl_error_t cli_ac_caloff(const struct cli_matcher *root, struct cli_ac_data *dat
     return CL_SUCCESS;
 }
 
-void cli_ac_freedata(struct cli_ac_data *data)
+static void ac_data_destroy(struct cli_ac_data *data)
 {
-    uint32_t i;
+    uint32_t i, j;
 
-    if (!data)
-        return;
-
-    if (data->partsigs) {
+    if (data->offmatrix) {
         for (i = 0; i < data->partsigs; i++) {
             if (data->offmatrix[i]) {
                 free(data->offmatrix[i][0]);
                 free(data->offmatrix[i]);
             }
         }
-        free(data->offmatrix);
-        data->offmatrix = NULL;
-        data->partsigs  = 0;
-    }
-
-    if (data->lsigs) {
-        if (data->lsig_matches) {
-            for (i = 0; i < data->lsigs; i++) {
-                struct cli_lsig_matches *ls_matches;
-                if ((ls_matches = data->lsig_matches[i])) {
-                    uint32_t j;
-                    for (j = 0; j < ls_matches->subsigs; j++) {
-                        if (ls_matches->matches[j]) {
-                            free(ls_matches->matches[j]);
-                            ls_matches->matches[j] = 0;
-                        }
-                    }
-                    free(data->lsig_matches[i]);
-                    data->lsig_matches[i] = 0;
-                }
+    }
+    free(data->offmatrix);
+    free(data->partsig_dirty);
+
+    if (data->lsig_matches) {
+        for (i = 0; i < data->lsigs; i++) {
+            if (data->lsig_matches[i]) {
+                for (j = 0; j < data->lsig_matches[i]->subsigs; j++)
+                    free(data->lsig_matches[i]->matches[j]);
+                free(data->lsig_matches[i]);
             }
-            free(data->lsig_matches);
-            data->lsig_matches = 0;
         }
-        free(data->yr_matches);
-        free(data->lsigcnt[0]);
-        free(data->lsigcnt);
-        free(data->lsigsuboff_last[0]);
-        free(data->lsigsuboff_last);
-        free(data->lsigsuboff_first[0]);
-        free(data->lsigsuboff_first);
-        data->lsigs = 0;
     }
+    free(data->lsig_matches);
+    free(data->yr_matches);
+    free(data->lsig_dirty);
+    free(data->lsigcnt);
+    free(data->lsigsuboff_last);
+    free(data->lsigsuboff_first);
+    free(data->lsig_shared);
+    for (i = 0; i < data->lsig_chunks_num; i++)
+        free(data->lsig_chunks[i]);
+    free(data->lsig_chunks);
+
+    free(data->offset);
+
+    memset(data, 0, sizeof(struct cli_ac_data));
+}
+
+void cli_ac_freedata(struct cli_ac_data *data)
+{
+    struct ac_data_stash *stash;
+
+    if (!data)
+        return;
+
+    if (data->pool && (stash = cli_threadlocal_get(data->pool->stashes)) && stash->count < CLI_AC_DATA_POOL_MAX) {
+        ac_data_reset(data);
+        memcpy(&stash->entries[stash->count], data, sizeof(struct cli_ac_data));
+        stash->count++;
+        memset(data, 0, sizeof(struct cli_ac_data));
+        return;
+    }
+
+    ac_data_destroy(data);
+}
 
-    if (data->reloffsigs) {
-        free(data->offset);
-        data->reloffsigs = 0;
+/* a thread exited or the root is freed */
+static void ac_data_stash_release(void *ptr)
+{
+    struct ac_data_stash *stash = (struct ac_data_stash *)ptr;
+
+    while (stash->count)
+        ac_data_destroy(&stash->entries[--stash->count]);
+}
+
+static cl_error_t ac_data_pool_new(struct cli_matcher *root)
+{
+    struct cli_ac_data_pool *pool;
+
+    if (root->ac_data_pool)
+        return CL_SUCCESS;
+
+    pool = (struct cli_ac_data_pool *)calloc(1, sizeof(struct cli_ac_data_pool));
+    if (!pool) {
+        cli_errmsg("cli_ac_buildtrie: Can't allocate memory for the match data pool\n");
+        return CL_EMEM;
     }
+    pool->stashes = cli_threadlocal_new(sizeof(struct ac_data_stash), ac_data_stash_release);
+    if (!pool->stashes) {
+        cli_errmsg("cli_ac_buildtrie: Can't allocate the per-thread match data pools\n");
+        free(pool);
+        return CL_EMEM;
+    }
+
+    root->ac_data_pool = pool;
+    return CL_SUCCESS;
+}
+
+static void ac_data_pool_free(struct cli_matcher *root)
+{
+    struct cli_ac_data_pool *pool = root->ac_data_pool;
+
+    if (!pool)
+        return;
+
+    cli_threadlocal_free(pool->stashes);
+    free(pool);
+    root->ac_data_pool = NULL;
 }
 
 /* returns only CL_SUCCESS or CL_EMEM */
@@ -1658,9 +2105,56 @@ inline static int ac_addtype(struct cli_matched_type **list, cli_file_t type, of
     return CL_SUCCESS;
 }
 
-void lsig_increment_subsig_match(struct cli_ac_data *mdata, uint32_t lsig_id, uint32_t subsig_id)
+/*
+ * Give an lsig its own match state before anything of it is recorded, and mark it for cli_exp_eval().
+ */
+static cl_error_t lsig_touch(struct cli_ac_data *mdata, uint32_t lsig_id)
+{
+    uint32_t *row, **chunks, i;
+
+    if (mdata->lsig_dirty[lsig_id / 64] & ((uint64_t)1 << (lsig_id % 64)))
+        return CL_SUCCESS;
+
+    if (mdata->lsig_rows_used == mdata->lsig_chunks_num * AC_LSIG_CHUNK_ROWS) {
+        chunks = (uint32_t **)cli_safer_realloc(mdata->lsig_chunks, (mdata->lsig_chunks_num + 1) * sizeof(uint32_t *));
+        if (!chunks) {
+            cli_errmsg("lsig_touch: Can't allocate memory for the lsig match state\n");
+            return CL_EMEM;
+        }
+        mdata->lsig_chunks = chunks;
+
+        chunks[mdata->lsig_chunks_num] = (uint32_t *)malloc(AC_LSIG_CHUNK_ROWS * AC_LSIG_ROW_SIZE * sizeof(uint32_t));
+        if (!chunks[mdata->lsig_chunks_num]) {
+            cli_errmsg("lsig_touch: Can't allocate memory for the lsig match state\n");
+            return CL_EMEM;
+        }
+        mdata->lsig_chunks_num++;
+    }
+
+    row = mdata->lsig_chunks[mdata->lsig_rows_used / AC_LSIG_CHUNK_ROWS] + (mdata->lsig_rows_used % AC_LSIG_CHUNK_ROWS) * AC_LSIG_ROW_SIZE;
+    mdata->lsig_rows_used++;
+
+    memset(row, 0, 64 * sizeof(uint32_t));
+    for (i = 64; i < AC_LSIG_ROW_SIZE; i++)
+        row[i] = CLI_OFF_NONE;
+
+    mdata->lsigcnt[lsig_id]          = row;
+    mdata->lsigsuboff_first[lsig_id] = row + 64;
+    mdata->lsigsuboff_last[lsig_id]  = row + 128;
+
+    mdata->lsig_dirty[lsig_id / 64] |= (uint64_t)1 << (lsig_id % 64);
+    return CL_SUCCESS;
+}
+
+cl_error_t lsig_increment_subsig_match(struct cli_ac_data *mdata, uint32_t lsig_id, uint32_t subsig_id)
 {
+    cl_error_t ret;
+
+    if ((ret = lsig_touch(mdata, lsig_id)) != CL_SUCCESS)
+        return ret;
+
     mdata->lsigcnt[lsig_id][subsig_id]++;
+    return CL_SUCCESS;
 }
 
 cl_error_t lsig_sub_matched(const struct cli_matcher *root, struct cli_ac_data *mdata, uint32_t lsig_id, uint32_t subsig_id, uint32_t realoff, int partial)
@@ -1669,6 +2163,10 @@ cl_error_t lsig_sub_matched(const struct cli_matcher *root, struct cli_ac_data *
     const struct cli_lsig_tdb *tdb    = &ac_lsig->tdb;
 
     if (realoff != CLI_OFF_NONE) {
+        cl_error_t ret = lsig_touch(mdata, lsig_id);
+        if (ret != CL_SUCCESS)
+            return ret;
+
         if (mdata->lsigsuboff_first[lsig_id][subsig_id] == CLI_OFF_NONE) {
             /* If this is the first subsig in the lsig, store the offset in the first-list. */
             mdata->lsigsuboff_first[lsig_id][subsig_id] = realoff;
@@ -1945,6 +2443,7 @@ cl_error_t cli_ac_scanbuff(
                                     mdata->offmatrix[pt->sigid - 1][j]    = mdata->offmatrix[pt->sigid - 1][0] + j * (CLI_DEFAULT_AC_TRACKLEN + 2);
                                     mdata->offmatrix[pt->sigid - 1][j][0] = 0;
                                 }
+                                mdata->partsig_dirty[(pt->sigid - 1) / 64] |= (uint64_t)1 << ((pt->sigid - 1) % 64);
                             }
                             offmatrix = mdata->offmatrix[pt->sigid - 1];
 
@@ -63,13 +63,23 @@ typedef struct cli_ac_data {
     uint32_t **lsigsuboff_last, **lsigsuboff_first;
     struct cli_lsig_matches **lsig_matches;
     uint8_t *yr_matches;
+    uint64_t *lsig_dirty; /* bitmap of the lsigs with at least one subsig match, see cli_exp_eval() */
     uint32_t *offset;
     uint32_t macro_lastmatch[32];
     /** Hashset for versioninfo matching */
     const struct cli_hashset *vinfo;
     uint32_t min_partno;
+    uint64_t *partsig_dirty;        /* bitmap of the allocated offmatrix entries */
+    uint32_t *lsig_shared;          /* read-only match state of the lsigs without a match */
+    uint32_t **lsig_chunks;         /* storage for the match state of the lsigs in lsig_dirty */
+    uint32_t lsig_chunks_num;       /* number of lsig_chunks */
+    uint32_t lsig_rows_used;        /* number of lsig states used in lsig_chunks */
+    struct cli_ac_data_pool *pool;  /* pool cli_ac_freedata() returns the data to, if any */
 } cli_ac_data;
 
+/* Maximum number of released match data kept for reuse per matcher root and thread */
+#define CLI_AC_DATA_POOL_MAX 4
+
 struct cli_alt_node {
     uint16_t *str;
     uint16_t len;
@@ -132,6 +142,8 @@ struct cli_ac_result {
 
 #include "matcher.h"
 
+struct cli_ac_lsig;
+
 /**
  * @brief Add a simple sub-pattern into the AC trie.
  *
@@ -145,10 +157,25 @@ cl_error_t cli_ac_addpatt(struct cli_matcher *root, struct cli_ac_patt *pattern)
  * This is and alternative to lsig_increment_subsig_match() for use in subsigs that don't have a specific offset,
  * like byte-compare subsigs and fuzzy-hash subsigs.
  */
-void lsig_increment_subsig_match(struct cli_ac_data *mdata, uint32_t lsig_id, uint32_t subsig_id);
+cl_error_t lsig_increment_subsig_match(struct cli_ac_data *mdata, uint32_t lsig_id, uint32_t subsig_id);
 
 cl_error_t cli_ac_initdata(struct cli_ac_data *data, uint32_t partsigs, uint32_t lsigs, uint32_t reloffsigs, uint8_t tracklen);
 
+/**
+ * @brief Initialize the match data for a scan with a root, reusing one released by an earlier scan if available.
+ *
+ * The data is returned to the root's pool by cli_ac_freedata(), only clearing
+ * the state of the signatures that matched. The pool is kept per thread, so
+ * the data released by one thread is only reused by that thread. Roots that weren't built with
+ * cli_ac_buildtrie() have no pool, the data is then allocated as by
+ * cli_ac_initdata().
+ *
+ * @param root      The root that will be scanned with the data.
+ * @param[out] data The match data.
+ * @return cl_error_t CL_SUCCESS or CL_EMEM.
+ */
+cl_error_t cli_ac_initdata_pool(struct cli_matcher *root, struct cli_ac_data *data);
+
 /**
  * @brief Increment the count for a subsignature of a logical signature.
  *
@@ -166,6 +193,29 @@ cl_error_t lsig_sub_matched(const struct cli_matcher *root, struct cli_ac_data *
 
 cl_error_t cli_ac_chkmacro(struct cli_matcher *root, struct cli_ac_data *data, unsigned lsigid1);
 int cli_ac_chklsig(const char *expr, const char *end, uint32_t *lsigcnt, unsigned int *cnt, uint64_t *ids, unsigned int parse_only);
+
+/**
+ * @brief Compile the logical expression of a signature for cli_ac_lsig_check().
+ *
+ * The text of the expression is kept. Expressions that can't be compiled are
+ * still evaluated from the text, that is not an error.
+ *
+ * @param root      The root the signature belongs to, for its memory pool.
+ * @param ac_lsig   The logical signature, with u.logic set.
+ * @return cl_error_t CL_SUCCESS or CL_EMEM.
+ */
+cl_error_t cli_ac_lsig_compile(struct cli_matcher *root, struct cli_ac_lsig *ac_lsig);
+
+/**
+ * @brief Evaluate the logical expression of a signature, as cli_ac_chklsig() does.
+ *
+ * @param ac_lsig       The logical signature.
+ * @param lsigcnt       Match counts of its subsigs.
+ * @param[in,out] cnt   Incremented by the counts of the subsigs that satisfied the expression.
+ * @param[in,out] ids   The bits of the subsigs that satisfied the expression are set.
+ * @return int          1 if the expression is true, 0 if not, -1 on error.
+ */
+int cli_ac_lsig_check(const struct cli_ac_lsig *ac_lsig, uint32_t *lsigcnt, unsigned int *cnt, uint64_t *ids);
 void cli_ac_freedata(struct cli_ac_data *data);
 cl_error_t cli_ac_scanbuff(const unsigned char *buffer, uint32_t length, const char **virname, void **customdata, struct cli_ac_result **res, const struct cli_matcher *root, struct cli_ac_data *mdata, uint32_t offset, cli_file_t ftype, struct cli_matched_type **ftoffset, unsigned int mode, cli_ctx *ctx);
 cl_error_t cli_ac_buildtrie(struct cli_matcher *root);
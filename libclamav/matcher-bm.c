@@ -36,6 +36,15 @@
 
 #include "mpool.h"
 
+/*
+ * The SIMD prefilter is built with a per-function target attribute and picked
+ * at run time, so the library itself doesn't need to be compiled with -mssse3.
+ */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BM_X86_SIMD
+#include <immintrin.h>
+#endif
+
 #define BM_MIN_LENGTH 3
 #define BM_BLOCK_SIZE 3
 #define HASH(a, b, c) (211 * a + 37 * b + c)
@@ -130,6 +139,12 @@ cl_error_t cli_bm_addpatt(struct cli_matcher *root, struct cli_bm_patt *pattern,
             pattern->offset_min = root->bm_patterns;
     }
 
+    /* a prefilter built before this pattern was added would miss it */
+    if (root->bm_teddy) {
+        MPOOL_FREE(root->mempool, root->bm_teddy);
+        root->bm_teddy = NULL;
+    }
+
     root->bm_patterns++;
     return CL_SUCCESS;
 }
@@ -155,6 +170,151 @@ cl_error_t cli_bm_init(struct cli_matcher *root)
     return CL_SUCCESS;
 }
 
+/*
+ * Static signatures anchored at an exact offset (absolute, EOF-n, EP+n, Sx+n,
+ * SEx, SL+n) can only match at one place in a file. Instead of hashing every
+ * position of the file for them together with the floating signatures, the
+ * loader puts them in a separate matcher in BM offset mode, which resolves
+ * their offsets per file with cli_bm_initoff() and only checks there.
+ * Buffers scanned without a target (cli_scan_buff()) can only match the ones
+ * at an absolute offset, which cli_bm_build() lists once in bm_absoff.
+ *
+ * Signatures with an offset range (n,m and EOF-n,m alike) can match anywhere
+ * in it and stay in the root, as do AC and PCRE signatures: their offsets are
+ * already resolved per file, by cli_ac_caloff() and cli_pcre_recaloff().
+ */
+cl_error_t cli_bm_init_anchored(struct cli_matcher *root)
+{
+    struct cli_matcher *anchored;
+    cl_error_t ret;
+
+    anchored = (struct cli_matcher *)MPOOL_CALLOC(root->mempool, 1, sizeof(struct cli_matcher));
+    if (!anchored) {
+        cli_errmsg("cli_bm_init_anchored: Can't allocate memory for cli_matcher\n");
+        return CL_EMEM;
+    }
+#ifdef USE_MPOOL
+    anchored->mempool = root->mempool;
+#endif
+    anchored->type       = root->type;
+    anchored->bm_offmode = 1;
+
+    if (CL_SUCCESS != (ret = cli_bm_init(anchored))) {
+        MPOOL_FREE(root->mempool, anchored);
+        return ret;
+    }
+
+    root->bm_anchored = anchored;
+    return CL_SUCCESS;
+}
+
+/*
+ * Teddy-style prefilter: every pattern is put in one of 8 buckets by the hash
+ * of its first BM_BLOCK_SIZE bytes (ie. by its bm_suffix chain), and for each
+ * of these bytes two 16 byte tables map the low and the high nibble to the set
+ * of buckets with a pattern having that nibble there. ANDing the shuffled
+ * tables for 16 input positions at a time yields the positions where some
+ * bucket may match; only those are hashed and checked against bm_suffix.
+ * Even when the tables saturate (thousands of patterns) this is no slower than
+ * hashing every position, so it's used for every root the CPU can do it for.
+ *
+ * bm_teddy holds the tables as lo0, hi0, lo1, hi1, lo2, hi2.
+ */
+#define BM_TEDDY_SIZE (BM_BLOCK_SIZE * 2 * 16)
+
+static void bm_free_absoff(struct cli_matcher *root)
+{
+    if (root->bm_absoff.offtab) {
+        MPOOL_FREE(root->mempool, root->bm_absoff.offtab);
+        root->bm_absoff.offtab = NULL;
+    }
+    if (root->bm_absoff.offset) {
+        MPOOL_FREE(root->mempool, root->bm_absoff.offset);
+        root->bm_absoff.offset = NULL;
+    }
+    root->bm_absoff.cnt = root->bm_absoff.pos = 0;
+}
+
+/*
+ * Like cli_bm_initoff() without a target: only the signatures at an absolute
+ * offset have one, so the table is the same for every scan.
+ */
+static cl_error_t bm_build_absoff(struct cli_matcher *root)
+{
+    struct cli_bm_off *data = &root->bm_absoff;
+    struct cli_bm_patt *patt;
+    uint32_t i;
+
+    bm_free_absoff(root);
+    if (!root->bm_patterns)
+        return CL_SUCCESS;
+
+    data->offtab = (uint32_t *)MPOOL_MALLOC(root->mempool, root->bm_patterns * sizeof(uint32_t));
+    data->offset = (uint32_t *)MPOOL_MALLOC(root->mempool, root->bm_patterns * sizeof(uint32_t));
+    if (!data->offtab || !data->offset) {
+        cli_errmsg("bm_build_absoff: Can't allocate memory for the offset table\n");
+        bm_free_absoff(root);
+        return CL_EMEM;
+    }
+
+    for (i = 0; i < root->bm_patterns; i++) {
+        data->offset[i] = CLI_OFF_NONE;
+        patt            = root->bm_pattab[i];
+        if (patt->offdata[0] == CLI_OFF_ABSOLUTE)
+            data->offtab[data->cnt++] = patt->offset_min + patt->prefix_length;
+    }
+
+    cli_qsort(data->offtab, data->cnt, sizeof(uint32_t), NULL);
+    return CL_SUCCESS;
+}
+
+cl_error_t cli_bm_build(struct cli_matcher *root)
+{
+#ifdef BM_X86_SIMD
+    uint32_t i, size = HASH(255, 255, 255) + 1;
+    unsigned int k;
+    struct cli_bm_patt *p;
+    uint8_t *masks;
+#endif
+    cl_error_t ret;
+
+    if (root->bm_anchored && CL_SUCCESS != (ret = bm_build_absoff(root->bm_anchored)))
+        return ret;
+
+#ifdef BM_X86_SIMD
+    if (root->bm_teddy) {
+        MPOOL_FREE(root->mempool, root->bm_teddy);
+        root->bm_teddy = NULL;
+    }
+
+    /* BM offset mode jumps between the expected offsets, nothing to filter */
+    if (!root->bm_suffix || root->bm_offmode || !root->bm_patterns)
+        return CL_SUCCESS;
+
+    if (!__builtin_cpu_supports("ssse3"))
+        return CL_SUCCESS;
+
+    masks = (uint8_t *)MPOOL_CALLOC(root->mempool, BM_TEDDY_SIZE, sizeof(uint8_t));
+    if (!masks) {
+        cli_errmsg("cli_bm_build: Can't allocate memory for the prefilter\n");
+        return CL_EMEM;
+    }
+
+    for (i = 0; i < size; i++) {
+        for (p = root->bm_suffix[i]; p; p = p->next) {
+            for (k = 0; k < BM_BLOCK_SIZE; k++) {
+                masks[32 * k + (p->pattern[k] & 0xf)] |= 1 << (i & 7);
+                masks[32 * k + 16 + (p->pattern[k] >> 4)] |= 1 << (i & 7);
+            }
+        }
+    }
+
+    cli_dbgmsg("cli_bm_build: using the SIMD prefilter for %u patterns\n", root->bm_patterns);
+    root->bm_teddy = masks;
+#endif
+    return CL_SUCCESS;
+}
+
 cl_error_t cli_bm_initoff(const struct cli_matcher *root, struct cli_bm_off *data, const struct cli_target_info *info)
 {
     cl_error_t ret;
@@ -221,6 +381,11 @@ void cli_bm_free(struct cli_matcher *root)
     if (root->bm_shift)
         MPOOL_FREE(root->mempool, root->bm_shift);
 
+    if (root->bm_teddy) {
+        MPOOL_FREE(root->mempool, root->bm_teddy);
+        root->bm_teddy = NULL;
+    }
+
     if (root->bm_pattab)
         MPOOL_FREE(root->mempool, root->bm_pattab);
 
@@ -241,15 +406,196 @@ void cli_bm_free(struct cli_matcher *root)
         }
         MPOOL_FREE(root->mempool, root->bm_suffix);
     }
+
+    bm_free_absoff(root);
+
+    if (root->bm_anchored) {
+        cli_bm_free(root->bm_anchored);
+        MPOOL_FREE(root->mempool, root->bm_anchored);
+        root->bm_anchored = NULL;
+    }
+}
+
+/*
+ * Check the patterns of the bm_suffix chain p against the buffer at position i.
+ * Returns CL_SUCCESS to go on scanning.
+ */
+static inline cl_error_t bm_scan_chain(struct cli_bm_patt *p, const unsigned char *buffer, uint32_t length, uint32_t i, const char **virname, const struct cli_bm_patt **patt, const struct cli_matcher *root, uint32_t offset, const struct cli_target_info *info, struct cli_bm_off *offdata, cli_ctx *ctx, int *viruses_found)
+{
+    uint32_t j, off, off_min, off_max;
+    uint8_t found, pchain;
+    uint16_t idxchk;
+    const unsigned char *bp, *pt;
+    unsigned char prefix;
+    cl_error_t ret;
+
+    prefix = buffer[i - BM_MIN_LENGTH + BM_BLOCK_SIZE];
+    pchain = 0;
+    while (p) {
+        if (p->pattern0 != prefix) {
+            if (pchain)
+                break;
+            p = p->next;
+            continue;
+        } else
+            pchain = 1;
+
+        off = i - BM_MIN_LENGTH + BM_BLOCK_SIZE;
+        bp  = buffer + off;
+
+        if ((off + p->length > length) || (p->prefix_length > off)) {
+            p = p->next;
+            continue;
+        }
+
+        if (offdata) {
+            if (p->offdata[0] == CLI_OFF_ABSOLUTE) {
+                if (p->offset_min != offset + off - p->prefix_length) {
+                    p = p->next;
+                    continue;
+                }
+            } else if ((offdata->offset[p->offset_min] == CLI_OFF_NONE) || (offdata->offset[p->offset_min] != offset + off - p->prefix_length)) {
+                p = p->next;
+                continue;
+            }
+        }
+
+        idxchk = MIN(p->length, length - off) - 1;
+        if (idxchk) {
+            if ((bp[idxchk] != p->pattern[idxchk]) || (bp[idxchk / 2] != p->pattern[idxchk / 2])) {
+                p = p->next;
+                continue;
+            }
+        }
+
+        if (p->prefix_length) {
+            off -= p->prefix_length;
+            bp -= p->prefix_length;
+            pt = p->prefix;
+        } else {
+            pt = p->pattern;
+        }
+
+        found = 1;
+        for (j = 0; j < p->length + p->prefix_length && off < length; j++, off++) {
+            if (bp[j] != pt[j]) {
+                found = 0;
+                break;
+            }
+        }
+
+        if (found && (p->boundary & BM_BOUNDARY_EOL)) {
+            if (off != length) {
+                p = p->next;
+                continue;
+            }
+        }
+
+        if (found && p->length + p->prefix_length == j) {
+            if (!offdata && (p->offset_min != CLI_OFF_ANY)) {
+                if (p->offdata[0] != CLI_OFF_ABSOLUTE) {
+                    if (!info) {
+                        p = p->next;
+                        continue;
+                    }
+                    ret = cli_caloff(NULL, info, root->type, p->offdata, &off_min, &off_max);
+                    if (ret != CL_SUCCESS) {
+                        cli_errmsg("cli_bm_scanbuff: Can't calculate relative offset in signature for %s\n", p->virname);
+                        return ret;
+                    }
+                } else {
+                    off_min = p->offset_min;
+                    off_max = p->offset_max;
+                }
+                off = offset + i - p->prefix_length - BM_MIN_LENGTH + BM_BLOCK_SIZE;
+                if (off_min == CLI_OFF_NONE || off_max < off || off_min > off) {
+                    p = p->next;
+                    continue;
+                }
+            }
+
+            *viruses_found += 1;
+            if (virname) {
+                *virname = p->virname;
+                if (ctx != NULL && SCAN_ALLMATCHES) {
+                    ret = cli_append_virus(ctx, *virname);
+                    if (ret == CL_CLEAN && *viruses_found > 0) {
+                        *viruses_found -= 1;
+                    }
+                }
+            }
+
+            if (patt)
+                *patt = p;
+
+            if (ctx != NULL && !SCAN_ALLMATCHES)
+                return CL_VIRUS;
+        }
+        p = p->next;
+    }
+
+    return CL_SUCCESS;
 }
 
+#ifdef BM_X86_SIMD
+/*
+ * Scan the buffer from *pos with the bm_teddy prefilter while there are 16
+ * positions (plus the rest of their block) left, and leave *pos at the first
+ * position not scanned yet.
+ */
+__attribute__((target("ssse3"))) static cl_error_t bm_scan_teddy(const unsigned char *buffer, uint32_t length, uint32_t *pos, const char **virname, const struct cli_bm_patt **patt, const struct cli_matcher *root, uint32_t offset, const struct cli_target_info *info, cli_ctx *ctx, int *viruses_found)
+{
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    const __m128i zero   = _mm_setzero_si128();
+    const __m128i lo0    = _mm_loadu_si128((const __m128i *)&root->bm_teddy[0]);
+    const __m128i hi0    = _mm_loadu_si128((const __m128i *)&root->bm_teddy[16]);
+    const __m128i lo1    = _mm_loadu_si128((const __m128i *)&root->bm_teddy[32]);
+    const __m128i hi1    = _mm_loadu_si128((const __m128i *)&root->bm_teddy[48]);
+    const __m128i lo2    = _mm_loadu_si128((const __m128i *)&root->bm_teddy[64]);
+    const __m128i hi2    = _mm_loadu_si128((const __m128i *)&root->bm_teddy[80]);
+    __m128i v, m;
+    uint32_t i = *pos, cand, c;
+    uint16_t idx;
+    cl_error_t ret;
+
+    for (; length - i >= 16 + BM_BLOCK_SIZE - 1; i += 16) {
+        v = _mm_loadu_si128((const __m128i *)(buffer + i));
+        m = _mm_and_si128(_mm_shuffle_epi8(lo0, _mm_and_si128(v, nibble)),
+                          _mm_shuffle_epi8(hi0, _mm_and_si128(_mm_srli_epi16(v, 4), nibble)));
+        v = _mm_loadu_si128((const __m128i *)(buffer + i + 1));
+        m = _mm_and_si128(m, _mm_shuffle_epi8(lo1, _mm_and_si128(v, nibble)));
+        m = _mm_and_si128(m, _mm_shuffle_epi8(hi1, _mm_and_si128(_mm_srli_epi16(v, 4), nibble)));
+        v = _mm_loadu_si128((const __m128i *)(buffer + i + 2));
+        m = _mm_and_si128(m, _mm_shuffle_epi8(lo2, _mm_and_si128(v, nibble)));
+        m = _mm_and_si128(m, _mm_shuffle_epi8(hi2, _mm_and_si128(_mm_srli_epi16(v, 4), nibble)));
+
+        cand = ~_mm_movemask_epi8(_mm_cmpeq_epi8(m, zero)) & 0xffff;
+        while (cand) {
+            c = i + __builtin_ctz(cand);
+            cand &= cand - 1;
+
+            idx = HASH(buffer[c], buffer[c + 1], buffer[c + 2]);
+            if (root->bm_shift[idx])
+                continue;
+            ret = bm_scan_chain(root->bm_suffix[idx], buffer, length, c, virname, patt, root, offset, info, NULL, ctx, viruses_found);
+            if (ret != CL_SUCCESS) {
+                *pos = c;
+                return ret;
+            }
+        }
+    }
+
+    *pos = i;
+    return CL_SUCCESS;
+}
+#endif
+
 cl_error_t cli_bm_scanbuff(const unsigned char *buffer, uint32_t length, const char **virname, const struct cli_bm_patt **patt, const struct cli_matcher *root, uint32_t offset, const struct cli_target_info *info, struct cli_bm_off *offdata, cli_ctx *ctx)
 {
-    uint32_t i, j, off, off_min, off_max;
-    uint8_t found, pchain, shift;
-    uint16_t idx, idxchk;
+    uint32_t i, off;
+    uint8_t shift;
+    uint16_t idx;
     struct cli_bm_patt *p;
-    const unsigned char *bp, *pt;
     unsigned char prefix;
     cl_error_t ret;
     int viruses_found = 0;
@@ -274,6 +620,14 @@ cl_error_t cli_bm_scanbuff(const unsigned char *buffer, uint32_t length, const c
             return CL_CLEAN;
         i += offdata->offtab[offdata->pos] - offset;
     }
+#ifdef BM_X86_SIMD
+    else if (root->bm_teddy) {
+        /* the rest of the buffer is scanned with the shift table below */
+        ret = bm_scan_teddy(buffer, length, &i, virname, patt, root, offset, info, ctx, &viruses_found);
+        if (ret != CL_SUCCESS)
+            return ret;
+    }
+#endif
     for (; i < length - BM_BLOCK_SIZE + 1;) {
         idx   = HASH(buffer[i], buffer[i + 1], buffer[i + 2]);
         shift = root->bm_shift[idx];
@@ -297,109 +651,9 @@ cl_error_t cli_bm_scanbuff(const unsigned char *buffer, uint32_t length, const c
                 }
                 continue;
             }
-            pchain = 0;
-            while (p) {
-                if (p->pattern0 != prefix) {
-                    if (pchain)
-                        break;
-                    p = p->next;
-                    continue;
-                } else
-                    pchain = 1;
-
-                off = i - BM_MIN_LENGTH + BM_BLOCK_SIZE;
-                bp  = buffer + off;
-
-                if ((off + p->length > length) || (p->prefix_length > off)) {
-                    p = p->next;
-                    continue;
-                }
-
-                if (offdata) {
-                    if (p->offdata[0] == CLI_OFF_ABSOLUTE) {
-                        if (p->offset_min != offset + off - p->prefix_length) {
-                            p = p->next;
-                            continue;
-                        }
-                    } else if ((offdata->offset[p->offset_min] == CLI_OFF_NONE) || (offdata->offset[p->offset_min] != offset + off - p->prefix_length)) {
-                        p = p->next;
-                        continue;
-                    }
-                }
-
-                idxchk = MIN(p->length, length - off) - 1;
-                if (idxchk) {
-                    if ((bp[idxchk] != p->pattern[idxchk]) || (bp[idxchk / 2] != p->pattern[idxchk / 2])) {
-                        p = p->next;
-                        continue;
-                    }
-                }
-
-                if (p->prefix_length) {
-                    off -= p->prefix_length;
-                    bp -= p->prefix_length;
-                    pt = p->prefix;
-                } else {
-                    pt = p->pattern;
-                }
-
-                found = 1;
-                for (j = 0; j < p->length + p->prefix_length && off < length; j++, off++) {
-                    if (bp[j] != pt[j]) {
-                        found = 0;
-                        break;
-                    }
-                }
-
-                if (found && (p->boundary & BM_BOUNDARY_EOL)) {
-                    if (off != length) {
-                        p = p->next;
-                        continue;
-                    }
-                }
-
-                if (found && p->length + p->prefix_length == j) {
-                    if (!offdata && (p->offset_min != CLI_OFF_ANY)) {
-                        if (p->offdata[0] != CLI_OFF_ABSOLUTE) {
-                            if (!info) {
-                                p = p->next;
-                                continue;
-                            }
-                            ret = cli_caloff(NULL, info, root->type, p->offdata, &off_min, &off_max);
-                            if (ret != CL_SUCCESS) {
-                                cli_errmsg("cli_bm_scanbuff: Can't calculate relative offset in signature for %s\n", p->virname);
-                                return ret;
-                            }
-                        } else {
-                            off_min = p->offset_min;
-                            off_max = p->offset_max;
-                        }
-                        off = offset + i - p->prefix_length - BM_MIN_LENGTH + BM_BLOCK_SIZE;
-                        if (off_min == CLI_OFF_NONE || off_max < off || off_min > off) {
-                            p = p->next;
-                            continue;
-                        }
-                    }
-
-                    viruses_found += 1;
-                    if (virname) {
-                        *virname = p->virname;
-                        if (ctx != NULL && SCAN_ALLMATCHES) {
-                            ret = cli_append_virus(ctx, *virname);
-                            if (ret == CL_CLEAN && viruses_found > 0) {
-                                viruses_found -= 1;
-                            }
-                        }
-                    }
-
-                    if (patt)
-                        *patt = p;
-
-                    if (ctx != NULL && !SCAN_ALLMATCHES)
-                        return CL_VIRUS;
-                }
-                p = p->next;
-            }
+            ret = bm_scan_chain(p, buffer, length, i, virname, patt, root, offset, info, offdata, ctx, &viruses_found);
+            if (ret != CL_SUCCESS)
+                return ret;
             shift = 1;
         }
 
@@ -47,6 +47,8 @@ struct cli_bm_off {
 
 cl_error_t cli_bm_addpatt(struct cli_matcher *root, struct cli_bm_patt *pattern, const char *offset);
 cl_error_t cli_bm_init(struct cli_matcher *root);
+cl_error_t cli_bm_init_anchored(struct cli_matcher *root);
+cl_error_t cli_bm_build(struct cli_matcher *root);
 cl_error_t cli_bm_initoff(const struct cli_matcher *root, struct cli_bm_off *data, const struct cli_target_info *info);
 void cli_bm_freeoff(struct cli_bm_off *data);
 cl_error_t cli_bm_scanbuff(const unsigned char *buffer, uint32_t length, const char **virname, const struct cli_bm_patt **patt, const struct cli_matcher *root, uint32_t offset, const struct cli_target_info *info, struct cli_bm_off *offdata, cli_ctx *ctx);
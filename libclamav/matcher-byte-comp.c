@@ -523,7 +523,10 @@ cl_error_t cli_bcomp_scanbuf(const unsigned char *buffer, size_t buffer_length,
         if (CL_VIRUS == bcomp_check) {
             /* check to see if we are being run in sigtool or not */
             if (bcomp->lsigid[0]) {
-                mdata->lsigcnt[bcomp->lsigid[1]][bcomp->lsigid[2]]++;
+                ret = lsig_increment_subsig_match(mdata, bcomp->lsigid[1], bcomp->lsigid[2]);
+                if (CL_SUCCESS != ret) {
+                    break;
+                }
             } else {
                 /* Run by sigtool's --test-sigs feature without context of whole lsig or previous subsigs */
                 ret = cli_append_virus(ctx, "test");
@@ -108,6 +108,7 @@ static inline cl_error_t matcher_run(const struct cli_matcher *root,
                                      struct cli_ac_result **acres,
                                      fmap_t *map,
                                      struct cli_bm_off *offdata,
+                                     struct cli_bm_off *anchored_offdata,
                                      struct cli_pcre_off *poffdata,
                                      cli_ctx *ctx)
 {
@@ -116,6 +117,7 @@ static inline cl_error_t matcher_run(const struct cli_matcher *root,
     struct filter_match_info info;
     uint32_t orig_length, orig_offset;
     const unsigned char *orig_buffer;
+    struct cli_bm_off absoff;
 
     if (root->filter) {
         if (filter_search_ext(root->filter, buffer, length, &info) == -1) {
@@ -159,6 +161,27 @@ static inline cl_error_t matcher_run(const struct cli_matcher *root,
             if (ret != CL_SUCCESS)
                 return ret;
         }
+
+        if (root->bm_anchored && root->bm_anchored->bm_patterns) {
+            if (!anchored_offdata) {
+                /* no target to resolve offsets against (cli_scan_buff()), only
+                 * the signatures at an absolute offset can match */
+                absoff           = root->bm_anchored->bm_absoff;
+                absoff.pos       = 0;
+                anchored_offdata = &absoff;
+            }
+            /* signatures at exact offsets, in BM offset mode: like above this
+             * needs the whole buffer, not just the part after the prefilter match */
+            ret = cli_bm_scanbuff(orig_buffer, orig_length, virname, NULL, root->bm_anchored, orig_offset, tinfo, anchored_offdata, ctx);
+            if (ret != CL_SUCCESS) {
+                if (ret != CL_VIRUS)
+                    return ret;
+
+                ret = cli_append_virus(ctx, *virname);
+                if (ret != CL_SUCCESS)
+                    return ret;
+            }
+        }
     }
     perf_log_tries(acmode, 0, length);
     ret = cli_ac_scanbuff(buffer, length, virname, NULL, acres, root, mdata, offset, ftype, ftoffset, acmode, ctx);
@@ -296,7 +319,7 @@ cl_error_t cli_scan_buff(const unsigned char *buffer, uint32_t length, uint32_t
 
         if (!acdata) {
             // no ac matcher data was provided, so we need to initialize our own.
-            ret = cli_ac_initdata(&matcher_data, target_ac_root->ac_partsigs, target_ac_root->ac_lsigs, target_ac_root->ac_reloff_num, CLI_DEFAULT_AC_TRACKLEN);
+            ret = cli_ac_initdata_pool(target_ac_root, &matcher_data);
             if (CL_SUCCESS != ret) {
                 return ret;
             }
@@ -304,7 +327,7 @@ cl_error_t cli_scan_buff(const unsigned char *buffer, uint32_t length, uint32_t
 
         ret = matcher_run(target_ac_root, buffer, length, &virname,
                           acdata ? (acdata[0]) : (&matcher_data),
-                          offset, NULL, ftype, NULL, AC_SCAN_VIR, PCRE_SCAN_BUFF, NULL, ctx->fmap, NULL, NULL, ctx);
+                          offset, NULL, ftype, NULL, AC_SCAN_VIR, PCRE_SCAN_BUFF, NULL, ctx->fmap, NULL, NULL, NULL, ctx);
 
         if (!acdata) {
             // no longer need our AC local matcher data (if using)
@@ -321,7 +344,7 @@ cl_error_t cli_scan_buff(const unsigned char *buffer, uint32_t length, uint32_t
 
     if (!acdata) {
         // no ac matcher data was provided, so we need to initialize our own.
-        ret = cli_ac_initdata(&matcher_data, generic_ac_root->ac_partsigs, generic_ac_root->ac_lsigs, generic_ac_root->ac_reloff_num, CLI_DEFAULT_AC_TRACKLEN);
+        ret = cli_ac_initdata_pool(generic_ac_root, &matcher_data);
         if (CL_SUCCESS != ret) {
             return ret;
         }
@@ -329,7 +352,7 @@ cl_error_t cli_scan_buff(const unsigned char *buffer, uint32_t length, uint32_t
 
     ret = matcher_run(generic_ac_root, buffer, length, &virname,
                       acdata ? (acdata[1]) : (&matcher_data),
-                      offset, NULL, ftype, NULL, AC_SCAN_VIR, PCRE_SCAN_BUFF, NULL, ctx->fmap, NULL, NULL, ctx);
+                      offset, NULL, ftype, NULL, AC_SCAN_VIR, PCRE_SCAN_BUFF, NULL, ctx->fmap, NULL, NULL, NULL, ctx);
 
     if (!acdata) {
         // no longer need our AC local matcher data (if using)
@@ -589,6 +612,12 @@ cl_error_t cli_check_fp(cli_ctx *ctx, const char *vname)
     while (stack_index >= 0) {
         map = ctx->recursion_stack[stack_index].fmap;
 
+        if (NULL == map) {
+            // A layer above a parallel scan job, checked by the parent when the job is finished.
+            stack_index--;
+            continue;
+        }
+
         if (CL_SUCCESS != fmap_get_hash(map, &digest, CLI_HASH_MD5)) {
             cli_dbgmsg("cli_check_fp: Failed to get a hash for the map at stack index # %u\n", stack_index);
             stack_index--;
@@ -837,14 +866,12 @@ static cl_error_t lsig_eval(cli_ctx *ctx, struct cli_matcher *root, struct cli_a
     uint64_t evalids            = 0;
     fmap_t *new_map             = NULL;
     struct cli_ac_lsig *ac_lsig = root->ac_lsigtable[lsid];
-    char *exp                   = ac_lsig->u.logic;
-    char *exp_end               = exp + strlen(exp);
 
     status = cli_ac_chkmacro(root, acdata, lsid);
     if (status != CL_SUCCESS)
         return status;
 
-    if (cli_ac_chklsig(exp, exp_end, acdata->lsigcnt[lsid], &evalcnt, &evalids, 0) != 1) {
+    if (cli_ac_lsig_check(ac_lsig, acdata->lsigcnt[lsid], &evalcnt, &evalids) != 1) {
         // Logical expression did not match.
         goto done;
     }
@@ -1001,31 +1028,46 @@ static cl_error_t yara_eval(cli_ctx *ctx, struct cli_matcher *root, struct cli_a
 
 cl_error_t cli_exp_eval(cli_ctx *ctx, struct cli_matcher *root, struct cli_ac_data *acdata, struct cli_target_info *target_info, const char *hash)
 {
-    uint32_t i;
+    uint32_t i, w, evaluated = 0;
+    uint64_t pending;
     cl_error_t status = CL_SUCCESS;
 
-    for (i = 0; i < root->ac_lsigs; i++) {
-        if (root->ac_lsigtable[i]->type == CLI_LSIG_NORMAL) {
-            status = lsig_eval(ctx, root, acdata, target_info, hash, i);
+    // Only the lsigs with a subsig match, and those that may match without one, need to be evaluated.
+    // Walk both bitmaps together so the lsigs are still evaluated in the order they were loaded.
+    for (w = 0; w < (root->ac_lsigs + 63) / 64; w++) {
+        if (root->ac_lsig_evalmap && acdata->lsig_dirty) {
+            pending = root->ac_lsig_evalmap[w] | acdata->lsig_dirty[w];
+        } else {
+            pending = UINT64_MAX;
         }
+
+        for (i = w * 64; pending && i < root->ac_lsigs; i++, pending >>= 1) {
+            if (!(pending & 1)) {
+                continue;
+            }
+
+            if (root->ac_lsigtable[i]->type == CLI_LSIG_NORMAL) {
+                status = lsig_eval(ctx, root, acdata, target_info, hash, i);
+            }
 #ifdef HAVE_YARA
-        else if (root->ac_lsigtable[i]->type == CLI_YARA_NORMAL || root->ac_lsigtable[i]->type == CLI_YARA_OFFSET) {
-            status = yara_eval(ctx, root, acdata, target_info, hash, i);
-        }
+            else if (root->ac_lsigtable[i]->type == CLI_YARA_NORMAL || root->ac_lsigtable[i]->type == CLI_YARA_OFFSET) {
+                status = yara_eval(ctx, root, acdata, target_info, hash, i);
+            }
 #endif
 
-        if (CL_SUCCESS != status) {
-            break;
-        }
-
-        if (i % 10 == 0) {
-            // Check the time limit every n'th lsig.
-            // In testing with a large signature set, we found n = 10 to be just as fast as 100 or
-            // 1000 and has a significant performance improvement over checking with every lsig.
-            status = cli_checktimelimit(ctx);
             if (CL_SUCCESS != status) {
-                cli_dbgmsg("Exceeded scan time limit while evaluating logical and yara signatures (max: %u)\n", ctx->engine->maxscantime);
-                break;
+                return status;
+            }
+
+            if (evaluated++ % 10 == 0) {
+                // Check the time limit every n'th lsig.
+                // In testing with a large signature set, we found n = 10 to be just as fast as 100 or
+                // 1000 and has a significant performance improvement over checking with every lsig.
+                status = cli_checktimelimit(ctx);
+                if (CL_SUCCESS != status) {
+                    cli_dbgmsg("Exceeded scan time limit while evaluating logical and yara signatures (max: %u)\n", ctx->engine->maxscantime);
+                    return status;
+                }
             }
         }
     }
@@ -1050,6 +1092,12 @@ cl_error_t cli_scan_fmap(cli_ctx *ctx, cli_file_t ftype, bool filetype_only, str
     struct cli_bm_off bm_offsets_table;
     bool bm_offsets_table_initialized = false;
 
+    struct cli_bm_off generic_anchored_offsets_table;
+    bool generic_anchored_offsets_table_initialized = false;
+
+    struct cli_bm_off target_anchored_offsets_table;
+    bool target_anchored_offsets_table_initialized = false;
+
     struct cli_pcre_off generic_pcre_offsets_table;
     bool generic_pcre_offsets_table_initialized = false;
 
@@ -1177,7 +1225,7 @@ cl_error_t cli_scan_fmap(cli_ctx *ctx, cli_file_t ftype, bool filetype_only, str
         /* If we're not doing a filetype-only scan, so we definitely need to include generic signatures.
            So initialize the ac data for the generic signatures root. */
 
-        ret = cli_ac_initdata(&generic_ac_data, generic_ac_root->ac_partsigs, generic_ac_root->ac_lsigs, generic_ac_root->ac_reloff_num, CLI_DEFAULT_AC_TRACKLEN);
+        ret = cli_ac_initdata_pool(generic_ac_root, &generic_ac_data);
         if (CL_SUCCESS != ret) {
             goto done;
         }
@@ -1189,6 +1237,16 @@ cl_error_t cli_scan_fmap(cli_ctx *ctx, cli_file_t ftype, bool filetype_only, str
             goto done;
         }
 
+        if (generic_ac_root->bm_anchored) {
+            /* Resolve the offsets of the boyer-moore signatures at exact offsets, so only those are checked.
+               Unlike the PE root's, this is done for files of any size: they aren't in the root's prefilter. */
+            ret = cli_bm_initoff(generic_ac_root->bm_anchored, &generic_anchored_offsets_table, &info);
+            if (CL_SUCCESS != ret) {
+                goto done;
+            }
+            generic_anchored_offsets_table_initialized = true;
+        }
+
         /* Recalculate the pcre offsets.
            This does an allocation, that we will need to free later. */
         ret = cli_pcre_recaloff(generic_ac_root, &generic_pcre_offsets_table, &info, ctx);
@@ -1202,7 +1260,7 @@ cl_error_t cli_scan_fmap(cli_ctx *ctx, cli_file_t ftype, bool filetype_only, str
         /* We have to match against target-specific signatures.
            So initialize the ac data for the target-specific signatures root. */
 
-        ret = cli_ac_initdata(&target_ac_data, target_ac_root->ac_partsigs, target_ac_root->ac_lsigs, target_ac_root->ac_reloff_num, CLI_DEFAULT_AC_TRACKLEN);
+        ret = cli_ac_initdata_pool(target_ac_root, &target_ac_data);
         if (CL_SUCCESS != ret) {
             goto done;
         }
@@ -1225,6 +1283,16 @@ cl_error_t cli_scan_fmap(cli_ctx *ctx, cli_file_t ftype, bool filetype_only, str
             }
         }
 
+        if (target_ac_root->bm_anchored) {
+            /* Resolve the offsets of the boyer-moore signatures at exact offsets, so only those are checked.
+               Unlike the PE root's, this is done for files of any size: they aren't in the root's prefilter. */
+            ret = cli_bm_initoff(target_ac_root->bm_anchored, &target_anchored_offsets_table, &info);
+            if (CL_SUCCESS != ret) {
+                goto done;
+            }
+            target_anchored_offsets_table_initialized = true;
+        }
+
         /* Recalculate the pcre offsets.
            This does an allocation, that we will need to free later. */
         ret = cli_pcre_recaloff(target_ac_root, &target_pcre_offsets_table, &info, ctx);
@@ -1297,6 +1365,7 @@ cl_error_t cli_scan_fmap(cli_ctx *ctx, cli_file_t ftype, bool filetype_only, str
             ret = matcher_run(target_ac_root, buff, bytes, &virname, &target_ac_data, offset,
                               &info, ftype, ftoffset, acmode, PCRE_SCAN_FMAP, acres, ctx->fmap,
                               bm_offsets_table_initialized ? &bm_offsets_table : NULL,
+                              target_anchored_offsets_table_initialized ? &target_anchored_offsets_table : NULL,
                               &target_pcre_offsets_table, ctx);
             if (ret == CL_VIRUS || ret == CL_EMEM) {
                 goto done;
@@ -1309,6 +1378,7 @@ cl_error_t cli_scan_fmap(cli_ctx *ctx, cli_file_t ftype, bool filetype_only, str
             ret = matcher_run(generic_ac_root, buff, bytes, &virname, &generic_ac_data, offset,
                               &info, ftype, ftoffset, acmode, PCRE_SCAN_FMAP, acres, ctx->fmap,
                               NULL,
+                              generic_anchored_offsets_table_initialized ? &generic_anchored_offsets_table : NULL,
                               &generic_pcre_offsets_table, ctx);
             if (ret == CL_VIRUS || ret == CL_EMEM) {
                 goto done;
@@ -1451,6 +1521,12 @@ done:
     if (bm_offsets_table_initialized) {
         cli_bm_freeoff(&bm_offsets_table);
     }
+    if (generic_anchored_offsets_table_initialized) {
+        cli_bm_freeoff(&generic_anchored_offsets_table);
+    }
+    if (target_anchored_offsets_table_initialized) {
+        cli_bm_freeoff(&target_anchored_offsets_table);
+    }
 
     if (ret != CL_SUCCESS) {
         return ret;
@@ -114,6 +114,26 @@ typedef enum lsig_type {
     CLI_YARA_OFFSET
 } lsig_type_t;
 
+/*
+ * The logical expression of a CLI_LSIG_NORMAL signature, compiled to postfix
+ * at load time, see cli_ac_lsig_compile().
+ */
+typedef enum lsig_op_code {
+    CLI_LSIG_OP_SUB,    /* subsig id matched */
+    CLI_LSIG_OP_SUBCNT, /* match count of subsig id compared with val1, e.g. "0>2" */
+    CLI_LSIG_OP_AND,
+    CLI_LSIG_OP_OR,
+    CLI_LSIG_OP_BLOCK /* total count of the preceding operation compared with val1, and val2 different subsigs, e.g. "(0|1)>2,2" */
+} lsig_op_code_t;
+
+struct cli_lsig_op {
+    uint8_t code; /* lsig_op_code_t */
+    char mod;     /* '=', '<' or '>' */
+    uint8_t id;
+    uint32_t val1;
+    uint32_t val2;
+};
+
 struct cli_bc;
 struct cli_ac_lsig {
     uint32_t id;
@@ -124,6 +144,8 @@ struct cli_ac_lsig {
         char *logic;
         uint8_t *code_start;
     } u;
+    struct cli_lsig_op *prog; /* compiled u.logic, NULL if evaluated from the text */
+    uint32_t prog_len;
     char *virname;
     struct cli_lsig_tdb tdb;
 };
@@ -135,9 +157,12 @@ struct cli_matcher {
 
     /* Extended Boyer-Moore */
     uint8_t *bm_shift;
+    uint8_t *bm_teddy; /* SIMD prefilter, see cli_bm_build() */
     struct cli_bm_patt **bm_suffix, **bm_pattab;
     uint32_t *soff, soff_len; /* for PE section sigs */
     uint32_t bm_offmode, bm_patterns, bm_reloff_num, bm_absoff_num;
+    struct cli_matcher *bm_anchored; /* BM sigs at an exact offset, see cli_bm_init_anchored() */
+    struct cli_bm_off bm_absoff;     /* the absolute offsets of bm_anchored, for scans without a target */
 
     /* HASH */
     struct cli_hash_patt hm;
@@ -146,6 +171,7 @@ struct cli_matcher {
     /* Extended Aho-Corasick */
     uint32_t ac_partsigs, ac_nodes, ac_lists, ac_patterns, ac_lsigs;
     struct cli_ac_lsig **ac_lsigtable;
+    uint64_t *ac_lsig_evalmap; /* bitmap of the lsigs evaluated without any subsig match, see cli_exp_eval() */
     struct cli_ac_node *ac_root, **ac_nodetable;
     struct cli_ac_list **ac_listtable;
     struct cli_ac_patt **ac_pattable;
@@ -153,6 +179,7 @@ struct cli_matcher {
     uint32_t ac_reloff_num, ac_absoff_num;
     uint8_t ac_mindepth, ac_maxdepth;
     struct filter *filter;
+    struct cli_ac_data_pool *ac_data_pool; /* released match data for reuse, see cli_ac_initdata_pool() */
 
     uint16_t maxpatlen;
     uint8_t ac_only;
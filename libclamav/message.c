@@ -49,6 +49,7 @@
 
 #include "others.h"
 #include "str.h"
+#include "textdecode.h"
 #include "filetypes.h"
 
 #include "mbox.h"
@@ -64,7 +65,7 @@
 static int messageHasArgument(const message *m, const char *variable);
 static void messageIsEncoding(message *m);
 static unsigned char *decode(message *m, const char *in, unsigned char *out, unsigned char (*decoder)(char), bool isFast);
-static void sanitiseBase64(char *s);
+static size_t sanitiseBase64(char *s);
 #ifdef __GNUC__
 static unsigned char hex(char c) __attribute__((const));
 static unsigned char base64(char c) __attribute__((const));
@@ -1842,45 +1843,7 @@ decodeLine(message *m, encoding_type et, const char *line, unsigned char *buf, s
                 break;
             }
 
-            softbreak = false;
-            while (buflen && *line) {
-                if (*line == '=') {
-                    unsigned char byte;
-
-                    if ((*++line == '\0') || (*line == '\n')) {
-                        softbreak = true;
-                        /* soft line break */
-                        break;
-                    }
-
-                    byte = hex(*line);
-
-                    if ((*++line == '\0') || (*line == '\n')) {
-                        /*
-                         * broken e-mail, not
-                         * adhering to RFC2045
-                         */
-                        *buf++ = byte;
-                        break;
-                    }
-
-                    /*
-                     * Handle messages that use a broken
-                     * quoted-printable encoding of
-                     * href=\"http://, instead of =3D
-                     */
-                    if (byte != '=')
-                        byte = (byte << 4) | hex(*line);
-                    else
-                        line -= 2;
-
-                    *buf++ = byte;
-                } else {
-                    *buf++ = *line;
-                }
-                ++line;
-                --buflen;
-            }
+            buf += cli_qp_decode_line(line, strlen(line), buf, buflen, &softbreak);
             if (!softbreak) {
                 /* Put the new line back in */
                 *buf++ = '\n';
@@ -1907,12 +1870,40 @@ decodeLine(message *m, encoding_type et, const char *line, unsigned char *buf, s
             if (p2)
                 *p2 = '\0';
 
-            sanitiseBase64(copy);
+            len = sanitiseBase64(copy);
+            p2  = copy;
+
+            /*
+             * Complete the quantum carried over from the previous line,
+             * then decode all of the whole quanta in one go
+             */
+            if (m->base64chars) {
+                char carry[4];
+
+                reallen = 4 - (size_t)m->base64chars;
+                if (reallen > len)
+                    reallen = len;
+                memcpy(carry, p2, reallen);
+                carry[reallen] = '\0';
+                buf            = decode(m, carry, buf, base64, false);
+                p2 += reallen;
+                len -= reallen;
+            }
+            if ((m->base64chars == 0) && (len >= 4)) {
+                struct cli_base64_state state;
+
+                reallen = len & ~(size_t)3;
+                cli_base64_init(&state);
+                buf += cli_base64_decode(&state, (const uint8_t *)p2, reallen, buf);
+                p2 += reallen;
+                len -= reallen;
+            }
 
             /*
-             * Klez doesn't always put "=" on the last line
+             * Klez doesn't always put "=" on the last line, so keep whatever
+             * is left over for the next line or for base64Flush()
              */
-            buf = decode(m, copy, buf, base64, (p2 == NULL) && ((strlen(copy) & 3) == 0));
+            buf = decode(m, p2, buf, base64, false);
 
             if (copy != base64buf)
                 free(copy);
@@ -1982,18 +1973,19 @@ decodeLine(message *m, encoding_type et, const char *line, unsigned char *buf, s
  * ignore such errors rather than discarding the mail, and virus writers
  * exploit this bug
  */
-static void
+static size_t
 sanitiseBase64(char *s)
 {
+    char *p           = s;
+    const char *start = s;
+
     cli_dbgmsg("sanitiseBase64 '%s'\n", s);
-    while (*s)
-        if (base64Table[(unsigned int)(*s & 0xFF)] == 255) {
-            char *p1;
+    for (; *s; s++)
+        if (base64Table[(unsigned int)(*s & 0xFF)] != 255)
+            *p++ = *s;
+    *p = '\0';
 
-            for (p1 = s; p1[0] != '\0'; p1++)
-                p1[0] = p1[1];
-        } else
-            s++;
+    return (size_t)(p - start);
 }
 
 /*
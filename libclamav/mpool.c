@@ -39,7 +39,11 @@
 #if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
 #include <sys/mman.h>
 #endif
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
 #include <stddef.h>
+#include <errno.h>
 
 #include "clamav.h"
 #include "others.h"
@@ -370,14 +374,40 @@ static const unsigned int fragsz[] = {
 
 #define FRAGSBITS (sizeof(fragsz) / sizeof(fragsz[0]))
 
+/* huge page size used when the kernel doesn't tell us */
+#define MPOOL_HPSIZE 2097152
+/* MAP_HUGETLB takes log2 of the page size here, or uses the hugetlb default size */
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+/* highest NUMA node + 1 we can bind to */
+#define MPOOL_NUMA_NODES 256
+#define MPOOL_NUMA_MASKLEN (MPOOL_NUMA_NODES / (8 * sizeof(unsigned long)))
+
+#if defined(__linux__) && defined(SYS_mbind)
+#ifndef MPOL_BIND
+#define MPOL_BIND 2
+#endif
+#ifndef MPOL_INTERLEAVE
+#define MPOL_INTERLEAVE 3
+#endif
+#define MPOOL_HAVE_MBIND 1
+#endif
+
 struct MPMAP {
     struct MPMAP *next;
     size_t size;
     size_t usize;
+    size_t huge; /* if non zero, the map is aligned to (and sized in) huge pages of this size */
 };
 
 struct MP {
     size_t psize;
+    size_t hpsize;          /* huge page size, when hugepages is set */
+    unsigned int hugepages; /* enum cl_hugepages_mode */
+    int numa_node;          /* node, CL_NUMA_DEFAULT or CL_NUMA_INTERLEAVE */
+    unsigned long numa_mask[MPOOL_NUMA_MASKLEN];
+    int arena; /* malloc'ed by mpool_arena_create(), all its memory is in the next maps */
     struct FRAG *avail[FRAGSBITS];
     union {
         struct MPMAP mpm;
@@ -459,6 +489,7 @@ struct MP *mpool_create()
     size_t sz;
     memset(&mp, 0, sizeof(mp));
     mp.psize       = cli_getpagesize();
+    mp.numa_node   = CL_NUMA_DEFAULT;
     sz             = align_to_pagesize(&mp, MIN_FRAGSIZE);
     mp.u.mpm.usize = sizeof(struct MPMAP);
     mp.u.mpm.size  = sz - sizeof(mp);
@@ -484,6 +515,71 @@ struct MP *mpool_create()
     return mpool_p;
 }
 
+/*
+ * An arena is a pool of its own which borrows the huge page and NUMA settings
+ * of its parent. Each loader thread allocates from its own arena without
+ * locking; once the threads are done, mpool_arena_merge() hands the arena
+ * maps and free lists over to the parent so that everything allocated from
+ * the arena belongs to (and is freed with) the parent pool.
+ */
+struct MP *mpool_arena_create(const struct MP *parent)
+{
+    struct MP *arena;
+
+    if (!parent || parent->arena) {
+        cli_errmsg("mpool_arena_create: invalid parent pool\n");
+        return NULL;
+    }
+    if (!(arena = calloc(1, sizeof(*arena)))) {
+        cli_errmsg("mpool_arena_create: Can't allocate memory for the arena\n");
+        return NULL;
+    }
+    arena->psize     = parent->psize;
+    arena->hpsize    = parent->hpsize;
+    arena->hugepages = parent->hugepages;
+    arena->numa_node = parent->numa_node;
+    memcpy(arena->numa_mask, parent->numa_mask, sizeof(arena->numa_mask));
+    arena->arena = 1;
+    /* no room in the head map, the first allocation maps memory */
+    arena->u.mpm.size  = 0;
+    arena->u.mpm.usize = 0;
+    spam("Arena created @%p\n", arena);
+    return arena;
+}
+
+/* must not race with any other use of either pool */
+int mpool_arena_merge(struct MP *mp, struct MP *arena)
+{
+    struct MPMAP *last;
+    struct FRAG *f;
+    unsigned int i;
+
+    if (!mp || !arena || mp->arena || !arena->arena) {
+        cli_errmsg("mpool_arena_merge: invalid pools\n");
+        return -1;
+    }
+
+    if (arena->u.mpm.next) {
+        for (last = arena->u.mpm.next; last->next; last = last->next)
+            continue;
+        last->next     = mp->u.mpm.next;
+        mp->u.mpm.next = arena->u.mpm.next;
+    }
+
+    for (i = 0; i < FRAGSBITS; i++) {
+        if (!(f = arena->avail[i]))
+            continue;
+        while (f->u.next.ptr)
+            f = f->u.next.ptr;
+        f->u.next.ptr = mp->avail[i];
+        mp->avail[i]  = arena->avail[i];
+    }
+
+    spam("Arena @%p merged into map @%p\n", arena, mp);
+    free(arena);
+    return 0;
+}
+
 void mpool_destroy(struct MP *mp)
 {
     struct MPMAP *mpm_next = mp->u.mpm.next, *mpm;
@@ -502,6 +598,10 @@ void mpool_destroy(struct MP *mp)
         VirtualFree(mpm, 0, MEM_RELEASE);
 #endif
     }
+    if (mp->arena) {
+        free(mp);
+        return;
+    }
     mpmsize = mp->u.mpm.size;
 #ifdef CL_DEBUG
     memset(mp, FREEPOISON, mpmsize + sizeof(*mp));
@@ -525,6 +625,10 @@ void mpool_flush(struct MP *mp)
     while ((mpm = mpm_next)) {
         mpm_next = mpm->next;
         mused    = align_to_pagesize(mp, mpm->usize);
+        if (mpm->huge) {
+            /* don't split the huge pages (MAP_HUGETLB maps can't be) */
+            mused = (mused + mpm->huge - 1) / mpm->huge * mpm->huge;
+        }
         if (mused < mpm->size) {
 #ifdef CL_DEBUG
             memset((char *)mpm + mused, FREEPOISON, mpm->size - mused);
@@ -539,6 +643,11 @@ void mpool_flush(struct MP *mp)
         used += mpm->size;
     }
 
+    if (mp->arena) {
+        spam("Arena flushed @%p, in use: %lu\n", mp, (unsigned long)used);
+        return;
+    }
+
     mused = align_to_pagesize(mp, mp->u.mpm.usize + sizeof(*mp));
     if (mused < mp->u.mpm.size + sizeof(*mp)) {
 #ifdef CL_DEBUG
@@ -577,6 +686,172 @@ int mpool_getstats(const struct cl_engine *eng, size_t *used, size_t *total)
     return 0;
 }
 
+/*
+ * How much of the pool sits in maps that were set up for huge pages: either
+ * MAP_HUGETLB maps or aligned maps advised with MADV_HUGEPAGE. Whether the
+ * kernel actually backs the latter with huge pages shows in AnonHugePages in
+ * /proc/<pid>/smaps.
+ */
+int mpool_gethugestats(const struct cl_engine *eng, size_t *huge)
+{
+    size_t sum_huge = 0;
+    const struct MPMAP *mpm;
+    const mpool_t *mp;
+
+    if (!eng || !eng->refcount)
+        return -1;
+    mp = eng->mempool;
+    if (!mp)
+        return -1;
+    for (mpm = &mp->u.mpm; mpm; mpm = mpm->next) {
+        if (mpm->huge)
+            sum_huge += mpm->size;
+    }
+    *huge = sum_huge;
+    return 0;
+}
+
+void mpool_set_hugepages(struct MP *mp, unsigned int mode)
+{
+#if !defined(_WIN32) && (defined(MAP_HUGETLB) || defined(MADV_HUGEPAGE))
+    FILE *fs;
+    unsigned long hpsize = 0;
+
+    if (mode != CL_HUGEPAGES_NONE && !mp->hpsize) {
+        /* the size transparent huge pages use, MAP_HUGETLB maps ask for it too */
+        if ((fs = fopen("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size", "r"))) {
+            if (fscanf(fs, "%lu", &hpsize) != 1 || !hpsize || (hpsize & (hpsize - 1)) || hpsize % mp->psize)
+                hpsize = 0;
+            fclose(fs);
+        }
+        mp->hpsize = hpsize ? hpsize : MPOOL_HPSIZE;
+    }
+    mp->hugepages = mode;
+#else
+    UNUSEDPARAM(mp);
+    if (mode != CL_HUGEPAGES_NONE)
+        cli_warnmsg("mpool_set_hugepages: Huge pages are not supported on this system\n");
+#endif
+}
+
+void mpool_set_numa(struct MP *mp, int node)
+{
+#ifdef MPOOL_HAVE_MBIND
+    FILE *fs;
+    unsigned int first, last, i;
+    int c;
+
+    memset(mp->numa_mask, 0, sizeof(mp->numa_mask));
+    if (node >= MPOOL_NUMA_NODES) {
+        cli_warnmsg("mpool_set_numa: NUMA node %d is out of range, using the default policy\n", node);
+        node = CL_NUMA_DEFAULT;
+    } else if (node >= 0) {
+        mp->numa_mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+    } else if (node == CL_NUMA_INTERLEAVE) {
+        /* a list of ranges such as "0-3,8-11" */
+        if (!(fs = fopen("/sys/devices/system/node/online", "r"))) {
+            cli_warnmsg("mpool_set_numa: Can't read the online NUMA nodes, using the default policy\n");
+            node = CL_NUMA_DEFAULT;
+        } else {
+            while (fscanf(fs, "%u", &first) == 1) {
+                last = first;
+                if ((c = fgetc(fs)) == '-') {
+                    if (fscanf(fs, "%u", &last) != 1)
+                        break;
+                    c = fgetc(fs);
+                }
+                for (i = first; i <= last && i < MPOOL_NUMA_NODES; i++)
+                    mp->numa_mask[i / (8 * sizeof(unsigned long))] |= 1UL << (i % (8 * sizeof(unsigned long)));
+                if (c != ',')
+                    break;
+            }
+            fclose(fs);
+        }
+    }
+    mp->numa_node = node;
+#else
+    UNUSEDPARAM(mp);
+    if (node != CL_NUMA_DEFAULT)
+        cli_warnmsg("mpool_set_numa: NUMA memory policies are not supported on this system\n");
+#endif
+}
+
+/* Apply the pool's NUMA policy to a fresh map, before anything touches it */
+static void mpool_numa_bind(struct MP *mp, void *addr, size_t size)
+{
+#ifdef MPOOL_HAVE_MBIND
+    int mode;
+
+    if (mp->numa_node == CL_NUMA_DEFAULT)
+        return;
+    mode = mp->numa_node == CL_NUMA_INTERLEAVE ? MPOL_INTERLEAVE : MPOL_BIND;
+    if (syscall(SYS_mbind, addr, size, mode, mp->numa_mask, MPOOL_NUMA_NODES + 1, 0))
+        cli_dbgmsg("mpool_numa_bind: mbind() failed, errno = %d\n", errno);
+#else
+    UNUSEDPARAM(mp);
+    UNUSEDPARAM(addr);
+    UNUSEDPARAM(size);
+#endif
+}
+
+/*
+ * Map size bytes for the pool. With huge pages on, size must be a multiple of
+ * mp->hpsize; *huge is set to the huge page size if the map is backed by (or
+ * aligned and advised for) huge pages.
+ */
+static void *mpool_map(struct MP *mp, size_t size, size_t *huge)
+{
+    void *p;
+
+    *huge = 0;
+#ifndef _WIN32
+#ifdef MAP_HUGETLB
+    if (mp->hugepages == CL_HUGEPAGES_EXPLICIT) {
+        /* ask for huge pages of mp->hpsize: the hugetlb default may be larger (eg. 1 GiB),
+         * and mpool_flush() only trims maps in mp->hpsize steps */
+        int shift = 0;
+
+        while (((size_t)1 << shift) < mp->hpsize)
+            shift++;
+        if ((p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | ANONYMOUS_MAP | MAP_HUGETLB | (shift << MAP_HUGE_SHIFT), -1, 0)) != MAP_FAILED) {
+            mpool_numa_bind(mp, p, size);
+            *huge = mp->hpsize;
+            return p;
+        }
+        spam("MAP_HUGETLB failed for %lu bytes, using transparent huge pages\n", (unsigned long)size);
+    }
+#endif
+#ifdef MADV_HUGEPAGE
+    if (mp->hugepages != CL_HUGEPAGES_NONE) {
+        /* map a huge page more, so the map can start on a huge page boundary */
+        if ((p = mmap(NULL, size + mp->hpsize, PROT_READ | PROT_WRITE, MAP_PRIVATE | ANONYMOUS_MAP, -1, 0)) != MAP_FAILED) {
+            char *start = (char *)alignto((size_t)p, mp->hpsize);
+            size_t head = start - (char *)p;
+
+            if (head)
+                munmap(p, head);
+            if (mp->hpsize - head)
+                munmap(start + size, mp->hpsize - head);
+            if (madvise(start, size, MADV_HUGEPAGE))
+                cli_dbgmsg("mpool_map: madvise(MADV_HUGEPAGE) failed, errno = %d\n", errno);
+            else
+                *huge = mp->hpsize;
+            mpool_numa_bind(mp, start, size);
+            return start;
+        }
+    }
+#endif
+    if ((p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | ANONYMOUS_MAP, -1, 0)) == MAP_FAILED)
+        return NULL;
+    mpool_numa_bind(mp, p, size);
+    return p;
+#else
+    UNUSEDPARAM(mp);
+    UNUSEDPARAM(huge);
+    return VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#endif
+}
+
 static inline size_t align_increase(size_t size, size_t a)
 {
     /* we must pad with at most a-1 bytes to align start of struct */
@@ -619,7 +894,7 @@ static void *allocate_aligned(struct MPMAP *mpm, size_t size, unsigned align, co
 void *mpool_malloc(struct MP *mp, size_t size)
 {
     size_t align = alignof(size);
-    size_t i, needed = align_increase(size + FRAG_OVERHEAD, align);
+    size_t i, huge, needed = align_increase(size + FRAG_OVERHEAD, align);
     const unsigned int sbits = to_bits(needed);
     struct FRAG *f           = NULL;
     struct MPMAP *mpm        = &mp->u.mpm;
@@ -663,16 +938,14 @@ void *mpool_malloc(struct MP *mp, size_t size)
     }
 
     /* Case 3: We allocate more */
-    if (needed + sizeof(*mpm) > MIN_FRAGSIZE)
+    if (mp->hugepages != CL_HUGEPAGES_NONE)
+        i = (needed + sizeof(*mpm) + mp->hpsize - 1) / mp->hpsize * mp->hpsize;
+    else if (needed + sizeof(*mpm) > MIN_FRAGSIZE)
         i = align_to_pagesize(mp, needed + sizeof(*mpm));
     else
         i = align_to_pagesize(mp, MIN_FRAGSIZE);
 
-#ifndef _WIN32
-    if ((mpm = (struct MPMAP *)mmap(NULL, i, PROT_READ | PROT_WRITE, MAP_PRIVATE | ANONYMOUS_MAP, -1, 0)) == MAP_FAILED) {
-#else
-    if (!(mpm = (struct MPMAP *)VirtualAlloc(NULL, i, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE))) {
-#endif
+    if (!(mpm = (struct MPMAP *)mpool_map(mp, i, &huge))) {
         cli_errmsg("mpool_malloc(): Can't allocate memory (%lu bytes).\n", (unsigned long)i);
         spam("failed to alloc %lu bytes (%lu requested)\n", (unsigned long)i, (unsigned long)size);
         return NULL;
@@ -682,6 +955,7 @@ void *mpool_malloc(struct MP *mp, size_t size)
 #endif
     mpm->size      = i;
     mpm->usize     = sizeof(*mpm);
+    mpm->huge      = huge;
     mpm->next      = mp->u.mpm.next;
     mp->u.mpm.next = mpm;
     return allocate_aligned(mpm, size, align, "new map");
@@ -925,6 +1199,9 @@ void mpool_free() {}
 void mpool_create() {}
 void mpool_destroy() {}
 void mpool_getstats() {}
+void mpool_gethugestats() {}
+void mpool_arena_create() {}
+void mpool_arena_merge() {}
 void mpool_calloc() {}
 
 #endif /* USE_MPOOL */
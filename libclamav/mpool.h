@@ -48,6 +48,13 @@ char *cli_mpool_virname(mpool_t *mpool, const char *virname, unsigned int offici
 uint16_t *cli_mpool_hex2ui(mpool_t *mpool, const char *hex);
 void mpool_flush(mpool_t *mpool);
 int mpool_getstats(const struct cl_engine *engine, size_t *used, size_t *total);
+int mpool_gethugestats(const struct cl_engine *engine, size_t *huge);
+void mpool_set_hugepages(mpool_t *mpool, unsigned int mode);
+void mpool_set_numa(mpool_t *mpool, int node);
+
+/* Per-thread pools for concurrent loading, see mpool_arena_create() in mpool.c */
+mpool_t *mpool_arena_create(const mpool_t *parent);
+int mpool_arena_merge(mpool_t *mpool, mpool_t *arena);
 
 #define MPOOL_MALLOC(a, b) mpool_malloc(a, b)
 #define MPOOL_FREE(a, b) mpool_free(a, b)
@@ -61,6 +68,9 @@ int mpool_getstats(const struct cl_engine *engine, size_t *used, size_t *total);
 #define CLI_MPOOL_HEX2UI(mpool, hex) cli_mpool_hex2ui(mpool, hex)
 #define MPOOL_FLUSH(val) mpool_flush(val)
 #define MPOOL_GETSTATS(mpool, used, total) mpool_getstats(mpool, used, total)
+#define MPOOL_GETHUGESTATS(engine, huge) mpool_gethugestats(engine, huge)
+#define MPOOL_SET_HUGEPAGES(mpool, mode) mpool_set_hugepages(mpool, mode)
+#define MPOOL_SET_NUMA(mpool, node) mpool_set_numa(mpool, node)
 
 #else /* USE_MPOOL */
 
@@ -78,6 +88,9 @@ typedef void mpool_t;
 #define CLI_MPOOL_HEX2UI(mpool, hex) cli_hex2ui(hex)
 #define MPOOL_FLUSH(val)
 #define MPOOL_GETSTATS(mpool, used, total) -1
+#define MPOOL_GETHUGESTATS(engine, huge) -1
+#define MPOOL_SET_HUGEPAGES(mpool, mode)
+#define MPOOL_SET_NUMA(mpool, node)
 
 #endif /* USE_MPOOL */
 
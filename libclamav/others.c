@@ -77,6 +77,7 @@
 #include "readdb.h"
 #include "stats.h"
 #include "json_api.h"
+#include "scanpool.h"
 
 #include "clamav_rust.h"
 
@@ -498,6 +499,8 @@ struct cl_engine *cl_engine_new(void)
     new->ac_only          = 0;
     new->ac_mindepth      = CLI_DEFAULT_AC_MINDEPTH;
     new->ac_maxdepth      = CLI_DEFAULT_AC_MAXDEPTH;
+    new->hugepages        = CL_HUGEPAGES_NONE;
+    new->numa_node        = CL_NUMA_DEFAULT;
 
 #ifdef USE_MPOOL
     if (!(new->mempool = mpool_create())) {
@@ -708,6 +711,8 @@ cl_error_t cl_engine_set_num(struct cl_engine *engine, enum cl_engine_field fiel
         case CL_ENGINE_DB_OPTIONS:
         case CL_ENGINE_DB_VERSION:
         case CL_ENGINE_DB_TIME:
+        case CL_ENGINE_BYTECODE_COUNT:
+        case CL_ENGINE_BYTECODE_PREPARED:
             cli_warnmsg("cl_engine_set_num: The field is read only\n");
             return CL_EARG;
         case CL_ENGINE_AC_ONLY:
@@ -751,6 +756,29 @@ cl_error_t cl_engine_set_num(struct cl_engine *engine, enum cl_engine_field fiel
             if (num == CL_BYTECODE_MODE_TEST)
                 cli_infomsg(NULL, "bytecode engine in test mode\n");
             break;
+        case CL_ENGINE_BYTECODE_LAZY:
+            if (engine->dboptions & CL_DB_COMPILED) {
+                cli_errmsg("cl_engine_set_num: CL_ENGINE_BYTECODE_LAZY cannot be set after engine was compiled\n");
+                return CL_EARG;
+            }
+            engine->bytecode_lazy = num;
+            break;
+        case CL_ENGINE_HUGEPAGES:
+            if (num < CL_HUGEPAGES_NONE || num > CL_HUGEPAGES_EXPLICIT) {
+                cli_errmsg("cl_engine_set_num: Invalid hugepages mode %lld\n", num);
+                return CL_EARG;
+            }
+            engine->hugepages = num;
+            MPOOL_SET_HUGEPAGES(engine->mempool, engine->hugepages);
+            break;
+        case CL_ENGINE_NUMA_NODE:
+            if (num < CL_NUMA_INTERLEAVE || num > INT32_MAX) {
+                cli_errmsg("cl_engine_set_num: Invalid NUMA node %lld\n", num);
+                return CL_EARG;
+            }
+            engine->numa_node = num;
+            MPOOL_SET_NUMA(engine->mempool, engine->numa_node);
+            break;
         case CL_ENGINE_DISABLE_CACHE:
             if (num) {
                 engine->engine_options |= ENGINE_OPTIONS_DISABLE_CACHE;
@@ -814,6 +842,13 @@ cl_error_t cl_engine_set_num(struct cl_engine *engine, enum cl_engine_field fiel
                 engine->engine_options &= ~(ENGINE_OPTIONS_PE_DUMPCERTS);
             }
             break;
+        case CL_ENGINE_PARALLEL_THREADS:
+            if (engine->dboptions & CL_DB_COMPILED) {
+                cli_errmsg("cl_engine_set_num: CL_ENGINE_PARALLEL_THREADS cannot be set after engine was compiled\n");
+                return CL_EARG;
+            }
+            engine->parallel_scan_threads = (uint32_t)num;
+            break;
         default:
             cli_errmsg("cl_engine_set_num: Incorrect field number\n");
             return CL_EARG;
@@ -879,6 +914,16 @@ long long cl_engine_get_num(const struct cl_engine *engine, enum cl_engine_field
             return engine->bytecode_timeout;
         case CL_ENGINE_BYTECODE_MODE:
             return engine->bytecode_mode;
+        case CL_ENGINE_BYTECODE_LAZY:
+            return engine->bytecode_lazy;
+        case CL_ENGINE_HUGEPAGES:
+            return engine->hugepages;
+        case CL_ENGINE_NUMA_NODE:
+            return engine->numa_node;
+        case CL_ENGINE_BYTECODE_COUNT:
+            return engine->bcs.count;
+        case CL_ENGINE_BYTECODE_PREPARED:
+            return engine->bcs.prepared;
         case CL_ENGINE_DISABLE_CACHE:
             return engine->engine_options & ENGINE_OPTIONS_DISABLE_CACHE;
         case CL_ENGINE_CACHE_SIZE:
@@ -899,6 +944,8 @@ long long cl_engine_get_num(const struct cl_engine *engine, enum cl_engine_field
             return engine->pcre_recmatch_limit;
         case CL_ENGINE_PCRE_MAX_FILESIZE:
             return engine->pcre_max_filesize;
+        case CL_ENGINE_PARALLEL_THREADS:
+            return engine->parallel_scan_threads;
         default:
             cli_errmsg("cl_engine_get: Incorrect field number\n");
             if (err)
@@ -931,6 +978,33 @@ cl_error_t cl_engine_set_str(struct cl_engine *engine, enum cl_engine_field fiel
             if (NULL == engine->tmpdir)
                 return CL_EMEM;
             break;
+        case CL_ENGINE_BYTECODE_CACHE_DIR:
+            if (NULL != engine->bytecode_cache_dir) {
+                MPOOL_FREE(engine->mempool, engine->bytecode_cache_dir);
+                engine->bytecode_cache_dir = NULL;
+            }
+            engine->bytecode_cache_dir = CLI_MPOOL_STRDUP(engine->mempool, str);
+            if (NULL == engine->bytecode_cache_dir)
+                return CL_EMEM;
+            break;
+        case CL_ENGINE_BYTECODE_NATIVE:
+            if (NULL != engine->bytecode_native_module) {
+                MPOOL_FREE(engine->mempool, engine->bytecode_native_module);
+                engine->bytecode_native_module = NULL;
+            }
+            engine->bytecode_native_module = CLI_MPOOL_STRDUP(engine->mempool, str);
+            if (NULL == engine->bytecode_native_module)
+                return CL_EMEM;
+            break;
+        case CL_ENGINE_BYTECODE_NATIVE_OUT:
+            if (NULL != engine->bytecode_native_output) {
+                MPOOL_FREE(engine->mempool, engine->bytecode_native_output);
+                engine->bytecode_native_output = NULL;
+            }
+            engine->bytecode_native_output = CLI_MPOOL_STRDUP(engine->mempool, str);
+            if (NULL == engine->bytecode_native_output)
+                return CL_EMEM;
+            break;
         default:
             cli_errmsg("cl_engine_set_num: Incorrect field number\n");
             return CL_EARG;
@@ -956,6 +1030,12 @@ const char *cl_engine_get_str(const struct cl_engine *engine, enum cl_engine_fie
             return engine->pua_cats;
         case CL_ENGINE_TMPDIR:
             return engine->tmpdir;
+        case CL_ENGINE_BYTECODE_CACHE_DIR:
+            return engine->bytecode_cache_dir;
+        case CL_ENGINE_BYTECODE_NATIVE:
+            return engine->bytecode_native_module;
+        case CL_ENGINE_BYTECODE_NATIVE_OUT:
+            return engine->bytecode_native_output;
         default:
             cli_errmsg("cl_engine_get: Incorrect field number\n");
             if (err)
@@ -995,8 +1075,15 @@ struct cl_settings *cl_engine_settings_copy(const struct cl_engine *engine)
     settings->bytecode_security   = engine->bytecode_security;
     settings->bytecode_timeout    = engine->bytecode_timeout;
     settings->bytecode_mode       = engine->bytecode_mode;
+    settings->bytecode_lazy       = engine->bytecode_lazy;
+    settings->hugepages           = engine->hugepages;
+    settings->numa_node           = engine->numa_node;
     settings->pua_cats            = engine->pua_cats ? strdup(engine->pua_cats) : NULL;
 
+    settings->bytecode_cache_dir     = engine->bytecode_cache_dir ? strdup(engine->bytecode_cache_dir) : NULL;
+    settings->bytecode_native_module = engine->bytecode_native_module ? strdup(engine->bytecode_native_module) : NULL;
+    settings->bytecode_native_output = engine->bytecode_native_output ? strdup(engine->bytecode_native_output) : NULL;
+
     settings->cb_pre_cache                   = engine->cb_pre_cache;
     settings->cb_pre_scan                    = engine->cb_pre_scan;
     settings->cb_post_scan                   = engine->cb_post_scan;
@@ -1033,6 +1120,8 @@ struct cl_settings *cl_engine_settings_copy(const struct cl_engine *engine)
     settings->pcre_recmatch_limit = engine->pcre_recmatch_limit;
     settings->pcre_max_filesize   = engine->pcre_max_filesize;
 
+    settings->parallel_scan_threads = engine->parallel_scan_threads;
+
     return settings;
 }
 
@@ -1057,6 +1146,11 @@ cl_error_t cl_engine_settings_apply(struct cl_engine *engine, const struct cl_se
     engine->bytecode_security   = settings->bytecode_security;
     engine->bytecode_timeout    = settings->bytecode_timeout;
     engine->bytecode_mode       = settings->bytecode_mode;
+    engine->bytecode_lazy       = settings->bytecode_lazy;
+    engine->hugepages           = settings->hugepages;
+    engine->numa_node           = settings->numa_node;
+    MPOOL_SET_HUGEPAGES(engine->mempool, engine->hugepages);
+    MPOOL_SET_NUMA(engine->mempool, engine->numa_node);
     engine->engine_options      = settings->engine_options;
     engine->cache_size          = settings->cache_size;
 
@@ -1080,6 +1174,36 @@ cl_error_t cl_engine_settings_apply(struct cl_engine *engine, const struct cl_se
         engine->pua_cats = NULL;
     }
 
+    if (engine->bytecode_cache_dir)
+        MPOOL_FREE(engine->mempool, engine->bytecode_cache_dir);
+    if (settings->bytecode_cache_dir) {
+        engine->bytecode_cache_dir = CLI_MPOOL_STRDUP(engine->mempool, settings->bytecode_cache_dir);
+        if (!engine->bytecode_cache_dir)
+            return CL_EMEM;
+    } else {
+        engine->bytecode_cache_dir = NULL;
+    }
+
+    if (engine->bytecode_native_module)
+        MPOOL_FREE(engine->mempool, engine->bytecode_native_module);
+    if (settings->bytecode_native_module) {
+        engine->bytecode_native_module = CLI_MPOOL_STRDUP(engine->mempool, settings->bytecode_native_module);
+        if (!engine->bytecode_native_module)
+            return CL_EMEM;
+    } else {
+        engine->bytecode_native_module = NULL;
+    }
+
+    if (engine->bytecode_native_output)
+        MPOOL_FREE(engine->mempool, engine->bytecode_native_output);
+    if (settings->bytecode_native_output) {
+        engine->bytecode_native_output = CLI_MPOOL_STRDUP(engine->mempool, settings->bytecode_native_output);
+        if (!engine->bytecode_native_output)
+            return CL_EMEM;
+    } else {
+        engine->bytecode_native_output = NULL;
+    }
+
     engine->cb_pre_cache                   = settings->cb_pre_cache;
     engine->cb_pre_scan                    = settings->cb_pre_scan;
     engine->cb_post_scan                   = settings->cb_post_scan;
@@ -1114,6 +1238,8 @@ cl_error_t cl_engine_settings_apply(struct cl_engine *engine, const struct cl_se
     engine->pcre_recmatch_limit = settings->pcre_recmatch_limit;
     engine->pcre_max_filesize   = settings->pcre_max_filesize;
 
+    engine->parallel_scan_threads = settings->parallel_scan_threads;
+
     return CL_SUCCESS;
 }
 
@@ -1124,6 +1250,9 @@ cl_error_t cl_engine_settings_free(struct cl_settings *settings)
 
     free(settings->tmpdir);
     free(settings->pua_cats);
+    free(settings->bytecode_cache_dir);
+    free(settings->bytecode_native_module);
+    free(settings->bytecode_native_output);
     free(settings);
     return CL_SUCCESS;
 }
@@ -1159,6 +1288,11 @@ cl_error_t cli_checklimits(const char *who, cli_ctx *ctx, uint64_t need1, uint64
     needed = (need1 > need2) ? need1 : need2;
     needed = (needed > need3) ? needed : need3;
 
+    if (NULL != ctx->limits) {
+        // The counters are shared with parallel scan jobs, get the current values.
+        cli_scan_limits_sync(ctx);
+    }
+
     /* Enforce global time limit, if limit enabled */
     ret = cli_checktimelimit(ctx);
     if (CL_SUCCESS != ret) {
@@ -1212,6 +1346,17 @@ cl_error_t cli_updatelimits(cli_ctx *ctx, size_t needed)
         return ret;
     }
 
+    if (NULL != ctx->limits) {
+        // The counters are shared with parallel scan jobs, check again while accounting for the file.
+        ret = cli_scan_limits_add(ctx, needed);
+        if (CL_EMAXSIZE == ret) {
+            cli_append_potentially_unwanted_if_heur_exceedsmax(ctx, "Heuristics.Limits.Exceeded.MaxScanSize");
+        } else if (CL_EMAXFILES == ret) {
+            cli_append_potentially_unwanted_if_heur_exceedsmax(ctx, "Heuristics.Limits.Exceeded.MaxFiles");
+        }
+        return ret;
+    }
+
     ctx->scannedfiles++;
     ctx->scansize += needed;
     if (ctx->scansize > ctx->engine->maxscansize)
@@ -1235,6 +1380,13 @@ cl_error_t cli_checktimelimit(cli_ctx *ctx)
         goto done;
     }
 
+    if (NULL != ctx->job && cli_scan_job_cancelled(ctx->job)) {
+        // The parallel scan job was discarded, nobody will look at the result.
+        ctx->abort_scan = true;
+        ret             = CL_BREAK;
+        goto done;
+    }
+
     if (ctx->time_limit.tv_sec != 0) {
         struct timeval now;
         if (gettimeofday(&now, NULL) == 0) {
@@ -1405,7 +1557,14 @@ static cl_error_t append_virus(cli_ctx *ctx, const char *virname, IndicatorType
         goto done;
     }
 
-    if (type == IndicatorType_Strong) {
+    if (NULL != ctx->job) {
+        // This is the detached context of a parallel scan job.
+        // The indicator is added to the parent (and reported) when the job is finished.
+        if (CL_SUCCESS != cli_scan_job_add_alert(ctx->job, virname, type == IndicatorType_Strong)) {
+            status = CL_EMEM;
+            goto done;
+        }
+    } else if (type == IndicatorType_Strong) {
         // Run that virus callback which in clamscan says "<signature name> FOUND"
         cli_virus_found_cb(ctx, virname);
     }
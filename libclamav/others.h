@@ -191,6 +191,10 @@ typedef struct recursion_level_tag {
 typedef void *evidence_t;
 typedef void *onedump_t;
 
+struct cli_scan_job;
+struct cli_scan_pool;
+struct cli_scan_limits;
+
 /* internal clamav context */
 typedef struct cli_ctx_tag {
     char *target_filepath;    /* (optional) The filepath of the original scan target. */
@@ -221,6 +225,8 @@ typedef struct cli_ctx_tag {
     struct timeval time_limit;
     bool limit_exceeded; /* To guard against alerting on limits exceeded more than once, or storing that in the JSON metadata more than once. */
     bool abort_scan;     /* So we can guarantee a scan is aborted, even if CL_ETIMEOUT/etc. status is lost in the scan recursion stack. */
+    struct cli_scan_job *job;       /* Set in the detached context of a parallel scan job, see scanpool.h. */
+    struct cli_scan_limits *limits; /* scansize and scannedfiles, once shared with parallel scan jobs. */
 } cli_ctx;
 
 #define STATS_ANON_UUID "5b585e8f-3be5-11e3-bf0b-18037319526c"
@@ -400,6 +406,8 @@ struct cl_engine {
 
     /* Used for memory pools */
     mpool_t *mempool;
+    uint32_t hugepages; /* enum cl_hugepages_mode */
+    int32_t numa_node;  /* node, CL_NUMA_DEFAULT or CL_NUMA_INTERLEAVE */
 
     /* crtmgr stuff */
     crtmgr cmgr;
@@ -431,6 +439,11 @@ struct cl_engine {
     enum bytecode_security bytecode_security;
     uint32_t bytecode_timeout;
     enum bytecode_mode bytecode_mode;
+    uint32_t bytecode_lazy;       /* prepare bytecodes on their first run */
+    char *bytecode_cache_dir;     /* JIT object cache, NULL if disabled */
+    char *bytecode_native_module; /* precompiled bytecode module to load */
+    char *bytecode_native_output; /* write the compiled bytecodes here */
+    struct cli_threadlocal *bc_ctx_pool; /* recycled bytecode contexts */
 
     /* Engine max settings */
     uint64_t maxembeddedpe;      /* max size to scan MSEXE for PE */
@@ -462,6 +475,10 @@ struct cl_engine {
     uint64_t pcre_recmatch_limit;
     uint64_t pcre_max_filesize;
 
+    /* Parallel scanning of embedded content, see scanpool.h */
+    uint32_t parallel_scan_threads; /* 0 to scan everything in the scanning thread */
+    struct cli_scan_pool *scan_pool;
+
 #ifdef HAVE_YARA
     /* YARA */
     struct _yara_global *yara_global;
@@ -492,6 +509,12 @@ struct cl_settings {
     enum bytecode_security bytecode_security;
     uint32_t bytecode_timeout;
     enum bytecode_mode bytecode_mode;
+    uint32_t bytecode_lazy;
+    char *bytecode_cache_dir;
+    char *bytecode_native_module;
+    char *bytecode_native_output;
+    uint32_t hugepages;
+    int32_t numa_node;
     char *pua_cats;
     uint64_t engine_options;
     uint32_t cache_size;
@@ -543,6 +566,8 @@ struct cl_settings {
     uint64_t pcre_match_limit;
     uint64_t pcre_recmatch_limit;
     uint64_t pcre_max_filesize;
+
+    uint32_t parallel_scan_threads;
 };
 
 extern cl_unrar_error_t (*cli_unrar_open)(const char *filename, void **hArchive, char **comment, uint32_t *comment_size, uint8_t debug_flag);
@@ -56,6 +56,7 @@
 #include "others.h"
 #include "pdf.h"
 #include "pdfdecode.h"
+#include "scanpool.h"
 #include "scanners.h"
 #include "fmap.h"
 #include "str.h"
@@ -737,7 +738,76 @@ done:
     return status;
 }
 
-static size_t filter_writen(struct pdf_struct *pdf, struct pdf_obj *obj, int fout, const char *buf, size_t len, size_t *sum)
+/**
+ * @brief   Move an in-memory dump to its temp file.
+ *
+ * @param dump          The dump.
+ * @return cl_error_t   CL_SUCCESS, CL_ETMPFILE or CL_EWRITE.
+ */
+static cl_error_t pdf_dump_spill(struct pdf_dump *dump)
+{
+    dump->fd = open(dump->path, O_RDWR | O_CREAT | O_EXCL | O_TRUNC | O_BINARY, 0600);
+    if (dump->fd < 0) {
+        char err[128];
+        cli_errmsg("pdf_dump_spill: can't create temporary file %s: %s\n", dump->path, cli_strerror(errno, err, sizeof(err)));
+        return CL_ETMPFILE;
+    }
+
+    if (dump->len && cli_writen(dump->fd, dump->buf, dump->len) != dump->len) {
+        cli_errmsg("pdf_dump_spill: failed to write to temporary file %s\n", dump->path);
+        return CL_EWRITE;
+    }
+
+    free(dump->buf);
+    dump->buf      = NULL;
+    dump->capacity = 0;
+
+    return CL_SUCCESS;
+}
+
+cl_error_t pdf_dump_write(struct pdf_dump *dump, const char *buf, size_t len)
+{
+    cl_error_t ret;
+
+    if (dump->fd >= 0) {
+        if (cli_writen(dump->fd, buf, len) != len)
+            return CL_EWRITE;
+        dump->len += len;
+        return CL_SUCCESS;
+    }
+
+    if (len > PDF_DUMP_MEMORY_MAX - dump->len) {
+        /* Too big to keep in memory, continue in the temp file */
+        if (CL_SUCCESS != (ret = pdf_dump_spill(dump)))
+            return ret;
+        return pdf_dump_write(dump, buf, len);
+    }
+
+    if (dump->len + len > dump->capacity) {
+        size_t capacity = dump->capacity ? dump->capacity : BUFSIZ;
+        char *newbuf;
+
+        while (capacity < dump->len + len)
+            capacity *= 2;
+        if (capacity > PDF_DUMP_MEMORY_MAX)
+            capacity = PDF_DUMP_MEMORY_MAX;
+
+        newbuf = cli_max_realloc(dump->buf, capacity);
+        if (!newbuf) {
+            cli_errmsg("pdf_dump_write: can't allocate %zu bytes\n", capacity);
+            return CL_EMEM;
+        }
+        dump->buf      = newbuf;
+        dump->capacity = capacity;
+    }
+
+    memcpy(dump->buf + dump->len, buf, len);
+    dump->len += len;
+
+    return CL_SUCCESS;
+}
+
+static size_t filter_writen(struct pdf_struct *pdf, struct pdf_obj *obj, struct pdf_dump *dump, const char *buf, size_t len, size_t *sum)
 {
     UNUSEDPARAM(obj);
 
@@ -746,7 +816,10 @@ static size_t filter_writen(struct pdf_struct *pdf, struct pdf_obj *obj, int fou
 
     *sum += len;
 
-    return cli_writen(fout, buf, len);
+    if (CL_SUCCESS != pdf_dump_write(dump, buf, len))
+        return 0;
+
+    return len;
 }
 
 void pdfobj_flag(struct pdf_struct *pdf, struct pdf_obj *obj, enum pdf_flag flag)
@@ -826,12 +899,159 @@ void pdfobj_flag(struct pdf_struct *pdf, struct pdf_obj *obj, enum pdf_flag flag
     cli_dbgmsg("pdfobj_flag: %s flagged in object %u %u\n", s, obj->id >> 8, obj->id & 0xff);
 }
 
+static int objidx_cmp(const void *a, const void *b)
+{
+    const struct pdf_objidx_entry *ea = a;
+    const struct pdf_objidx_entry *eb = b;
+
+    if (ea->id != eb->id)
+        return (ea->id < eb->id) ? -1 : 1;
+    if (ea->pos != eb->pos)
+        return (ea->pos < eb->pos) ? -1 : 1;
+    return 0;
+}
+
+/**
+ * @brief   Bring the object id index up to date with pdf->objs.
+ *
+ * Objects are only ever appended to pdf->objs (e.g. when an object stream is
+ * parsed), so the new ones are sorted on their own and merged into the index.
+ *
+ * @param pdf           Pdf context structure.
+ * @return cl_error_t   CL_SUCCESS, or CL_EMEM.
+ */
+static cl_error_t objidx_update(struct pdf_struct *pdf)
+{
+    struct pdf_objidx_entry *idx;
+    uint32_t nold = pdf->nobjidx;
+    uint32_t i, a, b, n;
+
+    if (nold > pdf->nobjs) {
+        /* shouldn't happen, start over */
+        nold = 0;
+    }
+
+    idx = cli_max_realloc(pdf->objidx, sizeof(*idx) * ((size_t)pdf->nobjs + (pdf->nobjs - nold)));
+    if (!idx)
+        return CL_EMEM;
+    pdf->objidx = idx;
+
+    /* the new entries go after the scratch space for the merge */
+    for (i = nold; i < pdf->nobjs; i++) {
+        idx[pdf->nobjs + (i - nold)].id  = pdf->objs[i]->id;
+        idx[pdf->nobjs + (i - nold)].pos = i;
+    }
+    qsort(&idx[pdf->nobjs], pdf->nobjs - nold, sizeof(*idx), objidx_cmp);
+
+    /* merge from the back, so the old entries don't need to be moved out of the way */
+    a = nold;
+    b = pdf->nobjs - nold;
+    n = pdf->nobjs;
+    while (b > 0) {
+        if (a > 0 && objidx_cmp(&idx[a - 1], &idx[pdf->nobjs + b - 1]) > 0)
+            idx[--n] = idx[--a];
+        else {
+            idx[--n] = idx[pdf->nobjs + b - 1];
+            b--;
+        }
+    }
+
+    pdf->nobjidx = pdf->nobjs;
+    return CL_SUCCESS;
+}
+
+/**
+ * @brief   Find the first object id index entry for an id.
+ *
+ * @param pdf       Pdf context structure.
+ * @param objid     Object id.
+ * @return uint32_t Index of the entry, pdf->nobjidx if there is none.
+ */
+static uint32_t objidx_lookup(struct pdf_struct *pdf, uint32_t objid)
+{
+    uint32_t lo = 0;
+    uint32_t hi = pdf->nobjidx;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (pdf->objidx[mid].id < objid)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo < pdf->nobjidx && pdf->objidx[lo].id == objid)
+        return lo;
+
+    return pdf->nobjidx;
+}
+
+/**
+ * @brief   Find an object by id, using the object id index.
+ *
+ * Gives the same result as a linear search of pdf->objs starting at obj and
+ * wrapping around at the end.
+ *
+ * @param pdf       Pdf context structure.
+ * @param obj       Object to start the search at, may be NULL.
+ * @param objid     Object id.
+ * @param[out] res  The object found, or NULL.
+ * @return bool     false if the index couldn't be used.
+ */
+static bool objidx_find(struct pdf_struct *pdf, struct pdf_obj *obj, uint32_t objid, struct pdf_obj **res)
+{
+    uint32_t start = pdf->nobjs;
+    uint32_t i, first;
+
+    if (pdf->nobjidx != pdf->nobjs || !pdf->objidx) {
+        if (CL_SUCCESS != objidx_update(pdf))
+            return false;
+    }
+
+    /* position of obj in pdf->objs */
+    if (obj) {
+        for (i = objidx_lookup(pdf, obj->id); i < pdf->nobjidx && pdf->objidx[i].id == obj->id; i++) {
+            if (pdf->objs[pdf->objidx[i].pos] == obj) {
+                start = pdf->objidx[i].pos;
+                break;
+            }
+        }
+    }
+
+    *res  = NULL;
+    first = objidx_lookup(pdf, objid);
+    if (first == pdf->nobjidx)
+        return true;
+
+    for (i = first; i < pdf->nobjidx && pdf->objidx[i].id == objid; i++) {
+        if (pdf->objidx[i].pos >= start)
+            break;
+    }
+    if (i == pdf->nobjidx || pdf->objidx[i].id != objid) {
+        /* restart from the beginning */
+        i = first;
+    }
+
+    if (pdf->objs[pdf->objidx[i].pos]->id != objid) {
+        /* pdf->objs was changed behind our back, rebuild next time */
+        pdf->nobjidx = 0;
+        return false;
+    }
+
+    *res = pdf->objs[pdf->objidx[i].pos];
+    return true;
+}
+
 struct pdf_obj *find_obj(struct pdf_struct *pdf, struct pdf_obj *obj, uint32_t objid)
 {
     uint32_t j;
     uint32_t i;
+    struct pdf_obj *res;
+
+    if (objidx_find(pdf, obj, objid, &res))
+        return res;
 
-    /* search starting at previous obj (if exists) */
+    /* couldn't allocate the index, search starting at previous obj (if exists) */
     for (i = 0; i < pdf->nobjs; i++) {
         if (pdf->objs[i] == obj)
             break;
@@ -1057,7 +1277,7 @@ static size_t find_length(struct pdf_struct *pdf, struct pdf_obj *obj, const cha
 
 #define DUMP_MASK ((1 << OBJ_CONTENTS) | (1 << OBJ_FILTER_FLATE) | (1 << OBJ_FILTER_DCT) | (1 << OBJ_FILTER_AH) | (1 << OBJ_FILTER_A85) | (1 << OBJ_EMBEDDED_FILE) | (1 << OBJ_JAVASCRIPT) | (1 << OBJ_OPENACTION) | (1 << OBJ_LAUNCHACTION))
 
-static int run_pdf_hooks(struct pdf_struct *pdf, enum pdf_phase phase, int fd)
+static int run_pdf_hooks(struct pdf_struct *pdf, enum pdf_phase phase, struct pdf_dump *dump)
 {
     int ret;
     struct cli_bc_ctx *bc_ctx;
@@ -1069,19 +1289,22 @@ static int run_pdf_hooks(struct pdf_struct *pdf, enum pdf_phase phase, int fd)
 
     ctx = pdf->ctx;
 
-    bc_ctx = cli_bytecode_context_alloc();
+    bc_ctx = cli_bytecode_context_alloc(ctx->engine);
     if (!bc_ctx) {
         cli_errmsg("run_pdf_hooks: can't allocate memory for bc_ctx\n");
         return CL_EMEM;
     }
 
     map = ctx->fmap;
-    if (fd != -1) {
-        map = fmap(fd, 0, 0, NULL);
+    if (NULL != dump) {
+        if (dump->fd >= 0)
+            map = fmap(dump->fd, 0, 0, NULL);
+        else
+            map = fmap_open_memory(dump->buf, dump->len, NULL);
         if (!map) {
             cli_dbgmsg("run_pdf_hooks: can't mmap pdf extracted obj\n");
-            map = ctx->fmap;
-            fd  = -1;
+            map  = ctx->fmap;
+            dump = NULL;
         }
     }
 
@@ -1090,7 +1313,7 @@ static int run_pdf_hooks(struct pdf_struct *pdf, enum pdf_phase phase, int fd)
     ret = cli_bytecode_runhook(ctx, ctx->engine, bc_ctx, BC_PDF, map);
     cli_bytecode_context_destroy(bc_ctx);
 
-    if (fd != -1)
+    if (NULL != dump)
         funmap(map);
 
     return ret;
@@ -1357,7 +1580,7 @@ enum cstate {
     CSTATE_TJ_PAROPEN
 };
 
-static void process(struct text_norm_state *s, enum cstate *st, const char *buf, size_t length, int fout)
+static void process(struct text_norm_state *s, enum cstate *st, const char *buf, size_t length, struct pdf_dump *out)
 {
     do {
         switch (*st) {
@@ -1388,7 +1611,7 @@ static void process(struct text_norm_state *s, enum cstate *st, const char *buf,
                     *st = CSTATE_TJ;
                 } else {
                     if (text_normalize_buffer(s, (const unsigned char *)buf, 1) != 1) {
-                        cli_writen(fout, s->out, s->out_pos);
+                        pdf_dump_write(out, (const char *)s->out, s->out_pos);
                         text_normalize_reset(s);
                     }
                 }
@@ -1402,52 +1625,215 @@ static void process(struct text_norm_state *s, enum cstate *st, const char *buf,
     } while (length > 0);
 }
 
-static int pdf_scan_contents(int fd, struct pdf_struct *pdf, struct pdf_obj *obj)
+static int pdf_scan_contents(struct pdf_dump *dump, struct pdf_struct *pdf, struct pdf_obj *obj)
 {
     struct text_norm_state s;
     char fullname[1024];
     char outbuff[BUFSIZ];
     char inbuf[BUFSIZ];
-    int fout;
+    struct pdf_dump out;
     size_t n;
     cl_error_t rc;
     enum cstate st = CSTATE_NONE;
 
     snprintf(fullname, sizeof(fullname), "%s" PATHSEP "pdf obj %d %d contents", pdf->dir, obj->id >> 8, obj->id & 0xff);
-    fout = open(fullname, O_RDWR | O_CREAT | O_EXCL | O_TRUNC | O_BINARY, 0600);
-    if (fout < 0) {
-        char err[128];
 
-        cli_errmsg("pdf_scan_contents: can't create temporary file %s: %s\n", fullname, cli_strerror(errno, err, sizeof(err)));
-        return CL_ETMPFILE;
+    memset(&out, 0, sizeof(out));
+    out.fd   = -1;
+    out.path = fullname;
+    if (pdf->ctx->engine->keeptmp) {
+        rc = pdf_dump_spill(&out);
+        if (CL_SUCCESS != rc) {
+            if (out.fd >= 0)
+                close(out.fd);
+            return rc;
+        }
     }
 
     text_normalize_init(&s, (unsigned char *)outbuff, sizeof(outbuff));
-    while (1) {
-        n = cli_readn(fd, inbuf, sizeof(inbuf));
-        if ((n == 0) || (n == (size_t)-1))
-            break;
+    if (dump->fd >= 0) {
+        lseek(dump->fd, 0, SEEK_SET);
+        while (1) {
+            n = cli_readn(dump->fd, inbuf, sizeof(inbuf));
+            if ((n == 0) || (n == (size_t)-1))
+                break;
+
+            process(&s, &st, inbuf, n, &out);
+        }
+    } else {
+        size_t off;
 
-        process(&s, &st, inbuf, n, fout);
+        for (off = 0; off < dump->len; off += n) {
+            n = MIN(dump->len - off, sizeof(inbuf));
+            process(&s, &st, dump->buf + off, n, &out);
+        }
     }
 
-    cli_writen(fout, s.out, s.out_pos);
+    pdf_dump_write(&out, (const char *)s.out, s.out_pos);
 
-    lseek(fout, 0, SEEK_SET);
-    rc = cli_magic_scan_desc(fout, fullname, pdf->ctx, NULL, LAYER_ATTRIBUTES_NONE);
-    close(fout);
+    if (out.fd >= 0) {
+        lseek(out.fd, 0, SEEK_SET);
+        rc = cli_magic_scan_desc(out.fd, fullname, pdf->ctx, NULL, LAYER_ATTRIBUTES_NONE);
+        close(out.fd);
 
-    if (!pdf->ctx->engine->keeptmp || (s.out_pos == 0))
-        if (cli_unlink(fullname) && rc != CL_VIRUS)
-            rc = CL_EUNLINK;
+        if (!pdf->ctx->engine->keeptmp || (out.len == 0))
+            if (cli_unlink(fullname) && rc != CL_VIRUS)
+                rc = CL_EUNLINK;
+    } else if (out.len > 0) {
+        rc = cli_magic_scan_buff(out.buf, out.len, pdf->ctx, NULL, LAYER_ATTRIBUTES_NONE);
+    } else {
+        rc = CL_SUCCESS;
+    }
 
+    free(out.buf);
     return rc;
 }
 
+/**
+ * @brief   Finish up an extracted object after the scan of its dump.
+ *
+ * Runs the post-dump bytecode hooks, and scans the text of /Contents objects.
+ *
+ * @param pdf           Pdf context structure.
+ * @param obj           The object.
+ * @param dump          The object's dump.
+ * @param rc            Status of the extraction.
+ * @param scan_rc       Result of the scan of the dump.
+ * @return cl_error_t   Status of the object.
+ */
+static cl_error_t pdf_obj_scanned(struct pdf_struct *pdf, struct pdf_obj *obj, struct pdf_dump *dump, cl_error_t rc, cl_error_t scan_rc)
+{
+    cl_error_t rc2;
+
+    if (scan_rc != CL_SUCCESS)
+        return scan_rc;
+
+    if ((rc == CL_CLEAN) || (rc == CL_VIRUS)) {
+        rc2 = run_pdf_hooks(pdf, PDF_PHASE_POSTDUMP, dump);
+        if (rc2 == CL_VIRUS)
+            return rc2;
+    }
+
+    if (((rc == CL_CLEAN) || (rc == CL_VIRUS)) && (obj->flags & (1 << OBJ_CONTENTS))) {
+        cli_dbgmsg("pdf_extract_obj: dumping contents from obj %u %u\n", obj->id >> 8, obj->id & 0xff);
+
+        rc2 = pdf_scan_contents(dump, pdf, obj);
+        if (rc2 != CL_SUCCESS)
+            return rc2;
+    }
+
+    return rc;
+}
+
+/**
+ * @brief   Hand the scan of an extracted object over to the scan pool.
+ *
+ * Only dumps held in memory are handed over, the buffer is moved to the job.
+ *
+ * @param pdf           Pdf context structure.
+ * @param obj           The object.
+ * @param dump          The object's dump.
+ * @return cl_error_t   CL_SUCCESS if the job was submitted, otherwise the object must be scanned by the caller.
+ */
+static cl_error_t pdf_scan_job_submit(struct pdf_struct *pdf, struct pdf_obj *obj, struct pdf_dump *dump)
+{
+    struct pdf_scan_job *slot;
+    cl_error_t ret;
+
+    if ((dump->fd >= 0) || (dump->len == 0) || (pdf->nscan_jobs == pdf->scan_jobs_max))
+        return CL_EARG;
+
+    slot = &pdf->scan_jobs[(pdf->scan_jobs_first + pdf->nscan_jobs) % pdf->scan_jobs_max];
+
+    ret = cli_scan_job_submit(pdf->ctx, dump->buf, dump->len, NULL, LAYER_ATTRIBUTES_NONE, &slot->job);
+    if (CL_SUCCESS != ret)
+        return ret;
+
+    slot->obj       = obj;
+    slot->dump      = *dump;
+    slot->dump.path = NULL;
+    pdf->nscan_jobs++;
+
+    dump->buf      = NULL;
+    dump->len      = 0;
+    dump->capacity = 0;
+
+    return CL_SUCCESS;
+}
+
+/**
+ * @brief   Wait for the scan of the oldest object handed to the scan pool, and finish it up.
+ *
+ * @param pdf           Pdf context structure.
+ * @return cl_error_t   Status of the object, as pdf_extract_obj() would have returned it.
+ */
+static cl_error_t pdf_scan_job_finish(struct pdf_struct *pdf)
+{
+    struct pdf_scan_job *slot = &pdf->scan_jobs[pdf->scan_jobs_first];
+    cl_error_t rc;
+
+    rc = cli_scan_job_finish(pdf->ctx, slot->job);
+    rc = pdf_obj_scanned(pdf, slot->obj, &slot->dump, CL_SUCCESS, rc);
+
+    free(slot->dump.buf);
+    memset(slot, 0, sizeof(*slot));
+
+    pdf->scan_jobs_first = (pdf->scan_jobs_first + 1) % pdf->scan_jobs_max;
+    pdf->nscan_jobs--;
+
+    return rc;
+}
+
+/**
+ * @brief   Wait for all objects handed to the scan pool, and finish them up in order.
+ *
+ * Must be called before anything is scanned inline, so that alerts are added
+ * in the order a serial scan would have found them.
+ *
+ * @param pdf           Pdf context structure.
+ * @return cl_error_t   CL_SUCCESS, or the status of the first object that stops the scan.
+ */
+static cl_error_t pdf_scan_jobs_finish(struct pdf_struct *pdf)
+{
+    cl_error_t rc;
+
+    while (pdf->nscan_jobs) {
+        rc = pdf_scan_job_finish(pdf);
+        if (rc == CL_EFORMAT) {
+            /* Don't halt on one bad object */
+            pdf->scan_jobs_badobjects++;
+            pdf->stats.ninvalidobjs++;
+        } else if (rc != CL_SUCCESS) {
+            return rc;
+        }
+    }
+
+    return CL_SUCCESS;
+}
+
+/**
+ * @brief   Throw away the objects still being scanned by the scan pool.
+ *
+ * @param pdf   Pdf context structure.
+ */
+static void pdf_scan_jobs_discard(struct pdf_struct *pdf)
+{
+    while (pdf->nscan_jobs) {
+        struct pdf_scan_job *slot = &pdf->scan_jobs[pdf->scan_jobs_first];
+
+        cli_scan_job_discard(slot->job);
+        free(slot->dump.buf);
+        memset(slot, 0, sizeof(*slot));
+
+        pdf->scan_jobs_first = (pdf->scan_jobs_first + 1) % pdf->scan_jobs_max;
+        pdf->nscan_jobs--;
+    }
+}
+
 cl_error_t pdf_extract_obj(struct pdf_struct *pdf, struct pdf_obj *obj, uint32_t flags)
 {
     char fullname[PATH_MAX + 1];
-    int fout      = -1;
+    struct pdf_dump fout;
     size_t sum    = 0;
     cl_error_t rc = CL_SUCCESS;
     int dump      = 1;
@@ -1497,12 +1883,20 @@ cl_error_t pdf_extract_obj(struct pdf_struct *pdf, struct pdf_obj *obj, uint32_t
     cli_dbgmsg("pdf_extract_obj: dumping obj %u %u\n", obj->id >> 8, obj->id & 0xff);
 
     snprintf(fullname, sizeof(fullname), "%s" PATHSEP "pdf obj %d %d", pdf->dir, obj->id >> 8, obj->id & 0xff);
-    fout = open(fullname, O_RDWR | O_CREAT | O_EXCL | O_TRUNC | O_BINARY, 0600);
-    if (fout < 0) {
-        char err[128];
-        cli_errmsg("pdf_extract_obj: can't create temporary file %s: %s\n", fullname, cli_strerror(errno, err, sizeof(err)));
 
-        return CL_ETMPFILE;
+    /*
+     * The object is decoded into memory and scanned from there, unless it
+     * is too big, or the file is wanted: it is dumped for the caller, or
+     * temp files are kept.
+     */
+    memset(&fout, 0, sizeof(fout));
+    fout.fd   = -1;
+    fout.path = fullname;
+    if (!(flags & PDF_EXTRACT_OBJ_SCAN) || pdf->ctx->engine->keeptmp) {
+        rc = pdf_dump_spill(&fout);
+        if (CL_SUCCESS != rc) {
+            goto really_done;
+        }
     }
 
     if (!(flags & PDF_EXTRACT_OBJ_SCAN)) {
@@ -1648,14 +2042,16 @@ cl_error_t pdf_extract_obj(struct pdf_struct *pdf, struct pdf_obj *obj, uint32_t
                 if (!pdf->objstms) {
                     cli_warnmsg("pdf_extract_obj: out of memory parsing object stream (%u)\n", pdf->nobjstms);
                     pdf_free_dict(dparams);
-                    return CL_EMEM;
+                    rc = CL_EMEM;
+                    goto really_done;
                 }
 
                 objstm = malloc(sizeof(struct objstm_struct));
                 if (!objstm) {
                     cli_warnmsg("pdf_extract_obj: out of memory parsing object stream (%u)\n", pdf->nobjstms);
                     pdf_free_dict(dparams);
-                    return CL_EMEM;
+                    rc = CL_EMEM;
+                    goto really_done;
                 }
                 pdf->objstms[pdf->nobjstms - 1] = objstm;
 
@@ -1673,7 +2069,7 @@ cl_error_t pdf_extract_obj(struct pdf_struct *pdf, struct pdf_obj *obj, uint32_t
             }
         }
 
-        sum = pdf_decodestream(pdf, obj, dparams, obj->stream, (uint32_t)length, xref, fout, &rc, objstm);
+        sum = pdf_decodestream(pdf, obj, dparams, obj->stream, (uint32_t)length, xref, &fout, &rc, objstm);
         if ((CL_SUCCESS != rc) && (CL_VIRUS != rc)) {
             cli_dbgmsg("Error decoding stream! Error code: %d\n", rc);
 
@@ -1713,7 +2109,8 @@ cl_error_t pdf_extract_obj(struct pdf_struct *pdf, struct pdf_obj *obj, uint32_t
 
                             if (!pdf->objstms) {
                                 cli_warnmsg("pdf_extract_obj: out of memory when shrinking down objstm array\n");
-                                return CL_EMEM;
+                                rc = CL_EMEM;
+                                goto really_done;
                             }
                         }
                     } else {
@@ -1788,7 +2185,7 @@ cl_error_t pdf_extract_obj(struct pdf_struct *pdf, struct pdf_obj *obj, uint32_t
 
                 pdf->stats.njs++;
 
-                if (filter_writen(pdf, obj, fout, out, js_len, (size_t *)&sum) != js_len) {
+                if (filter_writen(pdf, obj, &fout, out, js_len, (size_t *)&sum) != js_len) {
                     rc = CL_EWRITE;
                     free(js);
                     break;
@@ -1813,7 +2210,7 @@ cl_error_t pdf_extract_obj(struct pdf_struct *pdf, struct pdf_obj *obj, uint32_t
 
                     if (q2 > q) {
                         q--;
-                        filter_writen(pdf, obj, fout, q, q2 - q, (size_t *)&sum);
+                        filter_writen(pdf, obj, &fout, q, q2 - q, (size_t *)&sum);
                         q++;
                     }
                 }
@@ -1827,10 +2224,10 @@ cl_error_t pdf_extract_obj(struct pdf_struct *pdf, struct pdf_obj *obj, uint32_t
             rc = CL_EFORMAT;
         else {
             if (obj->objstm) {
-                if (filter_writen(pdf, obj, fout, obj->objstm->streambuf + obj->start, bytesleft, (size_t *)&sum) != (size_t)bytesleft)
+                if (filter_writen(pdf, obj, &fout, obj->objstm->streambuf + obj->start, bytesleft, (size_t *)&sum) != (size_t)bytesleft)
                     rc = CL_EWRITE;
             } else {
-                if (filter_writen(pdf, obj, fout, pdf->map + obj->start, bytesleft, (size_t *)&sum) != (size_t)bytesleft)
+                if (filter_writen(pdf, obj, &fout, pdf->map + obj->start, bytesleft, (size_t *)&sum) != (size_t)bytesleft)
                     rc = CL_EWRITE;
             }
         }
@@ -1839,46 +2236,51 @@ cl_error_t pdf_extract_obj(struct pdf_struct *pdf, struct pdf_obj *obj, uint32_t
 done:
 
     cli_dbgmsg("pdf_extract_obj: extracted %td bytes %u %u obj\n", sum, obj->id >> 8, obj->id & 0xff);
-    cli_dbgmsg("pdf_extract_obj:         ... to %s\n", fullname);
+    if (fout.fd >= 0)
+        cli_dbgmsg("pdf_extract_obj:         ... to %s\n", fullname);
 
     if (flags & PDF_EXTRACT_OBJ_SCAN && sum) {
-        int rc2;
+        cl_error_t rc2;
 
-        /* TODO: invoke bytecode on this pdf obj with metainformation associated */
-        lseek(fout, 0, SEEK_SET);
-        rc2 = cli_magic_scan_desc(fout, fullname, pdf->ctx, NULL, LAYER_ATTRIBUTES_NONE);
-        if (rc2 != CL_SUCCESS) {
-            rc = rc2;
+        if ((flags & PDF_EXTRACT_OBJ_PARALLEL) && (CL_SUCCESS == rc) &&
+            (CL_SUCCESS == pdf_scan_job_submit(pdf, obj, &fout))) {
+            /* the rest is done in pdf_scan_job_finish() */
             goto really_done;
         }
 
-        if ((rc == CL_CLEAN) || (rc == CL_VIRUS)) {
-            rc2 = run_pdf_hooks(pdf, PDF_PHASE_POSTDUMP, fout);
-            if (rc2 == CL_VIRUS) {
+        if ((flags & PDF_EXTRACT_OBJ_PARALLEL) && pdf->nscan_jobs) {
+            /* objects extracted earlier must be done before this one is scanned */
+            rc2 = pdf_scan_jobs_finish(pdf);
+            if (rc2 != CL_SUCCESS) {
                 rc = rc2;
                 goto really_done;
             }
         }
 
-        if (((rc == CL_CLEAN) || (rc == CL_VIRUS)) && (obj->flags & (1 << OBJ_CONTENTS))) {
-            lseek(fout, 0, SEEK_SET);
-            cli_dbgmsg("pdf_extract_obj: dumping contents from obj %u %u\n", obj->id >> 8, obj->id & 0xff);
-
-            rc2 = pdf_scan_contents(fout, pdf, obj);
-            if (rc2 != CL_SUCCESS) {
-                rc = rc2;
-                goto really_done;
-            }
+        /* TODO: invoke bytecode on this pdf obj with metainformation associated */
+        if (fout.fd >= 0) {
+            lseek(fout.fd, 0, SEEK_SET);
+            rc2 = cli_magic_scan_desc(fout.fd, fullname, pdf->ctx, NULL, LAYER_ATTRIBUTES_NONE);
+        } else if (fout.len > 0) {
+            rc2 = cli_magic_scan_buff(fout.buf, fout.len, pdf->ctx, NULL, LAYER_ATTRIBUTES_NONE);
+        } else {
+            rc2 = CL_SUCCESS;
         }
+
+        rc = pdf_obj_scanned(pdf, obj, &fout, rc, rc2);
     }
 
 really_done:
-    close(fout);
+    free(fout.buf);
 
-    if (CL_EMEM != rc) {
-        if (flags & PDF_EXTRACT_OBJ_SCAN && !pdf->ctx->engine->keeptmp)
-            if (cli_unlink(fullname) && rc != CL_VIRUS)
-                rc = CL_EUNLINK;
+    if (fout.fd >= 0) {
+        close(fout.fd);
+
+        if (CL_EMEM != rc) {
+            if (flags & PDF_EXTRACT_OBJ_SCAN && !pdf->ctx->engine->keeptmp)
+                if (cli_unlink(fullname) && rc != CL_VIRUS)
+                    rc = CL_EUNLINK;
+        }
     }
 
     return rc;
@@ -3627,15 +4029,28 @@ static cl_error_t pdf_find_and_extract_objs(struct pdf_struct *pdf)
     }
 
     if (CL_SUCCESS == status) {
-        status = run_pdf_hooks(pdf, PDF_PHASE_PARSED, -1);
+        status = run_pdf_hooks(pdf, PDF_PHASE_PARSED, NULL);
         cli_dbgmsg("pdf_find_and_extract_objs: (parsed hooks) returned %d\n", status);
     }
 
     if (CL_SUCCESS == status) {
-        /* extract PDF objs */
-        for (i = 0; !status && i < pdf->nobjs; i++) {
-            struct pdf_obj *obj = pdf->objs[i];
+        uint32_t extract_flags = PDF_EXTRACT_OBJ_SCAN;
+
+        /*
+         * Objects are still decoded one at a time, in order, as that updates
+         * the parser state. The scans of the decoded objects may run in
+         * parallel, and are finished in the same order.
+         */
+        pdf->scan_jobs_max = cli_scan_parallel_jobs(ctx);
+        if (pdf->scan_jobs_max) {
+            pdf->scan_jobs = cli_max_calloc(pdf->scan_jobs_max, sizeof(struct pdf_scan_job));
+            if (pdf->scan_jobs) {
+                extract_flags |= PDF_EXTRACT_OBJ_PARALLEL;
+            }
+        }
 
+        /* extract PDF objs */
+        for (i = 0; !status && (i < pdf->nobjs || pdf->nscan_jobs); i++) {
             if (cli_checktimelimit(pdf->ctx) != CL_SUCCESS) {
                 cli_dbgmsg("pdf_find_and_extract_objs: Timeout reached in the PDF parser while extracting objects.\n");
 
@@ -3643,9 +4058,15 @@ static cl_error_t pdf_find_and_extract_objs(struct pdf_struct *pdf)
                 goto done;
             }
 
-            pdf->parse_recursion_depth++;
-            status = pdf_extract_obj(pdf, obj, PDF_EXTRACT_OBJ_SCAN);
-            pdf->parse_recursion_depth--;
+            if (pdf->nscan_jobs && (pdf->nscan_jobs == pdf->scan_jobs_max || i >= pdf->nobjs)) {
+                /* make room, or collect the rest once all objects are extracted */
+                status = pdf_scan_job_finish(pdf);
+                i--;
+            } else {
+                pdf->parse_recursion_depth++;
+                status = pdf_extract_obj(pdf, pdf->objs[i], extract_flags);
+                pdf->parse_recursion_depth--;
+            }
             switch (status) {
                 case CL_EFORMAT:
                     /* Don't halt on one bad object */
@@ -3663,6 +4084,25 @@ static cl_error_t pdf_find_and_extract_objs(struct pdf_struct *pdf)
     }
 
 done:
+    if (pdf && pdf->scan_jobs) {
+        if (status != CL_VIRUS) {
+            /*
+             * A serial scan would have scanned these objects before stopping
+             * on a timeout or an error, so keep what they found.
+             */
+            cl_error_t rc = pdf_scan_jobs_finish(pdf);
+            if (rc == CL_VIRUS)
+                status = rc;
+        }
+        /* after a detection, the objects left wouldn't have been scanned */
+        pdf_scan_jobs_discard(pdf);
+        free(pdf->scan_jobs);
+        pdf->scan_jobs     = NULL;
+        pdf->scan_jobs_max = 0;
+
+        badobjects += pdf->scan_jobs_badobjects;
+    }
+
     if ((CL_SUCCESS == status) && badobjects) {
         status = CL_EFORMAT;
     }
@@ -3854,7 +4294,7 @@ cl_error_t cli_pdf(const char *dir, cli_ctx *ctx, off_t offset)
 
     pdf.startoff = offset;
 
-    rc = run_pdf_hooks(&pdf, PDF_PHASE_PRE, -1);
+    rc = run_pdf_hooks(&pdf, PDF_PHASE_PRE, NULL);
     if (CL_SUCCESS != rc) {
         cli_dbgmsg("cli_pdf: (pre hooks) returning %d\n", rc);
 
@@ -3883,7 +4323,7 @@ cl_error_t cli_pdf(const char *dir, cli_ctx *ctx, off_t offset)
 
     if (pdf.flags && CL_SUCCESS == rc) {
         cli_dbgmsg("cli_pdf: flags 0x%02x\n", pdf.flags);
-        rc = run_pdf_hooks(&pdf, PDF_PHASE_END, -1);
+        rc = run_pdf_hooks(&pdf, PDF_PHASE_END, NULL);
 
         if (CL_SUCCESS == rc && SCAN_HEURISTICS && (ctx->dconf->other & OTHER_CONF_PDFNAMEOBJ)) {
             if (pdf.flags & (1 << ESCAPED_COMMON_PDFNAME)) {
@@ -3944,6 +4384,11 @@ err:
         free(pdf.objs);
         pdf.objs = NULL;
     }
+    if (pdf.objidx) {
+        free(pdf.objidx);
+        pdf.objidx  = NULL;
+        pdf.nobjidx = 0;
+    }
     if (pdf.fileID) {
         free(pdf.fileID);
         pdf.fileID = NULL;
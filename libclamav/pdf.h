@@ -37,6 +37,34 @@ struct objstm_struct {
     size_t streambuf_len;  // length of stream buffer, includes pairs followed by actual objects
 };
 
+/*
+ * Output of an extracted object.
+ * It is kept in memory and scanned with cli_magic_scan_buff() unless it grows
+ * past PDF_DUMP_MEMORY_MAX, in which case it is moved to a temp file.
+ */
+#define PDF_DUMP_MEMORY_MAX (16 * 1024 * 1024)
+
+struct pdf_dump {
+    int fd;           /* temp file, or -1 while the output is held in memory */
+    const char *path; /* temp file path, used if the output is moved to a file */
+    char *buf;
+    size_t len;
+    size_t capacity;
+};
+
+/* An extracted object being scanned by the scan pool */
+struct pdf_scan_job {
+    struct pdf_obj *obj;
+    struct pdf_dump dump;
+    struct cli_scan_job *job;
+};
+
+/* Object id lookup index, sorted by id then position in pdf->objs */
+struct pdf_objidx_entry {
+    uint32_t id;
+    uint32_t pos;
+};
+
 struct pdf_obj {
     uint32_t start;
     size_t size;
@@ -171,6 +199,13 @@ struct pdf_struct {
     struct objstm_struct **objstms;
     uint32_t nobjstms;
     uint32_t parse_recursion_depth;
+    struct pdf_objidx_entry *objidx;
+    uint32_t nobjidx; /* number of objs indexed, re-indexed when it differs from nobjs */
+    struct pdf_scan_job *scan_jobs; /* ring of objects being scanned in parallel, in extraction order */
+    uint32_t scan_jobs_max;
+    uint32_t scan_jobs_first;
+    uint32_t nscan_jobs;
+    uint32_t scan_jobs_badobjects; /* format errors of objects finished early, ahead of an inline scan */
 };
 
 #define OBJ_FLAG_PDFNAME_NONE 0x0
@@ -178,6 +213,7 @@ struct pdf_struct {
 
 #define PDF_EXTRACT_OBJ_NONE 0x0
 #define PDF_EXTRACT_OBJ_SCAN 0x1
+#define PDF_EXTRACT_OBJ_PARALLEL 0x2 /* with PDF_EXTRACT_OBJ_SCAN, the scan may be left to the scan pool */
 
 cl_error_t cli_pdf(const char *dir, cli_ctx *ctx, off_t offset);
 void pdf_parseobj(struct pdf_struct *pdf, struct pdf_obj *obj);
@@ -185,6 +221,8 @@ cl_error_t pdf_extract_obj(struct pdf_struct *pdf, struct pdf_obj *obj, uint32_t
 cl_error_t pdf_findobj(struct pdf_struct *pdf);
 struct pdf_obj *find_obj(struct pdf_struct *pdf, struct pdf_obj *obj, uint32_t objid);
 
+cl_error_t pdf_dump_write(struct pdf_dump *dump, const char *buf, size_t len);
+
 void pdf_handle_enc(struct pdf_struct *pdf);
 char *decrypt_any(struct pdf_struct *pdf, uint32_t id, const char *in, size_t *length, enum enc_method enc_method);
 enum enc_method get_enc_method(struct pdf_struct *pdf, struct pdf_obj *obj);
@@ -62,6 +62,7 @@
 #include "pdf.h"
 #include "pdfdecode.h"
 #include "str.h"
+#include "textdecode.h"
 #include "bytecode.h"
 #include "bytecode_api.h"
 #include "lzw/lzwdec.h"
@@ -77,7 +78,7 @@ struct pdf_token {
     uint8_t *content; /* content stream */
 };
 
-static size_t pdf_decodestream_internal(struct pdf_struct *pdf, struct pdf_obj *obj, struct pdf_dict *params, struct pdf_token *token, int fout, cl_error_t *status, struct objstm_struct *objstm);
+static size_t pdf_decodestream_internal(struct pdf_struct *pdf, struct pdf_obj *obj, struct pdf_dict *params, struct pdf_token *token, struct pdf_dump *dump, cl_error_t *status, struct objstm_struct *objstm);
 
 static cl_error_t filter_ascii85decode(struct pdf_struct *pdf, struct pdf_obj *obj, struct pdf_token *token);
 static cl_error_t filter_rldecode(struct pdf_struct *pdf, struct pdf_obj *obj, struct pdf_token *token);
@@ -98,14 +99,14 @@ static cl_error_t filter_lzwdecode(struct pdf_struct *pdf, struct pdf_obj *obj,
  * @param stream    Filter stream buffer pointer.
  * @param streamlen Length of filter stream buffer.
  * @param xref      Indicates if the stream is an /XRef stream.  Do not apply forced decryption on /XRef streams.
- * @param fout      File descriptor to write to be scanned.
+ * @param dump      Output to write the data to be scanned to.
  * @param[out] rc   Return code ()
  * @param objstm    (optional) Object stream context structure.
- * @return size_t   The number of bytes written to 'fout' to be scanned.
+ * @return size_t   The number of bytes written to 'dump' to be scanned.
  */
 size_t pdf_decodestream(
     struct pdf_struct *pdf, struct pdf_obj *obj, struct pdf_dict *params,
-    const char *stream, uint32_t streamlen, int xref, int fout, cl_error_t *status,
+    const char *stream, uint32_t streamlen, int xref, struct pdf_dump *dump, cl_error_t *status,
     struct objstm_struct *objstm)
 {
     struct pdf_token *token = NULL;
@@ -122,7 +123,7 @@ size_t pdf_decodestream(
         goto done;
     }
 
-    if (!stream || !streamlen || fout < 0) {
+    if (!stream || !streamlen || !dump) {
         cli_dbgmsg("pdf_decodestream: no filters or stream on obj %u %u\n", obj->id >> 8, obj->id & 0xff);
         *status = CL_ENULLARG;
         goto done;
@@ -158,7 +159,7 @@ size_t pdf_decodestream(
 
     cli_dbgmsg("pdf_decodestream: detected %lu applied filters\n", (long unsigned)(obj->numfilters));
 
-    bytes_scanned = pdf_decodestream_internal(pdf, obj, params, token, fout, status, objstm);
+    bytes_scanned = pdf_decodestream_internal(pdf, obj, params, token, dump, status, objstm);
     if (CL_VIRUS == *status) {
         goto done;
     }
@@ -177,8 +178,8 @@ size_t pdf_decodestream(
         if (!cli_checklimits("pdf", pdf->ctx, streamlen, 0, 0)) {
             cli_dbgmsg("pdf_decodestream: no non-forced filters decoded, returning raw stream\n");
 
-            if (cli_writen(fout, stream, streamlen) != streamlen) {
-                cli_errmsg("pdf_decodestream: failed to write raw stream to output file\n");
+            if (CL_SUCCESS != pdf_dump_write(dump, stream, streamlen)) {
+                cli_errmsg("pdf_decodestream: failed to write raw stream to output\n");
             } else {
                 bytes_scanned = streamlen;
             }
@@ -211,14 +212,14 @@ done:
  * @param obj           The object we found the filter content in.
  * @param params        (optional) Dictionary parameters describing the filter data.
  * @param token         Pointer to and length of filter data.
- * @param fout          File handle to write data to be scanned.
+ * @param dump          Output to write data to be scanned to.
  * @param[out] status   CL_CLEAN/CL_SUCCESS or CL_VIRUS/CL_E<error>
  * @param objstm        (optional) Object stream context structure.
- * @return ptrdiff_t    The number of bytes we wrote to 'fout'. -1 if failed out.
+ * @return ptrdiff_t    The number of bytes we wrote to 'dump'. -1 if failed out.
  */
 static size_t pdf_decodestream_internal(
     struct pdf_struct *pdf, struct pdf_obj *obj, struct pdf_dict *params,
-    struct pdf_token *token, int fout, cl_error_t *status, struct objstm_struct *objstm)
+    struct pdf_token *token, struct pdf_dump *dump, cl_error_t *status, struct objstm_struct *objstm)
 {
     cl_error_t retval    = CL_SUCCESS;
     size_t bytes_scanned = 0;
@@ -342,15 +343,15 @@ static size_t pdf_decodestream_internal(
     if ((token->success > 0) && (NULL != token->content)) {
         /*
          * Looks like we successfully decoded some or all of the stream filters,
-         * so lets write it out to a file descriptor we scan.
+         * so lets write it out to be scanned.
          *
          * In the event that we didn't decode any filters (or maybe there
          * weren't any filters), the calling function will do the same with
          * the raw stream.
          */
         if (CL_SUCCESS == cli_checklimits("pdf", pdf->ctx, token->length, 0, 0)) {
-            if (cli_writen(fout, token->content, token->length) != token->length) {
-                cli_errmsg("pdf_decodestream_internal: failed to write decoded stream content to output file\n");
+            if (CL_SUCCESS != pdf_dump_write(dump, (const char *)token->content, token->length)) {
+                cli_errmsg("pdf_decodestream_internal: failed to write decoded stream content to output\n");
             } else {
                 bytes_scanned = token->length;
             }
@@ -397,83 +398,26 @@ done:
  */
 static cl_error_t filter_ascii85decode(struct pdf_struct *pdf, struct pdf_obj *obj, struct pdf_token *token)
 {
-    uint8_t *decoded, *dptr;
-    uint32_t declen = 0;
-
-    const uint8_t *ptr = (uint8_t *)token->content;
-    uint32_t remaining = token->length;
-    int quintet = 0, rc = CL_SUCCESS;
-    uint64_t sum = 0;
+    uint8_t *decoded;
+    size_t declen = 0, used = 0;
+    struct cli_ascii85_state state;
+    cl_error_t rc;
 
     /* 5:4 decoding ratio, with 1:4 expansion sequences => (4*length)+1 */
-    if (!(dptr = decoded = (uint8_t *)cli_max_malloc((4 * remaining) + 1))) {
+    if (!(decoded = (uint8_t *)cli_max_malloc(((size_t)4 * token->length) + 1))) {
         cli_errmsg("cli_pdf: cannot allocate memory for decoded output\n");
         return CL_EMEM;
     }
 
-    if (cli_memstr((const char *)ptr, remaining, "~>", 2) == NULL)
-        cli_dbgmsg("cli_pdf: no EOF marker found\n");
-
-    while (remaining > 0) {
-        int byte = (remaining--) ? (int)*ptr++ : EOF;
-
-        if ((byte == '~') && (remaining > 0) && (*ptr == '>'))
-            byte = EOF;
-
-        if (byte >= '!' && byte <= 'u') {
-            sum = (sum * 85) + ((uint32_t)byte - '!');
-            if (++quintet == 5) {
-                *dptr++ = (unsigned char)(sum >> 24);
-                *dptr++ = (unsigned char)((sum >> 16) & 0xFF);
-                *dptr++ = (unsigned char)((sum >> 8) & 0xFF);
-                *dptr++ = (unsigned char)(sum & 0xFF);
-
-                declen += 4;
-                quintet = 0;
-                sum     = 0;
-            }
-        } else if (byte == 'z') {
-            if (quintet) {
-                cli_dbgmsg("cli_pdf: unexpected 'z'\n");
-                rc = CL_EFORMAT;
-                break;
-            }
-
-            *dptr++ = '\0';
-            *dptr++ = '\0';
-            *dptr++ = '\0';
-            *dptr++ = '\0';
-
-            declen += 4;
-        } else if (byte == EOF) {
-            cli_dbgmsg("cli_pdf: last quintet contains %d bytes\n", quintet);
-            if (quintet) {
-                int i;
-
-                if (quintet == 1) {
-                    cli_dbgmsg("cli_pdf: invalid last quintet (only 1 byte)\n");
-                    rc = CL_EFORMAT;
-                    break;
-                }
-
-                for (i = quintet; i < 5; i++)
-                    sum *= 85;
-
-                if (quintet > 1)
-                    sum += (0xFFFFFF >> ((quintet - 2) * 8));
-
-                for (i = 0; i < quintet - 1; i++)
-                    *dptr++ = (uint8_t)((sum >> (24 - 8 * i)) & 0xFF);
-                declen += quintet - 1;
-            }
-
-            break;
-        } else if (!isspace(byte)) {
-            cli_dbgmsg("cli_pdf: invalid character 0x%x @ %lu\n",
-                       byte & 0xFF, (unsigned long)(token->length - remaining));
-
+    cli_ascii85_init(&state);
+    rc = cli_ascii85_decode(&state, token->content, token->length, decoded, &declen, &used);
+    if (rc == CL_SUCCESS) {
+        if (state.tilde) {
+            /* a '~' at the very end, not followed by '>' */
             rc = CL_EFORMAT;
-            break;
+        } else if (!state.done) {
+            /* a partial group without the EOF marker is dropped */
+            cli_dbgmsg("cli_pdf: no EOF marker found\n");
         }
     }
 
@@ -484,13 +428,13 @@ static cl_error_t filter_ascii85decode(struct pdf_struct *pdf, struct pdf_obj *o
                    (unsigned long)declen, (unsigned long)(token->length));
 
         token->content = decoded;
-        token->length  = declen;
+        token->length  = (uint32_t)declen;
     } else {
         if (!(obj->flags & ((1 << OBJ_IMAGE) | (1 << OBJ_TRUNCATED))))
             pdfobj_flag(pdf, obj, BAD_ASCIIDECODE);
 
         cli_dbgmsg("cli_pdf: error occurred parsing byte %lu of %lu\n",
-                   (unsigned long)(token->length - remaining), (unsigned long)(token->length));
+                   (unsigned long)used, (unsigned long)(token->length));
         free(decoded);
     }
     return rc;
@@ -789,50 +733,44 @@ static cl_error_t filter_flatedecode(struct pdf_struct *pdf, struct pdf_obj *obj
 static cl_error_t filter_asciihexdecode(struct pdf_struct *pdf, struct pdf_obj *obj, struct pdf_token *token)
 {
     uint8_t *decoded;
+    size_t declen = 0, used = 0;
+    struct cli_hex_state state;
+    cl_error_t rc;
 
-    const uint8_t *content = (uint8_t *)token->content;
-    uint32_t length        = token->length;
-    uint32_t i, j;
-    cl_error_t rc = CL_SUCCESS;
-
-    if (!(decoded = (uint8_t *)cli_max_calloc(length / 2 + 1, sizeof(uint8_t)))) {
+    if (!(decoded = (uint8_t *)cli_max_calloc(token->length / 2 + 1, sizeof(uint8_t)))) {
         cli_errmsg("cli_pdf: cannot allocate memory for decoded output\n");
         return CL_EMEM;
     }
 
-    for (i = 0, j = 0; i + 1 < length; i++) {
-        if (content[i] == ' ')
-            continue;
-
-        if (content[i] == '>')
-            break;
-
-        if (cli_hex2str_to((const char *)content + i, (char *)decoded + j, 2) == -1) {
-            if (length - i < 4)
-                continue;
+    cli_hex_init(&state);
+    rc = cli_hex_decode(&state, token->content, token->length, decoded, &declen, &used);
+    while (rc != CL_SUCCESS && token->length - used < 4) {
+        /* skip invalid characters in the last few bytes and carry on with the rest */
+        size_t skip = used + 1, outlen = 0;
 
-            rc = CL_EFORMAT;
-            break;
-        }
-
-        i++;
-        j++;
+        rc = cli_hex_decode(&state, token->content + skip, token->length - skip, decoded + declen, &outlen, &used);
+        declen += outlen;
+        used += skip;
+    }
+    if (rc == CL_SUCCESS) {
+        /* an odd final digit is followed by an implied 0 */
+        declen += cli_hex_finish(&state, decoded + declen);
     }
 
     if (rc == CL_SUCCESS) {
         free(token->content);
 
         cli_dbgmsg("cli_pdf: deflated %lu bytes from %lu total bytes\n",
-                   (unsigned long)j, (unsigned long)(token->length));
+                   (unsigned long)declen, (unsigned long)(token->length));
 
         token->content = decoded;
-        token->length  = j;
+        token->length  = (uint32_t)declen;
     } else {
         if (!(obj->flags & ((1 << OBJ_IMAGE) | (1 << OBJ_TRUNCATED))))
             pdfobj_flag(pdf, obj, BAD_ASCIIDECODE);
 
         cli_dbgmsg("cli_pdf: error occurred parsing byte %lu of %lu\n",
-                   (unsigned long)i, (unsigned long)(token->length));
+                   (unsigned long)used, (unsigned long)(token->length));
         free(decoded);
     }
     return rc;
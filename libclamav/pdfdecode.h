@@ -48,14 +48,14 @@
  * @param stream    Filter stream buffer pointer.
  * @param streamlen Length of filter stream buffer.
  * @param xref      Indicates if the stream is an /XRef stream.  Do not apply forced decryption on /XRef streams.
- * @param fout      File descriptor to write to a temp file.
+ * @param dump      Output to write the decoded stream to.
  * @param[out] rc   Return code ()
  * @param objstm    Object stream context structure.
- * @return size_t   The number of bytes written to fout to be scanned.
+ * @return size_t   The number of bytes written to dump to be scanned.
  */
 size_t pdf_decodestream(
     struct pdf_struct *pdf, struct pdf_obj *obj, struct pdf_dict *params,
-    const char *stream, uint32_t streamlen, int xref, int fout, cl_error_t *status,
+    const char *stream, uint32_t streamlen, int xref, struct pdf_dump *dump, cl_error_t *status,
     struct objstm_struct *objstm);
 
 #endif /* __PDFDECODE_H__ */
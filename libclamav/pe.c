@@ -2941,7 +2941,7 @@ int cli_scanpe(cli_ctx *ctx)
     pedata.hdr_size    = peinfo->hdr_size;
 
     /* Bytecode BC_PE_ALL hook */
-    bc_ctx = cli_bytecode_context_alloc();
+    bc_ctx = cli_bytecode_context_alloc(ctx->engine);
     if (!bc_ctx) {
         cli_errmsg("cli_scanpe: can't allocate memory for bc_ctx\n");
         cli_exe_info_destroy(peinfo);
@@ -4369,7 +4369,7 @@ int cli_scanpe(cli_ctx *ctx)
     ctx->corrupted_input = corrupted_cur;
 
     /* Bytecode BC_PE_UNPACKER hook */
-    bc_ctx = cli_bytecode_context_alloc();
+    bc_ctx = cli_bytecode_context_alloc(ctx->engine);
     if (!bc_ctx) {
         cli_errmsg("cli_scanpe: can't allocate memory for bc_ctx\n");
         return CL_EMEM;
@@ -81,6 +81,7 @@
 #include "bytecode_priv.h"
 #include "cache.h"
 #include "openioc.h"
+#include "scanpool.h"
 
 #include "predict.h"
 
@@ -965,7 +966,12 @@ cl_error_t cli_add_content_match_pattern(struct cli_matcher *root, const char *v
         if (bm_new->length > root->maxpatlen)
             root->maxpatlen = bm_new->length;
 
-        if (CL_SUCCESS != (ret = cli_bm_addpatt(root, bm_new, offset))) {
+        /* signatures at an exact offset are only checked there, see cli_bm_init_anchored() */
+        if (root->bm_anchored && strcmp(offset, "*") && !strchr(offset, ','))
+            ret = cli_bm_addpatt(root->bm_anchored, bm_new, offset);
+        else
+            ret = cli_bm_addpatt(root, bm_new, offset);
+        if (CL_SUCCESS != ret) {
             cli_errmsg("cli_add_content_match_pattern: Problem adding signature (4).\n");
             MPOOL_FREE(root->mempool, bm_new->pattern);
             MPOOL_FREE(root->mempool, bm_new->virname);
@@ -1010,6 +1016,12 @@ cl_error_t cli_initroots(struct cl_engine *engine, unsigned int options)
                     cli_errmsg("cli_initroots: Can't initialise BM pattern matcher\n");
                     return ret;
                 }
+
+                /* the PE root is in BM offset mode itself */
+                if (i != 1 && CL_SUCCESS != (ret = cli_bm_init_anchored(root))) {
+                    cli_errmsg("cli_initroots: Can't initialise BM pattern matcher\n");
+                    return ret;
+                }
             }
 
             root->fuzzy_hashmap = fuzzy_hashmap_new();
@@ -1033,7 +1045,13 @@ char *cli_dbgets(char *buff, unsigned int size, FILE *fs, struct cli_dbio *dbio)
                 if (!dbio->size)
                     return NULL;
 
-                if (dbio->gzs) {
+                if (dbio->pipe) {
+                    bread = cli_dbio_pipe_read(dbio->pipe, dbio->readpt, dbio->readsize);
+                    if (bread == -1) {
+                        cli_errmsg("cli_dbgets: inflating database failed\n");
+                        return NULL;
+                    }
+                } else if (dbio->gzs) {
                     bread = gzread(dbio->gzs, dbio->readpt, dbio->readsize);
                     if (bread == -1) {
                         cli_errmsg("cli_dbgets: gzread() failed\n");
@@ -2161,6 +2179,11 @@ static cl_error_t load_oneldb(char *buffer, int chkpua, struct cl_engine *engine
         goto done;
     }
 
+    if (CL_SUCCESS != (ret = cli_ac_lsig_compile(root, lsig))) {
+        status = ret;
+        goto done;
+    }
+
     lsigid[0] = lsig->id = root->ac_lsigs;
 
     newtable = (struct cli_ac_lsig **)MPOOL_REALLOC(engine->mempool, root->ac_lsigtable, (root->ac_lsigs + 1) * sizeof(struct cli_ac_lsig *));
@@ -2221,6 +2244,10 @@ done:
                 MPOOL_FREE(engine->mempool, lsig->u.logic);
             }
 
+            if (NULL != lsig->prog) {
+                MPOOL_FREE(engine->mempool, lsig->prog);
+            }
+
             MPOOL_FREE(engine->mempool, lsig);
         }
         if (tdb_initialized) {
@@ -4249,6 +4276,14 @@ static int load_oneyara(YR_RULE *rule, int chkpua, struct cl_engine *engine, uns
             free(newident);
             return CL_EMEM;
         }
+        if (CL_SUCCESS != cli_ac_lsig_compile(root, lsig)) {
+            FREE_TDB(tdb);
+            ytable_delete(&ytable);
+            MPOOL_FREE(engine->mempool, lsig->u.logic);
+            MPOOL_FREE(engine->mempool, lsig);
+            free(newident);
+            return CL_EMEM;
+        }
     } else {
         if (NULL != (lsig->u.code_start = rule->code_start)) {
             lsig->type = (rule->cl_flags & RULE_OFFSETS) ? CLI_YARA_OFFSET : CLI_YARA_NORMAL;
@@ -5603,6 +5638,15 @@ cl_error_t cl_engine_free(struct cl_engine *engine)
     if (engine->stats_data)
         free(engine->stats_data);
 
+    if (engine->scan_pool) {
+        cli_scan_pool_free(engine->scan_pool);
+        engine->scan_pool = NULL;
+    }
+
+    /* the bytecode contexts left in the pools of all threads */
+    cli_threadlocal_free(engine->bc_ctx_pool);
+    engine->bc_ctx_pool = NULL;
+
     /*
      * Pre-calculate number of "major" tasks to complete for the progress callback
      */
@@ -5690,6 +5734,8 @@ cl_error_t cl_engine_free(struct cl_engine *engine)
                     for (j = 0; j < root->ac_lsigs; j++) {
                         if (root->ac_lsigtable[j]->type == CLI_LSIG_NORMAL) {
                             MPOOL_FREE(engine->mempool, root->ac_lsigtable[j]->u.logic);
+                            if (root->ac_lsigtable[j]->prog)
+                                MPOOL_FREE(engine->mempool, root->ac_lsigtable[j]->prog);
                         }
                         MPOOL_FREE(engine->mempool, root->ac_lsigtable[j]->virname);
                         FREE_TDB(root->ac_lsigtable[j]->tdb);
@@ -5833,6 +5879,15 @@ cl_error_t cl_engine_free(struct cl_engine *engine)
     if (engine->tmpdir) {
         MPOOL_FREE(engine->mempool, engine->tmpdir);
     }
+    if (engine->bytecode_cache_dir) {
+        MPOOL_FREE(engine->mempool, engine->bytecode_cache_dir);
+    }
+    if (engine->bytecode_native_module) {
+        MPOOL_FREE(engine->mempool, engine->bytecode_native_module);
+    }
+    if (engine->bytecode_native_output) {
+        MPOOL_FREE(engine->mempool, engine->bytecode_native_output);
+    }
     TASK_COMPLETE();
 
     if (engine->cache) {
@@ -5862,6 +5917,8 @@ cl_error_t cl_engine_free(struct cl_engine *engine)
             for (i = 0; i < root->ac_lsigs; i++) {
                 if (root->ac_lsigtable[i]->type == CLI_LSIG_NORMAL) {
                     MPOOL_FREE(engine->mempool, root->ac_lsigtable[i]->u.logic);
+                    if (root->ac_lsigtable[i]->prog)
+                        MPOOL_FREE(engine->mempool, root->ac_lsigtable[i]->prog);
                 }
                 MPOOL_FREE(engine->mempool, root->ac_lsigtable[i]->virname);
                 FREE_TDB(root->ac_lsigtable[i]->tdb);
@@ -5897,6 +5954,133 @@ cl_error_t cl_engine_free(struct cl_engine *engine)
     return CL_SUCCESS;
 }
 
+static cl_error_t build_matcher(struct cli_matcher *root, const struct cl_engine *engine)
+{
+    cl_error_t ret;
+
+    if ((ret = cli_bm_build(root)))
+        return ret;
+
+    if ((ret = cli_ac_buildtrie(root)))
+        return ret;
+
+    return cli_pcre_build(root, engine->pcre_match_limit, engine->pcre_recmatch_limit, engine->dconf);
+}
+
+#if defined(USE_MPOOL) && defined(CL_THREAD_SAFE)
+/*
+ * The matchers of the targets share nothing but the engine pool, so they are
+ * built in parallel, each by a thread of its own that allocates from its own
+ * arena (see mpool_arena_create()). Once all threads are done the arenas are
+ * merged into the engine pool, which then owns everything they allocated.
+ */
+struct matcher_build {
+    struct cli_matcher *root;
+    const struct cl_engine *engine;
+    mpool_t *arena;
+    pthread_t thread;
+    int started;
+    cl_error_t ret;
+};
+
+static void set_matcher_mempool(struct cli_matcher *root, mpool_t *mempool)
+{
+    root->mempool = mempool;
+    if (root->bm_anchored)
+        root->bm_anchored->mempool = mempool;
+}
+
+static void *build_matcher_thread(void *arg)
+{
+    struct matcher_build *mb = (struct matcher_build *)arg;
+
+    mb->ret = build_matcher(mb->root, mb->engine);
+    return NULL;
+}
+#endif
+
+/* tells the progress callback that the matcher of the target is built */
+static void matcher_built(struct cl_engine *engine, unsigned int i, size_t tasks_to_do, size_t *tasks_complete)
+{
+    struct cli_matcher *root = engine->root[i];
+    unsigned int task;
+
+    for (task = 0; task < 3; task++) { // bm prefilter, ac trie, pcre regex
+        if (engine->cb_engine_compile_progress)
+            (void)engine->cb_engine_compile_progress(tasks_to_do, ++*tasks_complete, engine->cb_engine_compile_progress_ctx);
+    }
+
+    cli_dbgmsg("Matcher[%u]: %s: AC sigs: %u (reloff: %u, absoff: %u) BM sigs: %u (reloff: %u, absoff: %u, anchored: %u) PCREs: %u (reloff: %u, absoff: %u) maxpatlen %u %s\n", i, cli_mtargets[i].name, root->ac_patterns, root->ac_reloff_num, root->ac_absoff_num, root->bm_patterns, root->bm_reloff_num, root->bm_absoff_num, root->bm_anchored ? root->bm_anchored->bm_patterns : 0, root->pcre_metas, root->pcre_reloff_num, root->pcre_absoff_num, root->maxpatlen, root->ac_only ? "(ac_only mode)" : "");
+}
+
+/* returns the first error in the order of the targets */
+static cl_error_t build_matchers(struct cl_engine *engine, size_t tasks_to_do, size_t *tasks_complete)
+{
+    unsigned int i;
+    cl_error_t ret;
+#if defined(USE_MPOOL) && defined(CL_THREAD_SAFE)
+    struct matcher_build builds[CLI_MTARGETS];
+    unsigned int nroots = 0;
+
+    for (i = 0; i < CLI_MTARGETS; i++) {
+        if (engine->root[i])
+            nroots++;
+    }
+
+    if (nroots > 1 && (engine->dconf->other & OTHER_CONF_PARALLEL_BUILD)) {
+        cli_dbgmsg("build_matchers: building %u matchers in parallel\n", nroots);
+
+        memset(builds, 0, sizeof(builds));
+        for (i = 0; i < CLI_MTARGETS; i++) {
+            if (!(builds[i].root = engine->root[i]))
+                continue;
+            builds[i].engine = engine;
+            /* without an arena or a thread, it's built from here once the threads are done */
+            if (!(builds[i].arena = mpool_arena_create(engine->mempool)))
+                continue;
+            set_matcher_mempool(builds[i].root, builds[i].arena);
+            builds[i].started = !pthread_create(&builds[i].thread, NULL, build_matcher_thread, &builds[i]);
+        }
+
+        for (i = 0; i < CLI_MTARGETS; i++) {
+            if (builds[i].started) {
+                pthread_join(builds[i].thread, NULL);
+                if (!builds[i].ret)
+                    matcher_built(engine, i, tasks_to_do, tasks_complete);
+            }
+        }
+
+        for (i = 0; i < CLI_MTARGETS; i++) {
+            if (builds[i].root && !builds[i].started) {
+                if (!(builds[i].ret = build_matcher(builds[i].root, engine)))
+                    matcher_built(engine, i, tasks_to_do, tasks_complete);
+            }
+        }
+
+        ret = CL_SUCCESS;
+        for (i = 0; i < CLI_MTARGETS; i++) {
+            if (builds[i].arena) {
+                set_matcher_mempool(builds[i].root, engine->mempool);
+                mpool_arena_merge(engine->mempool, builds[i].arena);
+            }
+            if (builds[i].ret && !ret)
+                ret = builds[i].ret;
+        }
+        return ret;
+    }
+#endif
+
+    for (i = 0; i < CLI_MTARGETS; i++) {
+        if (!engine->root[i])
+            continue;
+        if ((ret = build_matcher(engine->root[i], engine)))
+            return ret;
+        matcher_built(engine, i, tasks_to_do, tasks_complete);
+    }
+
+    return CL_SUCCESS;
+}
+
 cl_error_t cl_engine_compile(struct cl_engine *engine)
 {
     unsigned int i;
@@ -5922,6 +6106,7 @@ cl_error_t cl_engine_compile(struct cl_engine *engine)
 
     for (i = 0; i < CLI_MTARGETS; i++) {
         if ((root = engine->root[i])) {
+            tasks_to_do += 1; // build bm prefilter
             tasks_to_do += 1; // build ac trie
             tasks_to_do += 1; // compile pcre regex
         }
@@ -5978,19 +6163,9 @@ cl_error_t cl_engine_compile(struct cl_engine *engine)
             return ret;
     TASK_COMPLETE();
 
-    for (i = 0; i < CLI_MTARGETS; i++) {
-        if ((root = engine->root[i])) {
-            if ((ret = cli_ac_buildtrie(root)))
-                return ret;
-            TASK_COMPLETE();
-
-            if ((ret = cli_pcre_build(root, engine->pcre_match_limit, engine->pcre_recmatch_limit, engine->dconf)))
-                return ret;
-            TASK_COMPLETE();
-
-            cli_dbgmsg("Matcher[%u]: %s: AC sigs: %u (reloff: %u, absoff: %u) BM sigs: %u (reloff: %u, absoff: %u) PCREs: %u (reloff: %u, absoff: %u) maxpatlen %u %s\n", i, cli_mtargets[i].name, root->ac_patterns, root->ac_reloff_num, root->ac_absoff_num, root->bm_patterns, root->bm_reloff_num, root->bm_absoff_num, root->pcre_metas, root->pcre_reloff_num, root->pcre_absoff_num, root->maxpatlen, root->ac_only ? "(ac_only mode)" : "");
-        }
-    }
+    /* the progress of each matcher is reported as soon as it's built */
+    if ((ret = build_matchers(engine, tasks_to_do, &tasks_complete)))
+        return ret;
 
     if (engine->hm_hdb)
         hm_flush(engine->hm_hdb);
@@ -6034,6 +6209,8 @@ cl_error_t cl_engine_compile(struct cl_engine *engine)
             for (i = 0; i < root->ac_lsigs; i++) {
                 if (root->ac_lsigtable[i]->type == CLI_LSIG_NORMAL) {
                     MPOOL_FREE(engine->mempool, root->ac_lsigtable[i]->u.logic);
+                    if (root->ac_lsigtable[i]->prog)
+                        MPOOL_FREE(engine->mempool, root->ac_lsigtable[i]->prog);
                 }
                 MPOOL_FREE(engine->mempool, root->ac_lsigtable[i]->virname);
                 FREE_TDB(root->ac_lsigtable[i]->tdb);
@@ -6059,6 +6236,13 @@ cl_error_t cl_engine_compile(struct cl_engine *engine)
     }
     TASK_COMPLETE();
 
+    if (engine->parallel_scan_threads && !engine->scan_pool) {
+        if (CL_SUCCESS != (ret = cli_scan_pool_new(engine->parallel_scan_threads, &engine->scan_pool))) {
+            cli_errmsg("Unable to start %u parallel scan threads: %s\n", engine->parallel_scan_threads, cl_strerror(ret));
+            return ret;
+        }
+    }
+
     engine->dboptions |= CL_DB_COMPILED;
     return CL_SUCCESS;
 }
@@ -117,6 +117,7 @@
 #include "msdoc.h"
 #include "execs.h"
 #include "egg.h"
+#include "scanpool.h"
 
 // libclamunrar_iface
 #include "unrar_iface.h"
@@ -233,6 +234,9 @@ static cl_error_t cli_scanrar_file(const char *filepath, int desc, cli_ctx *ctx)
     char *extract_fullpath = NULL;
     char *comment_fullpath = NULL;
 
+    cli_scan_queue_t *queue = NULL;
+    bool queue_failed       = false;
+
     UNUSEDPARAM(desc);
 
     if (filepath == NULL || ctx == NULL) {
@@ -305,7 +309,14 @@ static cl_error_t cli_scanrar_file(const char *filepath, int desc, cli_ctx *ctx)
      *  - Alert if there are encrypted files,
      *      if the Heuristic for encrypted archives is enabled,
      *      and if we have not detected a signature match.
+     *
+     * The files are extracted in order, but may be scanned on the scan pool.
      */
+    status = cli_scan_queue_new(ctx, &queue);
+    if (status != CL_SUCCESS) {
+        goto done;
+    }
+
     do {
         status = CL_CLEAN;
 
@@ -439,8 +450,16 @@ static cl_error_t cli_scanrar_file(const char *filepath, int desc, cli_ctx *ctx)
                      * ... scan the extracted file.
                      */
                     cli_dbgmsg("RAR: Extraction complete.  Scanning now...\n");
-                    status = cli_magic_scan_file(extract_fullpath, ctx, filename_base, LAYER_ATTRIBUTES_NONE);
-                    if (status == CL_EOPEN) {
+                    if (NULL != queue) {
+                        /* The queue removes the file once it is scanned. */
+                        status           = cli_scan_queue_file(queue, extract_fullpath, filename_base, LAYER_ATTRIBUTES_NONE);
+                        extract_fullpath = NULL;
+                        if (status != CL_SUCCESS) {
+                            // An earlier file alerted, or exceeded a limit.
+                            queue_failed = true;
+                            goto done;
+                        }
+                    } else if ((status = cli_magic_scan_file(extract_fullpath, ctx, filename_base, LAYER_ATTRIBUTES_NONE)) == CL_EOPEN) {
                         cli_dbgmsg("RAR: File not found, Extraction failed!\n");
 
                         // Don't abort the scan just because one file failed to extract.
@@ -482,7 +501,17 @@ static cl_error_t cli_scanrar_file(const char *filepath, int desc, cli_ctx *ctx)
         status = CL_SUCCESS;
     }
 
+    if ((NULL != queue) && !queue_failed) {
+        // The files still in flight were found before whatever stopped the loop.
+        cl_error_t queue_ret = cli_scan_queue_wait(queue);
+        if (queue_ret != CL_SUCCESS) {
+            status = queue_ret;
+        }
+    }
+
 done:
+    cli_scan_queue_free(queue);
+
     if (NULL != comment) {
         free(comment);
         comment = NULL;
@@ -1480,12 +1509,12 @@ static cl_error_t vba_scandata(const unsigned char *data, size_t len, cli_ctx *c
 
     cl_fmap_t *new_map = NULL;
 
-    if ((ret = cli_ac_initdata(&tmdata, target_ac_root->ac_partsigs, target_ac_root->ac_lsigs, target_ac_root->ac_reloff_num, CLI_DEFAULT_AC_TRACKLEN))) {
+    if ((ret = cli_ac_initdata_pool(target_ac_root, &tmdata))) {
         goto done;
     }
     tmdata_initialized = true;
 
-    if ((ret = cli_ac_initdata(&gmdata, generic_ac_root->ac_partsigs, generic_ac_root->ac_lsigs, generic_ac_root->ac_reloff_num, CLI_DEFAULT_AC_TRACKLEN))) {
+    if ((ret = cli_ac_initdata_pool(generic_ac_root, &gmdata))) {
         goto done;
     }
     gmdata_initialized = true;
@@ -2701,12 +2730,12 @@ static cl_error_t cli_scanscript(cli_ctx *ctx)
     }
     text_normalize_init(&state, normalized, SCANBUFF + maxpatlen);
 
-    if ((ret = cli_ac_initdata(&tmdata, target_ac_root ? target_ac_root->ac_partsigs : 0, target_ac_root ? target_ac_root->ac_lsigs : 0, target_ac_root ? target_ac_root->ac_reloff_num : 0, CLI_DEFAULT_AC_TRACKLEN))) {
+    if ((ret = target_ac_root ? cli_ac_initdata_pool(target_ac_root, &tmdata) : cli_ac_initdata(&tmdata, 0, 0, 0, CLI_DEFAULT_AC_TRACKLEN))) {
         goto done;
     }
     tmdata_initialized = 1;
 
-    if ((ret = cli_ac_initdata(&gmdata, generic_ac_root->ac_partsigs, generic_ac_root->ac_lsigs, generic_ac_root->ac_reloff_num, CLI_DEFAULT_AC_TRACKLEN))) {
+    if ((ret = cli_ac_initdata_pool(generic_ac_root, &gmdata))) {
         goto done;
     }
     gmdata_initialized = 1;
@@ -4397,6 +4426,11 @@ void emax_reached(cli_ctx *ctx)
         stack_index -= 1;
     }
 
+    if (NULL != ctx->job) {
+        // The layers above a parallel scan job are marked when it is finished.
+        cli_scan_job_emax_reached(ctx->job);
+    }
+
     cli_dbgmsg("emax_reached: marked parents as non cacheable\n");
 }
 
@@ -5992,7 +6026,7 @@ static cl_error_t scan_common(cl_fmap_t *map, const char *filepath, const char *
              */
             struct cli_matcher *iroot = ctx.engine->root[13];
 
-            struct cli_bc_ctx *bc_ctx = cli_bytecode_context_alloc();
+            struct cli_bc_ctx *bc_ctx = cli_bytecode_context_alloc(ctx.engine);
             if (!bc_ctx) {
                 cli_errmsg("scan_common: can't allocate memory for bc_ctx\n");
                 status = CL_EMEM;
@@ -6150,6 +6184,8 @@ done:
         evidence_free(ctx.evidence);
     }
 
+    cli_scan_limits_release(&ctx);
+
     return status;
 }
 
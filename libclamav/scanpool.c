@@ -0,0 +1,877 @@
+/*
+ *  Copyright (C) 2025 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#if HAVE_CONFIG_H
+#include "clamav-config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "clamav.h"
+#include "others.h"
+#include "scanners.h"
+#include "scanpool.h"
+
+#include "clamav_rust.h"
+
+enum job_state {
+    JOB_QUEUED,
+    JOB_RUNNING,
+    JOB_DONE
+};
+
+enum job_type {
+    JOB_BUFFER, /* scan a buffer */
+    JOB_FILE,   /* scan a file */
+    JOB_CALL    /* call a function */
+};
+
+struct job_alert {
+    const char *virname;
+    bool strong;
+};
+
+struct cli_scan_job {
+    struct cli_scan_job *prev; /* queue links, while JOB_QUEUED */
+    struct cli_scan_job *next;
+    cli_scan_pool_t *pool;
+    enum job_state state;
+    bool cancelled;            /* see JOB_LOAD() */
+    volatile bool interrupted; /* stopped because an earlier sibling alerted */
+
+    enum job_type type;
+    const void *buffer;
+    size_t length;
+    const char *filepath;
+    cli_scan_job_fn fn;
+    void *arg;
+    char *name;
+    uint32_t attributes;
+
+    /* siblings, if submitted through a cli_scan_queue */
+    cli_scan_queue_t *queue;
+    size_t seq;
+
+    /* detached scan context */
+    cli_ctx ctx;
+    struct cl_scan_options options;
+    unsigned long int scanned;
+    uint64_t charged_scansize; /* added to the shared limits by this job and its own jobs */
+    unsigned int charged_files;
+    bool limit_exceeded; /* ctx.limit_exceeded when submitted */
+    cl_error_t status;
+
+    struct job_alert *alerts;
+    size_t nalerts;
+    size_t alerts_capacity;
+    bool emax;
+};
+
+struct cli_scan_pool {
+    pthread_mutex_t mutex;
+    pthread_cond_t queued; /* a job was queued, or the pool is stopping */
+    pthread_cond_t done;   /* a job is done */
+    cli_scan_job_t *head;
+    cli_scan_job_t *tail;
+    pthread_t *threads;
+    uint32_t nthreads;
+    bool stop;
+};
+
+/*
+ * The scansize and scannedfiles counters of a scan, once shared by the
+ * scanning thread and its parallel scan jobs. ctx->scansize and
+ * ctx->scannedfiles are then snapshots, refreshed by cli_checklimits().
+ */
+struct cli_scan_limits {
+    pthread_mutex_t mutex;
+    uint64_t scansize;
+    unsigned int scannedfiles;
+    unsigned int refs;
+};
+
+struct queue_entry {
+    cli_scan_job_t *job;
+    void *buffer;   /* owned buffer of a buffer job */
+    size_t length;
+    char *filepath; /* owned file of a file job, removed unless keeptmp */
+    cli_scan_job_fn fn;
+    void *arg;
+    void (*arg_free)(void *arg);
+};
+
+struct cli_scan_queue {
+    cli_ctx *ctx;
+    struct queue_entry *entries; /* ring of the jobs in flight, oldest first */
+    size_t max;
+    size_t first;
+    size_t count;
+    size_t next_seq;
+    size_t stop_seq; /* jobs after this one are stopped, SIZE_MAX if none, see JOB_LOAD() */
+};
+
+/* A job's cancelled flag and its queue's stop_seq are polled by the running
+ * job without the pool mutex. stop_seq is only changed with the mutex held,
+ * and both are published with a release store, so that the job sees them
+ * together with whatever was written before. */
+#if defined(__GNUC__) || defined(__clang__)
+#define JOB_LOAD(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define JOB_STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#else
+#define JOB_LOAD(p) (*(p))
+#define JOB_STORE(p, v) (*(p) = (v))
+#endif
+
+static void job_run(cli_scan_job_t *job)
+{
+    if (cli_scan_job_cancelled(job)) {
+        job->status = CL_BREAK;
+        return;
+    }
+
+    switch (job->type) {
+        case JOB_BUFFER:
+            job->status = cli_magic_scan_buff(job->buffer, job->length, &job->ctx, job->name, job->attributes);
+            break;
+        case JOB_FILE:
+            job->status = cli_magic_scan_file(job->filepath, &job->ctx, job->name, job->attributes);
+            if (CL_EOPEN == job->status) {
+                // Don't abort the scan just because one file failed to extract.
+                cli_dbgmsg("cli_scan_job: file not found, extraction failed: %s\n", job->filepath);
+                job->status = CL_SUCCESS;
+            }
+            break;
+        case JOB_CALL:
+            job->status = job->fn(&job->ctx, job->arg);
+            break;
+    }
+}
+
+/* Take a job off the queue. Called with the pool mutex held. */
+static void job_unlink(cli_scan_pool_t *pool, cli_scan_job_t *job)
+{
+    if (job->prev)
+        job->prev->next = job->next;
+    else
+        pool->head = job->next;
+
+    if (job->next)
+        job->next->prev = job->prev;
+    else
+        pool->tail = job->prev;
+
+    job->prev = job->next = NULL;
+}
+
+static void *worker(void *arg)
+{
+    cli_scan_pool_t *pool = (cli_scan_pool_t *)arg;
+    cli_scan_job_t *job;
+
+    pthread_mutex_lock(&pool->mutex);
+    while (1) {
+        while (!pool->stop && !pool->head)
+            pthread_cond_wait(&pool->queued, &pool->mutex);
+
+        if (pool->stop)
+            break;
+
+        job = pool->head;
+        job_unlink(pool, job);
+        job->state = JOB_RUNNING;
+        pthread_mutex_unlock(&pool->mutex);
+
+        job_run(job);
+
+        pthread_mutex_lock(&pool->mutex);
+        job->state = JOB_DONE;
+        pthread_cond_broadcast(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    return NULL;
+}
+
+cl_error_t cli_scan_pool_new(uint32_t nthreads, cli_scan_pool_t **pool)
+{
+    cli_scan_pool_t *p;
+    uint32_t i;
+
+    if (!pool || !nthreads)
+        return CL_ENULLARG;
+
+    *pool = NULL;
+
+    p = calloc(1, sizeof(*p));
+    if (!p)
+        return CL_EMEM;
+
+    p->threads = cli_max_calloc(nthreads, sizeof(pthread_t));
+    if (!p->threads) {
+        free(p);
+        return CL_EMEM;
+    }
+
+    pthread_mutex_init(&p->mutex, NULL);
+    pthread_cond_init(&p->queued, NULL);
+    pthread_cond_init(&p->done, NULL);
+
+    for (i = 0; i < nthreads; i++) {
+        if (pthread_create(&p->threads[i], NULL, worker, p)) {
+            cli_errmsg("cli_scan_pool_new: failed to start worker thread %u\n", i);
+            break;
+        }
+        p->nthreads++;
+    }
+
+    if (p->nthreads < nthreads) {
+        cli_scan_pool_free(p);
+        return CL_ERROR;
+    }
+
+    cli_dbgmsg("cli_scan_pool_new: started %u scan threads\n", nthreads);
+    *pool = p;
+    return CL_SUCCESS;
+}
+
+void cli_scan_pool_free(cli_scan_pool_t *pool)
+{
+    uint32_t i;
+
+    if (!pool)
+        return;
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->queued);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (i = 0; i < pool->nthreads; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->queued);
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool->threads);
+    free(pool);
+}
+
+uint32_t cli_scan_parallel_jobs(cli_ctx *ctx)
+{
+    const struct cl_engine *engine;
+
+    if (!ctx || !ctx->engine || !ctx->engine->scan_pool)
+        return 0;
+
+    engine = ctx->engine;
+
+    if (SCAN_COLLECT_METADATA)
+        return 0;
+
+    if (engine->cb_file_inspection || engine->cb_pre_cache || engine->cb_pre_scan || engine->cb_post_scan ||
+        engine->cb_hash || engine->cb_meta || engine->cb_vba)
+        return 0;
+
+    /* enough to keep every worker busy while the parser prepares the next one */
+    return engine->scan_pool->nthreads * 2;
+}
+
+/*
+ * Shared limits accounting.
+ */
+
+static void limits_release(struct cli_scan_limits *limits)
+{
+    unsigned int refs;
+
+    pthread_mutex_lock(&limits->mutex);
+    refs = --limits->refs;
+    pthread_mutex_unlock(&limits->mutex);
+
+    if (refs)
+        return;
+
+    pthread_mutex_destroy(&limits->mutex);
+    free(limits);
+}
+
+/* Move the counters of ctx to a shared object, if not done yet. */
+static cl_error_t limits_share(cli_ctx *ctx)
+{
+    struct cli_scan_limits *limits;
+
+    if (ctx->limits)
+        return CL_SUCCESS;
+
+    limits = calloc(1, sizeof(*limits));
+    if (!limits)
+        return CL_EMEM;
+
+    pthread_mutex_init(&limits->mutex, NULL);
+    limits->scansize     = ctx->scansize;
+    limits->scannedfiles = ctx->scannedfiles;
+    limits->refs         = 1;
+
+    ctx->limits = limits;
+    return CL_SUCCESS;
+}
+
+void cli_scan_limits_sync(cli_ctx *ctx)
+{
+    struct cli_scan_limits *limits = ctx->limits;
+
+    pthread_mutex_lock(&limits->mutex);
+    ctx->scansize     = limits->scansize;
+    ctx->scannedfiles = limits->scannedfiles;
+    pthread_mutex_unlock(&limits->mutex);
+}
+
+cl_error_t cli_scan_limits_add(cli_ctx *ctx, uint64_t needed)
+{
+    struct cli_scan_limits *limits = ctx->limits;
+    cl_error_t ret                 = CL_SUCCESS;
+    uint64_t scansize;
+
+    pthread_mutex_lock(&limits->mutex);
+    if (needed && (ctx->engine->maxscansize != 0) && (ctx->engine->maxscansize - limits->scansize < needed)) {
+        ret = CL_EMAXSIZE;
+    } else if ((ctx->engine->maxfiles != 0) && (limits->scannedfiles >= ctx->engine->maxfiles)) {
+        ret = CL_EMAXFILES;
+    } else {
+        scansize = limits->scansize;
+        limits->scannedfiles++;
+        limits->scansize += needed;
+        if (limits->scansize > ctx->engine->maxscansize)
+            limits->scansize = ctx->engine->maxscansize;
+        if (ctx->job) {
+            ctx->job->charged_files++;
+            ctx->job->charged_scansize += limits->scansize - scansize;
+        }
+    }
+    ctx->scansize     = limits->scansize;
+    ctx->scannedfiles = limits->scannedfiles;
+    pthread_mutex_unlock(&limits->mutex);
+
+    return ret;
+}
+
+void cli_scan_limits_release(cli_ctx *ctx)
+{
+    if (!ctx || !ctx->limits)
+        return;
+
+    limits_release(ctx->limits);
+    ctx->limits = NULL;
+}
+
+/*
+ * Jobs.
+ */
+
+static void job_free(cli_scan_job_t *job)
+{
+    if (job->ctx.evidence)
+        evidence_free(job->ctx.evidence);
+    if (job->ctx.hook_lsig_matches)
+        cli_bitset_free(job->ctx.hook_lsig_matches);
+    if (job->ctx.limits)
+        limits_release(job->ctx.limits);
+    free(job->ctx.recursion_stack);
+    free(job->alerts);
+    free(job->name);
+    free(job);
+}
+
+/* Create a job with a detached scan context for the current layer of ctx. */
+static cl_error_t job_new(cli_ctx *ctx, const char *name, uint32_t attributes, cli_scan_job_t **job)
+{
+    cli_scan_job_t *j;
+    uint32_t i;
+
+    *job = NULL;
+
+    if (CL_SUCCESS != limits_share(ctx))
+        return CL_EMEM;
+
+    j = calloc(1, sizeof(*j));
+    if (!j)
+        return CL_EMEM;
+
+    j->pool       = ctx->engine->scan_pool;
+    j->attributes = attributes;
+    if (name && !(j->name = cli_safer_strdup(name)))
+        goto fail;
+
+    /*
+     * The detached context shares the engine, the temp directory, the
+     * deadline and the limits counters with the parent.
+     */
+    memcpy(&j->options, ctx->options, sizeof(j->options));
+    j->ctx.options         = &j->options;
+    j->ctx.engine          = ctx->engine;
+    j->ctx.dconf           = ctx->dconf;
+    j->ctx.cb_ctx          = ctx->cb_ctx;
+    j->ctx.target_filepath = ctx->target_filepath;
+    j->ctx.sub_tmpdir      = ctx->sub_tmpdir;
+    j->ctx.scanned         = &j->scanned;
+    j->ctx.corrupted_input = ctx->corrupted_input;
+    j->ctx.time_limit      = ctx->time_limit;
+    j->ctx.limit_exceeded  = ctx->limit_exceeded;
+    j->ctx.job             = j;
+    j->limit_exceeded      = ctx->limit_exceeded;
+
+    pthread_mutex_lock(&ctx->limits->mutex);
+    ctx->limits->refs++;
+    j->ctx.limits       = ctx->limits;
+    j->ctx.scansize     = ctx->limits->scansize;
+    j->ctx.scannedfiles = ctx->limits->scannedfiles;
+    pthread_mutex_unlock(&ctx->limits->mutex);
+
+    j->ctx.evidence = evidence_new();
+    if (!j->ctx.evidence)
+        goto fail;
+
+    j->ctx.hook_lsig_matches = cli_bitset_init();
+    if (!j->ctx.hook_lsig_matches)
+        goto fail;
+
+    /*
+     * Copy the layers above the content without their fmaps, those belong to
+     * the parent's thread. The parent checks them for false positives when
+     * the alerts are added to it.
+     */
+    j->ctx.recursion_stack_size = ctx->recursion_stack_size;
+    j->ctx.recursion_stack      = cli_max_calloc(ctx->recursion_stack_size, sizeof(recursion_level_t));
+    if (!j->ctx.recursion_stack)
+        goto fail;
+
+    for (i = 0; i <= ctx->recursion_level; i++) {
+        j->ctx.recursion_stack[i]      = ctx->recursion_stack[i];
+        j->ctx.recursion_stack[i].fmap = NULL;
+    }
+    j->ctx.recursion_level = ctx->recursion_level;
+
+    *job = j;
+    return CL_SUCCESS;
+
+fail:
+    job_free(j);
+    return CL_EMEM;
+}
+
+/* Throw away the result of a job that was stopped, so it can be run again.
+ * What it charged to the shared limits is given back. */
+static cl_error_t job_reset(cli_scan_job_t *job)
+{
+    struct cli_scan_limits *limits = job->ctx.limits;
+
+    pthread_mutex_lock(&limits->mutex);
+    limits->scansize -= job->charged_scansize;
+    limits->scannedfiles -= job->charged_files;
+    job->ctx.scansize     = limits->scansize;
+    job->ctx.scannedfiles = limits->scannedfiles;
+    pthread_mutex_unlock(&limits->mutex);
+    job->charged_scansize = 0;
+    job->charged_files    = 0;
+
+    evidence_free(job->ctx.evidence);
+    job->ctx.evidence = evidence_new();
+    if (!job->ctx.evidence)
+        return CL_EMEM;
+
+    cli_bitset_free(job->ctx.hook_lsig_matches);
+    job->ctx.hook_lsig_matches = cli_bitset_init();
+    if (!job->ctx.hook_lsig_matches)
+        return CL_EMEM;
+
+    job->ctx.abort_scan     = false;
+    job->ctx.limit_exceeded = job->limit_exceeded;
+    job->scanned            = 0;
+    job->nalerts            = 0;
+    job->emax               = false;
+    job->interrupted        = false;
+
+    return CL_SUCCESS;
+}
+
+static void job_enqueue(cli_scan_job_t *job)
+{
+    cli_scan_pool_t *pool = job->pool;
+
+    pthread_mutex_lock(&pool->mutex);
+    job->state = JOB_QUEUED;
+    job->prev  = pool->tail;
+    if (pool->tail)
+        pool->tail->next = job;
+    else
+        pool->head = job;
+    pool->tail = job;
+    pthread_cond_signal(&pool->queued);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+cl_error_t cli_scan_job_submit(cli_ctx *ctx, const void *buffer, size_t length, const char *name, uint32_t attributes, cli_scan_job_t **job)
+{
+    cl_error_t ret;
+
+    if (!ctx || !job || !ctx->engine->scan_pool)
+        return CL_ENULLARG;
+
+    ret = job_new(ctx, name, attributes, job);
+    if (CL_SUCCESS != ret)
+        return ret;
+
+    (*job)->type   = JOB_BUFFER;
+    (*job)->buffer = buffer;
+    (*job)->length = length;
+
+    job_enqueue(*job);
+    return CL_SUCCESS;
+}
+
+/* Wait until a job is done, running it here if no worker picked it up yet. */
+static void job_wait(cli_scan_job_t *job)
+{
+    cli_scan_pool_t *pool = job->pool;
+
+    pthread_mutex_lock(&pool->mutex);
+    if (job->state == JOB_QUEUED) {
+        job_unlink(pool, job);
+        job->state = JOB_RUNNING;
+        pthread_mutex_unlock(&pool->mutex);
+
+        job_run(job);
+
+        pthread_mutex_lock(&pool->mutex);
+        job->state = JOB_DONE;
+    }
+    while (job->state != JOB_DONE)
+        pthread_cond_wait(&pool->done, &pool->mutex);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+cl_error_t cli_scan_job_finish(cli_ctx *ctx, cli_scan_job_t *job)
+{
+    cl_error_t status;
+    size_t i;
+
+    if (!ctx || !job)
+        return CL_ENULLARG;
+
+    job_wait(job);
+
+    if (job->queue && JOB_LOAD(&job->queue->stop_seq) < job->seq) {
+        /*
+         * An earlier sibling alerted, but as the parent got this far its
+         * alert was dropped (e.g. a false positive signature for one of the
+         * layers above it). The siblings may carry on.
+         */
+        pthread_mutex_lock(&job->pool->mutex);
+        JOB_STORE(&job->queue->stop_seq, SIZE_MAX);
+        pthread_mutex_unlock(&job->pool->mutex);
+    }
+
+    if (job->interrupted) {
+        /* This one was stopped half-way, scan it again. */
+        cli_dbgmsg("cli_scan_job_finish: scanning interrupted job again\n");
+        if (CL_SUCCESS != job_reset(job)) {
+            job_free(job);
+            return CL_EMEM;
+        }
+        job_run(job);
+    }
+
+    if (ctx->scanned)
+        *ctx->scanned += job->scanned;
+    if (ctx->job) {
+        /* refunded with the parent job, should it run again */
+        ctx->job->charged_scansize += job->charged_scansize;
+        ctx->job->charged_files += job->charged_files;
+    }
+    cli_scan_limits_sync(ctx);
+    if (job->ctx.limit_exceeded)
+        ctx->limit_exceeded = true;
+    if (job->emax)
+        emax_reached(ctx);
+
+    status = job->status;
+    if (CL_VIRUS == status) {
+        /* unless the parent agrees, see below */
+        status = CL_CLEAN;
+    }
+
+    for (i = 0; i < job->nalerts; i++) {
+        cl_error_t ret;
+
+        if (job->alerts[i].strong)
+            ret = cli_append_virus(ctx, job->alerts[i].virname);
+        else
+            ret = cli_append_potentially_unwanted(ctx, job->alerts[i].virname);
+
+        if (CL_SUCCESS != ret) {
+            status = ret;
+            break;
+        }
+    }
+
+    if (job->ctx.abort_scan && CL_VIRUS != job->status) {
+        /* e.g. the time limit */
+        ctx->abort_scan = true;
+    }
+
+    job_free(job);
+    return status;
+}
+
+void cli_scan_job_discard(cli_scan_job_t *job)
+{
+    if (!job)
+        return;
+
+    JOB_STORE(&job->cancelled, true);
+    job_wait(job);
+    job_free(job);
+}
+
+cl_error_t cli_scan_job_add_alert(cli_scan_job_t *job, const char *virname, bool strong)
+{
+    if (job->nalerts == job->alerts_capacity) {
+        size_t capacity = job->alerts_capacity ? job->alerts_capacity * 2 : 4;
+        struct job_alert *alerts;
+
+        alerts = cli_max_realloc(job->alerts, capacity * sizeof(*alerts));
+        if (!alerts)
+            return CL_EMEM;
+        job->alerts          = alerts;
+        job->alerts_capacity = capacity;
+    }
+
+    job->alerts[job->nalerts].virname = virname;
+    job->alerts[job->nalerts].strong  = strong;
+    job->nalerts++;
+
+    if (strong && job->queue && !(job->options.general & CL_SCAN_GENERAL_ALLMATCHES)) {
+        /* the later siblings won't be looked at, unless this alert is dropped by the parent */
+        pthread_mutex_lock(&job->pool->mutex);
+        if (job->seq < job->queue->stop_seq)
+            JOB_STORE(&job->queue->stop_seq, job->seq);
+        pthread_mutex_unlock(&job->pool->mutex);
+    }
+
+    return CL_SUCCESS;
+}
+
+void cli_scan_job_emax_reached(cli_scan_job_t *job)
+{
+    job->emax = true;
+}
+
+bool cli_scan_job_cancelled(cli_scan_job_t *job)
+{
+    if (JOB_LOAD(&job->cancelled))
+        return true;
+
+    if (job->queue && job->seq > JOB_LOAD(&job->queue->stop_seq)) {
+        job->interrupted = true;
+        return true;
+    }
+
+    return false;
+}
+
+/*
+ * Queues.
+ */
+
+cl_error_t cli_scan_queue_new(cli_ctx *ctx, cli_scan_queue_t **queue)
+{
+    cli_scan_queue_t *q;
+    uint32_t max;
+
+    if (!ctx || !queue)
+        return CL_ENULLARG;
+
+    *queue = NULL;
+
+    max = cli_scan_parallel_jobs(ctx);
+    if (!max)
+        return CL_SUCCESS;
+
+    q = calloc(1, sizeof(*q));
+    if (!q)
+        return CL_EMEM;
+
+    q->entries = cli_max_calloc(max, sizeof(struct queue_entry));
+    if (!q->entries) {
+        free(q);
+        return CL_EMEM;
+    }
+
+    q->ctx      = ctx;
+    q->max      = max;
+    q->stop_seq = SIZE_MAX;
+
+    cli_dbgmsg("cli_scan_queue_new: scanning up to %u jobs in parallel\n", max);
+
+    *queue = q;
+    return CL_SUCCESS;
+}
+
+/* Free what a queue entry owns, the job must be finished or discarded. */
+static void entry_cleanup(cli_scan_queue_t *queue, struct queue_entry *entry)
+{
+    if (entry->buffer)
+        free(entry->buffer);
+
+    if (entry->filepath) {
+        if (!queue->ctx->engine->keeptmp && cli_unlink(entry->filepath))
+            cli_dbgmsg("cli_scan_queue: failed to remove %s\n", entry->filepath);
+        free(entry->filepath);
+    }
+
+    if (entry->arg && entry->arg_free)
+        entry->arg_free(entry->arg);
+
+    memset(entry, 0, sizeof(*entry));
+}
+
+/* Finish the oldest job of a queue. */
+static cl_error_t queue_finish_one(cli_scan_queue_t *queue)
+{
+    struct queue_entry *entry = &queue->entries[queue->first];
+    cl_error_t status;
+
+    status = cli_scan_job_finish(queue->ctx, entry->job);
+    entry_cleanup(queue, entry);
+
+    queue->first = (queue->first + 1) % queue->max;
+    queue->count--;
+
+    return status;
+}
+
+/*
+ * Submit the job of a new entry, after making room for it.
+ * The entry's resources are released if it can't be submitted.
+ */
+static cl_error_t queue_submit(cli_scan_queue_t *queue, struct queue_entry *new_entry, enum job_type type, const char *name, uint32_t attributes)
+{
+    struct queue_entry *entry;
+    cli_scan_job_t *job = NULL;
+    cl_error_t status   = CL_SUCCESS;
+
+    if (queue->count == queue->max) {
+        status = queue_finish_one(queue);
+        if (CL_SUCCESS != status)
+            goto done;
+    }
+
+    status = job_new(queue->ctx, name, attributes, &job);
+    if (CL_SUCCESS != status)
+        goto done;
+
+    entry  = &queue->entries[(queue->first + queue->count) % queue->max];
+    *entry = *new_entry;
+    memset(new_entry, 0, sizeof(*new_entry));
+
+    entry->job    = job;
+    job->type     = type;
+    job->queue    = queue;
+    job->seq      = queue->next_seq++;
+    job->buffer   = entry->buffer;
+    job->length   = entry->length;
+    job->filepath = entry->filepath;
+    job->fn       = entry->fn;
+    job->arg      = entry->arg;
+
+    queue->count++;
+    job_enqueue(job);
+
+done:
+    if (CL_SUCCESS != status)
+        entry_cleanup(queue, new_entry);
+
+    return status;
+}
+
+cl_error_t cli_scan_queue_buff(cli_scan_queue_t *queue, void *buffer, size_t length, const char *name, uint32_t attributes)
+{
+    struct queue_entry entry = {0};
+
+    entry.buffer = buffer;
+    entry.length = length;
+
+    return queue_submit(queue, &entry, JOB_BUFFER, name, attributes);
+}
+
+cl_error_t cli_scan_queue_file(cli_scan_queue_t *queue, char *filepath, const char *name, uint32_t attributes)
+{
+    struct queue_entry entry = {0};
+
+    entry.filepath = filepath;
+
+    return queue_submit(queue, &entry, JOB_FILE, name, attributes);
+}
+
+cl_error_t cli_scan_queue_call(cli_scan_queue_t *queue, cli_scan_job_fn fn, void *arg, void (*arg_free)(void *arg))
+{
+    struct queue_entry entry = {0};
+
+    entry.fn       = fn;
+    entry.arg      = arg;
+    entry.arg_free = arg_free;
+
+    return queue_submit(queue, &entry, JOB_CALL, NULL, LAYER_ATTRIBUTES_NONE);
+}
+
+cl_error_t cli_scan_queue_wait(cli_scan_queue_t *queue)
+{
+    cl_error_t status;
+
+    if (!queue)
+        return CL_SUCCESS;
+
+    while (queue->count) {
+        status = queue_finish_one(queue);
+        if (CL_SUCCESS != status)
+            return status;
+    }
+
+    return CL_SUCCESS;
+}
+
+void cli_scan_queue_free(cli_scan_queue_t *queue)
+{
+    if (!queue)
+        return;
+
+    while (queue->count) {
+        struct queue_entry *entry = &queue->entries[queue->first];
+
+        cli_scan_job_discard(entry->job);
+        entry_cleanup(queue, entry);
+
+        queue->first = (queue->first + 1) % queue->max;
+        queue->count--;
+    }
+
+    free(queue->entries);
+    free(queue);
+}
@@ -0,0 +1,263 @@
+/*
+ *  Copyright (C) 2025 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+/*
+ * Parallel scanning of embedded content within a single file.
+ *
+ * A parser that has extracted an independent piece of content (e.g. a PDF
+ * object) may hand it to the engine's scan pool instead of scanning it
+ * inline. The job is scanned by a worker thread in a detached scan context:
+ * it has its own evidence and limits counters, and the types (but not the
+ * fmaps) of the layers above it, so container and intermediate conditions of
+ * signatures work as usual.
+ *
+ * Nothing of a job's result reaches the parent context until the parser
+ * calls cli_scan_job_finish(), from the thread that owns the parent context.
+ * The alerts are then added to the parent, in the order they were found, as
+ * if the content had been scanned inline at that point. Finishing the jobs in
+ * the order they were submitted keeps the result deterministic, including
+ * the order of the alerts in ALLMATCH mode.
+ *
+ * A job that no worker has picked up yet when it is finished is scanned by
+ * the finishing thread, so a job never waits on a queue that is busy with
+ * its own parents.
+ *
+ * Parsers that hand over a series of members (e.g. of an archive) use a
+ * cli_scan_queue, which keeps a window of jobs in flight and finishes them in
+ * order. Once a member alerts, the jobs for the members after it are stopped
+ * unless in ALLMATCH mode.
+ *
+ * The scansize and scannedfiles counters used for the MaxScanSize and
+ * MaxFiles limits are shared by the parent and all of its jobs, see
+ * cli_scan_limits_add().
+ */
+
+#ifndef __SCANPOOL_H
+#define __SCANPOOL_H
+
+#include <stdbool.h>
+
+#include "clamav.h"
+#include "others.h"
+
+typedef struct cli_scan_pool cli_scan_pool_t;
+typedef struct cli_scan_job cli_scan_job_t;
+typedef struct cli_scan_queue cli_scan_queue_t;
+
+/**
+ * @brief A function run by the scan pool, see cli_scan_queue_call().
+ *
+ * @param ctx       The detached scan context of the job.
+ * @param arg       The argument given to cli_scan_queue_call().
+ * @return cl_error_t The result, as for cli_magic_scan_desc().
+ */
+typedef cl_error_t (*cli_scan_job_fn)(cli_ctx *ctx, void *arg);
+
+/**
+ * @brief Start a scan pool.
+ *
+ * @param nthreads      Number of worker threads.
+ * @param[out] pool     The new pool.
+ * @return cl_error_t   CL_SUCCESS, CL_EMEM, or CL_ERROR if the threads couldn't be started.
+ */
+cl_error_t cli_scan_pool_new(uint32_t nthreads, cli_scan_pool_t **pool);
+
+/**
+ * @brief Stop the worker threads and free a scan pool.
+ *
+ * There must not be any unfinished jobs left.
+ *
+ * @param pool  The pool, may be NULL.
+ */
+void cli_scan_pool_free(cli_scan_pool_t *pool);
+
+/**
+ * @brief Check if content found in the current layer may be scanned in parallel.
+ *
+ * Parallel scanning requires a scan pool on the engine, and is not used if
+ * metadata is collected or if the application set a callback that is invoked
+ * for every layer, as those expect to be called in order from the scanning
+ * thread.
+ *
+ * @param ctx       The scanning context.
+ * @return uint32_t The number of jobs a parser should keep in flight, 0 if parallel scanning can't be used.
+ */
+uint32_t cli_scan_parallel_jobs(cli_ctx *ctx);
+
+/**
+ * @brief Queue a buffer to be scanned by the scan pool.
+ *
+ * The buffer is scanned as if by cli_magic_scan_buff() in the current layer.
+ * It must stay valid until the job is finished or discarded.
+ *
+ * @param ctx           The scanning context.
+ * @param buffer        The buffer to scan.
+ * @param length        Length of the buffer.
+ * @param name          (optional) Name of the content, copied.
+ * @param attributes    Layer attributes of the content.
+ * @param[out] job      The new job.
+ * @return cl_error_t   CL_SUCCESS, CL_EMEM, or CL_ENULLARG if the engine has no scan pool.
+ */
+cl_error_t cli_scan_job_submit(cli_ctx *ctx, const void *buffer, size_t length, const char *name, uint32_t attributes, cli_scan_job_t **job);
+
+/**
+ * @brief Wait for a job and add its result to the scanning context.
+ *
+ * Must be called from the thread that owns ctx, with ctx in the layer the
+ * job was submitted from. The job is freed.
+ *
+ * @param ctx           The scanning context the job was submitted from.
+ * @param job           The job.
+ * @return cl_error_t   The result, as cli_magic_scan_buff() would have returned it.
+ */
+cl_error_t cli_scan_job_finish(cli_ctx *ctx, cli_scan_job_t *job);
+
+/**
+ * @brief Stop a job and throw away its result.
+ *
+ * Used for the remaining jobs once the scan of the parent is stopped, e.g.
+ * after an alert when not in ALLMATCH mode. The job is freed.
+ *
+ * @param job   The job, may be NULL.
+ */
+void cli_scan_job_discard(cli_scan_job_t *job);
+
+/*
+ * For the detached scan context of a job, see cli_ctx.job.
+ */
+
+/**
+ * @brief Record an alert of a job, to be added to the parent context when the job is finished.
+ *
+ * @param job       The job.
+ * @param virname   Signature name, must stay valid until the job is finished.
+ * @param strong    true for a strong indicator, false for a potentially unwanted one.
+ * @return cl_error_t CL_SUCCESS or CL_EMEM.
+ */
+cl_error_t cli_scan_job_add_alert(cli_scan_job_t *job, const char *virname, bool strong);
+
+/**
+ * @brief Record that some content of a job was skipped because of a limit.
+ *
+ * The layers above the job are marked as not cacheable when it is finished.
+ *
+ * @param job   The job.
+ */
+void cli_scan_job_emax_reached(cli_scan_job_t *job);
+
+/**
+ * @brief Check if a job was discarded, or stopped after an alert of an earlier sibling, and its scan should stop.
+ *
+ * @param job   The job.
+ * @return bool true if the scan should stop.
+ */
+bool cli_scan_job_cancelled(cli_scan_job_t *job);
+
+/**
+ * @brief Start a queue for the members found in the current layer.
+ *
+ * @param ctx           The scanning context.
+ * @param[out] queue    The new queue, NULL if parallel scanning can't be used (see cli_scan_parallel_jobs()).
+ * @return cl_error_t   CL_SUCCESS or CL_EMEM.
+ */
+cl_error_t cli_scan_queue_new(cli_ctx *ctx, cli_scan_queue_t **queue);
+
+/**
+ * @brief Queue a buffer to be scanned as if by cli_magic_scan_buff().
+ *
+ * If the queue is full, the oldest job is finished first.
+ *
+ * @param queue         The queue.
+ * @param buffer        The buffer to scan, freed by the queue.
+ * @param length        Length of the buffer.
+ * @param name          (optional) Name of the member, copied.
+ * @param attributes    Layer attributes of the member.
+ * @return cl_error_t   CL_SUCCESS, or the result of the job finished to make room. The buffer is freed on error.
+ */
+cl_error_t cli_scan_queue_buff(cli_scan_queue_t *queue, void *buffer, size_t length, const char *name, uint32_t attributes);
+
+/**
+ * @brief Queue an extracted file to be scanned as if by cli_magic_scan_file().
+ *
+ * If the queue is full, the oldest job is finished first.
+ *
+ * @param queue         The queue.
+ * @param filepath      The file to scan, freed by the queue. The file is removed unless keeptmp is set.
+ * @param name          (optional) Name of the member, copied.
+ * @param attributes    Layer attributes of the member.
+ * @return cl_error_t   CL_SUCCESS, or the result of the job finished to make room. The file is removed on error.
+ */
+cl_error_t cli_scan_queue_file(cli_scan_queue_t *queue, char *filepath, const char *name, uint32_t attributes);
+
+/**
+ * @brief Queue a function to be run in a detached scan context, e.g. to decompress and scan a member.
+ *
+ * The function must not use anything of the parent context.
+ * If the queue is full, the oldest job is finished first.
+ *
+ * @param queue         The queue.
+ * @param fn            The function.
+ * @param arg           Argument for the function.
+ * @param arg_free      (optional) Called to free arg once the job is finished or discarded.
+ * @return cl_error_t   CL_SUCCESS, or the result of the job finished to make room. arg is freed on error.
+ */
+cl_error_t cli_scan_queue_call(cli_scan_queue_t *queue, cli_scan_job_fn fn, void *arg, void (*arg_free)(void *arg));
+
+/**
+ * @brief Finish the queued jobs in order, e.g. before a member is scanned inline.
+ *
+ * @param queue         The queue, may be NULL.
+ * @return cl_error_t   CL_SUCCESS, or the first result other than CL_SUCCESS. The jobs after it are left in the queue.
+ */
+cl_error_t cli_scan_queue_wait(cli_scan_queue_t *queue);
+
+/**
+ * @brief Discard the jobs left in a queue, and free it.
+ *
+ * @param queue The queue, may be NULL.
+ */
+void cli_scan_queue_free(cli_scan_queue_t *queue);
+
+/**
+ * @brief Refresh ctx->scansize and ctx->scannedfiles from the counters shared with parallel scan jobs.
+ *
+ * Only for a context with shared counters (ctx->limits).
+ *
+ * @param ctx   The scanning context.
+ */
+void cli_scan_limits_sync(cli_ctx *ctx);
+
+/**
+ * @brief Check the MaxScanSize and MaxFiles limits and account for a file, on the counters shared with parallel scan jobs.
+ *
+ * Only for a context with shared counters (ctx->limits).
+ *
+ * @param ctx           The scanning context.
+ * @param needed        Size of the file.
+ * @return cl_error_t   CL_SUCCESS, CL_EMAXSIZE or CL_EMAXFILES.
+ */
+cl_error_t cli_scan_limits_add(cli_ctx *ctx, uint64_t needed);
+
+/**
+ * @brief Drop the reference of the scanning context to the shared counters, at the end of the scan.
+ *
+ * @param ctx   The scanning context.
+ */
+void cli_scan_limits_release(cli_ctx *ctx);
+
+#endif
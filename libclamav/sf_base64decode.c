@@ -25,27 +25,17 @@
 #include "clamav-config.h"
 #endif
 
+#include <string.h>
+
 #include "sf_base64decode.h"
+#include "textdecode.h"
+
+#ifndef MIN
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#endif
 
-// clang-format off
-uint8_t sf_decode64tab[256] = {
-        100,100,100,100,100,100,100,100,100,100,100,100,100,100,100,100,
-        100,100,100,100,100,100,100,100,100,100,100,100,100,100,100,100,
-        100,100,100,100,100,100,100,100,100,100,100,62 ,100,100,100, 63,
-         52, 53, 54, 55, 56, 57, 58, 59, 60, 61,100,100,100, 99,100,100,
-        100,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
-         15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25,100,100,100,100,100,
-        100, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
-         41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51,100,100,100,100,100,
-        100,100,100,100,100,100,100,100,100,100,100,100,100,100,100,100,
-        100,100,100,100,100,100,100,100,100,100,100,100,100,100,100,100,
-        100,100,100,100,100,100,100,100,100,100,100,100,100,100,100,100,
-        100,100,100,100,100,100,100,100,100,100,100,100,100,100,100,100,
-        100,100,100,100,100,100,100,100,100,100,100,100,100,100,100,100,
-        100,100,100,100,100,100,100,100,100,100,100,100,100,100,100,100,
-        100,100,100,100,100,100,100,100,100,100,100,100,100,100,100,100,
-        100,100,100,100,100,100,100,100,100,100,100,100,100,100,100,100};
-// clang-format on
+/* input consumed per call to the decoder, a partial group is carried over by its state */
+#define SF_BASE64_CHUNK 4096
 
 /* base64decode assumes the input data terminates with '=' and/or at the end of the input buffer
  * at inbuf_size.  If extra characters exist within inbuf before inbuf_size is reached, it will
@@ -53,78 +43,31 @@ uint8_t sf_decode64tab[256] = {
  * out there.  So, either terminate the string, set inbuf_size correctly, or at least be sure the
  * data is valid up until the point you care about.  Note base64 data does NOT have to end with
  * '=' and won't if the number of bytes of input data is evenly divisible by 3.
+ * A trailing partial group without padding is dropped.
  */
 int sf_base64decode(uint8_t *inbuf, size_t inbuf_size, uint8_t *outbuf, size_t outbuf_size, size_t *bytes_written)
 {
-    uint8_t *cursor, *endofinbuf;
-    uint8_t *outbuf_ptr;
-    uint8_t base64data[4], *base64data_ptr; /* temporary holder for current base64 chunk */
-    uint8_t tableval_a, tableval_b, tableval_c, tableval_d;
-
-    size_t n;
-    size_t max_base64_chars; /* The max number of decoded base64 chars that fit into outbuf */
-
-    int error = 0;
+    struct cli_base64_state state;
+    uint8_t decoded[SF_BASE64_CHUNK / 4 * 3];
+    size_t n, len;
 
-    /* This algorithm will waste up to 4 bytes but we really don't care.
-      At the end we're going to copy the exact number of bytes requested. */
-    max_base64_chars = (outbuf_size / 3) * 4 + 4; /* 4 base64 bytes gives 3 data bytes, plus
-                                                    an extra 4 to take care of any rounding */
-
-    base64data_ptr = base64data;
-    endofinbuf     = inbuf + inbuf_size;
-
-    /* Strip non-base64 chars from inbuf and decode */
-    n              = 0;
+    cli_base64_init(&state);
     *bytes_written = 0;
-    cursor         = inbuf;
-    outbuf_ptr     = outbuf;
-    while ((cursor < endofinbuf) && (n < max_base64_chars)) {
-        if (sf_decode64tab[*cursor] != 100) {
-            *base64data_ptr++ = *cursor;
-            n++; /* Number of base64 bytes we've stored */
-            if (!(n % 4)) {
-                /* We have four databytes upon which to operate */
-
-                if ((base64data[0] == '=') || (base64data[1] == '=')) {
-                    /* Error in input data */
-                    error = 1;
-                    break;
-                }
-
-                /* retrieve values from lookup table */
-                tableval_a = sf_decode64tab[base64data[0]];
-                tableval_b = sf_decode64tab[base64data[1]];
-                tableval_c = sf_decode64tab[base64data[2]];
-                tableval_d = sf_decode64tab[base64data[3]];
-
-                if (*bytes_written < outbuf_size) {
-                    *outbuf_ptr++ = (tableval_a << 2) | (tableval_b >> 4);
-                    (*bytes_written)++;
-                }
 
-                if ((base64data[2] != '=') && (*bytes_written < outbuf_size)) {
-                    *outbuf_ptr++ = (tableval_b << 4) | (tableval_c >> 2);
-                    (*bytes_written)++;
-                } else {
-                    break;
-                }
+    /* Decode in chunks so that we never write past outbuf, and stop as soon as it is full */
+    while (inbuf_size && !state.done && *bytes_written < outbuf_size) {
+        n = MIN(inbuf_size, SF_BASE64_CHUNK);
 
-                if ((base64data[3] != '=') && (*bytes_written < outbuf_size)) {
-                    *outbuf_ptr++ = (tableval_c << 6) | tableval_d;
-                    (*bytes_written)++;
-                } else {
-                    break;
-                }
+        len = cli_base64_decode(&state, inbuf, n, decoded);
+        len = MIN(len, outbuf_size - *bytes_written);
+        memcpy(outbuf + *bytes_written, decoded, len);
+        *bytes_written += len;
 
-                /* Reset our decode pointer for the next group of four */
-                base64data_ptr = base64data;
-            }
-        }
-        cursor++;
+        inbuf += n;
+        inbuf_size -= n;
     }
 
-    if (error)
+    if (state.invalid)
         return (-1);
     else
         return (0);
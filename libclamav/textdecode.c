@@ -0,0 +1,594 @@
+/*
+ *  Copyright (C) 2025 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#if HAVE_CONFIG_H
+#include "clamav-config.h"
+#endif
+
+#include <string.h>
+#include <ctype.h>
+
+#include "textdecode.h"
+
+/*
+ * The SIMD paths are built with per-function target attributes and picked at
+ * run time, so the library itself doesn't need to be compiled with -mavx2.
+ */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TEXTDECODE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#define B64_PAD 0xFE
+#define B64_BAD 0xFF
+
+// clang-format off
+static const uint8_t b64tab[256] = {
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,  62,0xFF,0xFF,0xFF,  63,
+      52,  53,  54,  55,  56,  57,  58,  59,  60,  61,0xFF,0xFF,0xFF,0xFE,0xFF,0xFF,
+    0xFF,   0,   1,   2,   3,   4,   5,   6,   7,   8,   9,  10,  11,  12,  13,  14,
+      15,  16,  17,  18,  19,  20,  21,  22,  23,  24,  25,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,  26,  27,  28,  29,  30,  31,  32,  33,  34,  35,  36,  37,  38,  39,  40,
+      41,  42,  43,  44,  45,  46,  47,  48,  49,  50,  51,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF
+};
+// clang-format on
+
+#define HEX_SPACE 0xFE
+#define HEX_END 0xFD
+#define HEX_BAD 0xFF
+
+/* PDF white space is NUL, TAB, LF, FF, CR and SPACE (ISO 32000-1, 7.2.2) */
+// clang-format off
+static const uint8_t hextab[256] = {
+    0xFE,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFE,0xFE,0xFF,0xFE,0xFE,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFE,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+       0,   1,   2,   3,   4,   5,   6,   7,   8,   9,0xFF,0xFF,0xFF,0xFF,0xFD,0xFF,
+    0xFF,  10,  11,  12,  13,  14,  15,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,  10,  11,  12,  13,  14,  15,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF
+};
+// clang-format on
+
+#ifdef TEXTDECODE_X86_SIMD
+
+/*
+ * Translate and pack 16 (32) base64 characters into 12 (24) bytes at a time.
+ * The classification uses the nibble lookup tables described in
+ * "Faster Base64 Encoding and Decoding using AVX2 Instructions"
+ * (Muła, Lemire, 2018): a character is valid when the bitmasks looked up by
+ * its low and high nibbles don't intersect.
+ * Both functions stop at the first block that contains anything but the 64
+ * alphabet characters, and leave it to the scalar code.
+ * They store a whole vector, so they only run while at least twice the
+ * vector width of input remains, which guarantees the output has room.
+ */
+__attribute__((target("sse4.1"))) static void base64_decode_sse41(const uint8_t **in, const uint8_t *end, uint8_t **out)
+{
+    const uint8_t *ip = *in;
+    uint8_t *op       = *out;
+
+    const __m128i lut_lo   = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                           0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m128i lut_hi   = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                           0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+                                           0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i mask_2f  = _mm_set1_epi8(0x2F);
+    const __m128i pack     = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+
+    while (end - ip >= 32) {
+        __m128i str = _mm_loadu_si128((const __m128i *)ip);
+        __m128i hi_nibbles, lo_nibbles, hi, lo, roll;
+
+        hi_nibbles = _mm_and_si128(_mm_srli_epi32(str, 4), mask_2f);
+        lo_nibbles = _mm_and_si128(str, mask_2f);
+        hi         = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+        lo         = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+        if (!_mm_testz_si128(lo, hi))
+            break;
+
+        roll = _mm_shuffle_epi8(lut_roll, _mm_add_epi8(_mm_cmpeq_epi8(str, mask_2f), hi_nibbles));
+        str  = _mm_add_epi8(str, roll);
+
+        str = _mm_maddubs_epi16(str, _mm_set1_epi32(0x01400140));
+        str = _mm_madd_epi16(str, _mm_set1_epi32(0x00011000));
+        str = _mm_shuffle_epi8(str, pack);
+        _mm_storeu_si128((__m128i *)op, str);
+
+        ip += 16;
+        op += 12;
+    }
+
+    *in  = ip;
+    *out = op;
+}
+
+__attribute__((target("avx2"))) static void base64_decode_avx2(const uint8_t **in, const uint8_t *end, uint8_t **out)
+{
+    const uint8_t *ip = *in;
+    uint8_t *op       = *out;
+
+    const __m256i lut_lo   = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                              0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+                                              0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                              0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m256i lut_hi   = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                              0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+                                              0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                              0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m256i lut_roll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+                                              0, 0, 0, 0, 0, 0, 0, 0,
+                                              0, 16, 19, 4, -65, -65, -71, -71,
+                                              0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i mask_2f  = _mm256_set1_epi8(0x2F);
+    const __m256i pack     = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                              2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    const __m256i lanes    = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, -1, -1);
+
+    while (end - ip >= 64) {
+        __m256i str = _mm256_loadu_si256((const __m256i *)ip);
+        __m256i hi_nibbles, lo_nibbles, hi, lo, roll;
+
+        hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(str, 4), mask_2f);
+        lo_nibbles = _mm256_and_si256(str, mask_2f);
+        hi         = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+        lo         = _mm256_shuffle_epi8(lut_lo, lo_nibbles);
+        if (!_mm256_testz_si256(lo, hi))
+            break;
+
+        roll = _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(_mm256_cmpeq_epi8(str, mask_2f), hi_nibbles));
+        str  = _mm256_add_epi8(str, roll);
+
+        str = _mm256_maddubs_epi16(str, _mm256_set1_epi32(0x01400140));
+        str = _mm256_madd_epi16(str, _mm256_set1_epi32(0x00011000));
+        str = _mm256_shuffle_epi8(str, pack);
+        str = _mm256_permutevar8x32_epi32(str, lanes);
+        _mm256_storeu_si256((__m256i *)op, str);
+
+        ip += 32;
+        op += 24;
+    }
+
+    *in  = ip;
+    *out = op;
+}
+
+/*
+ * 16 hex digits to 8 bytes at a time, stops at the first block with anything
+ * else in it (typically white space) and leaves it to the scalar code.
+ */
+__attribute__((target("sse4.1"))) static void hex_decode_sse41(const uint8_t **in, const uint8_t *end, uint8_t **out)
+{
+    const uint8_t *ip = *in;
+    uint8_t *op       = *out;
+
+    while (end - ip >= 16) {
+        __m128i str = _mm_loadu_si128((const __m128i *)ip);
+        __m128i lc  = _mm_or_si128(str, _mm_set1_epi8(0x20));
+        __m128i digit, alpha, nibbles;
+
+        digit = _mm_and_si128(_mm_cmpgt_epi8(str, _mm_set1_epi8('0' - 1)),
+                              _mm_cmplt_epi8(str, _mm_set1_epi8('9' + 1)));
+        alpha = _mm_and_si128(_mm_cmpgt_epi8(lc, _mm_set1_epi8('a' - 1)),
+                              _mm_cmplt_epi8(lc, _mm_set1_epi8('f' + 1)));
+        if (_mm_movemask_epi8(_mm_or_si128(digit, alpha)) != 0xFFFF)
+            break;
+
+        nibbles = _mm_blendv_epi8(_mm_sub_epi8(lc, _mm_set1_epi8('a' - 10)),
+                                  _mm_sub_epi8(str, _mm_set1_epi8('0')), digit);
+        /* high nibble * 16 + low nibble, then narrow the words to bytes */
+        nibbles = _mm_maddubs_epi16(nibbles, _mm_set1_epi16(0x0110));
+        _mm_storel_epi64((__m128i *)op, _mm_packus_epi16(nibbles, nibbles));
+
+        ip += 16;
+        op += 8;
+    }
+
+    *in  = ip;
+    *out = op;
+}
+
+#endif /* TEXTDECODE_X86_SIMD */
+
+void cli_base64_init(struct cli_base64_state *state)
+{
+    memset(state, 0, sizeof(*state));
+}
+
+/* '=' seen: flush what we've got and ignore the rest */
+static size_t base64_pad(struct cli_base64_state *state, uint8_t *out)
+{
+    size_t ret = 0;
+
+    switch (state->nchars) {
+        case 3:
+            out[0] = (uint8_t)(state->quantum >> 10);
+            out[1] = (uint8_t)(state->quantum >> 2);
+            ret    = 2;
+            break;
+        case 2:
+            out[0] = (uint8_t)(state->quantum >> 4);
+            ret    = 1;
+            break;
+        default:
+            state->invalid = true;
+            break;
+    }
+
+    state->quantum = 0;
+    state->nchars  = 0;
+    state->done    = true;
+
+    return ret;
+}
+
+size_t cli_base64_decode(struct cli_base64_state *state, const uint8_t *in, size_t len, uint8_t *out)
+{
+    const uint8_t *end = in + len;
+    uint8_t *op        = out;
+
+    if (state->done)
+        return 0;
+
+    while (in < end) {
+        uint8_t v;
+
+        if (state->nchars == 0) {
+#ifdef TEXTDECODE_X86_SIMD
+            if (end - in >= 64 && __builtin_cpu_supports("avx2"))
+                base64_decode_avx2(&in, end, &op);
+            if (end - in >= 32 && __builtin_cpu_supports("sse4.1"))
+                base64_decode_sse41(&in, end, &op);
+#endif
+            while (end - in >= 4) {
+                uint8_t a = b64tab[in[0]], b = b64tab[in[1]], c = b64tab[in[2]], d = b64tab[in[3]];
+
+                if ((a | b | c | d) & 0xC0)
+                    break;
+
+                op[0] = (uint8_t)((a << 2) | (b >> 4));
+                op[1] = (uint8_t)((b << 4) | (c >> 2));
+                op[2] = (uint8_t)((c << 6) | d);
+                op += 3;
+                in += 4;
+            }
+            if (in == end)
+                break;
+        }
+
+        v = b64tab[*in++];
+        if (v == B64_BAD)
+            continue;
+        if (v == B64_PAD) {
+            op += base64_pad(state, op);
+            break;
+        }
+
+        state->quantum = (state->quantum << 6) | v;
+        if (++state->nchars == 4) {
+            op[0]          = (uint8_t)(state->quantum >> 16);
+            op[1]          = (uint8_t)(state->quantum >> 8);
+            op[2]          = (uint8_t)state->quantum;
+            op += 3;
+            state->quantum = 0;
+            state->nchars  = 0;
+        }
+    }
+
+    return (size_t)(op - out);
+}
+
+size_t cli_base64_finish(struct cli_base64_state *state, uint8_t *out)
+{
+    size_t ret = 0;
+
+    if (!state->done && state->nchars >= 2)
+        ret = base64_pad(state, out);
+
+    state->quantum = 0;
+    state->nchars  = 0;
+    state->done    = true;
+
+    return ret;
+}
+
+void cli_hex_init(struct cli_hex_state *state)
+{
+    memset(state, 0, sizeof(*state));
+}
+
+cl_error_t cli_hex_decode(struct cli_hex_state *state, const uint8_t *in, size_t len, uint8_t *out, size_t *outlen, size_t *inused)
+{
+    const uint8_t *start = in, *end = in + len;
+    uint8_t *op          = out;
+    cl_error_t ret       = CL_SUCCESS;
+
+    if (state->done) {
+        *outlen = 0;
+        *inused = 0;
+        return CL_SUCCESS;
+    }
+
+    while (in < end) {
+        uint8_t v;
+
+        if (!state->pending) {
+#ifdef TEXTDECODE_X86_SIMD
+            if (end - in >= 16 && __builtin_cpu_supports("sse4.1"))
+                hex_decode_sse41(&in, end, &op);
+#endif
+            while (end - in >= 2) {
+                uint8_t hi = hextab[in[0]], lo = hextab[in[1]];
+
+                if ((hi | lo) & 0xF0)
+                    break;
+
+                *op++ = (uint8_t)((hi << 4) | lo);
+                in += 2;
+            }
+            if (in == end)
+                break;
+        }
+
+        v = hextab[*in];
+        if (v == HEX_BAD) {
+            ret = CL_EFORMAT;
+            break;
+        }
+        in++;
+        if (v == HEX_SPACE)
+            continue;
+        if (v == HEX_END) {
+            op += cli_hex_finish(state, op);
+            break;
+        }
+
+        if (state->pending) {
+            *op++          = (uint8_t)((state->nibble << 4) | v);
+            state->pending = false;
+        } else {
+            state->nibble  = v;
+            state->pending = true;
+        }
+    }
+
+    *outlen = (size_t)(op - out);
+    *inused = (size_t)(in - start);
+    return ret;
+}
+
+size_t cli_hex_finish(struct cli_hex_state *state, uint8_t *out)
+{
+    size_t ret = 0;
+
+    if (state->pending) {
+        out[0] = (uint8_t)(state->nibble << 4);
+        ret    = 1;
+    }
+
+    state->pending = false;
+    state->done    = true;
+
+    return ret;
+}
+
+void cli_ascii85_init(struct cli_ascii85_state *state)
+{
+    memset(state, 0, sizeof(*state));
+}
+
+static inline uint8_t *ascii85_put(uint8_t *op, uint32_t v)
+{
+    op[0] = (uint8_t)(v >> 24);
+    op[1] = (uint8_t)(v >> 16);
+    op[2] = (uint8_t)(v >> 8);
+    op[3] = (uint8_t)v;
+    return op + 4;
+}
+
+/* "~>" seen: the final partial group is padded with 'u' */
+static cl_error_t ascii85_end(struct cli_ascii85_state *state, uint8_t **op)
+{
+    unsigned int i;
+
+    state->done = true;
+    if (state->quintet == 0)
+        return CL_SUCCESS;
+
+    if (state->quintet == 1)
+        return CL_EFORMAT;
+
+    for (i = state->quintet; i < 5; i++)
+        state->sum = state->sum * 85 + ('u' - '!');
+
+    for (i = 0; i < state->quintet - 1; i++)
+        *(*op)++ = (uint8_t)(state->sum >> (24 - 8 * i));
+
+    state->sum     = 0;
+    state->quintet = 0;
+    return CL_SUCCESS;
+}
+
+cl_error_t cli_ascii85_decode(struct cli_ascii85_state *state, const uint8_t *in, size_t len, uint8_t *out, size_t *outlen, size_t *inused)
+{
+    const uint8_t *start = in, *end = in + len;
+    uint8_t *op          = out;
+    cl_error_t ret       = CL_SUCCESS;
+
+    if (state->done) {
+        *outlen = 0;
+        *inused = 0;
+        return CL_SUCCESS;
+    }
+
+    if (state->tilde && in < end) {
+        state->tilde = false;
+        if (*in != '>') {
+            ret = CL_EFORMAT;
+            goto done;
+        }
+        in++;
+        ret = ascii85_end(state, &op);
+        goto done;
+    }
+
+    while (in < end) {
+        uint8_t c;
+
+        /* whole groups, the common case */
+        while (state->quintet == 0 && end - in >= 5 &&
+               (uint8_t)(in[0] - '!') < 85 && (uint8_t)(in[1] - '!') < 85 &&
+               (uint8_t)(in[2] - '!') < 85 && (uint8_t)(in[3] - '!') < 85 &&
+               (uint8_t)(in[4] - '!') < 85) {
+            uint64_t sum = (uint64_t)(in[0] - '!') * (85 * 85 * 85 * 85) +
+                           (uint64_t)(in[1] - '!') * (85 * 85 * 85) +
+                           (uint64_t)(in[2] - '!') * (85 * 85) +
+                           (uint64_t)(in[3] - '!') * 85 +
+                           (uint64_t)(in[4] - '!');
+
+            op = ascii85_put(op, (uint32_t)sum);
+            in += 5;
+        }
+        if (in == end)
+            break;
+
+        c = *in;
+        if (c >= '!' && c <= 'u') {
+            state->sum = state->sum * 85 + (c - '!');
+            if (++state->quintet == 5) {
+                op             = ascii85_put(op, (uint32_t)state->sum);
+                state->sum     = 0;
+                state->quintet = 0;
+            }
+        } else if (c == 'z') {
+            if (state->quintet) {
+                ret = CL_EFORMAT;
+                break;
+            }
+            op = ascii85_put(op, 0);
+        } else if (c == '~') {
+            if (in + 1 == end) {
+                /* the '>' may be in the next piece */
+                state->tilde = true;
+                in++;
+                break;
+            }
+            if (in[1] != '>') {
+                ret = CL_EFORMAT;
+                break;
+            }
+            in += 2;
+            ret = ascii85_end(state, &op);
+            break;
+        } else if (!isspace(c)) {
+            ret = CL_EFORMAT;
+            break;
+        }
+        in++;
+    }
+
+done:
+    *outlen = (size_t)(op - out);
+    *inused = (size_t)(in - start);
+    return ret;
+}
+
+/*
+ * Some mails (notably some spam) break RFC2045 by failing to encode
+ * the '=' character, so an invalid digit decodes as '='
+ */
+static inline uint8_t qp_hex(char c)
+{
+    uint8_t v = hextab[(uint8_t)c];
+
+    return (v < 16) ? v : '=';
+}
+
+size_t cli_qp_decode_line(const char *line, size_t len, uint8_t *out, size_t outlen, bool *softbreak)
+{
+    const char *end = line + len;
+    uint8_t *op = out, *oend = out + outlen;
+
+    *softbreak = false;
+
+    while (line < end && op < oend) {
+        uint8_t byte;
+
+        if (*line != '=') {
+            /* copy the run of literal characters in one go */
+            const char *eq = memchr(line, '=', (size_t)(end - line));
+            size_t n       = (size_t)((eq ? eq : end) - line);
+
+            if (n > (size_t)(oend - op))
+                n = (size_t)(oend - op);
+            memcpy(op, line, n);
+            op += n;
+            line += n;
+            continue;
+        }
+
+        if ((++line == end) || (*line == '\n')) {
+            /* soft line break */
+            *softbreak = true;
+            break;
+        }
+
+        byte = qp_hex(*line);
+
+        if ((++line == end) || (*line == '\n')) {
+            /* broken e-mail, not adhering to RFC2045 */
+            *op++ = byte;
+            break;
+        }
+
+        /*
+         * Handle messages that use a broken quoted-printable encoding of
+         * href=\"http://, instead of =3D
+         */
+        if (byte != '=') {
+            byte = (uint8_t)((byte << 4) | qp_hex(*line));
+            line++;
+        } else {
+            line--;
+        }
+
+        *op++ = byte;
+    }
+
+    return (size_t)(op - out);
+}
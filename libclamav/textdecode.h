@@ -0,0 +1,161 @@
+/*
+ *  Copyright (C) 2025 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+/*
+ * Decoders for the text transfer encodings used by mail and PDF:
+ * base64, ASCII hex, ASCII85 and quoted-printable.
+ *
+ * The base64, hex and ASCII85 decoders are incremental: the caller keeps a
+ * small state object and may feed the input in arbitrary pieces (e.g. one
+ * line at a time), a quantum split across two calls is carried over.
+ * Where the CPU supports it, base64 runs of clean input are decoded with
+ * SSE4.1 or AVX2, everything else goes through the scalar code.
+ */
+
+#ifndef __TEXTDECODE_H
+#define __TEXTDECODE_H
+
+#if HAVE_CONFIG_H
+#include "clamav-config.h"
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "clamav.h"
+#include "clamav-types.h"
+
+struct cli_base64_state {
+    uint32_t quantum;    /* sextets of the current quantum, oldest first */
+    unsigned int nchars; /* number of sextets in quantum (0-3) */
+    bool done;           /* '=' padding seen, the rest of the input is ignored */
+    bool invalid;        /* padding where there can't be any, e.g. "A===" */
+};
+
+struct cli_hex_state {
+    uint8_t nibble; /* pending high nibble */
+    bool pending;   /* nibble is valid */
+    bool done;      /* '>' end-of-data marker seen */
+};
+
+struct cli_ascii85_state {
+    uint64_t sum;
+    unsigned int quintet; /* number of digits in sum (0-4) */
+    bool tilde;           /* the last character was the '~' of "~>" */
+    bool done;            /* "~>" end-of-data marker seen */
+};
+
+/**
+ * @brief Reset a base64 decoding state.
+ */
+void cli_base64_init(struct cli_base64_state *state);
+
+/**
+ * @brief Decode a piece of base64 text.
+ *
+ * Characters outside of the base64 alphabet (e.g. line breaks) are skipped.
+ * Padding ends the data, any input after it is ignored.
+ *
+ * @param state     Decoding state, carried between calls.
+ * @param in        Encoded input.
+ * @param len       Length of in.
+ * @param[out] out  Output buffer, must have room for (len + 3) / 4 * 3 bytes.
+ * @return size_t   The number of bytes written to out.
+ */
+size_t cli_base64_decode(struct cli_base64_state *state, const uint8_t *in, size_t len, uint8_t *out);
+
+/**
+ * @brief Flush the trailing partial quantum of unpadded base64 input.
+ *
+ * @param state     Decoding state.
+ * @param[out] out  Output buffer, must have room for 2 bytes.
+ * @return size_t   The number of bytes written to out.
+ */
+size_t cli_base64_finish(struct cli_base64_state *state, uint8_t *out);
+
+/**
+ * @brief Reset an ASCII hex decoding state.
+ */
+void cli_hex_init(struct cli_hex_state *state);
+
+/**
+ * @brief Decode a piece of ASCII hex text, as in the PDF/PostScript ASCIIHexDecode filter.
+ *
+ * White space is skipped and '>' ends the data.
+ *
+ * @param state         Decoding state, carried between calls.
+ * @param in            Encoded input.
+ * @param len           Length of in.
+ * @param[out] out      Output buffer, must have room for len / 2 + 1 bytes.
+ * @param[out] outlen   The number of bytes written to out.
+ * @param[out] inused   The number of input bytes consumed, on error the offset of the offending character.
+ * @return cl_error_t   CL_SUCCESS, or CL_EFORMAT if a character other than a hex digit, white space or '>' was found.
+ */
+cl_error_t cli_hex_decode(struct cli_hex_state *state, const uint8_t *in, size_t len, uint8_t *out, size_t *outlen, size_t *inused);
+
+/**
+ * @brief Flush a trailing odd hex digit, which is treated as if followed by a 0.
+ *
+ * @param state     Decoding state.
+ * @param[out] out  Output buffer, must have room for 1 byte.
+ * @return size_t   The number of bytes written to out.
+ */
+size_t cli_hex_finish(struct cli_hex_state *state, uint8_t *out);
+
+/**
+ * @brief Reset an ASCII85 decoding state.
+ */
+void cli_ascii85_init(struct cli_ascii85_state *state);
+
+/**
+ * @brief Decode a piece of ASCII85 text, as in the PDF/PostScript ASCII85Decode filter.
+ *
+ * White space is skipped and "~>" ends the data, at which point the final
+ * partial group is padded with 'u' and flushed. Without the "~>" marker the
+ * final partial group is left in the state.
+ * If the piece ends in a '~' it is remembered in the state, as the '>' may
+ * be in the next one.
+ *
+ * @param state         Decoding state, carried between calls.
+ * @param in            Encoded input.
+ * @param len           Length of in.
+ * @param[out] out      Output buffer, must have room for 4 * len bytes.
+ * @param[out] outlen   The number of bytes written to out.
+ * @param[out] inused   The number of input bytes consumed, on error the offset of the offending character.
+ * @return cl_error_t   CL_SUCCESS, or CL_EFORMAT for an invalid character, a misplaced 'z' or a one digit final group.
+ */
+cl_error_t cli_ascii85_decode(struct cli_ascii85_state *state, const uint8_t *in, size_t len, uint8_t *out, size_t *outlen, size_t *inused);
+
+/**
+ * @brief Decode one line of quoted-printable text (without its line terminator).
+ *
+ * Quoted-printable is line oriented, the only state carried from one line to
+ * the next is whether it ended in a soft line break.
+ * Broken encoders that leave a literal '=' unencoded (e.g. href="...") are
+ * tolerated by passing the '=' through.
+ *
+ * @param line              Encoded line.
+ * @param len               Length of line.
+ * @param[out] out          Output buffer.
+ * @param outlen            Size of out, decoding stops when it is full.
+ * @param[out] softbreak    Set if the line ended with a soft line break.
+ * @return size_t           The number of bytes written to out.
+ */
+size_t cli_qp_decode_line(const char *line, size_t len, uint8_t *out, size_t outlen, bool *softbreak);
+
+#endif
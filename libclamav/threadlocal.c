@@ -0,0 +1,215 @@
+/*
+ *  Copyright (C) 2025 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#if HAVE_CONFIG_H
+#include "clamav-config.h"
+#endif
+
+#include <stdlib.h>
+
+#ifdef CL_THREAD_SAFE
+#include <pthread.h>
+#endif
+
+#include "threadlocal.h"
+
+/*
+ * Each block is on two lists: the blocks of its thread, reached through a
+ * single process-wide pthread key, and the blocks of its owner.
+ * The thread list is only ever modified by the thread itself (or its key
+ * destructor), so cli_threadlocal_get() can walk it without the lock.
+ * cli_threadlocal_free() releases the blocks of the owner and marks them
+ * with an id of 0 but leaves them on their threads' lists, each thread drops
+ * its released blocks the next time it takes the lock.
+ * Owners are told apart by an id rather than their address, which may be
+ * reused once freed.
+ */
+struct tl_block {
+    struct tl_block *thread_next;   /* next block of the same thread */
+    struct tl_block *owner_next;    /* next block of the same owner */
+    struct tl_block **owner_prev;   /* link to this block on the owner's list */
+    struct cli_threadlocal *owner;  /* only valid while id is set */
+    unsigned long id;               /* id of the owner, 0 once released */
+};
+
+struct cli_threadlocal {
+    unsigned long id;
+    size_t size;
+    cli_threadlocal_release_fn release;
+    struct tl_block *blocks; /* the blocks of all threads */
+};
+
+/* keep the data of the blocks aligned as malloc() would */
+#define TL_HEADER_SIZE ((sizeof(struct tl_block) + 15) & ~(size_t)15)
+#define TL_DATA(b) ((void *)((char *)(b) + TL_HEADER_SIZE))
+
+/* the id of a block is cleared by cli_threadlocal_free() while its thread may be reading it */
+#if defined(__GNUC__) || defined(__clang__)
+#define TL_ID_LOAD(b) __atomic_load_n(&(b)->id, __ATOMIC_RELAXED)
+#define TL_ID_STORE(b, v) __atomic_store_n(&(b)->id, (v), __ATOMIC_RELAXED)
+#else
+#define TL_ID_LOAD(b) (*(volatile unsigned long *)&(b)->id)
+#define TL_ID_STORE(b, v) (*(volatile unsigned long *)&(b)->id = (v))
+#endif
+
+static unsigned long tl_next_id = 1;
+
+#ifdef CL_THREAD_SAFE
+static pthread_mutex_t tl_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t tl_key;
+static pthread_once_t tl_key_once = PTHREAD_ONCE_INIT;
+static int tl_key_ok              = 0;
+
+#define TL_LOCK() pthread_mutex_lock(&tl_mutex)
+#define TL_UNLOCK() pthread_mutex_unlock(&tl_mutex)
+#define TL_THREAD_BLOCKS() ((struct tl_block *)pthread_getspecific(tl_key))
+#define TL_SET_THREAD_BLOCKS(b) pthread_setspecific(tl_key, (b))
+#else
+static struct tl_block *tl_thread_blocks = NULL;
+
+#define TL_LOCK()
+#define TL_UNLOCK()
+#define TL_THREAD_BLOCKS() tl_thread_blocks
+#define TL_SET_THREAD_BLOCKS(b) (tl_thread_blocks = (b), 0)
+#endif
+
+/* drop the released blocks from the list of the calling thread, called with the lock held */
+static struct tl_block *tl_prune(struct tl_block *head)
+{
+    struct tl_block **bp = &head, *b;
+
+    while ((b = *bp)) {
+        if (!b->id) {
+            *bp = b->thread_next;
+            free(b);
+        } else {
+            bp = &b->thread_next;
+        }
+    }
+
+    return head;
+}
+
+#ifdef CL_THREAD_SAFE
+static void tl_unlink(struct tl_block *b)
+{
+    if (b->owner_next)
+        b->owner_next->owner_prev = b->owner_prev;
+    *b->owner_prev = b->owner_next;
+}
+
+/* thread exit: release the blocks of the owners that are still around */
+static void tl_thread_exit(void *ptr)
+{
+    struct tl_block *b = ptr, *next;
+
+    TL_LOCK();
+    for (; b; b = next) {
+        next = b->thread_next;
+        if (b->id) {
+            if (b->owner->release)
+                b->owner->release(TL_DATA(b));
+            tl_unlink(b);
+        }
+        free(b);
+    }
+    TL_UNLOCK();
+}
+
+static void tl_key_alloc(void)
+{
+    tl_key_ok = !pthread_key_create(&tl_key, tl_thread_exit);
+}
+#endif
+
+cli_threadlocal_t *cli_threadlocal_new(size_t size, cli_threadlocal_release_fn release)
+{
+    cli_threadlocal_t *tl;
+
+#ifdef CL_THREAD_SAFE
+    pthread_once(&tl_key_once, tl_key_alloc);
+    if (!tl_key_ok)
+        return NULL;
+#endif
+
+    tl = calloc(1, sizeof(*tl));
+    if (!tl)
+        return NULL;
+    tl->size    = size;
+    tl->release = release;
+
+    TL_LOCK();
+    tl->id = tl_next_id++;
+    TL_UNLOCK();
+
+    return tl;
+}
+
+void *cli_threadlocal_get(cli_threadlocal_t *tl)
+{
+    struct tl_block *b, *head;
+
+    for (b = TL_THREAD_BLOCKS(); b; b = b->thread_next) {
+        if (TL_ID_LOAD(b) == tl->id)
+            return TL_DATA(b);
+    }
+
+    /* first use by this thread */
+    b = calloc(1, TL_HEADER_SIZE + tl->size);
+    if (!b)
+        return NULL;
+
+    TL_LOCK();
+    head           = tl_prune(TL_THREAD_BLOCKS());
+    b->id          = tl->id;
+    b->owner       = tl;
+    b->thread_next = head;
+    if (TL_SET_THREAD_BLOCKS(b)) {
+        (void)TL_SET_THREAD_BLOCKS(head);
+        TL_UNLOCK();
+        free(b);
+        return NULL;
+    }
+    b->owner_next = tl->blocks;
+    b->owner_prev = &tl->blocks;
+    if (tl->blocks)
+        tl->blocks->owner_prev = &b->owner_next;
+    tl->blocks = b;
+    TL_UNLOCK();
+
+    return TL_DATA(b);
+}
+
+void cli_threadlocal_free(cli_threadlocal_t *tl)
+{
+    struct tl_block *b;
+
+    if (!tl)
+        return;
+
+    TL_LOCK();
+    for (b = tl->blocks; b; b = b->owner_next) {
+        if (tl->release)
+            tl->release(TL_DATA(b));
+        TL_ID_STORE(b, 0);
+    }
+    (void)TL_SET_THREAD_BLOCKS(tl_prune(TL_THREAD_BLOCKS()));
+    TL_UNLOCK();
+
+    free(tl);
+}
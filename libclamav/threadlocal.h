@@ -0,0 +1,80 @@
+/*
+ *  Copyright (C) 2025 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+/*
+ * Per-thread data owned by an engine object (e.g. a matcher root), for
+ * caches that the scanning threads use without locking.
+ *
+ * Each thread gets its own zero-initialised block of data the first time it
+ * calls cli_threadlocal_get(). The block lives until either the thread exits
+ * or the owner calls cli_threadlocal_free(), whichever comes first; the
+ * release callback is then run on it exactly once. Unlike a plain pthread
+ * key, freeing the owner releases the data of every thread, including the
+ * ones still running and the main thread, whose key destructors never run.
+ *
+ * Only the first use by a thread, thread exit and cli_threadlocal_free()
+ * take a (process-wide) lock, cli_threadlocal_get() is otherwise a short
+ * walk over the blocks of the calling thread.
+ */
+
+#ifndef __THREADLOCAL_H
+#define __THREADLOCAL_H
+
+#if HAVE_CONFIG_H
+#include "clamav-config.h"
+#endif
+
+#include <stddef.h>
+
+typedef struct cli_threadlocal cli_threadlocal_t;
+
+/**
+ * @brief Release what a per-thread block refers to (not the block itself).
+ *
+ * Called with the process-wide lock held, it must not call back into the
+ * functions of this module.
+ */
+typedef void (*cli_threadlocal_release_fn)(void *data);
+
+/**
+ * @brief Create per-thread data.
+ *
+ * @param size      Size of the block of each thread.
+ * @param release   Called on each block when it goes away, may be NULL.
+ * @return cli_threadlocal_t* The new object, or NULL if out of memory.
+ */
+cli_threadlocal_t *cli_threadlocal_new(size_t size, cli_threadlocal_release_fn release);
+
+/**
+ * @brief Get the block of the calling thread, allocating it on first use.
+ *
+ * @param tl        The per-thread data.
+ * @return void*    The block, or NULL if out of memory.
+ */
+void *cli_threadlocal_get(cli_threadlocal_t *tl);
+
+/**
+ * @brief Release the blocks of all threads and free the object.
+ *
+ * No thread may use the object any more, but threads may exit concurrently.
+ *
+ * @param tl        The per-thread data, may be NULL.
+ */
+void cli_threadlocal_free(cli_threadlocal_t *tl);
+
+#endif
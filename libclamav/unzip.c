@@ -50,6 +50,7 @@
 #include "fmap.h"
 #include "json_api.h"
 #include "str.h"
+#include "scanpool.h"
 
 #define UNZIP_PRIVATE
 #include "unzip.h"
@@ -367,6 +368,87 @@ static cl_error_t unz(
     return ret;
 }
 
+/*
+ * A member decompressed and scanned on the scan pool. The compressed data is
+ * copied, as the fmap of the archive belongs to the scanning thread.
+ */
+struct zip_member {
+    uint8_t *data;
+    uint32_t csize;
+    uint32_t usize;
+    uint16_t method;
+    uint16_t flags;
+    char *original_filename;
+    unsigned int num_files_unzipped;
+    unsigned int *total_files_unzipped; /* the archive's counter, updated when the member is done */
+};
+
+static struct zip_member *zip_member_new(cli_scan_queue_t *queue, cli_ctx *ctx, const uint8_t *compressed_data, const struct zip_record *record, unsigned int *num_files_unzipped)
+{
+    struct zip_member *member = NULL;
+
+    if ((NULL == queue) || record->encrypted || (0 == record->compressed_size) ||
+        (NULL == fmap_need_ptr_once(ctx->fmap, compressed_data, record->compressed_size))) {
+        return NULL;
+    }
+
+    /*
+     * Don't copy more than the limits allow to be scanned. The same bounds as
+     * cli_checklimits(), but without its heuristic alerts: the serial path
+     * takes a member that is too big and only scans what the limits allow,
+     * while inflating it.
+     */
+    if (NULL != ctx->limits) {
+        cli_scan_limits_sync(ctx);
+    }
+    if ((ctx->engine->maxfilesize && (record->compressed_size > ctx->engine->maxfilesize)) ||
+        (ctx->engine->maxscansize && (ctx->engine->maxscansize - ctx->scansize < record->compressed_size))) {
+        return NULL;
+    }
+
+    member = cli_max_calloc(1, sizeof(*member));
+    if (NULL == member) {
+        return NULL;
+    }
+
+    member->data = cli_max_malloc(record->compressed_size);
+    if (NULL == member->data) {
+        free(member);
+        return NULL;
+    }
+    memcpy(member->data, compressed_data, record->compressed_size);
+
+    if (NULL != record->original_filename) {
+        member->original_filename = cli_safer_strdup(record->original_filename);
+    }
+    member->csize                = record->compressed_size;
+    member->usize                = record->uncompressed_size;
+    member->method               = record->method;
+    member->flags                = record->flags;
+    member->total_files_unzipped = num_files_unzipped;
+
+    return member;
+}
+
+static void zip_member_free(void *arg)
+{
+    struct zip_member *member = (struct zip_member *)arg;
+
+    *member->total_files_unzipped += member->num_files_unzipped;
+
+    free(member->original_filename);
+    free(member->data);
+    free(member);
+}
+
+static cl_error_t zip_member_unz(cli_ctx *ctx, void *arg)
+{
+    struct zip_member *member = (struct zip_member *)arg;
+
+    return unz(member->data, member->csize, member->usize, member->method, member->flags,
+               &member->num_files_unzipped, ctx, NULL, zip_scan_cb, member->original_filename, false);
+}
+
 /* zip update keys, taken from zip specification */
 static inline void zupdatekey(uint32_t key[3], unsigned char input)
 {
@@ -1179,6 +1261,8 @@ cl_error_t cli_unzip(cli_ctx *ctx)
     struct zip_record *zip_catalogue = NULL;
     size_t records_count             = 0;
     size_t i;
+    cli_scan_queue_t *queue = NULL;
+    bool queue_failed       = false;
 
     cli_dbgmsg("in cli_unzip\n");
     fsize = (uint32_t)map->len;
@@ -1223,9 +1307,16 @@ cl_error_t cli_unzip(cli_ctx *ctx)
 
         /*
          * Then decrypt/unzip & scan each unique file entry.
+         * If enabled, the entries are unzipped & scanned on the scan pool, several at a time.
          */
+        ret = cli_scan_queue_new(ctx, &queue);
+        if (CL_SUCCESS != ret) {
+            goto done;
+        }
+
         for (i = 0; i < records_count; i++) {
             const uint8_t *compressed_data = NULL;
+            struct zip_member *member      = NULL;
 
             if ((i > 0) &&
                 (zip_catalogue[i].local_header_offset == zip_catalogue[i - 1].local_header_offset) &&
@@ -1239,7 +1330,18 @@ cl_error_t cli_unzip(cli_ctx *ctx)
 
             compressed_data = fmap_need_off(map, zip_catalogue[i].local_header_offset + zip_catalogue[i].local_header_size, SIZEOF_LOCAL_HEADER);
 
-            if (zip_catalogue[i].encrypted) {
+            if (NULL != (member = zip_member_new(queue, ctx, compressed_data, &zip_catalogue[i], &num_files_unzipped))) {
+                ret = cli_scan_queue_call(queue, zip_member_unz, member, zip_member_free);
+                if (CL_SUCCESS != ret) {
+                    // An earlier entry alerted, or exceeded a limit.
+                    queue_failed = true;
+                    break;
+                }
+            } else if (CL_SUCCESS != (ret = cli_scan_queue_wait(queue))) {
+                // The entries in flight are scanned first, to keep the order.
+                queue_failed = true;
+                break;
+            } else if (zip_catalogue[i].encrypted) {
                 if (fmap_need_ptr_once(map, compressed_data, zip_catalogue[i].compressed_size))
                     ret = zdecrypt(
                         compressed_data,
@@ -1282,8 +1384,9 @@ cl_error_t cli_unzip(cli_ctx *ctx)
 
             if (cli_checktimelimit(ctx) != CL_SUCCESS) {
                 cli_dbgmsg("cli_unzip: Time limit reached (max: %u)\n", ctx->engine->maxscantime);
+                // Not straight to done, the alerts of the entries in flight are collected below.
                 ret = CL_ETIMEOUT;
-                goto done;
+                break;
             }
 
             if (cli_json_timeout_cycle_check(ctx, &toval) != CL_SUCCESS) {
@@ -1294,6 +1397,16 @@ cl_error_t cli_unzip(cli_ctx *ctx)
                 break;
             }
         }
+
+        if (!queue_failed) {
+            // The entries still in flight were found before whatever stopped the loop.
+            cl_error_t queue_ret = cli_scan_queue_wait(queue);
+            if (CL_SUCCESS != queue_ret) {
+                ret = queue_ret;
+            }
+        }
+        cli_scan_queue_free(queue);
+        queue = NULL;
     } else {
         cli_dbgmsg("cli_unzip: central not found, using localhdrs\n");
     }
@@ -1343,6 +1456,8 @@ cl_error_t cli_unzip(cli_ctx *ctx)
 
 done:
 
+    cli_scan_queue_free(queue);
+
     if (NULL != zip_catalogue) {
         /* Clean up zip record resources */
         for (i = 0; i < records_count; i++) {
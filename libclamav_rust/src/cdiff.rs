@@ -22,10 +22,10 @@ use std::{
     collections::BTreeMap,
     ffi::{CStr, CString},
     fs::{self, File, OpenOptions},
-    io::{prelude::*, BufReader, BufWriter, Read, Seek, SeekFrom, Write},
+    io::{prelude::*, BufReader, BufWriter, Cursor, Read, Seek, SeekFrom, Write},
     iter::*,
     os::raw::c_char,
-    path::{Path, PathBuf},
+    path::{Component, Path, PathBuf},
     str::{self, FromStr},
 };
 
@@ -43,6 +43,9 @@ const SIG_SIZE: usize = 350;
 /// A sane buffer size for various read operations
 const READ_SIZE: usize = 8192;
 
+/// Output buffer size used when writing back indexed database files
+const WRITE_SIZE: usize = 1024 * 1024;
+
 /// Acceptable public key for signing CDiffs. The C API expects these to be
 /// represented as a [large] ASCII-encoded decimal number.
 const PUBLIC_KEY_MODULUS: &str = concat!(
@@ -63,6 +66,19 @@ pub enum ApplyMode {
     Script,
 }
 
+/// How the commands of a cdiff are carried out on the database files
+#[derive(Clone, Copy, Debug, PartialEq)]
+pub enum ApplyStrategy {
+    /// Stream a database file from disk once per OPEN/CLOSE block or MOVE that
+    /// touches it. Uses little memory.
+    Streaming,
+
+    /// Read each database file the cdiff touches into memory once, index its
+    /// lines, carry out every command on the index, and write each changed
+    /// file back once at the end. Nothing is written if any command fails.
+    Indexed,
+}
+
 #[derive(Debug)]
 struct EditNode {
     line_no: usize,
@@ -84,6 +100,36 @@ struct Context {
 
     // Lines to append to the database
     additions: Vec<u8>,
+
+    // Database files held in memory, if applying with ApplyStrategy::Indexed
+    indexed: Option<BTreeMap<PathBuf, IndexedDb>>,
+}
+
+/// Byte range of one line in IndexedDb::data, not including the newline
+#[derive(Clone, Copy, Debug)]
+struct Span {
+    start: usize,
+    end: usize,
+}
+
+/// A database file held in memory by ApplyStrategy::Indexed
+#[derive(Debug, Default)]
+struct IndexedDb {
+    // The original file contents, followed by the bytes of any lines added or
+    // exchanged since. Lines that are deleted are simply no longer indexed.
+    data: Vec<u8>,
+
+    // The current lines of the file, in order
+    lines: Vec<Span>,
+
+    // The last line has no newline
+    unterminated: bool,
+
+    // The file existed on disk when it was loaded
+    on_disk: bool,
+
+    // The file must be written back
+    dirty: bool,
 }
 
 /// Possible errors returned by cdiff_apply() and script2cdiff
@@ -595,6 +641,42 @@ pub extern "C" fn _cdiff_apply(fd: i32, mode: u16) -> i32 {
     }
 }
 
+/// Apply a cdiff (patch) that is already in memory, such as one freshclam has
+/// just downloaded, to the database files in the current directory.
+///
+/// The patch is applied with ApplyStrategy::Indexed.
+///
+/// # Safety
+///
+/// `data` must not be NULL and must point to at least `len` readable bytes.
+#[export_name = "cdiff_apply_buffer"]
+pub unsafe extern "C" fn _cdiff_apply_buffer(data: *const u8, len: usize, mode: u16) -> i32 {
+    debug!(
+        "cdiff_apply_buffer() - called with len={}, mode={}",
+        len, mode
+    );
+
+    if data.is_null() {
+        error!("cdiff_apply_buffer() - data is NULL");
+        return -1;
+    }
+
+    let mode = if mode == 1 {
+        ApplyMode::Cdiff
+    } else {
+        ApplyMode::Script
+    };
+
+    let mut cursor = Cursor::new(std::slice::from_raw_parts(data, len));
+
+    if let Err(e) = cdiff_apply_with(&mut cursor, mode, ApplyStrategy::Indexed) {
+        error!("{}", e);
+        -1
+    } else {
+        0
+    }
+}
+
 /// Apply cdiff (patch) file to all database files described in the cdiff.
 ///
 /// A cdiff file contains a header consisting of a description, version, and
@@ -608,7 +690,25 @@ pub extern "C" fn _cdiff_apply(fd: i32, mode: u16) -> i32 {
 /// A cdiff file contains a footer that is the signed signature of the sha256
 /// file contains of the header and the body. The footer begins after the first
 /// ':' character to the left of EOF.
-pub fn cdiff_apply(file: &mut File, mode: ApplyMode) -> Result<(), Error> {
+///
+/// The cdiff may be read from a file or from memory.
+pub fn cdiff_apply<F>(file: &mut F, mode: ApplyMode) -> Result<(), Error>
+where
+    F: Read + Seek,
+{
+    cdiff_apply_with(file, mode, ApplyStrategy::Streaming)
+}
+
+/// Apply cdiff (patch) file as cdiff_apply() does, choosing how the commands
+/// are carried out on the database files.
+pub fn cdiff_apply_with<F>(
+    file: &mut F,
+    mode: ApplyMode,
+    strategy: ApplyStrategy,
+) -> Result<(), Error>
+where
+    F: Read + Seek,
+{
     let path = std::env::current_dir().unwrap();
     debug!("cdiff_apply() - current directory is {}", path.display());
 
@@ -623,7 +723,7 @@ pub fn cdiff_apply(file: &mut File, mode: ApplyMode) -> Result<(), Error> {
             }
 
             // Get file length
-            let file_len = file.metadata()?.len() as usize;
+            let file_len = file.seek(SeekFrom::End(0))? as usize;
             let footer_offset = file_len - dsig.len() - 1;
 
             // The SHA is calculated from the contents of the beginning of the file
@@ -674,9 +774,21 @@ pub fn cdiff_apply(file: &mut File, mode: ApplyMode) -> Result<(), Error> {
     };
 
     // Create contextual data structure
-    let mut ctx: Context = Context::default();
+    let mut ctx: Context = Context {
+        indexed: match strategy {
+            ApplyStrategy::Streaming => None,
+            ApplyStrategy::Indexed => Some(BTreeMap::new()),
+        },
+        ..Default::default()
+    };
+
+    process_lines(&mut ctx, &mut reader, header_length)?;
 
-    process_lines(&mut ctx, &mut reader, header_length)
+    if let Some(indexed) = &ctx.indexed {
+        write_indexed(indexed)?;
+    }
+
+    Ok(())
 }
 
 /// Set up Context structure with data parsed from command open
@@ -1002,6 +1114,306 @@ fn cmd_unlink(ctx: &mut Context, unlink_op: UnlinkOp) -> Result<(), InputError>
     Ok(())
 }
 
+impl IndexedDb {
+    /// Read a database file and index its lines
+    fn load(path: &Path) -> Result<Self, std::io::Error> {
+        let mut db = IndexedDb {
+            data: fs::read(path)?,
+            on_disk: true,
+            ..Default::default()
+        };
+        db.index_from(0);
+        Ok(db)
+    }
+
+    /// Index the lines found in data[start..]
+    fn index_from(&mut self, mut start: usize) {
+        let len = self.data.len();
+        self.unterminated = false;
+        while start < len {
+            match self.data[start..].iter().position(|b| *b == b'\n') {
+                Some(n) => {
+                    self.lines.push(Span {
+                        start,
+                        end: start + n,
+                    });
+                    start += n + 1;
+                }
+                None => {
+                    self.lines.push(Span { start, end: len });
+                    self.unterminated = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    fn line(&self, span: Span) -> &[u8] {
+        &self.data[span.start..span.end]
+    }
+
+    /// Append raw bytes to the end of the file, as if it were opened for append
+    fn append(&mut self, bytes: &[u8]) {
+        if bytes.is_empty() {
+            return;
+        }
+        let start = self.data.len();
+        if self.unterminated {
+            // The first appended line continues the last one
+            let last = self.lines.pop().unwrap();
+            self.data.extend_from_within(last.start..last.end);
+        }
+        self.data.extend_from_slice(bytes);
+        self.index_from(start);
+        self.dirty = true;
+    }
+
+    /// Carry out the delete and exchange edits of one OPEN/CLOSE block.
+    ///
+    /// Exchanged lines are appended to the data and re-pointed, deleted lines
+    /// are dropped from the index in one pass. Nothing is copied otherwise.
+    fn apply_edits(
+        &mut self,
+        edits: &mut BTreeMap<usize, EditNode>,
+        path: &Path,
+    ) -> Result<(), InputError> {
+        if edits.is_empty() {
+            return Ok(());
+        }
+        if self.unterminated {
+            return Err(InputError::MissingNL);
+        }
+
+        let mut deletions = vec![];
+        for edit in edits.values_mut() {
+            let action = if edit.new_line.is_some() {
+                "exchange"
+            } else {
+                "delete"
+            };
+
+            // cdiff files start at line 1
+            let span = match edit.line_no.checked_sub(1).and_then(|i| self.lines.get(i)) {
+                Some(span) => *span,
+                None => return Err(ProcessingError::NotAllEditProcessed(action).into()),
+            };
+            if !self.line(span).starts_with(&edit.orig_line) {
+                return Err(ProcessingError::PatternDoesNotMatch(
+                    action,
+                    edit.line_no,
+                    path.to_owned(),
+                )
+                .into());
+            }
+
+            match edit.new_line.take() {
+                Some(new_line) => {
+                    let start = self.data.len();
+                    self.data.extend_from_slice(&new_line);
+                    self.lines[edit.line_no - 1] = Span {
+                        start,
+                        end: self.data.len(),
+                    };
+                }
+                None => deletions.push(edit.line_no - 1),
+            }
+        }
+
+        // The edits are ordered, so the deletions are too
+        if let Some(&first) = deletions.first() {
+            let mut deletions = deletions.into_iter().peekable();
+            let mut kept = first;
+            for i in first..self.lines.len() {
+                if deletions.peek() == Some(&i) {
+                    deletions.next();
+                    continue;
+                }
+                self.lines[kept] = self.lines[i];
+                kept += 1;
+            }
+            self.lines.truncate(kept);
+        }
+
+        edits.clear();
+        self.dirty = true;
+
+        Ok(())
+    }
+
+    /// Write the file back by way of a temporary file in the same directory.
+    ///
+    /// Lines that are still adjacent in the data are written in a single run.
+    fn write(&self, path: &Path) -> Result<(), std::io::Error> {
+        let tmp_named_file = tempfile::Builder::new()
+            .prefix("_tmp_move_file")
+            .tempfile_in("./")?;
+
+        {
+            let mut writer = BufWriter::with_capacity(WRITE_SIZE, tmp_named_file.as_file());
+
+            let mut run: Option<Span> = None;
+            for span in &self.lines {
+                run = match run {
+                    Some(r) if r.end + 1 == span.start && self.data[r.end] == b'\n' => Some(Span {
+                        start: r.start,
+                        end: span.end,
+                    }),
+                    Some(r) => {
+                        writer.write_all(self.line(r))?;
+                        writer.write_all(b"\n")?;
+                        Some(*span)
+                    }
+                    None => Some(*span),
+                };
+            }
+            if let Some(r) = run {
+                writer.write_all(self.line(r))?;
+                if !self.unterminated {
+                    writer.write_all(b"\n")?;
+                }
+            }
+
+            writer.flush()?;
+        }
+
+        // Closes the temporary file, which Windows requires before the rename
+        let tmpfile_path = tmp_named_file.into_temp_path();
+        tmpfile_path.persist(path).map_err(|e| e.error)?;
+
+        Ok(())
+    }
+}
+
+/// Key for a database file in the indexed-mode cache, so that "db" and "./db"
+/// are the same file
+fn db_key(path: &Path) -> PathBuf {
+    path.components()
+        .filter(|c| *c != Component::CurDir)
+        .collect()
+}
+
+/// Look up a database file in the indexed-mode cache, reading it in the first
+/// time it is used. If `create` is set, a missing file starts out empty.
+fn indexed_db<'a>(
+    indexed: &'a mut BTreeMap<PathBuf, IndexedDb>,
+    path: &Path,
+    create: bool,
+) -> Result<&'a mut IndexedDb, ProcessingError> {
+    let key = db_key(path);
+    if !indexed.contains_key(&key) {
+        let db = match IndexedDb::load(&key) {
+            Ok(db) => db,
+            Err(e) if create && e.kind() == std::io::ErrorKind::NotFound => IndexedDb::default(),
+            Err(e) => return Err(e.into()),
+        };
+        indexed.insert(key.clone(), db);
+    }
+    Ok(indexed.get_mut(&key).unwrap())
+}
+
+/// Indexed-mode counterpart to cmd_close()
+fn cmd_close_indexed(ctx: &mut Context) -> Result<(), InputError> {
+    let open_db = ctx
+        .open_db
+        .take()
+        .ok_or(InputError::NoDBForAction("CLOSE"))?;
+
+    if ctx.edits.is_empty() && ctx.additions.is_empty() {
+        return Ok(());
+    }
+
+    let indexed = ctx.indexed.as_mut().unwrap();
+    let path = PathBuf::from(open_db);
+
+    // Edits need an existing file, additions alone may create one
+    let db = indexed_db(indexed, &path, ctx.edits.is_empty())?;
+    db.apply_edits(&mut ctx.edits, &path)?;
+    db.append(&ctx.additions);
+    ctx.additions.clear();
+
+    debug!("cmd_close_indexed() - finished");
+
+    Ok(())
+}
+
+/// Indexed-mode counterpart to cmd_move()
+fn cmd_move_indexed(ctx: &mut Context, move_op: MoveOp) -> Result<(), InputError> {
+    // Test for move with open db
+    if let Some(x) = &ctx.open_db {
+        return Err(ProcessingError::NotClosedBeforeAction(x.into()).into());
+    }
+
+    let indexed = ctx.indexed.as_mut().unwrap();
+
+    // dst is only ever appended to, but it must exist
+    indexed_db(indexed, &move_op.dst, false)?;
+
+    let src = indexed_db(indexed, &move_op.src, false)?;
+    let first = move_op.start_line_no;
+    let last = move_op.end_line_no;
+
+    if first == 0 || first > src.lines.len() {
+        return Err(ProcessingError::MoveOpFailed.into());
+    }
+    if !src
+        .line(src.lines[first - 1])
+        .starts_with(move_op.start_line)
+    {
+        return Err(ProcessingError::PatternDoesNotMatch("MOVE", first, move_op.src).into());
+    }
+    // As with cmd_move(), the end line is only looked for after the start line
+    if last <= first || last > src.lines.len() {
+        return Err(ProcessingError::MoveOpFailed.into());
+    }
+    if !src.line(src.lines[last - 1]).starts_with(move_op.end_line) {
+        return Err(ProcessingError::PatternDoesNotMatch("MOVE", last, move_op.src).into());
+    }
+
+    let mut moved = vec![];
+    for span in &src.lines[first - 1..last] {
+        moved.extend_from_slice(src.line(*span));
+        moved.push(b'\n');
+    }
+    if last == src.lines.len() && src.unterminated {
+        moved.pop();
+        src.unterminated = false;
+    }
+    src.lines.drain(first - 1..last);
+    src.dirty = true;
+
+    indexed_db(indexed, &move_op.dst, false)?.append(&moved);
+
+    Ok(())
+}
+
+/// Indexed-mode counterpart to cmd_unlink()
+fn cmd_unlink_indexed(ctx: &mut Context, unlink_op: UnlinkOp) -> Result<(), InputError> {
+    if let Some(open_db) = &ctx.open_db {
+        return Err(InputError::DBStillOpen(open_db.clone()));
+    }
+
+    let indexed = ctx.indexed.as_mut().unwrap();
+    let key = db_key(Path::new(unlink_op.db_name));
+
+    match indexed.remove(&key) {
+        // Only ever existed in memory
+        Some(db) if !db.on_disk => (),
+        _ => fs::remove_file(&key).map_err(ProcessingError::from)?,
+    }
+
+    Ok(())
+}
+
+/// Write back every database file changed in indexed mode
+fn write_indexed(indexed: &BTreeMap<PathBuf, IndexedDb>) -> Result<(), Error> {
+    for (path, db) in indexed.iter().filter(|(_, db)| db.dirty) {
+        db.write(path)
+            .map_err(|e| Error::FileWrite(path.display().to_string(), e))?;
+    }
+
+    Ok(())
+}
+
 /// Handle a specific command line in a cdiff file, calling the appropriate handler function
 fn process_line(ctx: &mut Context, line: &[u8]) -> Result<(), InputError> {
     let mut tokens = line.splitn(2, |b| *b == b' ' || *b == b'\n');
@@ -1023,12 +1435,26 @@ fn process_line(ctx: &mut Context, line: &[u8]) -> Result<(), InputError> {
         }
         b"MOVE" => {
             let move_op = MoveOp::new(remainder.unwrap())?;
-            cmd_move(ctx, move_op)
+            if ctx.indexed.is_some() {
+                cmd_move_indexed(ctx, move_op)
+            } else {
+                cmd_move(ctx, move_op)
+            }
+        }
+        b"CLOSE" => {
+            if ctx.indexed.is_some() {
+                cmd_close_indexed(ctx)
+            } else {
+                cmd_close(ctx)
+            }
         }
-        b"CLOSE" => cmd_close(ctx),
         b"UNLINK" => {
             let unlink_op = UnlinkOp::new(remainder.unwrap())?;
-            cmd_unlink(ctx, unlink_op)
+            if ctx.indexed.is_some() {
+                cmd_unlink_indexed(ctx, unlink_op)
+            } else {
+                cmd_unlink(ctx, unlink_op)
+            }
         }
         _ => Err(InputError::UnknownCommand(
             String::from_utf8_lossy(cmd).to_string(),
@@ -1075,9 +1501,9 @@ where
 }
 
 /// Find the signature at the end of the file, prefixed by ':'
-fn read_dsig(file: &mut File) -> Result<Vec<u8>, SignatureError> {
+fn read_dsig<F: Read + Seek>(file: &mut F) -> Result<Vec<u8>, SignatureError> {
     // Verify file length
-    if file.metadata()?.len() < SIG_SIZE as u64 {
+    if file.seek(SeekFrom::End(0))? < SIG_SIZE as u64 {
         return Err(SignatureError::TooSmall);
     }
 
@@ -1106,20 +1532,22 @@ fn read_dsig(file: &mut File) -> Result<Vec<u8>, SignatureError> {
 
 // Returns the parsed, uncompressed file size from the header, as well
 // as the offset in the file that the header ends.
-fn read_size(file: &mut File) -> Result<(u32, usize), HeaderError> {
+fn read_size<F: Read + Seek>(file: &mut F) -> Result<(u32, usize), HeaderError> {
     // Seek to beginning of file.
     file.rewind()?;
 
     // File should always start with "ClamAV-Diff".
     let prefix = b"ClamAV-Diff";
     let mut buf = Vec::with_capacity(prefix.len());
-    file.take(prefix.len() as u64).read_to_end(&mut buf)?;
+    file.by_ref()
+        .take(prefix.len() as u64)
+        .read_to_end(&mut buf)?;
     if buf.as_slice() != prefix.to_vec().as_slice() {
         return Err(HeaderError::BadMagic);
     }
 
     // Read up to READ_SIZE to parse out the file size.
-    let n = file.take(READ_SIZE as u64).read_to_end(&mut buf)?;
+    let n = file.by_ref().take(READ_SIZE as u64).read_to_end(&mut buf)?;
     let mut colons = 0;
     let mut file_size_vec = Vec::new();
     for (i, value) in buf.iter().enumerate().take(n + 1) {
@@ -1149,7 +1577,7 @@ fn read_size(file: &mut File) -> Result<(u32, usize), HeaderError> {
 }
 
 /// Calculate the sha256 of the first len bytes of a file
-fn get_hash(file: &mut File, len: usize) -> Result<[u8; 32], Error> {
+fn get_hash<F: Read + Seek>(file: &mut F, len: usize) -> Result<[u8; 32], Error> {
     let mut hasher = Sha256::new();
 
     // Seek to beginning of file
@@ -1162,7 +1590,7 @@ fn get_hash(file: &mut File, len: usize) -> Result<[u8; 32], Error> {
     // after signature is reached.
     loop {
         let mut buf = Vec::with_capacity(READ_SIZE);
-        let n = file.take(READ_SIZE as u64).read_to_end(&mut buf)?;
+        let n = file.by_ref().take(READ_SIZE as u64).read_to_end(&mut buf)?;
         if sum + n >= len {
             // update with len - sum
             hasher.update(&buf[..(len - sum)]);
@@ -1540,6 +1968,294 @@ mod tests {
         compare_file_with_expected(dst_file_path, &mut expected_dst_data);
     }
 
+    #[test]
+    fn apply_script_from_buffer() {
+        let initial_data = vec!["ClamAV-VDB:14 Jul 2021 14-29 -0400", "AAAA", "BBBB", "CCCC"];
+        let mut expected_data = vec!["ClamAV-VDB:14 Jul 2021 14-29 -0400", "DDDD", "CCCC", "EEEE"];
+
+        let db_file_path = initialize_db_file_with_data(initial_data).unwrap();
+        let db_name = db_file_path.file_name().unwrap().to_str().unwrap();
+
+        // The same edits as add_delete_exchange, but read from memory
+        let script = format!(
+            "OPEN {}\nDEL 2 AAAA\nXCHG 3 BBBB DDDD\nADD EEEE\nCLOSE\n",
+            db_name
+        );
+        let mut cursor = Cursor::new(script.as_bytes());
+
+        match cdiff_apply(&mut cursor, ApplyMode::Script) {
+            Ok(_) => (),
+            Err(e) => panic!("cdiff_apply failed with: {}", e),
+        }
+        compare_file_with_expected(db_file_path, &mut expected_data);
+    }
+
+    /// Script touching two databases: several OPEN/CLOSE blocks on the same
+    /// file, a MOVE between them, and an exchange of a line that was moved.
+    fn multi_block_script(a: &str, b: &str) -> String {
+        format!(
+            "OPEN {a}\n\
+             DEL 2 AAAA\n\
+             XCHG 4 CCCC XXXX\n\
+             ADD HHHH\n\
+             CLOSE\n\
+             OPEN {a}\n\
+             DEL 1 ClamAV-VDB\n\
+             XCHG 8 HHHH IIII\n\
+             CLOSE\n\
+             MOVE {a} {b} 2 XXXX 4 EEEE\n\
+             OPEN {b}\n\
+             XCHG 5 DDDD YYYY\n\
+             ADD JJJJ\n\
+             CLOSE\n",
+            a = a,
+            b = b
+        )
+    }
+
+    fn apply_multi_block_script(strategy: ApplyStrategy) {
+        let a_data = vec![
+            "ClamAV-VDB:14 Jul 2021 14-29 -0400",
+            "AAAA",
+            "BBBB",
+            "CCCC",
+            "DDDD",
+            "EEEE",
+            "FFFF",
+            "GGGG",
+        ];
+        let b_data = vec!["ClamAV-VDB:15 Aug 2021 14-30 -0400", "1111", "2222"];
+
+        let mut expected_a_data = vec!["BBBB", "FFFF", "GGGG", "IIII"];
+        let mut expected_b_data = vec![
+            "ClamAV-VDB:15 Aug 2021 14-30 -0400",
+            "1111",
+            "2222",
+            "XXXX",
+            "YYYY",
+            "EEEE",
+            "JJJJ",
+        ];
+
+        let a_path = initialize_db_file_with_data(a_data).unwrap();
+        let b_path = initialize_db_file_with_data(b_data).unwrap();
+
+        let script = multi_block_script(
+            a_path.file_name().unwrap().to_str().unwrap(),
+            b_path.file_name().unwrap().to_str().unwrap(),
+        );
+        let mut cursor = Cursor::new(script.as_bytes());
+
+        match cdiff_apply_with(&mut cursor, ApplyMode::Script, strategy) {
+            Ok(_) => (),
+            Err(e) => panic!("cdiff_apply_with failed with: {}", e),
+        }
+        compare_file_with_expected(a_path, &mut expected_a_data);
+        compare_file_with_expected(b_path, &mut expected_b_data);
+    }
+
+    #[test]
+    fn multi_block_streaming() {
+        apply_multi_block_script(ApplyStrategy::Streaming);
+    }
+
+    #[test]
+    fn multi_block_indexed() {
+        apply_multi_block_script(ApplyStrategy::Indexed);
+    }
+
+    #[test]
+    fn indexed_failure_writes_nothing() {
+        let initial_data = vec!["ClamAV-VDB:14 Jul 2021 14-29 -0400", "AAAA", "BBBB", "CCCC"];
+        let mut expected_data = initial_data.clone();
+
+        let db_file_path = initialize_db_file_with_data(initial_data).unwrap();
+        let db_name = db_file_path.file_name().unwrap().to_str().unwrap();
+
+        // The first block is fine, the second doesn't match
+        let script = format!(
+            "OPEN {0}\nDEL 2 AAAA\nCLOSE\nOPEN {0}\nXCHG 2 CCCC DDDD\nCLOSE\n",
+            db_name
+        );
+        let mut cursor = Cursor::new(script.as_bytes());
+
+        assert!(matches!(
+            cdiff_apply_with(&mut cursor, ApplyMode::Script, ApplyStrategy::Indexed),
+            Err(Error::Input {
+                line: 6,
+                err: InputError::Processing(ProcessingError::PatternDoesNotMatch(_, 2, _)),
+                ..
+            })
+        ));
+        compare_file_with_expected(db_file_path, &mut expected_data);
+    }
+
+    #[test]
+    fn indexed_unlink() {
+        let db_file_path = initialize_db_file_with_data(vec!["AAAA"]).unwrap();
+        let db_name = db_file_path.file_name().unwrap().to_str().unwrap();
+
+        let script = format!("OPEN {0}\nADD BBBB\nCLOSE\nUNLINK {0}\n", db_name);
+        let mut cursor = Cursor::new(script.as_bytes());
+
+        match cdiff_apply_with(&mut cursor, ApplyMode::Script, ApplyStrategy::Indexed) {
+            Ok(_) => (),
+            Err(e) => panic!("cdiff_apply_with failed with: {}", e),
+        }
+        assert!(!db_file_path.exists());
+    }
+
+    /// Small xorshift generator, so the timing workload is the same every run
+    struct Rng(u64);
+
+    impl Rng {
+        fn next(&mut self) -> usize {
+            self.0 ^= self.0 << 13;
+            self.0 ^= self.0 >> 7;
+            self.0 ^= self.0 << 17;
+            self.0 as usize
+        }
+    }
+
+    fn synthetic_signature(n: usize, rng: &mut Rng) -> String {
+        format!(
+            "Synthetic.Test-{}:{:016x}{:016x}:{}",
+            n,
+            rng.next(),
+            rng.next(),
+            rng.next() % 100_000
+        )
+    }
+
+    /// Build `dbs` database files of `lines` lines each, and a script of
+    /// `edits` DEL/XCHG edits split over `blocks` OPEN/CLOSE blocks per file,
+    /// with a few ADDs per block and a final MOVE between two files.
+    ///
+    /// The line numbers in each block are computed against the file as the
+    /// previous blocks left it.
+    fn synthesize_daily(
+        names: &[&str],
+        lines: usize,
+        edits: usize,
+        blocks: usize,
+    ) -> (Vec<Vec<u8>>, Vec<u8>) {
+        let mut rng = Rng(0x2545_f491_4f6c_dd1d);
+        let edits_per_block = edits / names.len() / blocks;
+        let mut added = 0;
+
+        let mut models: Vec<Vec<String>> = names
+            .iter()
+            .map(|_| {
+                (0..lines)
+                    .map(|_| {
+                        added += 1;
+                        synthetic_signature(added, &mut rng)
+                    })
+                    .collect()
+            })
+            .collect();
+
+        let files = models
+            .iter()
+            .map(|model| {
+                let mut data = model.join("\n").into_bytes();
+                data.push(b'\n');
+                data
+            })
+            .collect();
+
+        let mut script = String::new();
+        for _ in 0..blocks {
+            for (db, model) in names.iter().zip(models.iter_mut()) {
+                let mut line_nos: Vec<usize> = (0..edits_per_block)
+                    .map(|_| rng.next() % model.len())
+                    .collect();
+                line_nos.sort_unstable();
+                line_nos.dedup();
+
+                script.push_str(&format!("OPEN {}\n", db));
+                let mut deleted = vec![];
+                for &i in &line_nos {
+                    let pattern = model[i].split(':').next().unwrap().to_owned();
+                    if rng.next() % 2 == 0 {
+                        script.push_str(&format!("DEL {} {}\n", i + 1, pattern));
+                        deleted.push(i);
+                    } else {
+                        added += 1;
+                        let new_line = synthetic_signature(added, &mut rng);
+                        script.push_str(&format!("XCHG {} {} {}\n", i + 1, pattern, new_line));
+                        model[i] = new_line;
+                    }
+                }
+                for _ in 0..20 {
+                    added += 1;
+                    let new_line = synthetic_signature(added, &mut rng);
+                    script.push_str(&format!("ADD {}\n", new_line));
+                    model.push(new_line);
+                }
+                script.push_str("CLOSE\n");
+
+                for &i in deleted.iter().rev() {
+                    model.remove(i);
+                }
+            }
+        }
+
+        let src = &models[1];
+        let start = src.len() / 2;
+        let end = start + 99;
+        script.push_str(&format!(
+            "MOVE {} {} {} {} {} {}\n",
+            names[1],
+            names[0],
+            start + 1,
+            src[start].split(':').next().unwrap(),
+            end + 1,
+            src[end].split(':').next().unwrap(),
+        ));
+
+        (files, script.into_bytes())
+    }
+
+    /// Time both strategies on a synthetic unpacked daily.cld: 1M lines across
+    /// four files, patched by 10k edits in 10 blocks per file.
+    ///
+    /// Run with `cargo test --release -- --ignored --nocapture apply_timing`.
+    #[test]
+    #[ignore]
+    fn apply_timing() {
+        let paths: Vec<tempfile::TempPath> = (0..4)
+            .map(|_| initialize_db_file_with_data(vec![]).unwrap())
+            .collect();
+        let names: Vec<&str> = paths
+            .iter()
+            .map(|p| p.file_name().unwrap().to_str().unwrap())
+            .collect();
+        let (files, script) = synthesize_daily(&names, 250_000, 10_000, 10);
+
+        let mut results: Vec<Vec<u8>> = vec![];
+        for strategy in [ApplyStrategy::Streaming, ApplyStrategy::Indexed] {
+            for (path, data) in paths.iter().zip(&files) {
+                fs::write(path, data).expect("Failed to write database file");
+            }
+
+            let start = std::time::Instant::now();
+            match cdiff_apply_with(&mut Cursor::new(&script[..]), ApplyMode::Script, strategy) {
+                Ok(_) => (),
+                Err(e) => panic!("cdiff_apply_with failed with: {}", e),
+            }
+            println!("{:?}: {:?}", strategy, start.elapsed());
+
+            results.push(
+                paths
+                    .iter()
+                    .flat_map(|path| fs::read(path).expect("Failed to read database file"))
+                    .collect(),
+            );
+        }
+        assert!(results[0] == results[1]);
+    }
+
     #[test]
     fn script2cdiff_missing_hyphen() {
         assert!(matches!(
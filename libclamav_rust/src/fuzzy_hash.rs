@@ -160,7 +160,11 @@ pub unsafe extern "C" fn _fuzzy_hash_check(
 
     if let Some(meta_vec) = hashmap.check(hash_bytes) {
         for meta in meta_vec {
-            sys::lsig_increment_subsig_match(mdata, meta.lsigid, meta.subsigid);
+            if sys::lsig_increment_subsig_match(mdata, meta.lsigid, meta.subsigid)
+                != sys::cl_error_t_CL_SUCCESS
+            {
+                return false;
+            }
         }
     }
 
@@ -534,6 +534,8 @@ pub struct cli_bc {
     pub sigtime_id: u32,
     pub sigmatch_id: u32,
     pub hook_name: *mut ::std::os::raw::c_char,
+    pub interp_flags: u32,
+    pub hash: [u8; 32usize],
 }
 #[repr(C)]
 #[derive(Debug, Copy, Clone)]
@@ -543,6 +545,10 @@ pub struct cli_all_bc {
     pub engine: *mut cli_bcengine,
     pub env: cli_environment,
     pub inited: ::std::os::raw::c_int,
+    pub prepared: ::std::os::raw::c_uint,
+    pub lazy: ::std::os::raw::c_uint,
+    pub dconfmask: ::std::os::raw::c_uint,
+    pub native: ::std::os::raw::c_uint,
 }
 #[repr(C)]
 #[derive(Debug, Copy, Clone)]
@@ -876,11 +882,18 @@ pub struct cli_ac_data {
     pub lsigsuboff_first: *mut *mut u32,
     pub lsig_matches: *mut *mut cli_lsig_matches,
     pub yr_matches: *mut u8,
+    pub lsig_dirty: *mut u64,
     pub offset: *mut u32,
     pub macro_lastmatch: [u32; 32usize],
     #[doc = " Hashset for versioninfo matching"]
     pub vinfo: *const cli_hashset,
     pub min_partno: u32,
+    pub partsig_dirty: *mut u64,
+    pub lsig_shared: *mut u32,
+    pub lsig_chunks: *mut *mut u32,
+    pub lsig_chunks_num: u32,
+    pub lsig_rows_used: u32,
+    pub pool: *mut cli_ac_data_pool,
 }
 #[repr(C)]
 #[derive(Debug, Copy, Clone)]
@@ -966,7 +979,11 @@ pub struct cli_ac_result {
 }
 extern "C" {
     #[doc = " @brief Increment the count for a subsignature of a logical signature.\n\n This is and alternative to lsig_increment_subsig_match() for use in subsigs that don't have a specific offset,\n like byte-compare subsigs and fuzzy-hash subsigs."]
-    pub fn lsig_increment_subsig_match(mdata: *mut cli_ac_data, lsig_id: u32, subsig_id: u32);
+    pub fn lsig_increment_subsig_match(
+        mdata: *mut cli_ac_data,
+        lsig_id: u32,
+        subsig_id: u32,
+    ) -> cl_error_t;
 }
 #[repr(C)]
 #[derive(Debug, Copy, Clone)]
@@ -1089,6 +1106,15 @@ pub const lsig_type_CLI_YARA_OFFSET: lsig_type = 2;
 pub type lsig_type = ::std::os::raw::c_uint;
 pub use self::lsig_type as lsig_type_t;
 #[repr(C)]
+#[derive(Debug, Copy, Clone)]
+pub struct cli_lsig_op {
+    pub code: u8,
+    pub mod_: ::std::os::raw::c_char,
+    pub id: u8,
+    pub val1: u32,
+    pub val2: u32,
+}
+#[repr(C)]
 #[derive(Copy, Clone)]
 pub struct cli_ac_lsig {
     pub id: u32,
@@ -1096,6 +1122,8 @@ pub struct cli_ac_lsig {
     pub type_: lsig_type_t,
     pub flag: u8,
     pub u: cli_ac_lsig__bindgen_ty_1,
+    pub prog: *mut cli_lsig_op,
+    pub prog_len: u32,
     pub virname: *mut ::std::os::raw::c_char,
     pub tdb: cli_lsig_tdb,
 }
@@ -1111,6 +1139,7 @@ pub type fuzzyhashmap_t = *mut ::std::os::raw::c_void;
 pub struct cli_matcher {
     pub type_: ::std::os::raw::c_uint,
     pub bm_shift: *mut u8,
+    pub bm_teddy: *mut u8,
     pub bm_suffix: *mut *mut cli_bm_patt,
     pub bm_pattab: *mut *mut cli_bm_patt,
     pub soff: *mut u32,
@@ -1119,6 +1148,7 @@ pub struct cli_matcher {
     pub bm_patterns: u32,
     pub bm_reloff_num: u32,
     pub bm_absoff_num: u32,
+    pub bm_anchored: *mut cli_matcher,
     pub hm: cli_hash_patt,
     pub hwild: cli_hash_wild,
     pub ac_partsigs: u32,
@@ -1127,6 +1157,7 @@ pub struct cli_matcher {
     pub ac_patterns: u32,
     pub ac_lsigs: u32,
     pub ac_lsigtable: *mut *mut cli_ac_lsig,
+    pub ac_lsig_evalmap: *mut u64,
     pub ac_root: *mut cli_ac_node,
     pub ac_nodetable: *mut *mut cli_ac_node,
     pub ac_listtable: *mut *mut cli_ac_list,
@@ -1137,6 +1168,7 @@ pub struct cli_matcher {
     pub ac_mindepth: u8,
     pub ac_maxdepth: u8,
     pub filter: *mut filter,
+    pub ac_data_pool: *mut cli_ac_data_pool,
     pub maxpatlen: u16,
     pub ac_only: u8,
     pub pcre_metas: u32,
@@ -1238,3 +1270,8 @@ pub struct CACHE {
 pub struct filter {
     pub _address: u8,
 }
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+pub struct cli_ac_data_pool {
+    pub _address: u8,
+}
@@ -1165,6 +1165,99 @@ done:
     return status;
 }
 
+/**
+ * @brief Translate the response code of a finished transfer into a status code.
+ *
+ * A 403 or 429 response also records in freshclam.dat how long to wait before
+ * trying again.
+ *
+ * @param curl      The curl handle for the finished transfer.
+ * @param url       The URL that was requested, for logging.
+ * @param size      The number of bytes received.
+ * @param logerr    Non-zero to log unexpected responses as errors rather than warnings.
+ * @return fc_error_t
+ */
+static fc_error_t check_http_response(CURL *curl, const char *url, size_t size, int logerr)
+{
+    fc_error_t status = FC_EFAILEDGET;
+    long http_code    = 0;
+
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+    switch (http_code) {
+        case 200:
+        case 206: {
+            if (0 == size) {
+                status = FC_EEMPTYFILE;
+            } else {
+                status = FC_SUCCESS;
+            }
+            break;
+        }
+        case 304: {
+            status = FC_UPTODATE;
+            break;
+        }
+        case 403: {
+            status = FC_EFORBIDDEN;
+
+            /* Try again in no less than 24 hours if freshclam received a 403 FORBIDDEN. */
+            g_freshclamDat->retry_after = time(NULL) + 60 * 60 * 24;
+
+            (void)save_freshclam_dat();
+
+            break;
+        }
+        case 429: {
+            status = FC_ERETRYLATER;
+
+            curl_off_t retry_after = 0;
+
+#if (LIBCURL_VERSION_MAJOR > 7) || ((LIBCURL_VERSION_MAJOR == 7) && (LIBCURL_VERSION_MINOR >= 66))
+            /* CURLINFO_RETRY_AFTER was introduced in libcurl 7.66 */
+
+            /* Find out how long we should wait before allowing a retry. */
+            curl_easy_getinfo(curl, CURLINFO_RETRY_AFTER, &retry_after);
+#endif
+
+            if (retry_after > 0) {
+                /* The response gave us a Retry-After date. Use that. */
+                g_freshclamDat->retry_after = time(NULL) + (time_t)retry_after;
+            } else {
+                /* Try again in no less than 4 hours if the response didn't specify
+                   or if CURLINFO_RETRY_AFTER is not supported. */
+                g_freshclamDat->retry_after = time(NULL) + 60 * 60 * 4;
+            }
+            (void)save_freshclam_dat();
+
+            break;
+        }
+        case 404: {
+            if (g_proxyServer)
+                logg(LOGG_WARNING, "downloadFile: file not found: %s (Proxy: %s:%u)\n", url, g_proxyServer, g_proxyPort);
+            else
+                logg(LOGG_WARNING, "downloadFile: file not found: %s\n", url);
+            status = FC_EFAILEDGET;
+            break;
+        }
+        case 522: {
+            logg(LOGG_WARNING, "downloadFile: Origin Connection Time-out. Cloudflare was unable to reach the origin web server and the request timed out. URL: %s\n", url);
+            status = FC_EFAILEDGET;
+            break;
+        }
+        default: {
+            if (g_proxyServer)
+                logg(logerr ? LOGG_ERROR : LOGG_WARNING, "downloadFile: Unexpected response (%li) from %s (Proxy: %s:%u)\n",
+                     http_code, url, g_proxyServer, g_proxyPort);
+            else
+                logg(logerr ? LOGG_ERROR : LOGG_WARNING, "downloadFile: Unexpected response (%li) from %s\n",
+                     http_code, url);
+            status = FC_EFAILEDGET;
+        }
+    }
+
+    return status;
+}
+
 static fc_error_t downloadFile(
     const char *url,
     const char *destfile,
@@ -1183,8 +1276,6 @@ static fc_error_t downloadFile(
     struct curl_slist *slist = NULL;
     struct xfer_progress prog;
 
-    long http_code = 0;
-
     struct FileStruct receivedFile = {-1, 0};
 
     if ((NULL == url) || (NULL == destfile)) {
@@ -1346,78 +1437,7 @@ static fc_error_t downloadFile(
     }
 
     /* Check HTTP code */
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
-    switch (http_code) {
-        case 200:
-        case 206: {
-            if (0 == receivedFile.size) {
-                status = FC_EEMPTYFILE;
-            } else {
-                status = FC_SUCCESS;
-            }
-            break;
-        }
-        case 304: {
-            status = FC_UPTODATE;
-            break;
-        }
-        case 403: {
-            status = FC_EFORBIDDEN;
-
-            /* Try again in no less than 24 hours if freshclam received a 403 FORBIDDEN. */
-            g_freshclamDat->retry_after = time(NULL) + 60 * 60 * 24;
-
-            (void)save_freshclam_dat();
-
-            break;
-        }
-        case 429: {
-            status = FC_ERETRYLATER;
-
-            curl_off_t retry_after = 0;
-
-#if (LIBCURL_VERSION_MAJOR > 7) || ((LIBCURL_VERSION_MAJOR == 7) && (LIBCURL_VERSION_MINOR >= 66))
-            /* CURLINFO_RETRY_AFTER was introduced in libcurl 7.66 */
-
-            /* Find out how long we should wait before allowing a retry. */
-            curl_easy_getinfo(curl, CURLINFO_RETRY_AFTER, &retry_after);
-#endif
-
-            if (retry_after > 0) {
-                /* The response gave us a Retry-After date. Use that. */
-                g_freshclamDat->retry_after = time(NULL) + (time_t)retry_after;
-            } else {
-                /* Try again in no less than 4 hours if the response didn't specify
-                   or if CURLINFO_RETRY_AFTER is not supported. */
-                g_freshclamDat->retry_after = time(NULL) + 60 * 60 * 4;
-            }
-            (void)save_freshclam_dat();
-
-            break;
-        }
-        case 404: {
-            if (g_proxyServer)
-                logg(LOGG_WARNING, "downloadFile: file not found: %s (Proxy: %s:%u)\n", url, g_proxyServer, g_proxyPort);
-            else
-                logg(LOGG_WARNING, "downloadFile: file not found: %s\n", url);
-            status = FC_EFAILEDGET;
-            break;
-        }
-        case 522: {
-            logg(LOGG_WARNING, "downloadFile: Origin Connection Time-out. Cloudflare was unable to reach the origin web server and the request timed out. URL: %s\n", url);
-            status = FC_EFAILEDGET;
-            break;
-        }
-        default: {
-            if (g_proxyServer)
-                logg(logerr ? LOGG_ERROR : LOGG_WARNING, "downloadFile: Unexpected response (%li) from %s (Proxy: %s:%u)\n",
-                     http_code, url, g_proxyServer, g_proxyPort);
-            else
-                logg(logerr ? LOGG_ERROR : LOGG_WARNING, "downloadFile: Unexpected response (%li) from %s\n",
-                     http_code, url);
-            status = FC_EFAILEDGET;
-        }
-    }
+    status = check_http_response(curl, url, receivedFile.size, logerr);
 
 done:
 
@@ -1630,95 +1650,379 @@ done:
     return status;
 }
 
-static fc_error_t downloadPatch(
-    const char *database,
-    const char *tmpdir,
-    int version,
-    char *server,
-    int logerr)
+struct PatchTransfer {
+    CURL *curl;
+    struct curl_slist *slist;
+    char *url;
+    struct MemoryStruct body;
+    unsigned int version;
+    uint32_t attempts;
+    fc_error_t status;
+};
+
+/**
+ * @brief Start (or restart) the download of one CDIFF patch into memory.
+ *
+ * @param multi     The multi handle that drives the transfers.
+ * @param patch     The patch to download. `url` must already be set.
+ * @return fc_error_t
+ */
+static fc_error_t startPatchTransfer(CURLM *multi, struct PatchTransfer *patch)
 {
     fc_error_t ret;
-    fc_error_t status = FC_EARG;
-
-    char *tempname = NULL;
-    char patch[DB_FILENAME_MAX];
-    char olddir[PATH_MAX];
+    fc_error_t status = FC_EINIT;
 
-    char *url     = NULL;
-    size_t urlLen = 0;
+    int bHttpServer = 0;
 
-    int fd = -1;
+    if (0 == strncasecmp(patch->url, "http", strlen("http"))) {
+        bHttpServer = 1;
+    }
 
-    olddir[0] = '\0';
+    free(patch->body.buffer);
+    patch->body.buffer = NULL;
+    patch->body.size   = 0;
 
-    if ((NULL == database) || (NULL == tmpdir) || (NULL == server) || (0 == version)) {
-        logg(LOGG_ERROR, "downloadPatch: Invalid arguments.\n");
+    if (FC_SUCCESS != (ret = create_curl_handle(bHttpServer, 1, &patch->curl))) {
+        logg(LOGG_ERROR, "startPatchTransfer: Failed to create curl handle.\n");
+        status = ret;
         goto done;
     }
 
-    if (NULL == getcwd(olddir, sizeof(olddir))) {
-        logg(LOGG_ERROR, "downloadPatch: Can't get path of current working directory\n");
-        status = FC_EDIRECTORY;
+    if (CURLE_OK != curl_easy_setopt(patch->curl, CURLOPT_URL, patch->url)) {
+        logg(LOGG_ERROR, "startPatchTransfer: Failed to set CURLOPT_URL for curl session (%s).\n", patch->url);
+    }
+
+    if (bHttpServer) {
+        /*
+         * For HTTP, set some extra headers.
+         */
+        if (CURLE_OK != curl_easy_setopt(patch->curl, CURLOPT_HTTPGET, 1L)) {
+            logg(LOGG_ERROR, "startPatchTransfer: Failed to set CURLOPT_HTTPGET for curl session.\n");
+        }
+
+        if (NULL == patch->slist) {
+            struct curl_slist *temp = NULL;
+
+#ifdef FRESHCLAM_NO_CACHE
+            if (NULL == (temp = curl_slist_append(patch->slist, "Cache-Control: no-cache"))) {
+                logg(LOGG_ERROR, "startPatchTransfer: Failed to append \"Cache-Control: no-cache\" header to custom curl header list.\n");
+            } else {
+                patch->slist = temp;
+            }
+#endif
+            if (NULL == (temp = curl_slist_append(patch->slist, "Connection: close"))) {
+                logg(LOGG_ERROR, "startPatchTransfer: Failed to append \"Connection: close\" header to custom curl header list.\n");
+            } else {
+                patch->slist = temp;
+            }
+        }
+        if (NULL != patch->slist) {
+            if (CURLE_OK != curl_easy_setopt(patch->curl, CURLOPT_HTTPHEADER, patch->slist)) {
+                logg(LOGG_ERROR, "startPatchTransfer: Failed to add custom header list to curl session.\n");
+            }
+        }
+    }
+
+    if (CURLE_OK != curl_easy_setopt(patch->curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback)) {
+        logg(LOGG_ERROR, "startPatchTransfer: Failed to set write-data memory callback function for curl session.\n");
+    }
+    if (CURLE_OK != curl_easy_setopt(patch->curl, CURLOPT_WRITEDATA, (void *)&patch->body)) {
+        logg(LOGG_ERROR, "startPatchTransfer: Failed to set receive buffer for curl session.\n");
+    }
+    if (CURLE_OK != curl_easy_setopt(patch->curl, CURLOPT_HEADERDATA, g_lastRay)) {
+        logg(LOGG_ERROR, "startPatchTransfer: Failed to set header-data for header callback for curl session.\n");
+    }
+    if (CURLE_OK != curl_easy_setopt(patch->curl, CURLOPT_HEADERFUNCTION, HeaderCallback)) {
+        logg(LOGG_ERROR, "startPatchTransfer: Failed to set header-data callback function for curl session.\n");
+    }
+    if (CURLE_OK != curl_easy_setopt(patch->curl, CURLOPT_PRIVATE, (void *)patch)) {
+        logg(LOGG_ERROR, "startPatchTransfer: Failed to set private data for curl session.\n");
         goto done;
     }
 
-    if (FC_SUCCESS != mkdir_and_chdir_for_cdiff_tmp(database, tmpdir)) {
-        status = FC_EDIRECTORY;
+    if (CURLM_OK != curl_multi_add_handle(multi, patch->curl)) {
+        logg(LOGG_ERROR, "startPatchTransfer: Failed to add curl session for %s to the multi handle.\n", patch->url);
         goto done;
     }
 
-    if (NULL == (tempname = cli_gentemp("."))) {
-        status = FC_EMEM;
+    logg(LOGG_DEBUG, "Retrieving %s\n", patch->url);
+
+    patch->attempts += 1;
+    status = FC_SUCCESS;
+
+done:
+
+    if ((FC_SUCCESS != status) && (NULL != patch->curl)) {
+        curl_easy_cleanup(patch->curl);
+        patch->curl = NULL;
+    }
+
+    return status;
+}
+
+static void stopPatchTransfer(CURLM *multi, struct PatchTransfer *patch)
+{
+    if (NULL != patch->curl) {
+        curl_multi_remove_handle(multi, patch->curl);
+        curl_easy_cleanup(patch->curl);
+        patch->curl = NULL;
+    }
+}
+
+/**
+ * @brief Download a range of CDIFF patches into memory, several at a time.
+ *
+ * Up to CDIFF_MAX_TRANSFERS patches are downloaded at the same time. A patch
+ * that fails with a connection error or a failed GET is retried up to
+ * g_maxAttempts times. Once a patch has failed for good, the patches after it
+ * can't be applied anyway, so they are not started (or are abandoned).
+ *
+ * The outcome of each download is left in patches[n].status.
+ *
+ * @param database  The database we're updating.
+ * @param server    The server to download from.
+ * @param first     The version of the first patch.
+ * @param count     The number of patches, and the length of the patches array.
+ * @param logerr    Non-zero to log the final failed attempt as an error.
+ * @param patches   Array of `count` zeroed transfers.
+ * @return fc_error_t FC_SUCCESS if the transfers ran. Check patches[n].status for the result of each.
+ */
+static fc_error_t downloadPatches(
+    const char *database,
+    char *server,
+    unsigned int first,
+    unsigned int count,
+    int logerr,
+    struct PatchTransfer *patches)
+{
+    fc_error_t ret;
+    fc_error_t status = FC_EARG;
+
+    CURLM *multi = NULL;
+    CURLMsg *msg;
+    int msgs_left;
+    int still_running;
+
+    unsigned int next    = 0;     /* next patch to start */
+    unsigned int stop    = count; /* patches from here on are not needed */
+    unsigned int running = 0;
+    unsigned int i;
+
+    if ((NULL == database) || (NULL == server) || (0 == first) || (0 == count) || (NULL == patches)) {
+        logg(LOGG_ERROR, "downloadPatches: Invalid arguments.\n");
         goto done;
     }
 
-    snprintf(patch, sizeof(patch), "%s-%d.cdiff", database, version);
-    urlLen = strlen(server) + strlen("/") + strlen(patch);
-    url    = malloc(urlLen + 1);
-    snprintf(url, urlLen + 1, "%s/%s", server, patch);
+    for (i = 0; i < count; i++) {
+        char patch[DB_FILENAME_MAX];
+        size_t urlLen;
 
-    if (FC_SUCCESS != (ret = downloadFile(url, tempname, 1, logerr, 0))) {
-        if (ret == FC_EEMPTYFILE) {
-            logg(LOGG_INFO, "Empty script %s, need to download entire database\n", patch);
-        } else {
-            logg(logerr ? LOGG_ERROR : LOGG_WARNING, "downloadPatch: Can't download %s from %s\n", patch, url);
+        patches[i].version = first + i;
+        patches[i].status  = FC_EFAILEDGET;
+
+        snprintf(patch, sizeof(patch), "%s-%u.cdiff", database, patches[i].version);
+        urlLen          = strlen(server) + strlen("/") + strlen(patch);
+        patches[i].url = malloc(urlLen + 1);
+        if (NULL == patches[i].url) {
+            logg(LOGG_ERROR, "downloadPatches: Failed to allocate memory for URL.\n");
+            status = FC_EMEM;
+            goto done;
         }
-        status = ret;
-        goto done;
+        snprintf(patches[i].url, urlLen + 1, "%s/%s", server, patch);
     }
 
-    if (-1 == (fd = open(tempname, O_RDONLY | O_BINARY))) {
-        logg(LOGG_ERROR, "downloadPatch: Can't open %s for reading\n", tempname);
-        status = FC_EFILE;
+    if (NULL == (multi = curl_multi_init())) {
+        logg(LOGG_ERROR, "downloadPatches: Failed to create curl multi handle.\n");
+        status = FC_EINIT;
         goto done;
     }
 
-    if (-1 == cdiff_apply(fd, 1)) {
-        logg(LOGG_ERROR, "downloadPatch: Can't apply patch\n");
-        status = FC_EFAILEDUPDATE;
-        goto done;
+    while (1) {
+        /* Keep up to CDIFF_MAX_TRANSFERS patches in flight. */
+        while ((running < CDIFF_MAX_TRANSFERS) && (next < stop)) {
+#ifdef HAVE_UNISTD_H
+            if (!mprintf_quiet && (mprintf_progress || isatty(fileno(stdout))))
+#else
+            if (!mprintf_quiet)
+#endif
+            {
+                mprintf(LOGG_INFO, "Downloading database patch # %u...\n", patches[next].version);
+            }
+            if (FC_SUCCESS != (ret = startPatchTransfer(multi, &patches[next]))) {
+                patches[next].status = ret;
+                stop                 = next;
+                break;
+            }
+            next++;
+            running++;
+        }
+
+        if (0 == running) {
+            break;
+        }
+
+        if (CURLM_OK != curl_multi_perform(multi, &still_running)) {
+            logg(LOGG_ERROR, "downloadPatches: curl_multi_perform() failed.\n");
+            status = FC_ECONNECTION;
+            goto done;
+        }
+
+        while (NULL != (msg = curl_multi_info_read(multi, &msgs_left))) {
+            struct PatchTransfer *patch = NULL;
+            char *private               = NULL;
+            int llogerr                 = logerr;
+
+            if (CURLMSG_DONE != msg->msg) {
+                continue;
+            }
+
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &private);
+            patch = (struct PatchTransfer *)private;
+
+            if (logerr) {
+                llogerr = (patch->attempts >= g_maxAttempts);
+            }
+
+            if (CURLE_OK != msg->data.result) {
+                logg(llogerr ? LOGG_ERROR : LOGG_WARNING, "Download failed (%d)  Message: %s\n",
+                     msg->data.result, curl_easy_strerror(msg->data.result));
+                ret = FC_ECONNECTION;
+            } else {
+                ret = check_http_response(patch->curl, patch->url, patch->body.size, llogerr);
+            }
+
+            stopPatchTransfer(multi, patch);
+            running--;
+
+            if (((FC_ECONNECTION == ret) || (FC_EFAILEDGET == ret)) &&
+                (patch->attempts < g_maxAttempts) &&
+                ((unsigned int)(patch - patches) < stop)) {
+                /* Try again. */
+                if (FC_SUCCESS == (ret = startPatchTransfer(multi, patch))) {
+                    running++;
+                    continue;
+                }
+            }
+
+            patch->status = ret;
+            if (FC_SUCCESS != ret) {
+                if (FC_EEMPTYFILE == ret) {
+                    logg(LOGG_INFO, "Empty script %s-%u.cdiff, need to download entire database\n", database, patch->version);
+                } else {
+                    logg(logerr ? LOGG_ERROR : LOGG_WARNING, "downloadPatches: Can't download %s-%u.cdiff from %s\n", database, patch->version, patch->url);
+                }
+
+                if ((unsigned int)(patch - patches) < stop) {
+                    /* The patches after this one can't be applied without it. */
+                    stop = (unsigned int)(patch - patches);
+                    for (i = stop + 1; i < next; i++) {
+                        if (NULL != patches[i].curl) {
+                            stopPatchTransfer(multi, &patches[i]);
+                            running--;
+                        }
+                    }
+                }
+            }
+        }
+
+        if ((running > 0) && (CURLM_OK != curl_multi_wait(multi, NULL, 0, 1000, NULL))) {
+            logg(LOGG_ERROR, "downloadPatches: curl_multi_wait() failed.\n");
+            status = FC_ECONNECTION;
+            goto done;
+        }
     }
 
     status = FC_SUCCESS;
 
 done:
 
-    if (NULL != url) {
-        free(url);
+    if (NULL != multi) {
+        for (i = 0; i < count; i++) {
+            stopPatchTransfer(multi, &patches[i]);
+        }
+        curl_multi_cleanup(multi);
     }
 
-    if (-1 != fd) {
-        close(fd);
+    return status;
+}
+
+/**
+ * @brief Apply downloaded CDIFF patches, in order, to the unpacked database.
+ *
+ * The patches are applied straight from memory. Application stops at the
+ * first patch that failed to download or that won't apply.
+ *
+ * @param database          The database we're updating.
+ * @param tmpdir            The directory to unpack the local database into.
+ * @param patches           The downloaded patches. Each buffer is freed once applied.
+ * @param count             The number of patches.
+ * @param[out] numApplied   The number of patches applied.
+ * @return fc_error_t FC_SUCCESS if all patches were applied, else the reason the first one wasn't.
+ */
+static fc_error_t applyPatches(
+    const char *database,
+    const char *tmpdir,
+    struct PatchTransfer *patches,
+    unsigned int count,
+    uint32_t *numApplied)
+{
+    fc_error_t status = FC_EARG;
+
+    char olddir[PATH_MAX];
+    unsigned int i;
+
+    olddir[0] = '\0';
+
+    if ((NULL == database) || (NULL == tmpdir) || (NULL == patches) || (NULL == numApplied)) {
+        logg(LOGG_ERROR, "applyPatches: Invalid arguments.\n");
+        goto done;
+    }
+
+    *numApplied = 0;
+
+    if (FC_SUCCESS != patches[0].status) {
+        /* Nothing to apply; don't bother unpacking the database. */
+        status = patches[0].status;
+        goto done;
+    }
+
+    if (NULL == getcwd(olddir, sizeof(olddir))) {
+        logg(LOGG_ERROR, "applyPatches: Can't get path of current working directory\n");
+        status = FC_EDIRECTORY;
+        goto done;
     }
 
-    if (NULL != tempname) {
-        unlink(tempname);
-        free(tempname);
+    if (FC_SUCCESS != mkdir_and_chdir_for_cdiff_tmp(database, tmpdir)) {
+        status = FC_EDIRECTORY;
+        goto done;
     }
 
+    for (i = 0; i < count; i++) {
+        if (FC_SUCCESS != patches[i].status) {
+            status = patches[i].status;
+            goto done;
+        }
+
+        if (-1 == cdiff_apply_buffer((const uint8_t *)patches[i].body.buffer, patches[i].body.size, 1)) {
+            logg(LOGG_ERROR, "applyPatches: Can't apply patch %s-%u.cdiff\n", database, patches[i].version);
+            status = FC_EFAILEDUPDATE;
+            goto done;
+        }
+
+        free(patches[i].body.buffer);
+        patches[i].body.buffer = NULL;
+        patches[i].body.size   = 0;
+
+        *numApplied += 1;
+    }
+
+    status = FC_SUCCESS;
+
+done:
+
     if ('\0' != olddir[0]) {
         if (-1 == chdir(olddir)) {
-            logg(LOGG_ERROR, "downloadPatch: Can't chdir to %s\n", olddir);
+            logg(LOGG_ERROR, "applyPatches: Can't chdir to %s\n", olddir);
             status = FC_EDIRECTORY;
         }
     }
@@ -1726,6 +2030,24 @@ done:
     return status;
 }
 
+static void freePatches(struct PatchTransfer *patches, unsigned int count)
+{
+    unsigned int i;
+
+    if (NULL == patches) {
+        return;
+    }
+
+    for (i = 0; i < count; i++) {
+        if (NULL != patches[i].slist) {
+            curl_slist_free_all(patches[i].slist);
+        }
+        free(patches[i].url);
+        free(patches[i].body.buffer);
+    }
+    free(patches);
+}
+
 /**
  * @brief Get CVD header info for local CVD/CLD database.
  *
@@ -2277,8 +2599,6 @@ fc_error_t updatedb(
 
     unsigned int flevel;
 
-    unsigned int i, j;
-
     if ((NULL == database) || (NULL == server) || (NULL == signo) || (NULL == dbFilename) || (NULL == bUpdated)) {
         logg(LOGG_ERROR, "updatedb: Invalid args!\n");
         goto done;
@@ -2347,8 +2667,9 @@ fc_error_t updatedb(
         /*
          * Attempt scripted/CDIFF incremental update.
          */
-        ret                         = FC_SUCCESS;
-        uint32_t numPatchesReceived = 0;
+        ret                           = FC_SUCCESS;
+        uint32_t numPatchesReceived   = 0;
+        struct PatchTransfer *patches = NULL;
 
         tmpdir = cli_gentemp(g_tempDirectory);
         if (!tmpdir) {
@@ -2368,34 +2689,20 @@ fc_error_t updatedb(
                 mprintf(LOGG_INFO, "Current database is %u versions behind.\n", remoteVersion - localVersion);
             }
         }
-        for (i = localVersion + 1; i <= remoteVersion; i++) {
-            for (j = 1; j <= g_maxAttempts; j++) {
-                int llogerr = logerr;
-                if (logerr)
-                    llogerr = (j == g_maxAttempts);
+        patches = calloc(remoteVersion - localVersion, sizeof(struct PatchTransfer));
+        if (NULL == patches) {
+            status = FC_EMEM;
+            goto done;
+        }
 
-#ifdef HAVE_UNISTD_H
-                if (!mprintf_quiet && (mprintf_progress || isatty(fileno(stdout))))
-#else
-                if (!mprintf_quiet)
-#endif
-                {
-                    mprintf(LOGG_INFO, "Downloading database patch # %u...\n", i);
-                }
-                ret = downloadPatch(database, tmpdir, i, server, llogerr);
-                if (ret == FC_ECONNECTION || ret == FC_EFAILEDGET) {
-                    continue;
-                } else {
-                    break;
-                }
-            }
-            if (FC_SUCCESS == ret) {
-                numPatchesReceived += 1;
-            } else {
-                break;
-            }
+        /* Fetch the patches concurrently, then apply them in order. */
+        ret = downloadPatches(database, server, localVersion + 1, remoteVersion - localVersion, logerr, patches);
+        if (FC_SUCCESS == ret) {
+            ret = applyPatches(database, tmpdir, patches, remoteVersion - localVersion, &numPatchesReceived);
         }
 
+        freePatches(patches, remoteVersion - localVersion);
+
         if (
             (FC_EEMPTYFILE == ret) ||                                 /* Request a new CVD if we got an empty CDIFF.      */
             (FC_EFAILEDUPDATE == ret) ||                              /* Request a new CVD if we failed to apply a CDIFF. */
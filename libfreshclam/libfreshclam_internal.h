@@ -43,6 +43,9 @@ typedef struct _freshclam_dat_v1 {
 /*Length of a cf-ray id.*/
 #define CFRAY_LEN 20
 
+/* Maximum number of CDIFF patches downloaded at the same time. */
+#define CDIFF_MAX_TRANSFERS 4
+
 /* ----------------------------------------------------------------------------
  * Internal libfreshclam globals
  */
@@ -3644,6 +3644,58 @@ done:
     return status;
 }
 
+static int compilebytecode(const struct optstruct *opts)
+{
+    int ret                  = -1;
+    cl_error_t err           = CL_SUCCESS;
+    unsigned int sigs        = 0;
+    struct cl_engine *engine = NULL;
+    const char *dbfile       = optget(opts, "compile-bytecode")->strarg;
+
+    if (!opts->filename) {
+        mprintf(LOGG_ERROR, "--compile-bytecode requires two arguments\n");
+        return -1;
+    }
+
+    if ((err = cl_init(CL_INIT_DEFAULT))) {
+        mprintf(LOGG_ERROR, "Can't initialize libclamav: %s\n", cl_strerror(err));
+        goto done;
+    }
+
+    if (!(engine = cl_engine_new())) {
+        mprintf(LOGG_ERROR, "Can't initialize antivirus engine\n");
+        goto done;
+    }
+
+    if (!setTempDir(engine, opts))
+        goto done;
+
+    /* cl_engine_compile() fails if not every bytecode could be compiled */
+    if ((err = cl_engine_set_str(engine, CL_ENGINE_BYTECODE_NATIVE_OUT, opts->filename[0]))) {
+        mprintf(LOGG_ERROR, "cl_engine_set_str(CL_ENGINE_BYTECODE_NATIVE_OUT) failed: %s\n", cl_strerror(err));
+        goto done;
+    }
+
+    if ((err = cl_load(dbfile, engine, &sigs, CL_DB_BYTECODE | CL_DB_BYTECODE_UNSIGNED))) {
+        mprintf(LOGG_ERROR, "compilebytecode: Can't load %s: %s\n", dbfile, cl_strerror(err));
+        goto done;
+    }
+
+    if ((err = cl_engine_compile(engine))) {
+        mprintf(LOGG_ERROR, "compilebytecode: Can't compile the bytecode signatures: %s\n", cl_strerror(err));
+        goto done;
+    }
+
+    mprintf(LOGG_INFO, "Compiled the bytecode signatures of %s (%u signatures) into %s\n",
+            dbfile, sigs, opts->filename[0]);
+    ret = 0;
+
+done:
+    if (engine)
+        cl_engine_free(engine);
+    return ret;
+}
+
 static void help(void)
 {
     mprintf(LOGG_INFO, "\n");
@@ -3707,6 +3759,8 @@ static void help(void)
     mprintf(LOGG_INFO, "                                           cdiff format\n");
     mprintf(LOGG_INFO, "    --run-cdiff=FILE       -r FILE         Execute update script FILE in cwd\n");
     mprintf(LOGG_INFO, "    --verify-cdiff=DIFF CVD/CLD            Verify DIFF against CVD/CLD\n");
+    mprintf(LOGG_INFO, "    --compile-bytecode=DATABASE FILE       Compile the bytecode signatures in\n");
+    mprintf(LOGG_INFO, "                                           DATABASE into native module FILE\n");
     mprintf(LOGG_INFO, "    --tempdir=DIRECTORY                    Create temporary files in DIRECTORY\n");
     mprintf(LOGG_INFO, "    --leave-temps[=yes/no(*)]              Do not remove temporary files\n");
     mprintf(LOGG_INFO, "\n");
@@ -3814,6 +3868,8 @@ int main(int argc, char **argv)
         ret = dumpcerts(opts);
     else if (optget(opts, "run-cdiff")->enabled)
         ret = rundiff(opts);
+    else if (optget(opts, "compile-bytecode")->enabled)
+        ret = compilebytecode(opts);
     else if (optget(opts, "verify-cdiff")->enabled) {
         if (!opts->filename) {
             mprintf(LOGG_ERROR, "--verify-cdiff requires two arguments\n");
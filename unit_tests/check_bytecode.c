@@ -48,6 +48,13 @@
 #include <pthread.h>
 #endif
 
+/* interpreter options the bytecodes are prepared with, see test_switch_int */
+static unsigned interp_mask = BYTECODE_INTERP_MASK;
+/* prepare interpreted bytecodes on their first run, see test_lazy_int */
+static int lazy_prepare = 0;
+/* run the bytecode this many times, recycling the context, see test_reuse_int */
+static unsigned reuse_runs = 1;
+
 static void runtest(const char *file, uint64_t expected, int fail, int nojit,
                     const char *infile, struct cli_pe_hook_data *pedata,
                     struct cli_exe_section *sections, const char *expectedvirname,
@@ -67,6 +74,7 @@ static void runtest(const char *file, uint64_t expected, int fail, int nojit,
     char filestr[512];
     const char *virname = NULL;
     struct cl_scan_options options;
+    unsigned run;
 
     memset(&cctx, 0, sizeof(cctx));
     memset(&options, 0, sizeof(struct cl_scan_options));
@@ -113,15 +121,19 @@ static void runtest(const char *file, uint64_t expected, int fail, int nojit,
 
     if (testmode && have_clamjit())
         engine->bytecode_mode = CL_BYTECODE_MODE_TEST;
+    engine->bytecode_lazy = lazy_prepare;
 
-    rc = cli_bytecode_prepare2(engine, &bcs, BYTECODE_ENGINE_MASK);
+    rc = cli_bytecode_prepare2(engine, &bcs, BYTECODE_ENGINE_MASK | interp_mask);
     ck_assert_msg(rc == CL_SUCCESS, "cli_bytecode_prepare failed");
+    if (lazy_prepare && nojit) {
+        ck_assert_msg(bc.state == bc_loaded && !bcs.prepared, "bytecode prepared before its first run");
+    }
 
     if (have_clamjit() && !nojit && !testmode) {
         ck_assert_msg(bc.state == bc_jit, "preparing for JIT failed");
     }
 
-    ctx                   = cli_bytecode_context_alloc();
+    ctx                   = cli_bytecode_context_alloc(engine);
     ctx->bytecode_timeout = fail == CL_ETIMEOUT ? 10 : 10000;
     ck_assert_msg(!!ctx, "cli_bytecode_context_alloc failed");
 
@@ -144,6 +156,9 @@ static void runtest(const char *file, uint64_t expected, int fail, int nojit,
     rc = cli_bytecode_run(&bcs, &bc, ctx);
     ck_assert_msg(rc == fail, "cli_bytecode_run failed, expected: %u, have: %u\n",
                   fail, rc);
+    if (lazy_prepare && nojit) {
+        ck_assert_msg(bc.state == bc_interp && bcs.prepared == 1, "bytecode not prepared on its first run");
+    }
 
     if (rc == CL_SUCCESS) {
         v = cli_bytecode_context_getresult_int(ctx);
@@ -155,6 +170,27 @@ static void runtest(const char *file, uint64_t expected, int fail, int nojit,
                           !strcmp(ctx->virname, expectedvirname),
                       "Invalid virname, expected: %s\n", expectedvirname);
     }
+    for (run = 1; run < reuse_runs; run++) {
+        struct cli_bc_ctx *prev = ctx;
+
+        /* the pooled context comes back with its buffers, but reset */
+        cli_bytecode_context_destroy(ctx);
+        ctx = cli_bytecode_context_alloc(engine);
+        ck_assert_msg(ctx == prev, "bytecode context was not reused");
+        ck_assert_msg(!ctx->ctx && !ctx->virname && ctx->outfd == -1, "reused bytecode context was not reset");
+        ctx->bytecode_timeout = fail == CL_ETIMEOUT ? 10 : 10000;
+        ctx->ctx              = &cctx;
+
+        cli_bytecode_context_setfuncid(ctx, &bc, 0);
+        rc = cli_bytecode_run(&bcs, &bc, ctx);
+        ck_assert_msg(rc == fail, "cli_bytecode_run failed on run %u, expected: %u, have: %u\n",
+                      run, fail, rc);
+        if (rc == CL_SUCCESS) {
+            v = cli_bytecode_context_getresult_int(ctx);
+            ck_assert_msg(v == expected, "Invalid return value from bytecode run %u, expected: " STDx64 ", have: " STDx64 "\n",
+                          run, expected, v);
+        }
+    }
     cli_bytecode_context_destroy(ctx);
     if (map)
         funmap(map);
@@ -499,6 +535,42 @@ START_TEST(test_testadt_int)
 }
 END_TEST
 
+START_TEST(test_switch_int)
+{
+    /* the plain switch dispatch, without threading and superinstructions,
+     * must give the same results */
+    cl_init(CL_INIT_DEFAULT);
+    interp_mask = 0;
+    runtest("input" PATHSEP "bytecode_sigs" PATHSEP "arith.cbc", 0xd5555555, CL_SUCCESS, 1, NULL, NULL, NULL, NULL, 0);
+    runtest("input" PATHSEP "bytecode_sigs" PATHSEP "arith_7.cbc", 0xd55555dd, CL_SUCCESS, 1, NULL, NULL, NULL, NULL, 0);
+    runtest("input" PATHSEP "bytecode_sigs" PATHSEP "apicalls.cbc", 0xf00d, CL_SUCCESS, 1, NULL, NULL, NULL, NULL, 0);
+    runtest("input" PATHSEP "bytecode_sigs" PATHSEP "bswap.cbc", 0xbeef, CL_SUCCESS, 1, NULL, NULL, NULL, NULL, 0);
+    runtest("input" PATHSEP "bytecode_sigs" PATHSEP "retmagic_7.cbc", 0x1234f00d, CL_SUCCESS, 1, NULL, NULL, NULL, NULL, 0);
+    runtest("input" PATHSEP "bytecode_sigs" PATHSEP "testadt_7.cbc", 0xf00d, 0, 1, NULL, NULL, NULL, NULL, 0);
+    interp_mask = BYTECODE_INTERP_MASK;
+}
+END_TEST
+
+START_TEST(test_lazy_int)
+{
+    lazy_prepare = 1;
+    runtest("input" PATHSEP "bytecode_sigs" PATHSEP "arith.cbc", 0xd5555555, CL_SUCCESS, 1, NULL, NULL, NULL, NULL, 0);
+    runtest("input" PATHSEP "bytecode_sigs" PATHSEP "apicalls.cbc", 0xf00d, CL_SUCCESS, 1, NULL, NULL, NULL, NULL, 0);
+    runtest("input" PATHSEP "bytecode_sigs" PATHSEP "retmagic_7.cbc", 0x1234f00d, CL_SUCCESS, 1, NULL, NULL, NULL, NULL, 0);
+    lazy_prepare = 0;
+}
+END_TEST
+
+START_TEST(test_reuse_int)
+{
+    reuse_runs = 3;
+    runtest("input" PATHSEP "bytecode_sigs" PATHSEP "arith.cbc", 0xd5555555, CL_SUCCESS, 1, NULL, NULL, NULL, NULL, 0);
+    runtest("input" PATHSEP "bytecode_sigs" PATHSEP "apicalls.cbc", 0xf00d, CL_SUCCESS, 1, NULL, NULL, NULL, NULL, 0);
+    runtest("input" PATHSEP "bytecode_sigs" PATHSEP "div0.cbc", 0, CL_EBYTECODE, 1, NULL, NULL, NULL, NULL, 0);
+    reuse_runs = 1;
+}
+END_TEST
+
 static void runload(const char *dbname, struct cl_engine *engine, unsigned signoexp)
 {
     char *str;
@@ -548,6 +620,55 @@ START_TEST(test_load_bytecode_int)
 }
 END_TEST
 
+START_TEST(test_native_module_jit)
+{
+    struct cl_engine *engine;
+    char *module;
+    FILE *f;
+    unsigned i, jitted;
+
+    if (!have_clamjit())
+        return;
+    cl_init(CL_INIT_DEFAULT);
+    module = cli_gentemp(NULL);
+    ck_assert_msg(!!module, "cli_gentemp failed");
+
+    /* compile the bytecodes into a native module ... */
+    engine = cl_engine_new();
+    ck_assert_msg(!!engine, "failed to create engine\n");
+    ck_assert_msg(cl_engine_set_str(engine, CL_ENGINE_BYTECODE_NATIVE_OUT, module) == CL_SUCCESS,
+                  "failed to set native module output\n");
+    runload("input" PATHSEP "bytecode_sigs" PATHSEP "bytecode.cvd", engine, 5);
+    ck_assert_msg(engine->bcs.native == 0, "%u bytecodes taken from a native module while writing one\n",
+                  engine->bcs.native);
+    cl_engine_free(engine);
+
+    f = fopen(module, "rb");
+    ck_assert_msg(!!f, "native module %s not written\n", module);
+    fclose(f);
+
+    /* ... and load them from it */
+    engine = cl_engine_new();
+    ck_assert_msg(!!engine, "failed to create engine\n");
+    ck_assert_msg(cl_engine_set_str(engine, CL_ENGINE_BYTECODE_NATIVE, module) == CL_SUCCESS,
+                  "failed to set native module\n");
+    runload("input" PATHSEP "bytecode_sigs" PATHSEP "bytecode.cvd", engine, 5);
+    for (i = 0, jitted = 0; i < engine->bcs.count; i++) {
+        ck_assert_msg(engine->bcs.all_bcs[i].state == bc_jit || engine->bcs.all_bcs[i].state == bc_skip,
+                      "bytecode %u not prepared from the native module\n", i);
+        if (engine->bcs.all_bcs[i].state == bc_jit)
+            jitted++;
+    }
+    /* every JITed bytecode must come from the module, none recompiled */
+    ck_assert_msg(jitted > 0 && engine->bcs.native == jitted,
+                  "%u of %u JITed bytecodes taken from the native module\n", engine->bcs.native, jitted);
+    cl_engine_free(engine);
+
+    unlink(module);
+    free(module);
+}
+END_TEST
+
 #if defined(CL_THREAD_SAFE) && defined(C_LINUX) && ((__GLIBC__ << 16) + __GLIBC_MINOR__ >= (2 << 16) + 4)
 #define DO_BARRIER
 #endif
@@ -642,9 +763,13 @@ Suite *test_bytecode_suite(void)
     tcase_add_test(tc_cli_arith, test_lsig_7_int);
     tcase_add_test(tc_cli_arith, test_retmagic_int);
     tcase_add_test(tc_cli_arith, test_testadt_int);
+    tcase_add_test(tc_cli_arith, test_switch_int);
+    tcase_add_test(tc_cli_arith, test_lazy_int);
+    tcase_add_test(tc_cli_arith, test_reuse_int);
 
     tcase_add_test(tc_cli_arith, test_load_bytecode_jit);
     tcase_add_test(tc_cli_arith, test_load_bytecode_int);
+    tcase_add_test(tc_cli_arith, test_native_module_jit);
 #ifdef DO_BARRIER
     tcase_add_test(tc_cli_arith, test_parallel_load);
 #endif
@@ -14,6 +14,9 @@
 #ifdef HAVE_SYS_MMAN_H
 #include <sys/mman.h>
 #endif
+#ifdef CL_THREAD_SAFE
+#include <pthread.h>
+#endif
 
 #include <libxml/parser.h>
 
@@ -433,6 +436,155 @@ START_TEST(test_cl_load)
 }
 END_TEST
 
+#if defined(USE_MPOOL) && defined(__linux__) && defined(MADV_HUGEPAGE)
+/* Whether the kernel has transparent huge pages, and doesn't have them turned off */
+static int thp_available(void)
+{
+    char mode[128];
+    FILE *fs;
+    int ret = 0;
+
+    if ((fs = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r"))) {
+        if (fgets(mode, sizeof(mode), fs) && !strstr(mode, "[never]"))
+            ret = 1;
+        fclose(fs);
+    }
+    return ret;
+}
+#endif
+
+START_TEST(test_cl_load_hugepages)
+{
+    cl_error_t ret;
+    struct cl_engine *engine;
+    unsigned int sigs = 0;
+    const char *testfile;
+    size_t huge = 0;
+
+    ret = cl_init(CL_INIT_DEFAULT);
+    ck_assert_msg(ret == CL_SUCCESS, "cl_init failed: %s", cl_strerror(ret));
+
+    engine = cl_engine_new();
+    ck_assert_msg(engine != NULL, "cl_engine_new failed");
+
+    ck_assert_msg(cl_engine_set_num(engine, CL_ENGINE_HUGEPAGES, CL_HUGEPAGES_EXPLICIT + 1) == CL_EARG, "invalid hugepages mode accepted");
+    ck_assert_msg(cl_engine_set_num(engine, CL_ENGINE_NUMA_NODE, CL_NUMA_INTERLEAVE - 1) == CL_EARG, "invalid NUMA node accepted");
+
+    /* either mode must fall back to normal pages where huge pages aren't available */
+    ret = cl_engine_set_num(engine, CL_ENGINE_HUGEPAGES, CL_HUGEPAGES_EXPLICIT);
+    ck_assert_msg(ret == CL_SUCCESS, "cl_engine_set_num(CL_ENGINE_HUGEPAGES) failed: %s", cl_strerror(ret));
+    ret = cl_engine_set_num(engine, CL_ENGINE_NUMA_NODE, CL_NUMA_INTERLEAVE);
+    ck_assert_msg(ret == CL_SUCCESS, "cl_engine_set_num(CL_ENGINE_NUMA_NODE) failed: %s", cl_strerror(ret));
+    ck_assert_msg(cl_engine_get_num(engine, CL_ENGINE_HUGEPAGES, NULL) == CL_HUGEPAGES_EXPLICIT, "hugepages mode not kept");
+    ck_assert_msg(cl_engine_get_num(engine, CL_ENGINE_NUMA_NODE, NULL) == CL_NUMA_INTERLEAVE, "NUMA node not kept");
+
+    testfile = SRCDIR PATHSEP "input" PATHSEP "freshclam_testfiles" PATHSEP "test-5.cvd";
+    ret      = cl_load(testfile, engine, &sigs, CL_DB_STDOPT);
+    ck_assert_msg(ret == CL_SUCCESS, "cl_load failed for: %s -- %s", testfile, cl_strerror(ret));
+    ck_assert_msg(sigs > 0, "No signatures loaded");
+
+    ret = cl_engine_compile(engine);
+    ck_assert_msg(ret == CL_SUCCESS, "cl_engine_compile failed: %s", cl_strerror(ret));
+
+#ifdef USE_MPOOL
+    ck_assert_msg(mpool_gethugestats(engine, &huge) == 0, "mpool_gethugestats failed");
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    /* without THP madvise() fails, and only a hugetlb pool would be left to use */
+    if (thp_available())
+        ck_assert_msg(huge > 0, "no pool memory in huge page maps");
+#endif
+#endif
+    UNUSEDPARAM(huge);
+
+    cl_engine_free(engine);
+}
+END_TEST
+
+#if defined(USE_MPOOL) && defined(CL_THREAD_SAFE)
+#define ARENA_THREADS 4
+#define ARENA_ALLOCS 10000
+
+struct arena_job {
+    mpool_t *arena;
+    char *ptrs[ARENA_ALLOCS];
+    char fill;
+    size_t allocated;
+    size_t requested;
+};
+
+static void *arena_alloc_th(void *arg)
+{
+    struct arena_job *job = arg;
+    size_t i, size;
+
+    for (i = 0; i < ARENA_ALLOCS; i++) {
+        size         = 8 + i % 200;
+        job->ptrs[i] = mpool_calloc(job->arena, 1, size);
+        if (!job->ptrs[i])
+            break;
+        memset(job->ptrs[i], job->fill, size);
+        job->allocated++;
+        job->requested += size;
+    }
+    /* leave some holes in the free lists */
+    for (i = 0; i < ARENA_ALLOCS; i += 3) {
+        mpool_free(job->arena, job->ptrs[i]);
+        job->ptrs[i] = NULL;
+    }
+    return NULL;
+}
+
+/* mpool_t *mpool_arena_create(const mpool_t *parent) / int mpool_arena_merge(mpool_t *mpool, mpool_t *arena) */
+START_TEST(test_mpool_arena)
+{
+    struct cl_engine *engine;
+    struct arena_job *jobs;
+    pthread_t th[ARENA_THREADS];
+    size_t used_before, total_before, used_after, total_after, requested = 0;
+    size_t i, j;
+
+    engine = cl_engine_new();
+    ck_assert_msg(engine != NULL, "cl_engine_new failed");
+    ck_assert_msg(mpool_getstats(engine, &used_before, &total_before) == 0, "mpool_getstats failed");
+
+    jobs = calloc(ARENA_THREADS, sizeof(*jobs));
+    ck_assert_msg(jobs != NULL, "calloc failed");
+
+    for (i = 0; i < ARENA_THREADS; i++) {
+        jobs[i].fill  = 'a' + i;
+        jobs[i].arena = mpool_arena_create(engine->mempool);
+        ck_assert_msg(jobs[i].arena != NULL, "mpool_arena_create failed");
+        ck_assert_msg(!pthread_create(&th[i], NULL, arena_alloc_th, &jobs[i]), "pthread_create failed");
+    }
+    for (i = 0; i < ARENA_THREADS; i++) {
+        ck_assert_msg(!pthread_join(th[i], NULL), "pthread_join failed");
+        ck_assert_msg(jobs[i].allocated == ARENA_ALLOCS, "arena allocation failed after %zu allocations", jobs[i].allocated);
+        requested += jobs[i].requested;
+        ck_assert_msg(mpool_arena_merge(engine->mempool, jobs[i].arena) == 0, "mpool_arena_merge failed");
+    }
+    ck_assert_msg(mpool_arena_merge(engine->mempool, engine->mempool) == -1, "merged a pool into itself");
+
+    /* the arena memory is now accounted to the engine */
+    ck_assert_msg(mpool_getstats(engine, &used_after, &total_after) == 0, "mpool_getstats failed");
+    ck_assert_msg(used_after - used_before >= requested, "pool usage %zu doesn't cover the %zu bytes allocated in the arenas", used_after - used_before, requested);
+    ck_assert_msg(total_after >= used_after, "pool total %zu below usage %zu", total_after, used_after);
+
+    /* what the threads allocated stays intact and is freed through the engine pool */
+    for (i = 0; i < ARENA_THREADS; i++) {
+        for (j = 0; j < ARENA_ALLOCS; j++) {
+            if (!jobs[i].ptrs[j])
+                continue;
+            ck_assert_msg(jobs[i].ptrs[j][0] == jobs[i].fill && jobs[i].ptrs[j][7] == jobs[i].fill, "arena allocation corrupted");
+            mpool_free(engine->mempool, jobs[i].ptrs[j]);
+        }
+    }
+
+    free(jobs);
+    cl_engine_free(engine);
+}
+END_TEST
+#endif
+
 /* cl_error_t cl_cvdverify(const char *file) */
 START_TEST(test_cl_cvdverify)
 {
@@ -485,6 +637,53 @@ START_TEST(test_cl_cvdverify)
 }
 END_TEST
 
+/* a CVD with a flipped byte in its content must not load anything */
+START_TEST(test_cl_load_tampered_cvd)
+{
+    cl_error_t ret;
+    struct cl_engine *engine;
+    unsigned int sigs = 0;
+    char newtestfile[PATH_MAX];
+    unsigned char *cvd_bytes;
+    STATBUF sb;
+    FILE *fs;
+
+    ret = cl_init(CL_INIT_DEFAULT);
+    ck_assert_msg(ret == CL_SUCCESS, "cl_init failed: %s", cl_strerror(ret));
+
+    fs = fopen(SRCDIR "/input/freshclam_testfiles/test-5.cvd", "rb");
+    ck_assert_msg(fs != NULL, "Failed to open test-5.cvd");
+    ck_assert_msg(FSTAT(fileno(fs), &sb) == 0 && sb.st_size > 1024, "Failed to stat test-5.cvd");
+    cvd_bytes = malloc(sb.st_size);
+    ck_assert_msg(cvd_bytes != NULL, "malloc failed");
+    ck_assert_msg(fread(cvd_bytes, 1, sb.st_size, fs) == (size_t)sb.st_size, "Failed to read test-5.cvd");
+    fclose(fs);
+
+    /* same size, same header, one bit off in the middle of the archive */
+    cvd_bytes[512 + (sb.st_size - 512) / 2] ^= 0x01;
+
+    sprintf(newtestfile, "%s/tampered.cvd", tmpdir);
+    fs = fopen(newtestfile, "wb");
+    ck_assert_msg(fs != NULL, "Failed to open %s", newtestfile);
+    ck_assert_msg(fwrite(cvd_bytes, 1, sb.st_size, fs) == (size_t)sb.st_size, "Failed to write %s", newtestfile);
+    fclose(fs);
+    free(cvd_bytes);
+
+    ret = cl_cvdverify(newtestfile);
+    ck_assert_msg(CL_EVERIFY == ret, "cl_cvdverify should have failed for: %s -- %s", newtestfile, cl_strerror(ret));
+
+    engine = cl_engine_new();
+    ck_assert_msg(engine != NULL, "cl_engine_new failed");
+
+    ret = cl_load(newtestfile, engine, &sigs, CL_DB_STDOPT);
+    ck_assert_msg(CL_EVERIFY == ret, "cl_load should have failed for: %s -- %s", newtestfile, cl_strerror(ret));
+    ck_assert_msg(sigs == 0, "%u signatures loaded from a tampered CVD", sigs);
+
+    cl_engine_free(engine);
+    unlink(newtestfile);
+}
+END_TEST
+
 /* cl_error_t cl_cvdunpack(const char *file, const char *dir, bool dont_verify) */
 START_TEST(test_cl_cvdunpack)
 {
@@ -1314,7 +1513,12 @@ static Suite *test_cl_suite(void)
     tcase_add_test(tc_cl, test_cl_cvdhead);
     tcase_add_test(tc_cl, test_cl_cvdparse);
     tcase_add_test(tc_cl, test_cl_load);
+    tcase_add_test(tc_cl, test_cl_load_hugepages);
+#if defined(USE_MPOOL) && defined(CL_THREAD_SAFE)
+    tcase_add_test(tc_cl, test_mpool_arena);
+#endif
     tcase_add_test(tc_cl, test_cl_cvdverify);
+    tcase_add_test(tc_cl, test_cl_load_tampered_cvd);
     tcase_add_test(tc_cl, test_cl_statinidir);
     tcase_add_test(tc_cl, test_cl_statchkdir);
     tcase_add_test(tc_cl, test_cl_settempdir);
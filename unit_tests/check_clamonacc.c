@@ -0,0 +1,937 @@
+/*
+ *  Unit tests for clamonacc.
+ *
+ *  Copyright (C) 2025 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+#if HAVE_CONFIG_H
+#include "clamav-config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#if defined(HAVE_SYS_FANOTIFY_H)
+#include <sys/fanotify.h>
+#endif
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <curl/curl.h>
+
+#include <check.h>
+
+// libclamav
+#include "clamav.h"
+#include "platform.h"
+
+// common
+#include "optparser.h"
+#include "clamdcom.h"
+
+#include "../clamonacc/clamonacc.h"
+#include "../clamonacc/client/communication.h"
+#include "../clamonacc/client/pool.h"
+#include "../clamonacc/scan/onas_cache.h"
+#include "../clamonacc/scan/thread.h"
+#include "../clamonacc/scan/onas_queue.h"
+
+/*
+ * The verdict cache asks clamd for its database version through
+ * onas_client_version(), which is replaced here by the version the test sets.
+ */
+static char test_db_version[64] = "ClamAV 1.0.0/1/Thu Jan  1 00:00:00 1970";
+static int test_db_version_asked = 0;
+
+int onas_client_version(const char *tcpaddr, int64_t portnum, int64_t timeout, char *version, size_t len)
+{
+    UNUSEDPARAM(tcpaddr);
+    UNUSEDPARAM(portnum);
+    UNUSEDPARAM(timeout);
+
+    test_db_version_asked++;
+    strncpy(version, test_db_version, len - 1);
+    version[len - 1] = '\0';
+    return 0;
+}
+
+#define TEST_FILES 5
+
+static int test_fds[TEST_FILES];
+static char test_paths[TEST_FILES][PATH_MAX];
+
+static void cache_setup(void)
+{
+    int i;
+
+    for (i = 0; i < TEST_FILES; i++) {
+        snprintf(test_paths[i], sizeof(test_paths[i]), OBJDIR PATHSEP "onas-cache-%d-XXXXXX", i);
+        test_fds[i] = mkstemp(test_paths[i]);
+        ck_assert_msg(test_fds[i] >= 0, "mkstemp failed for %s", test_paths[i]);
+        ck_assert_msg(write(test_fds[i], "clean", 5) == 5, "write failed for %s", test_paths[i]);
+    }
+    test_db_version_asked = 0;
+}
+
+static void cache_teardown(void)
+{
+    int i;
+
+    onas_cache_destroy();
+    for (i = 0; i < TEST_FILES; i++) {
+        close(test_fds[i]);
+        unlink(test_paths[i]);
+    }
+}
+
+/* fstat the file, and pretend its scan started well after it was last changed */
+static time_t test_stat(int fd, STATBUF *sb)
+{
+    ck_assert_msg(FSTAT(fd, sb) == 0, "fstat failed");
+    return (sb->st_ctime > sb->st_mtime ? sb->st_ctime : sb->st_mtime) + ONAS_CACHE_RACY_WINDOW + 10;
+}
+
+START_TEST(test_cache_hit_and_change)
+{
+    STATBUF sb;
+    struct onas_cache_stats stats;
+    uint32_t generation;
+    time_t started;
+
+    ck_assert_msg(onas_cache_setup(16, ONAS_CACHE_VERSION_TTL) == CL_SUCCESS, "onas_cache_setup failed");
+
+    ck_assert_msg(!onas_cache_lookup(test_fds[0]), "hit in an empty cache");
+
+    generation = onas_cache_generation(NULL, 0, 0);
+    ck_assert_msg(generation != 0, "no generation to cache under");
+    ck_assert_msg(test_db_version_asked == 1, "clamd asked for its version %d times", test_db_version_asked);
+
+    started = test_stat(test_fds[0], &sb);
+    onas_cache_insert(&sb, generation, started);
+    ck_assert_msg(onas_cache_lookup(test_fds[0]), "clean verdict not cached");
+    ck_assert_msg(!onas_cache_lookup(test_fds[1]), "hit for another file");
+
+    /* the version is trusted for a while, no need to ask again */
+    ck_assert_msg(onas_cache_generation(NULL, 0, 0) == generation, "generation changed");
+    ck_assert_msg(test_db_version_asked == 1, "clamd asked for its version %d times", test_db_version_asked);
+
+    /* new content must miss */
+    ck_assert_msg(write(test_fds[0], "more", 4) == 4, "write failed");
+    ck_assert_msg(!onas_cache_lookup(test_fds[0]), "hit after the file changed");
+
+    onas_cache_getstats(&stats);
+    ck_assert_msg(stats.hits == 1 && stats.misses == 3 && stats.inserts == 1 && stats.entries == 1,
+                  "unexpected stats: %llu hits, %llu misses, %llu inserts, %llu entries",
+                  (unsigned long long)stats.hits, (unsigned long long)stats.misses,
+                  (unsigned long long)stats.inserts, (unsigned long long)stats.entries);
+}
+END_TEST
+
+START_TEST(test_cache_racy_window)
+{
+    STATBUF sb;
+    uint32_t generation;
+    time_t started;
+
+    ck_assert_msg(onas_cache_setup(16, ONAS_CACHE_VERSION_TTL) == CL_SUCCESS, "onas_cache_setup failed");
+    generation = onas_cache_generation(NULL, 0, 0);
+
+    /* changed within the racy window before the scan started: not cached */
+    started = test_stat(test_fds[0], &sb) - 10;
+    onas_cache_insert(&sb, generation, started);
+    ck_assert_msg(!onas_cache_lookup(test_fds[0]), "verdict of a file changed just before the scan was cached");
+
+    /* a verdict without a generation, e.g. from a scan by path, is not cached either */
+    started = test_stat(test_fds[1], &sb);
+    onas_cache_insert(&sb, 0, started);
+    ck_assert_msg(!onas_cache_lookup(test_fds[1]), "verdict without a generation was cached");
+
+    /* nor a verdict from before a generation change */
+    onas_cache_insert(&sb, generation + 1, started);
+    ck_assert_msg(!onas_cache_lookup(test_fds[1]), "verdict from another generation was cached");
+}
+END_TEST
+
+START_TEST(test_cache_generation_bump)
+{
+    STATBUF sb;
+    struct onas_cache_stats stats;
+    uint32_t generation, next;
+    time_t started;
+
+    /* the shortest TTL that still lets a lookup right after the version check hit */
+    ck_assert_msg(onas_cache_setup(16, 2) == CL_SUCCESS, "onas_cache_setup failed");
+
+    generation = onas_cache_generation(NULL, 0, 0);
+    started    = test_stat(test_fds[0], &sb);
+    onas_cache_insert(&sb, generation, started);
+    ck_assert_msg(onas_cache_lookup(test_fds[0]), "clean verdict not cached");
+
+    /* clamd reloads its databases */
+    strcpy(test_db_version, "ClamAV 1.0.0/2/Fri Jan  2 00:00:00 1970");
+    sleep(3);
+
+    /* the version is too old to trust, lookups miss until it's confirmed again */
+    ck_assert_msg(!onas_cache_lookup(test_fds[0]), "hit with an unconfirmed database version");
+
+    next = onas_cache_generation(NULL, 0, 0);
+    ck_assert_msg(test_db_version_asked == 2, "clamd asked for its version %d times", test_db_version_asked);
+    ck_assert_msg(next != 0 && next != generation, "no new generation after a reload");
+    ck_assert_msg(!onas_cache_lookup(test_fds[0]), "verdict from the old databases still cached");
+
+    /* a scan that started before the reload can't store its verdict */
+    onas_cache_insert(&sb, generation, started);
+    ck_assert_msg(!onas_cache_lookup(test_fds[0]), "verdict from the old databases was cached");
+
+    onas_cache_insert(&sb, next, started);
+    ck_assert_msg(onas_cache_lookup(test_fds[0]), "verdict from the new databases not cached");
+
+    onas_cache_getstats(&stats);
+    ck_assert_msg(stats.invalidations == 1, "%llu invalidations", (unsigned long long)stats.invalidations);
+}
+END_TEST
+
+START_TEST(test_cache_eviction)
+{
+    STATBUF sb[TEST_FILES];
+    struct onas_cache_stats stats;
+    uint32_t generation;
+    int i;
+
+    /* a single set, so that all files compete for the same slots */
+    ck_assert_msg(onas_cache_setup(1, ONAS_CACHE_VERSION_TTL) == CL_SUCCESS, "onas_cache_setup failed");
+    generation = onas_cache_generation(NULL, 0, 0);
+
+    for (i = 0; i < TEST_FILES - 1; i++) {
+        onas_cache_insert(&sb[i], generation, test_stat(test_fds[i], &sb[i]));
+    }
+    for (i = 0; i < TEST_FILES - 1; i++) {
+        ck_assert_msg(onas_cache_lookup(test_fds[i]), "verdict %d not cached", i);
+    }
+
+    /* file 0 is now the least recently used one, unless hit again */
+    ck_assert_msg(onas_cache_lookup(test_fds[0]), "verdict 0 not cached");
+
+    i = TEST_FILES - 1;
+    onas_cache_insert(&sb[i], generation, test_stat(test_fds[i], &sb[i]));
+    ck_assert_msg(onas_cache_lookup(test_fds[i]), "newest verdict not cached");
+    ck_assert_msg(onas_cache_lookup(test_fds[0]), "recently used verdict evicted");
+    ck_assert_msg(!onas_cache_lookup(test_fds[1]), "least recently used verdict not evicted");
+
+    /* the same file again replaces its own entry */
+    onas_cache_insert(&sb[0], generation, test_stat(test_fds[0], &sb[0]));
+
+    onas_cache_getstats(&stats);
+    ck_assert_msg(stats.evictions == 1 && stats.entries == 4,
+                  "%llu evictions, %llu entries", (unsigned long long)stats.evictions, (unsigned long long)stats.entries);
+}
+END_TEST
+
+/*
+ * The connection pool talks to a stand-in for clamd, served from a thread of
+ * this test on an abstract unix socket. It takes the "zSCAN <name>" requests
+ * sent by onas_send_stream() below and answers them by id within the session,
+ * holding a reply back now and then so that replies arrive out of order.
+ */
+static int server_fd = -1;
+static pthread_t server_thread;
+static char server_name[64];
+
+static pthread_mutex_t server_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t server_cond   = PTHREAD_COND_INITIALIZER;
+static int server_sessions          = 0; /* sessions accepted */
+static int server_requests          = 0; /* scan requests received */
+static int server_connections       = 0; /* sessions still being served */
+static int server_hangup_after      = 0; /* hang up on the first session after this many requests, unless 0 */
+static int server_silent            = 0; /* never reply */
+
+CURLcode onas_curl_init(CURL **curl, const char *ipaddr, int64_t port, int64_t timeout)
+{
+    UNUSEDPARAM(port);
+
+    *curl = curl_easy_init();
+    if (NULL == *curl) {
+        return CURLE_FAILED_INIT;
+    }
+    curl_easy_setopt(*curl, CURLOPT_ABSTRACT_UNIX_SOCKET, ipaddr);
+    curl_easy_setopt(*curl, CURLOPT_URL, "http://localhost/");
+    curl_easy_setopt(*curl, CURLOPT_CONNECT_ONLY, 1L);
+    curl_easy_setopt(*curl, CURLOPT_CONNECTTIMEOUT_MS, (long)timeout);
+    return CURLE_OK;
+}
+
+int onas_send_stream(CURL *curl, const char *filename, int fd, int64_t timeout, uint64_t maxstream)
+{
+    char line[PATH_MAX + 16];
+    int len;
+
+    UNUSEDPARAM(fd);
+    UNUSEDPARAM(maxstream);
+
+    len = snprintf(line, sizeof(line), "zSCAN %s", filename);
+    return onas_sendln(curl, line, len + 1, timeout) ? -1 : 1;
+}
+
+int onas_fdpass(const char *filename, int fd, int sockd)
+{
+    UNUSEDPARAM(filename);
+    UNUSEDPARAM(fd);
+    UNUSEDPARAM(sockd);
+
+    return -1;
+}
+
+/* checks that the reply is the one for filename */
+int onas_dsreply(int scantype, const char *filename, char *bol, char *eol, int len, int *infected, int *printok, int *errors, cl_error_t *ret_code)
+{
+    char expected[PATH_MAX + 32];
+
+    UNUSEDPARAM(scantype);
+    UNUSEDPARAM(eol);
+    UNUSEDPARAM(len);
+    UNUSEDPARAM(printok);
+    UNUSEDPARAM(ret_code);
+
+    snprintf(expected, sizeof(expected), "%s: %s", filename, strstr(filename, "bad") ? "Eicar-Signature FOUND" : "OK");
+    if (strcmp(bol, expected)) {
+        (*errors)++;
+        return -1;
+    }
+    if (strstr(bol, "FOUND")) {
+        (*infected)++;
+    }
+    return 0;
+}
+
+static void server_reply(int fd, unsigned int id, const char *name)
+{
+    char reply[PATH_MAX + 64];
+    int len;
+
+    len = snprintf(reply, sizeof(reply), "%u: %s: %s", id, name, strstr(name, "bad") ? "Eicar-Signature FOUND" : "OK");
+    (void)!send(fd, reply, len + 1, MSG_NOSIGNAL);
+}
+
+static void *server_session(void *arg)
+{
+    int fd = (int)(intptr_t)arg;
+    char buf[PATH_MAX + 64], held[PATH_MAX + 64], *cmd, *end;
+    size_t buflen = 0;
+    unsigned int id = 0, held_id = 0;
+    int session, requests = 0;
+    struct pollfd pfd;
+    ssize_t got;
+
+    pthread_mutex_lock(&server_mutex);
+    session = ++server_sessions;
+    pthread_mutex_unlock(&server_mutex);
+
+    pfd.fd     = fd;
+    pfd.events = POLLIN;
+    while (1) {
+        /* a held back reply goes out once nothing else is coming */
+        if (poll(&pfd, 1, held_id ? 10 : -1) == 0) {
+            server_reply(fd, held_id, held);
+            held_id = 0;
+            continue;
+        }
+        got = recv(fd, buf + buflen, sizeof(buf) - buflen, 0);
+        if (got <= 0) {
+            break;
+        }
+        buflen += got;
+
+        cmd = buf;
+        while ((end = memchr(cmd, '\0', buflen - (cmd - buf)))) {
+            if (!strncmp(cmd, "zSCAN ", 6)) {
+                id++;
+                requests++;
+                pthread_mutex_lock(&server_mutex);
+                server_requests++;
+                pthread_cond_broadcast(&server_cond);
+                pthread_mutex_unlock(&server_mutex);
+
+                if (server_hangup_after && session == 1 && requests == server_hangup_after) {
+                    goto done;
+                }
+                if (!server_silent) {
+                    if (held_id) {
+                        server_reply(fd, id, cmd + 6);
+                        server_reply(fd, held_id, held);
+                        held_id = 0;
+                    } else if (id % 3 == 0) {
+                        strcpy(held, cmd + 6);
+                        held_id = id;
+                    } else {
+                        server_reply(fd, id, cmd + 6);
+                    }
+                }
+            } else if (!strcmp(cmd, "zEND")) {
+                goto done;
+            }
+            cmd = end + 1;
+        }
+        buflen -= cmd - buf;
+        memmove(buf, cmd, buflen);
+    }
+
+done:
+    shutdown(fd, SHUT_RDWR);
+    close(fd);
+
+    pthread_mutex_lock(&server_mutex);
+    server_connections--;
+    pthread_cond_broadcast(&server_cond);
+    pthread_mutex_unlock(&server_mutex);
+    return NULL;
+}
+
+static void *server_main(void *arg)
+{
+    pthread_t session;
+    int fd;
+
+    UNUSEDPARAM(arg);
+
+    while ((fd = accept(server_fd, NULL, NULL)) >= 0) {
+        pthread_mutex_lock(&server_mutex);
+        server_connections++;
+        pthread_mutex_unlock(&server_mutex);
+
+        if (pthread_create(&session, NULL, server_session, (void *)(intptr_t)fd)) {
+            close(fd);
+            pthread_mutex_lock(&server_mutex);
+            server_connections--;
+            pthread_mutex_unlock(&server_mutex);
+            continue;
+        }
+        pthread_detach(session);
+    }
+    return NULL;
+}
+
+static struct optstruct *pool_clamdopts;
+
+static void pool_setup(void)
+{
+    struct sockaddr_un addr;
+    char conf[PATH_MAX];
+    FILE *fs;
+
+    server_sessions     = 0;
+    server_requests     = 0;
+    server_connections  = 0;
+    server_hangup_after = 0;
+    server_silent       = 0;
+
+    /* the name is used by curl, the address by bind(), which wants the leading NUL */
+    snprintf(server_name, sizeof(server_name), "check_clamonacc-%d", (int)getpid());
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path + 1, server_name, strlen(server_name));
+
+    server_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    ck_assert_msg(server_fd >= 0, "socket failed: %s", strerror(errno));
+    ck_assert_msg(bind(server_fd, (struct sockaddr *)&addr, offsetof(struct sockaddr_un, sun_path) + 1 + strlen(server_name)) == 0,
+                  "bind failed: %s", strerror(errno));
+    ck_assert_msg(listen(server_fd, 16) == 0, "listen failed: %s", strerror(errno));
+    ck_assert_msg(pthread_create(&server_thread, NULL, server_main, NULL) == 0, "could not start the server");
+
+    snprintf(conf, sizeof(conf), OBJDIR PATHSEP "check_clamonacc-%d.conf", (int)getpid());
+    fs = fopen(conf, "w");
+    ck_assert_msg(fs != NULL, "could not create %s", conf);
+    fputs("CommandReadTimeout 30\n", fs);
+    fclose(fs);
+    pool_clamdopts = optparse(conf, 0, NULL, 1, OPT_CLAMD, 0, NULL);
+    unlink(conf);
+    ck_assert_msg(pool_clamdopts != NULL, "could not parse %s", conf);
+}
+
+static void pool_teardown(void)
+{
+    onas_pool_destroy();
+    optfree(pool_clamdopts);
+
+    /* wakes up accept() */
+    shutdown(server_fd, SHUT_RDWR);
+    pthread_join(server_thread, NULL);
+    close(server_fd);
+
+    pthread_mutex_lock(&server_mutex);
+    while (server_connections) {
+        pthread_cond_wait(&server_cond, &server_mutex);
+    }
+    pthread_mutex_unlock(&server_mutex);
+}
+
+static void pool_init(int32_t maxthreads)
+{
+    struct onas_context ctx;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.clamdopts  = pool_clamdopts;
+    ctx.scantype   = STREAM;
+    ctx.maxthreads = maxthreads;
+    ctx.timeout    = 10000;
+
+    ck_assert_msg(onas_pool_init(&ctx) == CL_SUCCESS, "onas_pool_init failed");
+    ck_assert_msg(onas_pool_enabled(), "pool not enabled for STREAM scans");
+}
+
+struct pool_worker {
+    pthread_t thread;
+    int id;
+    int scans;
+    int64_t timeout;
+    int infected;
+    int errors;
+};
+
+static void *pool_worker_main(void *arg)
+{
+    struct pool_worker *worker = arg;
+    char name[64];
+    int i, infected, err;
+    cl_error_t ret;
+
+    for (i = 0; i < worker->scans; i++) {
+        snprintf(name, sizeof(name), "/worker-%d/file-%d%s", worker->id, i, i % 5 ? "" : "-bad");
+        infected = err = 0;
+        ret        = CL_SUCCESS;
+        switch (onas_pool_scan(server_name, 0, STREAM, 0, name, -1, worker->timeout, &infected, &err, &ret)) {
+            case CL_VIRUS:
+                worker->infected++;
+                break;
+            case CL_CLEAN:
+                break;
+            default:
+                worker->errors++;
+                break;
+        }
+    }
+    return NULL;
+}
+
+/* runs the workers to completion, returns the number of failed scans */
+static int pool_run(struct pool_worker *workers, int count, int scans, int64_t timeout)
+{
+    int i, errors = 0;
+
+    for (i = 0; i < count; i++) {
+        memset(&workers[i], 0, sizeof(workers[i]));
+        workers[i].id      = i;
+        workers[i].scans   = scans;
+        workers[i].timeout = timeout;
+        ck_assert_msg(pthread_create(&workers[i].thread, NULL, pool_worker_main, &workers[i]) == 0, "could not start worker %d", i);
+    }
+    for (i = 0; i < count; i++) {
+        pthread_join(workers[i].thread, NULL);
+        errors += workers[i].errors;
+    }
+    return errors;
+}
+
+START_TEST(test_pool_scans)
+{
+    struct pool_worker workers[8];
+    int errors, i;
+
+    /* 16 scan threads share 4 sessions */
+    pool_init(16);
+
+    errors = pool_run(workers, 8, 200, 10000);
+    ck_assert_msg(errors == 0, "%d scans failed", errors);
+    for (i = 0; i < 8; i++) {
+        ck_assert_msg(workers[i].infected == 40, "worker %d found %d infected files", i, workers[i].infected);
+    }
+    ck_assert_msg(server_requests == 8 * 200, "clamd got %d requests", server_requests);
+    ck_assert_msg(server_sessions <= 4, "%d sessions opened", server_sessions);
+}
+END_TEST
+
+START_TEST(test_pool_broken_session)
+{
+    struct pool_worker workers[4];
+    int errors;
+
+    /* a single session, which clamd drops with requests outstanding: those are sent
+     * again once it is replaced, and nobody gives up while the broken one drains */
+    pool_init(4);
+    server_hangup_after = 10;
+
+    errors = pool_run(workers, 4, 50, 10000);
+    ck_assert_msg(errors == 0, "%d scans failed", errors);
+    ck_assert_msg(server_sessions == 2, "%d sessions opened", server_sessions);
+}
+END_TEST
+
+START_TEST(test_pool_destroy)
+{
+    struct pool_worker workers[4];
+    time_t started;
+    int i;
+
+    /* scans waiting on clamd must not hold up, or outlive, the pool */
+    pool_init(4);
+    server_silent = 1;
+
+    for (i = 0; i < 4; i++) {
+        memset(&workers[i], 0, sizeof(workers[i]));
+        workers[i].id      = i;
+        workers[i].scans   = 1;
+        workers[i].timeout = 60000;
+        ck_assert_msg(pthread_create(&workers[i].thread, NULL, pool_worker_main, &workers[i]) == 0, "could not start worker %d", i);
+    }
+
+    pthread_mutex_lock(&server_mutex);
+    while (server_requests < 4) {
+        pthread_cond_wait(&server_cond, &server_mutex);
+    }
+    pthread_mutex_unlock(&server_mutex);
+
+    started = time(NULL);
+    onas_pool_destroy();
+    ck_assert_msg(time(NULL) - started < 10, "onas_pool_destroy() waited for the scans to time out");
+    ck_assert_msg(!onas_pool_enabled(), "pool still enabled");
+
+    for (i = 0; i < 4; i++) {
+        pthread_join(workers[i].thread, NULL);
+        ck_assert_msg(workers[i].errors == 1, "worker %d: %d failed scans", i, workers[i].errors);
+    }
+}
+END_TEST
+
+/*
+ * The scan queue hands its events to onas_scan_worker(), which is replaced
+ * here by one that counts the events by the id the test put in their portnum.
+ * Workers wait at a gate after taking an event, so that the queue fills up.
+ */
+pthread_t scan_queue_pid = 0;
+
+#define QUEUE_TEST_IDS (ONAS_QUEUE_SIZE + 16)
+
+static pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond   = PTHREAD_COND_INITIALIZER;
+static int queue_gate_open         = 0;
+static int queue_scans             = 0; /* events handed to the workers */
+static int queue_scanned[QUEUE_TEST_IDS];
+static int queue_produced = 0; /* events queued by queue_producer() */
+
+static struct onas_context queue_ctx;
+static struct onas_context *queue_pctx = &queue_ctx;
+static int queue_fd                    = -1;
+static char queue_path[PATH_MAX];
+
+void *onas_scan_worker(void *arg)
+{
+    struct onas_scan_event *event_data = arg;
+
+    pthread_mutex_lock(&queue_mutex);
+    queue_scans++;
+    queue_scanned[event_data->portnum]++;
+    pthread_cond_broadcast(&queue_cond);
+    while (!queue_gate_open) {
+        pthread_cond_wait(&queue_cond, &queue_mutex);
+    }
+    pthread_mutex_unlock(&queue_mutex);
+
+#if defined(HAVE_SYS_FANOTIFY_H)
+    if (NULL != event_data->fmd) {
+        close(event_data->fmd->fd);
+        free(event_data->fmd);
+    }
+#endif
+    free(event_data->pathname);
+    free(event_data);
+    return NULL;
+}
+
+static struct onas_scan_event *queue_inotify_event(int id, const char *path, uint8_t bool_opts)
+{
+    struct onas_scan_event *event_data = calloc(1, sizeof(*event_data));
+
+    ck_assert_msg(event_data != NULL, "calloc failed");
+    event_data->portnum   = id;
+    event_data->pathname  = strdup(path);
+    event_data->bool_opts = ONAS_SCTH_B_INOTIFY | ONAS_SCTH_B_SCAN | bool_opts;
+    return event_data;
+}
+
+#if defined(HAVE_SYS_FANOTIFY_H)
+static struct onas_scan_event *queue_fanotify_event(int id, uint64_t mask)
+{
+    struct onas_scan_event *event_data = calloc(1, sizeof(*event_data));
+
+    ck_assert_msg(event_data != NULL, "calloc failed");
+    event_data->fmd = calloc(1, sizeof(*event_data->fmd));
+    ck_assert_msg(event_data->fmd != NULL, "calloc failed");
+    event_data->fmd->fd   = dup(queue_fd);
+    event_data->fmd->mask = mask;
+    event_data->portnum   = id;
+    event_data->bool_opts = ONAS_SCTH_B_FANOTIFY;
+    return event_data;
+}
+#endif
+
+static void queue_event(struct onas_scan_event *event_data)
+{
+    ck_assert_msg(onas_queue_event(event_data) == CL_SUCCESS, "onas_queue_event failed");
+}
+
+static void queue_wait_scans(int scans)
+{
+    pthread_mutex_lock(&queue_mutex);
+    while (queue_scans < scans) {
+        pthread_cond_wait(&queue_cond, &queue_mutex);
+    }
+    pthread_mutex_unlock(&queue_mutex);
+}
+
+static void queue_open_gate(void)
+{
+    pthread_mutex_lock(&queue_mutex);
+    queue_gate_open = 1;
+    pthread_cond_broadcast(&queue_cond);
+    pthread_mutex_unlock(&queue_mutex);
+}
+
+/* starts the queue, with a first event (id 0) that a worker holds at the gate */
+static void queue_start(int32_t maxthreads)
+{
+    queue_ctx.maxthreads = maxthreads;
+    ck_assert_msg(onas_scan_queue_start(&queue_pctx) == CL_SUCCESS, "onas_scan_queue_start failed");
+
+    queue_event(queue_inotify_event(0, "/queue-test/held", 0));
+    queue_wait_scans(1);
+}
+
+/* stops the queue the way clamonacc does, which lets the workers drain it first */
+static void queue_stop(void)
+{
+    pthread_cancel(scan_queue_pid);
+    pthread_join(scan_queue_pid, NULL);
+    scan_queue_pid = 0;
+}
+
+static void *queue_producer(void *arg)
+{
+    queue_event(queue_inotify_event((int)(intptr_t)arg, "/queue-test/last", 0));
+
+    pthread_mutex_lock(&queue_mutex);
+    queue_produced++;
+    pthread_mutex_unlock(&queue_mutex);
+    return NULL;
+}
+
+static void queue_setup(void)
+{
+    memset(&queue_ctx, 0, sizeof(queue_ctx));
+    memset(queue_scanned, 0, sizeof(queue_scanned));
+    queue_gate_open = 0;
+    queue_scans     = 0;
+    queue_produced  = 0;
+
+    snprintf(queue_path, sizeof(queue_path), OBJDIR PATHSEP "onas-queue-XXXXXX");
+    queue_fd = mkstemp(queue_path);
+    ck_assert_msg(queue_fd >= 0, "mkstemp failed for %s", queue_path);
+}
+
+static void queue_teardown(void)
+{
+    queue_open_gate();
+    if (scan_queue_pid) {
+        queue_stop();
+    }
+    close(queue_fd);
+    unlink(queue_path);
+}
+
+START_TEST(test_queue_full)
+{
+    char path[64];
+    pthread_t producer;
+    int i, produced;
+
+    queue_start(1);
+
+    /* the worker holds the first event, so the ring takes exactly this many more */
+    for (i = 1; i <= ONAS_QUEUE_SIZE; i++) {
+        snprintf(path, sizeof(path), "/queue-test/%d", i);
+        queue_event(queue_inotify_event(i, path, 0));
+    }
+
+    /* one more has to wait for room */
+    ck_assert_msg(pthread_create(&producer, NULL, queue_producer, (void *)(intptr_t)(ONAS_QUEUE_SIZE + 1)) == 0, "could not start the producer");
+    usleep(200000);
+    pthread_mutex_lock(&queue_mutex);
+    produced = queue_produced;
+    pthread_mutex_unlock(&queue_mutex);
+    ck_assert_msg(produced == 0, "an event was queued into a full ring");
+
+    queue_open_gate();
+    pthread_join(producer, NULL);
+    queue_stop();
+
+    ck_assert_msg(queue_scans == ONAS_QUEUE_SIZE + 2, "%d events scanned", queue_scans);
+    for (i = 0; i < ONAS_QUEUE_SIZE + 2; i++) {
+        ck_assert_msg(queue_scanned[i] == 1, "event %d scanned %d times", i, queue_scanned[i]);
+    }
+}
+END_TEST
+
+START_TEST(test_queue_coalesce)
+{
+    int i, scans = 1;
+
+    queue_start(1);
+
+    /* repeats of an event that is still queued are folded into it */
+    for (i = 0; i < 3; i++) {
+        queue_event(queue_inotify_event(1, "/queue-test/a", 0));
+        queue_event(queue_inotify_event(2, "/queue-test/b", 0));
+    }
+    scans += 2;
+
+    /* the same path with other options is another event */
+    queue_event(queue_inotify_event(3, "/queue-test/a", ONAS_SCTH_B_FILE));
+    scans++;
+
+#if defined(HAVE_SYS_FANOTIFY_H)
+    /* fanotify events are folded by inode */
+    for (i = 0; i < 3; i++) {
+        queue_event(queue_fanotify_event(4, FAN_CLOSE_WRITE));
+    }
+    scans++;
+#endif
+
+    queue_open_gate();
+    queue_wait_scans(scans);
+    for (i = 0; i < scans; i++) {
+        ck_assert_msg(queue_scanned[i] == 1, "event %d scanned %d times", i, queue_scanned[i]);
+    }
+
+    /* once a worker took it, a repeat is scanned again */
+    queue_event(queue_inotify_event(1, "/queue-test/a", 0));
+    queue_wait_scans(scans + 1);
+    ck_assert_msg(queue_scanned[1] == 2, "repeat scanned %d times", queue_scanned[1] - 1);
+
+    queue_stop();
+    ck_assert_msg(queue_scans == scans + 1, "%d events scanned", queue_scans);
+}
+END_TEST
+
+#if defined(HAVE_SYS_FANOTIFY_H)
+START_TEST(test_queue_permission_events)
+{
+    int i;
+
+    queue_start(1);
+
+    /* somebody waits on the answer to each of these, so none may be dropped */
+    for (i = 0; i < 3; i++) {
+        queue_event(queue_fanotify_event(1, FAN_OPEN_PERM));
+    }
+
+    queue_open_gate();
+    queue_stop();
+    ck_assert_msg(queue_scanned[1] == 3, "%d of 3 permission events scanned", queue_scanned[1]);
+}
+END_TEST
+#endif
+
+START_TEST(test_queue_drain)
+{
+    char path[64];
+    int i;
+
+    queue_start(4);
+
+    for (i = 1; i <= 100; i++) {
+        snprintf(path, sizeof(path), "/queue-test/%d", i);
+        queue_event(queue_inotify_event(i, path, 0));
+    }
+
+    /* the events still queued are scanned before the queue goes away */
+    queue_open_gate();
+    queue_stop();
+
+    ck_assert_msg(queue_scans == 101, "%d of 101 events scanned", queue_scans);
+    for (i = 0; i <= 100; i++) {
+        ck_assert_msg(queue_scanned[i] == 1, "event %d scanned %d times", i, queue_scanned[i]);
+    }
+}
+END_TEST
+
+static Suite *test_clamonacc_suite(void)
+{
+    Suite *s = suite_create("clamonacc");
+    TCase *tc_cache, *tc_pool, *tc_queue;
+
+    tc_cache = tcase_create("verdict cache");
+    suite_add_tcase(s, tc_cache);
+    tcase_add_checked_fixture(tc_cache, cache_setup, cache_teardown);
+    tcase_add_test(tc_cache, test_cache_hit_and_change);
+    tcase_add_test(tc_cache, test_cache_racy_window);
+    tcase_add_test(tc_cache, test_cache_generation_bump);
+    tcase_add_test(tc_cache, test_cache_eviction);
+
+    tc_pool = tcase_create("connection pool");
+    suite_add_tcase(s, tc_pool);
+    tcase_add_checked_fixture(tc_pool, pool_setup, pool_teardown);
+    tcase_add_test(tc_pool, test_pool_scans);
+    tcase_add_test(tc_pool, test_pool_broken_session);
+    tcase_add_test(tc_pool, test_pool_destroy);
+
+    tc_queue = tcase_create("scan queue");
+    suite_add_tcase(s, tc_queue);
+    tcase_add_checked_fixture(tc_queue, queue_setup, queue_teardown);
+    tcase_add_test(tc_queue, test_queue_full);
+    tcase_add_test(tc_queue, test_queue_coalesce);
+#if defined(HAVE_SYS_FANOTIFY_H)
+    tcase_add_test(tc_queue, test_queue_permission_events);
+#endif
+    tcase_add_test(tc_queue, test_queue_drain);
+
+    return s;
+}
+
+int main(int argc, char **argv)
+{
+    int nf;
+
+    UNUSEDPARAM(argc);
+    UNUSEDPARAM(argv);
+
+    /* a session clamd hung up on must fail the send, not kill the test */
+    signal(SIGPIPE, SIG_IGN);
+
+    Suite *s    = test_clamonacc_suite();
+    SRunner *sr = srunner_create(s);
+    srunner_set_log(sr, OBJDIR PATHSEP "test-clamonacc.log");
+    srunner_run_all(sr, CK_NORMAL);
+    nf = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (nf == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
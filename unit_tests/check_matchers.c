@@ -25,6 +25,9 @@
 #include <check.h>
 #include <stdio.h>
 #include <string.h>
+#ifdef CL_THREAD_SAFE
+#include <pthread.h>
+#endif
 
 // libclamav
 #include "clamav.h"
@@ -150,6 +153,30 @@ static const struct pcre_testdata_s {
 
     {NULL, NULL, NULL, ACPATT_OPTION_NOOPTS, NULL, CL_CLEAN}};
 
+static const char *lsig_expr_testdata[] = {
+    "0",
+    "0&1",
+    "0|1",
+    "0&1&2|3",
+    "(0|1)&(2|3)",
+    "0>1",
+    "0<2&1=0",
+    "(0|1|2)>2",
+    "(0|1|2)>1,2",
+    "(0&1)=0",
+    "((0|1)&2)|(3>2&(4|5)<1)",
+    "(0|(1&2))>0,2&3",
+    NULL};
+
+static const uint32_t lsig_cnt_testdata[][6] = {
+    {0, 0, 0, 0, 0, 0},
+    {1, 0, 0, 0, 0, 0},
+    {0, 1, 1, 0, 0, 0},
+    {2, 0, 3, 1, 0, 0},
+    {1, 1, 1, 3, 0, 1},
+    {5, 2, 0, 0, 4, 0},
+    {3, 3, 3, 3, 3, 3}};
+
 static cli_ctx ctx;
 static struct cl_scan_options options;
 
@@ -452,6 +479,117 @@ START_TEST(test_bm_scanbuff_allscan)
 }
 END_TEST
 
+START_TEST(test_bm_scanbuff_prefilter)
+{
+    struct cli_matcher *root;
+    const char *virname = NULL;
+    unsigned char buf[64];
+    unsigned int i;
+    int ret;
+
+    root = ctx.engine->root[0];
+    ck_assert_msg(root != NULL, "root == NULL");
+
+#ifdef USE_MPOOL
+    root->mempool = mpool_create();
+#endif
+    ret = cli_bm_init(root);
+    ck_assert_msg(ret == CL_SUCCESS, "cli_bm_init() failed");
+
+    ret = cli_add_content_match_pattern(root, "Sig1", "deadbabe", 0, 0, 0, "*", NULL, 0);
+    ck_assert_msg(ret == CL_SUCCESS, "cli_add_content_match_pattern failed");
+    ret = cli_add_content_match_pattern(root, "Sig2", "deadbeef", 0, 0, 0, "*", NULL, 0);
+    ck_assert_msg(ret == CL_SUCCESS, "cli_add_content_match_pattern failed");
+    ret = cli_add_content_match_pattern(root, "Sig3", "babedead", 0, 0, 0, "*", NULL, 0);
+    ck_assert_msg(ret == CL_SUCCESS, "cli_add_content_match_pattern failed");
+
+    /* the prefilter is only used if the CPU has it, the results must not change */
+    ret = cli_bm_build(root);
+    ck_assert_msg(ret == CL_SUCCESS, "cli_bm_build() failed");
+
+    ctx.options->general &= ~CL_SCAN_GENERAL_ALLMATCHES; /* make sure all-match is disabled */
+
+    memset(buf, 'a', sizeof(buf));
+    ret = cli_bm_scanbuff(buf, sizeof(buf), &virname, NULL, root, 0, NULL, NULL, NULL);
+    ck_assert_msg(ret == CL_CLEAN, "cli_bm_scanbuff() found a signature in a clean buffer");
+
+    /* every position: in the 16 byte blocks, across them and in the tail */
+    for (i = 0; i <= sizeof(buf) - 4; i++) {
+        memset(buf, 'a', sizeof(buf));
+        memcpy(buf + i, "\xba\xbe\xde\xad", 4);
+        virname = NULL;
+        ret     = cli_bm_scanbuff(buf, sizeof(buf), &virname, NULL, root, 0, NULL, NULL, NULL);
+        ck_assert_msg(ret == CL_VIRUS, "cli_bm_scanbuff() failed at offset %u", i);
+        ck_assert_msg(virname && !strcmp(virname, "Sig3"), "Incorrect signature matched in cli_bm_scanbuff() at offset %u\n", i);
+    }
+}
+END_TEST
+
+START_TEST(test_bm_scanbuff_anchored)
+{
+    struct cli_matcher *root;
+    unsigned char buf[64];
+    int ret;
+
+    root = ctx.engine->root[0];
+    ck_assert_msg(root != NULL, "root == NULL");
+
+#ifdef USE_MPOOL
+    root->mempool = mpool_create();
+#endif
+    ret = cli_ac_init(root, CLI_DEFAULT_AC_MINDEPTH, CLI_DEFAULT_AC_MAXDEPTH, 1);
+    ck_assert_msg(ret == CL_SUCCESS, "cli_ac_init() failed");
+    ret = cli_bm_init(root);
+    ck_assert_msg(ret == CL_SUCCESS, "cli_bm_init() failed");
+    ret = cli_bm_init_anchored(root);
+    ck_assert_msg(ret == CL_SUCCESS, "cli_bm_init_anchored() failed");
+
+    ret = cli_add_content_match_pattern(root, "Abs", "deadbeef", 0, 0, 0, "10", NULL, 0);
+    ck_assert_msg(ret == CL_SUCCESS, "cli_add_content_match_pattern failed");
+    ret = cli_add_content_match_pattern(root, "Eof", "babecafe", 0, 0, 0, "EOF-8", NULL, 0);
+    ck_assert_msg(ret == CL_SUCCESS, "cli_add_content_match_pattern failed");
+    ret = cli_add_content_match_pattern(root, "Float", "cafed00d", 0, 0, 0, "*", NULL, 0);
+    ck_assert_msg(ret == CL_SUCCESS, "cli_add_content_match_pattern failed");
+    ck_assert_msg(root->bm_anchored->bm_patterns == 2, "%u signatures at exact offsets", root->bm_anchored->bm_patterns);
+
+    ret = cli_bm_build(root);
+    ck_assert_msg(ret == CL_SUCCESS, "cli_bm_build() failed");
+    ret = cli_ac_buildtrie(root);
+    ck_assert_msg(ret == CL_SUCCESS, "cli_ac_buildtrie() failed");
+
+    /* a buffer has no target to resolve EOF-8 against, only the absolute offset is known */
+    ck_assert_msg(root->bm_anchored->bm_absoff.cnt == 1, "%u absolute offsets", root->bm_anchored->bm_absoff.cnt);
+
+    ctx.options->general &= ~CL_SCAN_GENERAL_ALLMATCHES; /* make sure all-match is disabled */
+
+    memset(buf, 'a', sizeof(buf));
+    memcpy(buf + 10, "\xde\xad\xbe\xef", 4);
+    ret = cli_scan_buff(buf, sizeof(buf), 0, &ctx, 0, NULL);
+    ck_assert_msg(ret == CL_VIRUS, "cli_scan_buff() missed the signature at its offset");
+
+    memset(buf, 'a', sizeof(buf));
+    memcpy(buf + 11, "\xde\xad\xbe\xef", 4);
+    ret = cli_scan_buff(buf, sizeof(buf), 0, &ctx, 0, NULL);
+    ck_assert_msg(ret == CL_CLEAN, "cli_scan_buff() matched a signature off its offset");
+
+    /* the offset is that of the buffer in the data scanned */
+    ret = cli_scan_buff(buf + 1, sizeof(buf) - 1, 0, &ctx, 0, NULL);
+    ck_assert_msg(ret == CL_VIRUS, "cli_scan_buff() missed the signature at its offset");
+    ret = cli_scan_buff(buf + 1, sizeof(buf) - 1, 1, &ctx, 0, NULL);
+    ck_assert_msg(ret == CL_CLEAN, "cli_scan_buff() matched a signature off its offset");
+
+    memset(buf, 'a', sizeof(buf));
+    memcpy(buf + sizeof(buf) - 8, "\xba\xbe\xca\xfe", 4);
+    ret = cli_scan_buff(buf, sizeof(buf), 0, &ctx, 0, NULL);
+    ck_assert_msg(ret == CL_CLEAN, "cli_scan_buff() matched an EOF signature without a target");
+
+    memset(buf, 'a', sizeof(buf));
+    memcpy(buf + 33, "\xca\xfe\xd0\x0d", 4);
+    ret = cli_scan_buff(buf, sizeof(buf), 0, &ctx, 0, NULL);
+    ck_assert_msg(ret == CL_VIRUS, "cli_scan_buff() missed the floating signature");
+}
+END_TEST
+
 START_TEST(test_pcre_scanbuff)
 {
     struct cli_ac_data mdata;
@@ -570,6 +708,143 @@ START_TEST(test_pcre_scanbuff_allscan)
 }
 END_TEST
 
+START_TEST(test_lsig_compile)
+{
+    struct cli_matcher *root;
+    unsigned int i, j;
+
+    root = ctx.engine->root[0];
+    ck_assert_msg(root != NULL, "root == NULL");
+
+    for (i = 0; lsig_expr_testdata[i]; i++) {
+        struct cli_ac_lsig lsig;
+        const char *logic = lsig_expr_testdata[i];
+
+        memset(&lsig, 0, sizeof(lsig));
+        lsig.type    = CLI_LSIG_NORMAL;
+        lsig.u.logic = (char *)logic;
+
+        ck_assert_msg(cli_ac_lsig_compile(root, &lsig) == CL_SUCCESS, "[lsig] cli_ac_lsig_compile() failed for %s", logic);
+        ck_assert_msg(lsig.prog != NULL, "[lsig] %s wasn't compiled", logic);
+
+        for (j = 0; j < sizeof(lsig_cnt_testdata) / sizeof(lsig_cnt_testdata[0]); j++) {
+            uint32_t lsigcnt[64] = {0};
+            unsigned int text_cnt = 0, prog_cnt = 0;
+            uint64_t text_ids = 0, prog_ids = 0;
+            int text_ret, prog_ret;
+
+            memcpy(lsigcnt, lsig_cnt_testdata[j], sizeof(lsig_cnt_testdata[j]));
+
+            text_ret = cli_ac_chklsig(logic, logic + strlen(logic), lsigcnt, &text_cnt, &text_ids, 0);
+            prog_ret = cli_ac_lsig_check(&lsig, lsigcnt, &prog_cnt, &prog_ids);
+
+            ck_assert_msg(text_ret == prog_ret, "[lsig] %s with counts %u: result %d != %d", logic, j, prog_ret, text_ret);
+            ck_assert_msg(text_cnt == prog_cnt, "[lsig] %s with counts %u: count %u != %u", logic, j, prog_cnt, text_cnt);
+            ck_assert_msg(text_ids == prog_ids, "[lsig] %s with counts %u: subsigs %llx != %llx", logic, j,
+                          (unsigned long long)prog_ids, (unsigned long long)text_ids);
+        }
+
+        MPOOL_FREE(root->mempool, lsig.prog);
+    }
+}
+END_TEST
+
+#ifdef CL_THREAD_SAFE
+struct ac_data_reuse_job {
+    struct cli_matcher *root;
+    uint32_t **lsigcnt;
+    cl_error_t ret;
+};
+
+static void *ac_data_reuse_th(void *arg)
+{
+    struct ac_data_reuse_job *job = arg;
+    struct cli_ac_data mdata;
+
+    job->ret = cli_ac_initdata_pool(job->root, &mdata);
+    if (job->ret == CL_SUCCESS) {
+        job->lsigcnt = mdata.lsigcnt;
+        cli_ac_freedata(&mdata);
+    }
+    return NULL;
+}
+#endif
+
+START_TEST(test_ac_data_reuse)
+{
+    struct cli_ac_data mdata;
+    struct cli_matcher *root;
+    unsigned int i, round;
+    cl_error_t ret;
+#ifdef CL_THREAD_SAFE
+    struct ac_data_reuse_job job;
+    uint32_t **lsigcnt;
+    pthread_t th;
+#endif
+
+    root = ctx.engine->root[0];
+    ck_assert_msg(root != NULL, "root == NULL");
+    root->ac_only = 1;
+
+#ifdef USE_MPOOL
+    root->mempool = mpool_create();
+#endif
+    ret = cli_ac_init(root, CLI_DEFAULT_AC_MINDEPTH, CLI_DEFAULT_AC_MAXDEPTH, 1);
+    ck_assert_msg(ret == CL_SUCCESS, "cli_ac_init() failed");
+
+    ret = cli_add_content_match_pattern(root, ac_testdata[0].virname, ac_testdata[0].hexsig, 0, 0, 0, "*", NULL, 0);
+    ck_assert_msg(ret == CL_SUCCESS, "cli_add_content_match_pattern failed");
+
+    /* match state for logical signatures, without the signatures themselves */
+    root->ac_lsigs = 100;
+
+    ret = cli_ac_buildtrie(root);
+    ck_assert_msg(ret == CL_SUCCESS, "cli_ac_buildtrie() failed");
+
+    for (round = 0; round < 3; round++) {
+        ret = cli_ac_initdata_pool(root, &mdata);
+        ck_assert_msg(ret == CL_SUCCESS, "[reuse] cli_ac_initdata_pool() failed");
+
+        /* anything left over from the previous round must have been reset */
+        for (i = 0; i < root->ac_lsigs; i++) {
+            ck_assert_msg(mdata.lsigcnt[i][round] == 0, "[reuse] round %u: lsig %u has a stale count", round, i);
+            ck_assert_msg(mdata.lsigsuboff_first[i][round] == CLI_OFF_NONE, "[reuse] round %u: lsig %u has a stale offset", round, i);
+        }
+
+        for (i = round; i < root->ac_lsigs; i += 7) {
+            ck_assert_msg(lsig_increment_subsig_match(&mdata, i, round) == CL_SUCCESS, "[reuse] lsig_increment_subsig_match() failed");
+            ck_assert_msg(lsig_increment_subsig_match(&mdata, i, round + 1) == CL_SUCCESS, "[reuse] lsig_increment_subsig_match() failed");
+            mdata.lsigsuboff_first[i][round] = i;
+        }
+        for (i = 0; i < root->ac_lsigs; i++) {
+            ck_assert_msg(mdata.lsigcnt[i][round] == (i >= round && (i - round) % 7 == 0), "[reuse] round %u: lsig %u has a wrong count", round, i);
+        }
+
+        cli_ac_freedata(&mdata);
+    }
+
+#ifdef CL_THREAD_SAFE
+    /* the data released by a thread is only handed out to that thread again */
+    ret = cli_ac_initdata_pool(root, &mdata);
+    ck_assert_msg(ret == CL_SUCCESS, "[reuse] cli_ac_initdata_pool() failed");
+    lsigcnt = mdata.lsigcnt;
+    cli_ac_freedata(&mdata);
+
+    memset(&job, 0, sizeof(job));
+    job.root = root;
+    ck_assert_msg(!pthread_create(&th, NULL, ac_data_reuse_th, &job), "pthread_create failed");
+    pthread_join(th, NULL);
+    ck_assert_msg(job.ret == CL_SUCCESS, "[reuse] cli_ac_initdata_pool() failed in a thread");
+    ck_assert_msg(job.lsigcnt != lsigcnt, "[reuse] a thread got the match data released by another one");
+
+    ret = cli_ac_initdata_pool(root, &mdata);
+    ck_assert_msg(ret == CL_SUCCESS, "[reuse] cli_ac_initdata_pool() failed");
+    ck_assert_msg(mdata.lsigcnt == lsigcnt, "[reuse] the match data released by this thread wasn't reused");
+    cli_ac_freedata(&mdata);
+#endif
+}
+END_TEST
+
 Suite *test_matchers_suite(void)
 {
     Suite *s = suite_create("matchers");
@@ -584,6 +859,10 @@ Suite *test_matchers_suite(void)
     tcase_add_test(tc_matchers, test_ac_scanbuff_allscan);
     tcase_add_test(tc_matchers, test_ac_scanbuff_allscan_ex);
     tcase_add_test(tc_matchers, test_bm_scanbuff_allscan);
+    tcase_add_test(tc_matchers, test_bm_scanbuff_prefilter);
+    tcase_add_test(tc_matchers, test_bm_scanbuff_anchored);
     tcase_add_test(tc_matchers, test_pcre_scanbuff_allscan);
+    tcase_add_test(tc_matchers, test_lsig_compile);
+    tcase_add_test(tc_matchers, test_ac_data_reuse);
     return s;
 }
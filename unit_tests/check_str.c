@@ -29,6 +29,7 @@
 #include <stdlib.h>
 #include <limits.h>
 #include <string.h>
+#include <time.h>
 #include <check.h>
 
 // libclamav
@@ -38,6 +39,8 @@
 #include "entconv.h"
 #include "mbox.h"
 #include "message.h"
+#include "conv.h"
+#include "textdecode.h"
 #include "jsparse/textbuf.h"
 
 #include "checks.h"
@@ -212,6 +215,351 @@ START_TEST(test_base64)
 }
 END_TEST
 
+START_TEST(test_base64_multiline)
+{
+    /* quanta split across lines are carried over */
+    static const char *lines[] = {"Zm9vY", "mFy", "Zm9v", "YmF", "yZg=="};
+    const char expected[]      = "foobarfoobarf";
+    unsigned char buf[1024], *ret = buf, *ptr;
+    size_t i;
+    message *m = messageCreate();
+    ck_assert_msg(!!m, "Unable to create message");
+
+    for (i = 0; i < sizeof(lines) / sizeof(lines[0]); i++) {
+        ret = decodeLine(m, BASE64, lines[i], ret, sizeof(buf) - (ret - buf));
+        ck_assert_msg(!!ret, "unable to decode line %s", lines[i]);
+    }
+    ptr = base64Flush(m, ret);
+    if (ptr)
+        ret = ptr;
+
+    ck_assert_msg((size_t)(ret - buf) == sizeof(expected) - 1, "invalid base64 decoded length: %u expected %u",
+                  (unsigned)(ret - buf), (unsigned)(sizeof(expected) - 1));
+    ck_assert_msg(!memcmp(buf, expected, sizeof(expected) - 1), "invalid base64 decoded data");
+    messageDestroy(m);
+}
+END_TEST
+
+static struct qplines {
+    const char *line;
+    const char *decoded;
+    bool softbreak;
+} qptests[] = {
+    {"", "", false},
+    {"plain text", "plain text", false},
+    {"caf=C3=A9", "caf\xc3\xa9", false},
+    {"soft=", "soft", true},
+    {"a=3d=3Db", "a==b", false},
+    /* broken encoders that don't escape '=' */
+    {"<a href=\"x\">", "<a href=\"x\">", false},
+    {"trailing=4", "trailing\x04", false}};
+
+START_TEST(test_qp_decode_line)
+{
+    const struct qplines *test = &qptests[_i];
+    uint8_t buf[64];
+    bool softbreak;
+    size_t len;
+
+    len = cli_qp_decode_line(test->line, strlen(test->line), buf, sizeof(buf), &softbreak);
+    ck_assert_msg(len == strlen(test->decoded), "invalid QP decoded length for '%s': %u expected %u",
+                  test->line, (unsigned)len, (unsigned)strlen(test->decoded));
+    ck_assert_msg(!memcmp(buf, test->decoded, len), "invalid QP decoded data for '%s'", test->line);
+    ck_assert_msg(softbreak == test->softbreak, "invalid QP soft line break for '%s'", test->line);
+
+    /* output is capped */
+    len = cli_qp_decode_line(test->line, strlen(test->line), buf, 2, &softbreak);
+    ck_assert_msg(len <= 2, "QP output overflow for '%s'", test->line);
+}
+END_TEST
+
+START_TEST(test_base64_stream)
+{
+    uint8_t data[1000], *decoded;
+    char *encoded;
+    size_t enclen, split, len;
+    unsigned i;
+    struct cli_base64_state state;
+    const char *crlf = "Zm9v\r\nYm Fy\nZm9vYmFyZm9vYmFyZm9vYmFyZm9vYmFyZm9vYmFyZm9vYmFy";
+
+    /* long enough to take the vectorised path, and every split point across it */
+    for (i = 0; i < sizeof(data); i++)
+        data[i] = (uint8_t)(i * 7 + (i >> 3));
+    encoded = cl_base64_encode(data, sizeof(data));
+    ck_assert_msg(!!encoded, "cl_base64_encode failed");
+    enclen  = strlen(encoded);
+    decoded = malloc((enclen + 3) / 4 * 3 + 3);
+    ck_assert_msg(!!decoded, "malloc failed");
+
+    for (split = 0; split <= enclen; split++) {
+        cli_base64_init(&state);
+        len = cli_base64_decode(&state, (const uint8_t *)encoded, split, decoded);
+        len += cli_base64_decode(&state, (const uint8_t *)encoded + split, enclen - split, decoded + len);
+        len += cli_base64_finish(&state, decoded + len);
+        ck_assert_msg(!state.invalid, "invalid state at split %u", (unsigned)split);
+        ck_assert_msg(len == sizeof(data), "invalid base64 decoded length at split %u: %u",
+                      (unsigned)split, (unsigned)len);
+        ck_assert_msg(!memcmp(decoded, data, sizeof(data)), "invalid base64 decoded data at split %u",
+                      (unsigned)split);
+    }
+
+    /* characters outside of the alphabet are skipped, whatever the alignment */
+    cli_base64_init(&state);
+    len = cli_base64_decode(&state, (const uint8_t *)crlf, strlen(crlf), decoded);
+    ck_assert_msg(len == 42 && !memcmp(decoded, "foobarfoobar", 12), "base64 with line breaks");
+
+    cli_base64_init(&state);
+    len = cli_base64_decode(&state, (const uint8_t *)"Zm8=Zm9v", 8, decoded);
+    ck_assert_msg(len == 2 && state.done && !state.invalid, "data after padding should be ignored");
+
+    cli_base64_init(&state);
+    (void)cli_base64_decode(&state, (const uint8_t *)"Z===", 4, decoded);
+    ck_assert_msg(state.invalid, "misplaced padding not detected");
+
+    free(encoded);
+    free(decoded);
+}
+END_TEST
+
+START_TEST(test_hex_decode)
+{
+    const char in[] = "48 65\n6C6c6F2c20776f726c6421\r\n0a 7>ff";
+    const char expected[] = "Hello, world!\n\x70";
+    uint8_t out[sizeof(in)];
+    size_t outlen, used, split, len;
+    struct cli_hex_state state;
+
+    for (split = 0; split < sizeof(in) - 1; split++) {
+        cli_hex_init(&state);
+        ck_assert_msg(cli_hex_decode(&state, (const uint8_t *)in, split, out, &outlen, &used) == CL_SUCCESS,
+                      "cli_hex_decode failed at split %u", (unsigned)split);
+        len = outlen;
+        ck_assert_msg(cli_hex_decode(&state, (const uint8_t *)in + split, sizeof(in) - 1 - split, out + len, &outlen, &used) == CL_SUCCESS,
+                      "cli_hex_decode failed at split %u", (unsigned)split);
+        len += outlen;
+        len += cli_hex_finish(&state, out + len);
+        ck_assert_msg(len == sizeof(expected) - 1 && !memcmp(out, expected, len),
+                      "invalid hex decoded data at split %u", (unsigned)split);
+    }
+
+    cli_hex_init(&state);
+    ck_assert_msg(cli_hex_decode(&state, (const uint8_t *)"4865xx", 6, out, &outlen, &used) == CL_EFORMAT,
+                  "invalid hex digit not detected");
+    ck_assert_msg(outlen == 2 && used == 4, "wrong position of invalid hex digit");
+}
+END_TEST
+
+/*
+ * The vector paths only run on pieces of at least 16 (hex) or 32 (base64)
+ * characters, so feeding the same input one character at a time decodes it
+ * with the scalar code alone. Both must agree on random input with white
+ * space and invalid characters scattered at every alignment.
+ */
+START_TEST(test_textdecode_simd_scalar)
+{
+    static const char b64chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    static const char hexchars[] = "0123456789abcdefABCDEF";
+    static const char noise[]    = " \r\n\t-!";
+    uint8_t buf[4096 + 3], simd[sizeof(buf)], scalar[sizeof(buf) + 2];
+    uint8_t *in;
+    size_t i, round, len, simdlen, scalarlen, outlen, used, simdused, scalarused;
+    uint32_t seed = 0x5EED;
+    cl_error_t simdret, scalarret;
+    struct cli_base64_state b64state;
+    struct cli_hex_state hexstate;
+
+    for (round = 0; round < 64; round++) {
+        /* unaligned starts and lengths that aren't a multiple of any vector or quantum size */
+        in  = buf + round % 3;
+        len = sizeof(buf) - 3 - round % 7;
+
+        /* base64: runs of clean input broken up by line breaks and junk */
+        for (i = 0; i < len; i++) {
+            seed = seed * 1103515245 + 12345;
+            if ((seed >> 16) % (round + 2) == 0)
+                in[i] = noise[(seed >> 8) % (sizeof(noise) - 1)];
+            else
+                in[i] = b64chars[(seed >> 8) % (sizeof(b64chars) - 1)];
+        }
+        if (round % 4 == 3) {
+            /* padding in the middle ends the data */
+            seed                  = seed * 1103515245 + 12345;
+            in[(seed >> 8) % len] = '=';
+        }
+
+        cli_base64_init(&b64state);
+        simdlen = cli_base64_decode(&b64state, in, len, simd);
+        simdlen += cli_base64_finish(&b64state, simd + simdlen);
+
+        cli_base64_init(&b64state);
+        scalarlen = 0;
+        for (i = 0; i < len; i++)
+            scalarlen += cli_base64_decode(&b64state, in + i, 1, scalar + scalarlen);
+        scalarlen += cli_base64_finish(&b64state, scalar + scalarlen);
+
+        ck_assert_msg(simdlen == scalarlen && !memcmp(simd, scalar, simdlen),
+                      "base64 vector and scalar results differ in round %u", (unsigned)round);
+
+        /* hex: runs of digits broken up by white space, an odd number of digits in
+         * every third round and an invalid character in every other round */
+        for (i = 0; i < len; i++) {
+            seed = seed * 1103515245 + 12345;
+            if ((seed >> 16) % (round + 2) == 0)
+                in[i] = noise[(seed >> 8) % 4];
+            else
+                in[i] = hexchars[(seed >> 8) % (sizeof(hexchars) - 1)];
+        }
+        if (round % 3 == 0) {
+            for (i = 0, used = 0; i < len; i++)
+                used += !!memchr(hexchars, in[i], sizeof(hexchars) - 1);
+            if (!(used & 1))
+                in[len - 1] = memchr(hexchars, in[len - 1], sizeof(hexchars) - 1) ? ' ' : 'a';
+        }
+        if (round & 1) {
+            seed                  = seed * 1103515245 + 12345;
+            in[(seed >> 8) % len] = 'g';
+        }
+
+        cli_hex_init(&hexstate);
+        simdret = cli_hex_decode(&hexstate, in, len, simd, &simdlen, &simdused);
+        if (simdret == CL_SUCCESS)
+            simdlen += cli_hex_finish(&hexstate, simd + simdlen);
+
+        cli_hex_init(&hexstate);
+        scalarret  = CL_SUCCESS;
+        scalarlen  = 0;
+        scalarused = 0;
+        while (scalarused < len) {
+            scalarret = cli_hex_decode(&hexstate, in + scalarused, 1, scalar + scalarlen, &outlen, &used);
+            scalarlen += outlen;
+            scalarused += used;
+            if (scalarret != CL_SUCCESS)
+                break;
+        }
+        if (scalarret == CL_SUCCESS)
+            scalarlen += cli_hex_finish(&hexstate, scalar + scalarlen);
+
+        ck_assert_msg(simdret == scalarret && simdused == scalarused,
+                      "hex vector and scalar results differ in round %u: %d@%u, %d@%u", (unsigned)round,
+                      simdret, (unsigned)simdused, scalarret, (unsigned)scalarused);
+        ck_assert_msg(simdlen == scalarlen && !memcmp(simd, scalar, simdlen),
+                      "hex vector and scalar output differ in round %u", (unsigned)round);
+    }
+}
+END_TEST
+
+/*
+ * Not part of the normal run, as it only prints the throughput of the vector
+ * paths against the scalar ones (fed in pieces too short for the vectors).
+ * Run with:
+ *     CK_TIMING=1 CK_RUN_CASE=textdecode ./check_clamav
+ */
+START_TEST(test_textdecode_timing)
+{
+    static const char b64chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    static const char hexchars[] = "0123456789abcdef";
+    const size_t size = 4 * 1024 * 1024, runs = 16, piece = 15;
+    uint8_t *in, *vec, *sca;
+    size_t i, run, veclen = 0, scalen = 0, outlen, used;
+    struct cli_base64_state b64state;
+    struct cli_hex_state hexstate;
+    clock_t start;
+    double vect, scat;
+
+    in  = malloc(size);
+    vec = malloc(size);
+    sca = malloc(size);
+    ck_assert_msg(in && vec && sca, "out of memory");
+
+    /* base64 as found in mail: 76 character lines */
+    for (i = 0; i < size; i++)
+        in[i] = i % 78 == 76 ? '\r' : i % 78 == 77 ? '\n' : b64chars[(i * 7 + i / 78) % 64];
+
+    start = clock();
+    for (run = 0; run < runs; run++) {
+        cli_base64_init(&b64state);
+        veclen = cli_base64_decode(&b64state, in, size, vec);
+    }
+    vect  = (double)(clock() - start) / CLOCKS_PER_SEC;
+    start = clock();
+    for (run = 0; run < runs; run++) {
+        cli_base64_init(&b64state);
+        for (i = 0, scalen = 0; i < size; i += piece)
+            scalen += cli_base64_decode(&b64state, in + i, (size - i < piece ? size - i : piece), sca + scalen);
+    }
+    scat = (double)(clock() - start) / CLOCKS_PER_SEC;
+    ck_assert_msg(veclen == scalen && !memcmp(vec, sca, veclen), "base64 vector and scalar output differ");
+    printf("base64: vector %.0f MB/s, scalar %.0f MB/s\n",
+           runs * size / (vect + 1e-9) / 1e6, runs * size / (scat + 1e-9) / 1e6);
+
+    /* hex as found in PDF streams: 64 digit lines */
+    for (i = 0; i < size; i++)
+        in[i] = i % 65 == 64 ? '\n' : hexchars[(i * 5 + i / 65) % 16];
+
+    start = clock();
+    for (run = 0; run < runs; run++) {
+        cli_hex_init(&hexstate);
+        ck_assert_msg(cli_hex_decode(&hexstate, in, size, vec, &veclen, &used) == CL_SUCCESS, "cli_hex_decode failed");
+    }
+    vect  = (double)(clock() - start) / CLOCKS_PER_SEC;
+    start = clock();
+    for (run = 0; run < runs; run++) {
+        cli_hex_init(&hexstate);
+        for (i = 0, scalen = 0; i < size; i += piece) {
+            ck_assert_msg(cli_hex_decode(&hexstate, in + i, (size - i < piece ? size - i : piece), sca + scalen, &outlen, &used) == CL_SUCCESS,
+                          "cli_hex_decode failed");
+            scalen += outlen;
+        }
+    }
+    scat = (double)(clock() - start) / CLOCKS_PER_SEC;
+    ck_assert_msg(veclen == scalen && !memcmp(vec, sca, veclen), "hex vector and scalar output differ");
+    printf("hex:    vector %.0f MB/s, scalar %.0f MB/s\n",
+           runs * size / (vect + 1e-9) / 1e6, runs * size / (scat + 1e-9) / 1e6);
+
+    free(in);
+    free(vec);
+    free(sca);
+}
+END_TEST
+
+START_TEST(test_ascii85_decode)
+{
+    const char in[]       = "87cURD]i,\"Ebo80 z\n~>garbage";
+    const char expected[] = "Hello World!\0\0\0\0";
+    uint8_t out[4 * sizeof(in)];
+    size_t outlen, used, split, len;
+    struct cli_ascii85_state state;
+
+    for (split = 0; split < sizeof(in) - 1; split++) {
+        cli_ascii85_init(&state);
+        ck_assert_msg(cli_ascii85_decode(&state, (const uint8_t *)in, split, out, &outlen, &used) == CL_SUCCESS,
+                      "cli_ascii85_decode failed at split %u", (unsigned)split);
+        len = outlen;
+        ck_assert_msg(cli_ascii85_decode(&state, (const uint8_t *)in + split, sizeof(in) - 1 - split, out + len, &outlen, &used) == CL_SUCCESS,
+                      "cli_ascii85_decode failed at split %u", (unsigned)split);
+        len += outlen;
+        ck_assert_msg(state.done, "EOD marker not found at split %u", (unsigned)split);
+        ck_assert_msg(len == sizeof(expected) - 1 && !memcmp(out, expected, len),
+                      "invalid ascii85 decoded data at split %u", (unsigned)split);
+    }
+
+    /* partial final group */
+    cli_ascii85_init(&state);
+    ck_assert_msg(cli_ascii85_decode(&state, (const uint8_t *)"87cURD]i,\"Ebo8~>", 16, out, &outlen, &used) == CL_SUCCESS,
+                  "cli_ascii85_decode failed on partial final group");
+    ck_assert_msg(outlen == 11 && !memcmp(out, "Hello World", 11), "invalid ascii85 partial final group");
+
+    cli_ascii85_init(&state);
+    ck_assert_msg(cli_ascii85_decode(&state, (const uint8_t *)"87cURD]i,\"Ebo80A~>", 18, out, &outlen, &used) == CL_EFORMAT,
+                  "single digit final group not detected");
+
+    cli_ascii85_init(&state);
+    ck_assert_msg(cli_ascii85_decode(&state, (const uint8_t *)"87cUzRD]i", 9, out, &outlen, &used) == CL_EFORMAT,
+                  "misplaced 'z' not detected");
+    ck_assert_msg(used == 4, "wrong position of misplaced 'z'");
+}
+END_TEST
+
 static struct {
     const char *u16;
     const char *u8;
@@ -256,7 +604,7 @@ END_TEST
 Suite *test_str_suite(void)
 {
     Suite *s = suite_create("str");
-    TCase *tc_cli_unescape, *tc_tbuf, *tc_str, *tc_decodeline;
+    TCase *tc_cli_unescape, *tc_tbuf, *tc_str, *tc_decodeline, *tc_textdecode;
 
     tc_cli_unescape = tcase_create("cli_unescape");
     suite_add_tcase(s, tc_cli_unescape);
@@ -282,6 +630,17 @@ Suite *test_str_suite(void)
     suite_add_tcase(s, tc_decodeline);
 
     tcase_add_loop_test(tc_decodeline, test_base64, 0, sizeof(base64tests) / sizeof(base64tests[0]));
+    tcase_add_test(tc_decodeline, test_base64_multiline);
+
+    tc_textdecode = tcase_create("textdecode");
+    suite_add_tcase(s, tc_textdecode);
+    tcase_add_test(tc_textdecode, test_base64_stream);
+    tcase_add_test(tc_textdecode, test_hex_decode);
+    tcase_add_test(tc_textdecode, test_textdecode_simd_scalar);
+    if (getenv("CK_TIMING"))
+        tcase_add_test(tc_textdecode, test_textdecode_timing);
+    tcase_add_test(tc_textdecode, test_ascii85_decode);
+    tcase_add_loop_test(tc_textdecode, test_qp_decode_line, 0, sizeof(qptests) / sizeof(qptests[0]));
 
     return s;
 }
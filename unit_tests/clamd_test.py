@@ -800,3 +800,120 @@ class TC(testcase.TestCase):
         expected_results = ['{}: OK'.format(testpath.name) for testpath in testpaths]
         expected_results.append('Infected files: 0')
         self.verify_output(output.out, expected=expected_results)
+
+    def start_clamd_numa(self, nodes, clamd_log):
+        '''
+        Start clamd with NUMAEngineReplicas, pretending that the host has the given number of NUMA nodes.
+        '''
+        config = '''
+            Foreground yes
+            PidFile {pid}
+            DatabaseDirectory {dbdir}
+            LogFile {log}
+            LogFileMaxSize 0
+            LogTime yes
+            LogClean yes
+            LogVerbose yes
+            ExitOnOOM yes
+            CommandReadTimeout 1
+            SelfCheck 1
+            NUMAEngineReplicas yes
+            '''.format(pid=TC.clamd_pid, dbdir=TC.path_db, log=clamd_log)
+        if operating_system == 'windows':
+            # Only have TCP socket option for Windows.
+            config += '''
+                TCPSocket {socket}
+                TCPAddr localhost
+                '''.format(socket=TC.clamd_port_num)
+        else:
+            # Use LocalSocket for Posix, because that's what check_clamd expects.
+            config += '''
+                LocalSocket {localsocket}
+                TCPSocket {tcpsocket}
+                TCPAddr localhost
+                '''.format(localsocket=TC.clamd_socket, tcpsocket=TC.clamd_port_num)
+
+        clamd_config = TC.path_tmp / 'clamd-test.conf'
+        clamd_config.write_text(config)
+
+        # clamd only reads the node count from the environment at startup.
+        os.environ['CLAMD_NUMA_NODES'] = str(nodes)
+        try:
+            self.start_clamd(clamd_config=clamd_config)
+        finally:
+            del os.environ['CLAMD_NUMA_NODES']
+
+        poll = self.proc.poll()
+        assert poll == None  # subprocess is alive if poll() returns None
+
+        return clamd_config
+
+    def test_clamd_13_numa_replicas(self):
+        '''
+        Verify that scans, RELOAD and SelfCheck work with one engine replica per NUMA node.
+        The nodes are faked, so this runs on any host.
+        '''
+        self.step_name('Testing clamd with NUMA engine replicas')
+
+        clamd_log = TC.path_tmp / 'clamd-numa.log'
+        clamd_config = self.start_clamd_numa(2, clamd_log)
+
+        testfile = TC.path_build / 'unit_tests' / 'input' / 'clamav_hdb_scanfiles' / 'clam.exe'
+        self.run_clamdscan('{}'.format(testfile),
+            expected_ec=1, expected_out=['ClamAV-Test-File.UNOFFICIAL FOUND', 'Infected files: 1'])
+
+        self.verify_log(str(clamd_log),
+            expected=['Loading one signature replica per NUMA node (2 nodes).', 'Loaded the engine replicas for 2 NUMA nodes'],
+            unexpected=['Failed to load the NUMA replicas', 'doesn\'t match the primary'])
+
+        #
+        # RELOAD loads the replicas again, along with the new primary engine.
+        #
+        (TC.path_tmp / 'numa-testfile').write_bytes(b'ClamAV-NUMA-Test')
+        (TC.path_db / 'numa-test.ndb').write_text('ClamAV-NUMA-TestFile:0:0:{}'.format(b'ClamAV-NUMA-Test'.hex()))
+
+        output = self.execute_command('{clamdscan} --reload -c {clamd_config}'.format(
+            clamdscan=TC.clamdscan, clamd_config=clamd_config))
+        assert output.ec == 0  # success
+
+        time.sleep(2) # give clamd a moment to reload
+
+        self.run_clamdscan('{} {}'.format(testfile, TC.path_tmp / 'numa-testfile'),
+            expected_ec=1, expected_out=['ClamAV-Test-File.UNOFFICIAL FOUND', 'ClamAV-NUMA-TestFile.UNOFFICIAL FOUND', 'Infected files: 2'])
+
+        assert clamd_log.read_text().count('Loaded the engine replicas for 2 NUMA nodes') == 2
+
+        #
+        # So does a reload started by SelfCheck.
+        #
+        (TC.path_tmp / 'numa-selfcheck-testfile').write_bytes(b'ClamAV-NUMA-SelfCheck-Test')
+        (TC.path_db / 'numa-selfcheck-test.ndb').write_text('ClamAV-NUMA-SelfCheck-TestFile:0:0:{}'.format(b'ClamAV-NUMA-SelfCheck-Test'.hex()))
+
+        for _ in range(30):
+            time.sleep(1)
+            if clamd_log.read_text().count('Loaded the engine replicas for 2 NUMA nodes') == 3:
+                break
+
+        self.verify_log(str(clamd_log),
+            expected=['SelfCheck: Database modification detected. Forcing reload.'],
+            unexpected=['Failed to load the NUMA replicas', 'doesn\'t match the primary'])
+        assert clamd_log.read_text().count('Loaded the engine replicas for 2 NUMA nodes') == 3
+
+        self.run_clamdscan('{} {}'.format(testfile, TC.path_tmp / 'numa-selfcheck-testfile'),
+            expected_ec=1, expected_out=['ClamAV-Test-File.UNOFFICIAL FOUND', 'ClamAV-NUMA-SelfCheck-TestFile.UNOFFICIAL FOUND', 'Infected files: 2'])
+
+    def test_clamd_14_numa_replicas_one_node(self):
+        '''
+        Verify that NUMAEngineReplicas does nothing on a single node host.
+        '''
+        self.step_name('Testing clamd with NUMA engine replicas on one node')
+
+        clamd_log = TC.path_tmp / 'clamd-numa-one-node.log'
+        self.start_clamd_numa(1, clamd_log)
+
+        testfile = TC.path_build / 'unit_tests' / 'input' / 'clamav_hdb_scanfiles' / 'clam.exe'
+        self.run_clamdscan('{}'.format(testfile),
+            expected_ec=1, expected_out=['ClamAV-Test-File.UNOFFICIAL FOUND', 'Infected files: 1'])
+
+        self.verify_log(str(clamd_log),
+            unexpected=['Loading one signature replica per NUMA node', 'Loaded the engine replicas'])
@@ -0,0 +1,42 @@
+# Copyright (C) 2025 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
+
+"""
+Run clamonacc unit tests
+"""
+
+import unittest
+
+import testcase
+
+
+class TC(testcase.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        super(TC, cls).setUpClass()
+
+    @classmethod
+    def tearDownClass(cls):
+        super(TC, cls).tearDownClass()
+
+    def setUp(self):
+        super(TC, self).setUp()
+
+    def tearDown(self):
+        super(TC, self).tearDown()
+        self.verify_valgrind_log()
+
+    def test_clamonacc_00_unit_test(self):
+        self.step_name('clamonacc unit tests')
+
+        # If no valgrind, valgrind and valgrind args are empty strings
+        command = '{valgrind} {valgrind_args} {check_clamonacc}'.format(
+            valgrind=TC.valgrind, valgrind_args=TC.valgrind_args, check_clamonacc=TC.check_clamonacc
+        )
+        output = self.execute_command(command)
+
+        assert output.ec == 0  # success
+
+        expected_results = [
+            '100%', 'Failures: 0', 'Errors: 0'
+        ]
+        self.verify_output(output.out, expected=expected_results)
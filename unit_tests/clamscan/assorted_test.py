@@ -282,3 +282,35 @@ class TC(testcase.TestCase):
         expected_results.append('Scanned files: 3')
         expected_results.append('Infected files: 0')
         self.verify_output(output.out, expected=expected_results)
+
+    def test_ldb_eval_without_subsig_match(self):
+        self.step_name('Test that logical signatures that hold without any subsig match are still evaluated')
+
+        (TC.path_tmp / 'zero-match.ldb').write_text(
+            "ClamAV-Test-Ldb-Match;Engine:52-255,Target:1;0;0:4d5a\n"
+            "ClamAV-Test-Ldb-NoMatch;Engine:52-255,Target:1;0;deadbeefcafebabe\n"
+            "ClamAV-Test-Ldb-ZeroMatch;Engine:52-255,Target:1;0=0;deadbeefcafebabe\n"
+        )
+
+        testpaths = [
+            TC.path_build / "unit_tests" / "input" / "clamav_hdb_scanfiles" / "clam.exe",
+        ]
+
+        testfiles = ' '.join([str(testpath) for testpath in testpaths])
+
+        command = '{valgrind} {valgrind_args} {clamscan} -d {path_db} --allmatch {testfiles}'.format(
+            valgrind=TC.valgrind, valgrind_args=TC.valgrind_args,
+            clamscan=TC.clamscan,
+            path_db=TC.path_tmp / 'zero-match.ldb',
+            testfiles=testfiles,
+        )
+        output = self.execute_command(command)
+
+        assert output.ec == 1  # virus found
+
+        expected_results = [
+            'clam.exe: ClamAV-Test-Ldb-Match.UNOFFICIAL FOUND',
+            'clam.exe: ClamAV-Test-Ldb-ZeroMatch.UNOFFICIAL FOUND',
+        ]
+        unexpected_results = ['ClamAV-Test-Ldb-NoMatch.UNOFFICIAL FOUND']
+        self.verify_output(output.out, expected=expected_results, unexpected=unexpected_results)
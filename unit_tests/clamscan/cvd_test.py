@@ -0,0 +1,124 @@
+# Copyright (C) 2020-2025 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
+
+"""
+Run clamscan tests.
+"""
+
+import gzip
+import hashlib
+import io
+import sys
+import tarfile
+
+sys.path.append('../unit_tests')
+import testcase
+
+
+def make_cud(members, sigs):
+    '''
+    Build an unsigned database container (.cud) from a list of (name, content) pairs.
+    It is loaded the same way as a CVD, only the digital signatures aren't checked.
+    '''
+    header = 'ClamAV-VDB:18 Oct 2026 12-00 +0000:1:{}:1:X:X:clamav:1792324800'.format(sigs)
+
+    info = header + '\n' + ''.join(
+        '{}:{}:{}\n'.format(name, len(content), hashlib.sha256(content).hexdigest()) for name, content in members
+    )
+
+    tar_data = io.BytesIO()
+    with tarfile.open(fileobj=tar_data, mode='w', format=tarfile.USTAR_FORMAT) as tar:
+        for name, content in [('test.info', info.encode())] + members:
+            member = tarfile.TarInfo(name)
+            member.size = len(content)
+            tar.addfile(member, io.BytesIO(content))
+
+    return header.encode().ljust(512, b' ') + gzip.compress(tar_data.getvalue())
+
+
+class TC(testcase.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        super(TC, cls).setUpClass()
+
+        TC.testfile = TC.path_tmp / 'cvd-test-file.txt'
+        TC.testfile.write_bytes(b'A file detected by the last signature of a large database.\n')
+
+        # Enough hash signatures to inflate to several of the 1 MiB blocks that
+        # the loader is fed with, so the block ring wraps around a few times.
+        nsigs = 120000
+        hdb = ''.join(
+            '{}:{}:Test.Filler.{}\n'.format(hashlib.md5(b'filler %d' % i).hexdigest(), 1000 + i, i) for i in range(nsigs)
+        )
+        hdb += '{}:{}:Test.CVD.Last\n'.format(hashlib.md5(TC.testfile.read_bytes()).hexdigest(), TC.testfile.stat().st_size)
+        hdb = hdb.encode()
+        assert len(hdb) > 5 * 1024 * 1024
+
+        TC.path_cud = TC.path_tmp / 'large' / 'test.cud'
+        TC.path_cud.parent.mkdir()
+        cud = make_cud([('test.hdb', hdb)], nsigs + 1)
+        TC.path_cud.write_bytes(cud)
+
+        # The same, with the gzip stream cut off half-way.
+        TC.path_truncated = TC.path_tmp / 'truncated' / 'test.cud'
+        TC.path_truncated.parent.mkdir()
+        TC.path_truncated.write_bytes(cud[:512 + (len(cud) - 512) // 2])
+
+        # The same, with garbage in the middle of the deflate data.
+        corrupt = bytearray(cud)
+        middle = 512 + (len(cud) - 512) // 2
+        for i in range(middle, middle + 64):
+            corrupt[i] ^= 0x5a
+        TC.path_corrupt = TC.path_tmp / 'corrupt' / 'test.cud'
+        TC.path_corrupt.parent.mkdir()
+        TC.path_corrupt.write_bytes(bytes(corrupt))
+
+    @classmethod
+    def tearDownClass(cls):
+        super(TC, cls).tearDownClass()
+
+    def setUp(self):
+        super(TC, self).setUp()
+
+    def tearDown(self):
+        super(TC, self).tearDown()
+        self.verify_valgrind_log()
+
+    def test_large_database(self):
+        self.step_name('Test loading a database container that inflates to several MiB')
+
+        command = '{valgrind} {valgrind_args} {clamscan} -d {path_db} {testfile}'.format(
+            valgrind=TC.valgrind, valgrind_args=TC.valgrind_args, clamscan=TC.clamscan,
+            path_db=TC.path_cud,
+            testfile=TC.testfile,
+        )
+        output = self.execute_command(command)
+
+        assert output.ec == 1  # virus
+
+        expected_results = [
+            'Test.CVD.Last.UNOFFICIAL FOUND',
+            'Known viruses: 120001',
+        ]
+        self.verify_output(output.out, expected=expected_results)
+
+    def test_broken_database(self):
+        self.step_name('Test that a truncated or corrupt database container fails to load')
+
+        for path_db in (TC.path_truncated, TC.path_corrupt):
+            command = '{valgrind} {valgrind_args} {clamscan} -d {path_db} {testfile}'.format(
+                valgrind=TC.valgrind, valgrind_args=TC.valgrind_args, clamscan=TC.clamscan,
+                path_db=path_db,
+                testfile=TC.testfile,
+            )
+            output = self.execute_command(command)
+
+            assert output.ec == 2  # error
+
+            expected_results = [
+                'Malformed database',
+            ]
+            unexpected_results = [
+                'Test.CVD.Last.UNOFFICIAL FOUND',
+            ]
+            self.verify_output(output.err, expected=expected_results)
+            self.verify_output(output.out, unexpected=unexpected_results)
@@ -28,6 +28,18 @@ class TC(testcase.TestCase):
             "rule yara_in_range {strings: $tar_magic = { 75 73 74 61 72 } condition: $tar_magic in (200..300)}\n"
         )
 
+        # static signatures at exact offsets, checked only at their resolved offsets in larger files
+        for name, size in (('anchored-small.bin', 4096), ('anchored-large.bin', 512 * 1024)):
+            data = bytearray(size)
+            data[100:108] = b'anchor1!'
+            data[size - 50:size - 42] = b'anchor2!'
+            (TC.path_tmp / name).write_bytes(bytes(data))
+        (TC.path_tmp / 'anchored.ndb').write_text(
+            "Anchored-Abs:0:100:616e63686f723121\n"
+            "Anchored-EOF:0:EOF-50:616e63686f723221\n"
+            "Anchored-Miss:0:101:616e63686f723121\n"
+        )
+
     @classmethod
     def tearDownClass(cls):
         super(TC, cls).tearDownClass()
@@ -92,3 +104,24 @@ class TC(testcase.TestCase):
             'Infected files: 3',
         ]
         self.verify_output(output.out, expected=expected_results)
+
+    def test_ndb_exact_offsets(self):
+        self.step_name('Test NDB signatures at exact offsets')
+
+        testfiles = ' '.join([str(TC.path_tmp / name) for name in ('anchored-small.bin', 'anchored-large.bin')])
+        command = '{valgrind} {valgrind_args} {clamscan} -d {path_db} --allmatch {testfiles}'.format(
+            valgrind=TC.valgrind, valgrind_args=TC.valgrind_args, clamscan=TC.clamscan, path_db=TC.path_tmp / 'anchored.ndb', testfiles=testfiles,
+        )
+        output = self.execute_command(command)
+
+        assert output.ec == 1  # virus found
+
+        expected_results = [
+            'anchored-small.bin: Anchored-Abs.UNOFFICIAL FOUND',
+            'anchored-small.bin: Anchored-EOF.UNOFFICIAL FOUND',
+            'anchored-large.bin: Anchored-Abs.UNOFFICIAL FOUND',
+            'anchored-large.bin: Anchored-EOF.UNOFFICIAL FOUND',
+            'Infected files: 2',
+        ]
+        unexpected_results = ['Anchored-Miss']
+        self.verify_output(output.out, expected=expected_results, unexpected=unexpected_results)
@@ -0,0 +1,100 @@
+# Copyright (C) 2020-2025 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
+
+"""
+Run clamscan tests.
+"""
+
+import shutil
+import sys
+
+sys.path.append('../unit_tests')
+import testcase
+
+
+class TC(testcase.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        super(TC, cls).setUpClass()
+
+        TC.path_db = TC.path_tmp / 'database'
+        TC.path_db.mkdir(parents=True)
+
+        #
+        # Signatures for several targets, with plain (BM), anchored (BM) and
+        # wildcard (AC) patterns in each, and fillers that match nothing.
+        #
+        ndb = ''
+        for target in (0, 1, 7):
+            ndb += ''.join(
+                'Test.Build.Filler.{}.{}:{}:*:{}\n'.format(target, i, target, 'clamav build filler {} {}'.format(target, i).encode().hex())
+                for i in range(500)
+            )
+            ndb += ''.join(
+                'Test.Build.Wildcard.Filler.{}.{}:{}:*:{}??{}\n'.format(target, i, target, b'clamav'.hex(), 'wildcard filler {} {}'.format(target, i).encode().hex())
+                for i in range(500)
+            )
+        ndb += 'Test.Build.Any.BM:0:*:{}\n'.format(b'clamavbuildanymarker'.hex())
+        ndb += 'Test.Build.Any.AC:0:*:{}??{}\n'.format(b'clamavbuild'.hex(), b'anywildcard'.hex())
+        ndb += 'Test.Build.Any.Anchored:0:0:{}\n'.format(b'clamavbuildanchored'.hex())
+        ndb += 'Test.Build.PE.BM:1:0:4d5a\n'
+        ndb += 'Test.Build.PE.AC:1:*:{}*{}\n'.format(b'ClamAV'.hex(), b'Test'.hex())
+        ndb += 'Test.Build.Text:7:*:{}\n'.format(b'clamavbuildtextmarker'.hex())
+        (TC.path_db / 'build.ndb').write_text(ndb)
+
+        TC.testfiles = [TC.path_tmp / 'any.txt', TC.path_tmp / 'clam.exe']
+        TC.testfiles[0].write_bytes(b'clamavbuildanchored clamavbuildanymarker clamavbuild-anywildcard clamavbuildtextmarker\n')
+        shutil.copy(
+            str(TC.path_build / 'unit_tests' / 'input' / 'clamav_hdb_scanfiles' / 'clam.exe'),
+            str(TC.testfiles[1]),
+        )
+
+        # The same database, with the parallel matcher build turned off (OTHER_CONF_PARALLEL_BUILD).
+        TC.path_db_serial = TC.path_tmp / 'database-serial'
+        shutil.copytree(str(TC.path_db), str(TC.path_db_serial))
+        (TC.path_db_serial / 'serial.cfg').write_text('OTHER:0x7fff\n')
+
+    @classmethod
+    def tearDownClass(cls):
+        super(TC, cls).tearDownClass()
+
+    def setUp(self):
+        super(TC, self).setUp()
+
+    def tearDown(self):
+        super(TC, self).tearDown()
+        self.verify_valgrind_log()
+
+    def run_clamscan(self, path_db):
+        command = '{valgrind} {valgrind_args} {clamscan} -d {path_db} {testfiles} --allmatch --debug'.format(
+            valgrind=TC.valgrind, valgrind_args=TC.valgrind_args, clamscan=TC.clamscan,
+            path_db=path_db,
+            testfiles=' '.join(str(testfile) for testfile in TC.testfiles),
+        )
+        return self.execute_command(command)
+
+    @staticmethod
+    def results(output):
+        return sorted(line for line in output.out.splitlines() if line.endswith(' FOUND') or line.startswith('Known viruses: '))
+
+    def test_parallel_build(self):
+        self.step_name('Test that matchers built in parallel match the same as matchers built one after another')
+
+        serial = self.run_clamscan(TC.path_db_serial)
+        assert serial.ec == 1  # virus
+        self.verify_output(serial.err, unexpected=['build_matchers: building'])
+
+        parallel = self.run_clamscan(TC.path_db)
+        assert parallel.ec == 1  # virus
+        self.verify_output(parallel.err, expected=['build_matchers: building'])
+
+        expected_results = [
+            'Known viruses: 3006',
+            'any.txt: Test.Build.Any.BM.UNOFFICIAL FOUND',
+            'any.txt: Test.Build.Any.AC.UNOFFICIAL FOUND',
+            'any.txt: Test.Build.Any.Anchored.UNOFFICIAL FOUND',
+            'any.txt: Test.Build.Text.UNOFFICIAL FOUND',
+            'clam.exe: Test.Build.PE.BM.UNOFFICIAL FOUND',
+        ]
+        self.verify_output(serial.out, expected=expected_results)
+
+        assert self.results(parallel) == self.results(serial)
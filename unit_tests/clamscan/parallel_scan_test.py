@@ -0,0 +1,184 @@
+# Copyright (C) 2020-2025 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
+
+"""
+Run clamscan tests.
+"""
+
+import hashlib
+import io
+import sys
+from zipfile import ZIP_DEFLATED, ZipFile
+
+sys.path.append('../unit_tests')
+import testcase
+
+
+def marker(name):
+    return 'clamav-parallel-scan-{}-marker'.format(name).encode()
+
+
+def make_zip(members):
+    '''
+    Build a zip from a list of (name, content) pairs.
+    '''
+    data = io.BytesIO()
+    with ZipFile(data, 'w', ZIP_DEFLATED) as zf:
+        for name, content in members:
+            zf.writestr(name, content)
+    return data.getvalue()
+
+
+class TC(testcase.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        super(TC, cls).setUpClass()
+
+        TC.path_db = TC.path_tmp / 'database'
+        TC.path_db.mkdir(parents=True)
+
+        (TC.path_db / 'parallel.ndb').write_text(''.join(
+            'Test.Parallel.{}:0:*:{}\n'.format(i, marker(i).hex()) for i in range(8)
+        ) + 'Test.Parallel.Last:0:*:{}\n'.format(marker('last').hex()))
+
+        # Each member alerts. Members differ, so none is skipped by the clean cache.
+        TC.path_infected = TC.path_tmp / 'infected.zip'
+        TC.path_infected.write_bytes(make_zip(
+            [('member{}.txt'.format(i), b'member %d\n' % i + marker(i) * 64) for i in range(8)]
+        ))
+
+        # An archive with a false positive signature, where each member alerts.
+        # Once the first member alerted, the members after it are stopped, then
+        # scanned again when its alert is dropped.
+        fp_zip = make_zip(
+            [('member{}.txt'.format(i), b'fp member %d\n' % i + marker(i) * 64) for i in range(8)]
+        )
+        (TC.path_db / 'parallel.fp').write_text(
+            '{}:{}:Test.Parallel.FP\n'.format(hashlib.md5(fp_zip).hexdigest(), len(fp_zip))
+        )
+        TC.path_fp = TC.path_tmp / 'fp.zip'
+        TC.path_fp.write_bytes(fp_zip)
+
+        # The same inside another archive, with a member after it that is only
+        # scanned if the limits allow it.
+        TC.path_nested = TC.path_tmp / 'nested.zip'
+        TC.path_nested.write_bytes(make_zip(
+            [('fp.zip', fp_zip)] +
+            [('clean{}.txt'.format(i), b'clean member %d\n' % i * 64) for i in range(4)] +
+            [('last.txt', b'last member\n' + marker('last') * 64)]
+        ))
+
+    @classmethod
+    def tearDownClass(cls):
+        super(TC, cls).tearDownClass()
+
+    def setUp(self):
+        super(TC, self).setUp()
+
+    def tearDown(self):
+        super(TC, self).tearDown()
+        self.verify_valgrind_log()
+
+    def run_clamscan(self, testfile, threads, options=''):
+        command = '{valgrind} {valgrind_args} {clamscan} -d {path_db} {testfile} --parallel-scan-threads={threads} {options}'.format(
+            valgrind=TC.valgrind, valgrind_args=TC.valgrind_args, clamscan=TC.clamscan,
+            path_db=TC.path_db,
+            testfile=testfile,
+            threads=threads,
+            options=options,
+        )
+        return self.execute_command(command)
+
+    @staticmethod
+    def alerts(output):
+        return [line for line in output.out.splitlines() if line.endswith(' FOUND')]
+
+    def test_allmatch_order(self):
+        self.step_name('Test that all-match alerts are reported in the serial order')
+
+        serial = self.run_clamscan(TC.path_infected, 0, '--allmatch')
+        assert serial.ec == 1  # virus
+        assert len(self.alerts(serial)) == 8
+
+        for threads in (1, 4):
+            output = self.run_clamscan(TC.path_infected, threads, '--allmatch')
+            assert output.ec == 1  # virus
+            assert self.alerts(output) == self.alerts(serial)
+
+    def test_stop_at_first_alert(self):
+        self.step_name('Test that the scan stops at the same first alert as a serial scan')
+
+        serial = self.run_clamscan(TC.path_infected, 0)
+        assert serial.ec == 1  # virus
+        assert self.alerts(serial) == ['{}: Test.Parallel.0.UNOFFICIAL FOUND'.format(TC.path_infected)]
+
+        for threads in (1, 4):
+            output = self.run_clamscan(TC.path_infected, threads)
+            assert output.ec == 1  # virus
+            assert self.alerts(output) == self.alerts(serial)
+
+    def test_rescan_after_dropped_alert(self):
+        self.step_name('Test that members stopped by an alert that was dropped are scanned again')
+
+        serial = self.run_clamscan(TC.path_fp, 0)
+        assert serial.ec == 0  # clean
+        assert self.alerts(serial) == []
+
+        serial = self.run_clamscan(TC.path_nested, 0)
+        assert serial.ec == 1  # virus
+        assert self.alerts(serial) == ['{}: Test.Parallel.Last.UNOFFICIAL FOUND'.format(TC.path_nested)]
+
+        # With one thread, the second member is normally only started after the
+        # first one alerted, so it is stopped. It could still start earlier if
+        # the parent scans the first member itself, hence a few tries.
+        rescanned = False
+        for _ in range(3):
+            output = self.run_clamscan(TC.path_fp, 1, '--debug')
+            assert output.ec == 0  # clean
+            assert self.alerts(output) == []
+            if 'scanning interrupted job again' in output.err:
+                rescanned = True
+                break
+        assert rescanned
+
+        output = self.run_clamscan(TC.path_nested, 1)
+        assert output.ec == 1  # virus
+        assert self.alerts(output) == self.alerts(serial)
+
+    def test_shared_limits(self):
+        self.step_name('Test that MaxFiles and MaxScanSize are enforced as in a serial scan')
+
+        outcomes = set()
+        for max_files in range(1, 16):
+            options = '--max-files={}'.format(max_files)
+
+            serial = self.run_clamscan(TC.path_nested, 0, options)
+            outcomes.add(serial.ec)
+
+            # Members that are stopped and scanned again must not count twice.
+            output = self.run_clamscan(TC.path_nested, 1, options)
+            assert output.ec == serial.ec, 'max-files={}'.format(max_files)
+            assert self.alerts(output) == self.alerts(serial), 'max-files={}'.format(max_files)
+
+        # The last member was out of reach for some values, and not for others.
+        assert outcomes == {0, 1}
+
+        for max_scansize in ('1K', '2K', '4K', '8K', '16K', '32K'):
+            options = '--max-scansize={} --allmatch'.format(max_scansize)
+
+            serial = self.run_clamscan(TC.path_infected, 0, options)
+
+            output = self.run_clamscan(TC.path_infected, 4, options)
+            assert output.ec == serial.ec, 'max-scansize={}'.format(max_scansize)
+            assert self.alerts(output) == self.alerts(serial), 'max-scansize={}'.format(max_scansize)
+
+    def test_disabled(self):
+        self.step_name('Test that the parallel scan is not used with scan callbacks or metadata collection')
+
+        output = self.run_clamscan(TC.path_infected, 4, '--debug')
+        assert output.ec == 1  # virus
+        self.verify_output(output.err, expected=['cli_scan_queue_new: scanning up to'])
+
+        for options in ('--archive-verbose', '--gen-json'):
+            output = self.run_clamscan(TC.path_infected, 4, '--debug ' + options)
+            assert output.ec == 1  # virus
+            self.verify_output(output.err, unexpected=['cli_scan_queue_new: scanning up to'])
@@ -0,0 +1,150 @@
+# Copyright (C) 2020-2025 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
+
+"""
+Run clamscan tests.
+"""
+
+import sys
+import zlib
+
+sys.path.append('../unit_tests')
+import testcase
+
+
+def pdf_obj(objid, dictionary, stream=None):
+    '''
+    Build a PDF object, with a stream if one is given.
+    '''
+    if stream is None:
+        return b'%d 0 obj\n%s\nendobj\n' % (objid, dictionary)
+
+    return b'%d 0 obj\n%s\nstream\n%s\nendstream\nendobj\n' % (objid, dictionary, stream)
+
+
+def pdf_contents(objid, text, flate=False):
+    '''
+    Build a content stream object that shows the given text with a TJ operator.
+    The text of /Contents objects is normalized and scanned, so a signature on
+    the normalized text only matches if the object was flagged as /Contents.
+    '''
+    stream = b'BT\n[%s] TJ\nET' % b' '.join(b'(%s)' % word for word in text.split())
+    if flate:
+        stream = zlib.compress(stream)
+        return pdf_obj(objid, b'<< /Length %d /Filter /FlateDecode >>' % len(stream), stream)
+
+    return pdf_obj(objid, b'<< /Length %d >>' % len(stream), stream)
+
+
+class TC(testcase.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        super(TC, cls).setUpClass()
+
+        TC.path_db = TC.path_tmp / 'database'
+        TC.path_db.mkdir(parents=True)
+
+        (TC.path_db / 'pdf.ndb').write_text(
+            "Test.PDF.Index.Forward:0:*:{}\n".format(b'clamavindexforward'.hex()) +
+            "Test.PDF.Index.Wrapped:0:*:{}\n".format(b'clamavindexwrapped'.hex()) +
+            "Test.PDF.Index.ObjStm:0:*:{}\n".format(b'clamavindexobjstm'.hex()) +
+            "Test.PDF.Index.Decoy:0:*:{}\n".format(b'clamavindexdecoy'.hex()) +
+            "Test.PDF.Spill.Stream:0:*:{}\n".format(b'CLAMAV-PDF-SPILL-MARKER'.hex()) +
+            "Test.PDF.Spill.Contents:0:*:{}\n".format(b'clamavspilledcontents'.hex())
+        )
+
+        #
+        # Objects out of id order, with object 5 defined twice.
+        #
+        # The pages refer to their /Contents indirectly. A lookup searches
+        # forward from the referring object and wraps around at the end:
+        # - page 3 must get the second object 5, after it, not the decoy before it.
+        # - page 8 must get object 4, which is only found before it.
+        # - page 11 is in an object stream, so it is only found while objects
+        #   are extracted, after the object index was built.
+        #
+        objstm_header = b'11 0 '
+        objstm = objstm_header + b'<< /Type /Page /Parent 2 0 R /Contents 12 0 R >>'
+        objstm = zlib.compress(objstm)
+
+        (TC.path_tmp / 'index.pdf').write_bytes(
+            b'%PDF-1.7\n' +
+            pdf_contents(4, b'CLAMAV INDEX WRAPPED') +
+            pdf_contents(5, b'CLAMAV INDEX DECOY') +
+            pdf_obj(9, b'<< /Producer (ClamAV) >>') +
+            pdf_obj(3, b'<< /Type /Page /Parent 2 0 R /Contents 5 0 R >>') +
+            pdf_obj(8, b'<< /Type /Page /Parent 2 0 R /Contents 4 0 R >>') +
+            pdf_obj(2, b'<< /Type /Pages /Kids [3 0 R 8 0 R 11 0 R] /Count 3 >>') +
+            pdf_obj(1, b'<< /Type /Catalog /Pages 2 0 R >>') +
+            pdf_contents(5, b'CLAMAV INDEX FORWARD') +
+            pdf_obj(10, b'<< /Type /ObjStm /N 1 /First %d /Length %d /Filter /FlateDecode >>' % (len(objstm_header), len(objstm)), objstm) +
+            pdf_contents(12, b'CLAMAV INDEX OBJSTM', flate=True) +
+            b'trailer\n<< /Root 1 0 R >>\n%%EOF\n'
+        )
+
+        #
+        # A /Contents stream that inflates to more than the 16 MiB that an
+        # extracted object may use in memory, so the dump moves to a temp file.
+        # The text to match is at the end, after the dump was moved.
+        #
+        spill = b'BT\n%' + b' ' * (17 * 1024 * 1024) + b'\n[(CLAMAV) (SPILLED) (CONTENTS)] TJ\nET\n% CLAMAV-PDF-SPILL-MARKER'
+        spill = zlib.compress(spill, 9)
+
+        (TC.path_tmp / 'spill.pdf').write_bytes(
+            b'%PDF-1.7\n' +
+            pdf_obj(1, b'<< /Type /Catalog /Pages 2 0 R >>') +
+            pdf_obj(2, b'<< /Type /Pages /Kids [3 0 R] /Count 1 >>') +
+            pdf_obj(3, b'<< /Type /Page /Parent 2 0 R /Contents 4 0 R >>') +
+            pdf_obj(4, b'<< /Length %d /Filter /FlateDecode >>' % len(spill), spill) +
+            b'trailer\n<< /Root 1 0 R >>\n%%EOF\n'
+        )
+
+    @classmethod
+    def tearDownClass(cls):
+        super(TC, cls).tearDownClass()
+
+    def setUp(self):
+        super(TC, self).setUp()
+
+    def tearDown(self):
+        super(TC, self).tearDown()
+        self.verify_valgrind_log()
+
+    def test_pdf_indirect_lookup(self):
+        self.step_name('Test that indirect references find the right object with out of order and duplicate ids')
+
+        command = '{valgrind} {valgrind_args} {clamscan} -d {path_db} {testfile} --allmatch'.format(
+            valgrind=TC.valgrind, valgrind_args=TC.valgrind_args, clamscan=TC.clamscan,
+            path_db=TC.path_db / 'pdf.ndb',
+            testfile=TC.path_tmp / 'index.pdf',
+        )
+        output = self.execute_command(command)
+
+        assert output.ec == 1  # virus
+
+        expected_results = [
+            'Test.PDF.Index.Forward.UNOFFICIAL FOUND',
+            'Test.PDF.Index.Wrapped.UNOFFICIAL FOUND',
+            'Test.PDF.Index.ObjStm.UNOFFICIAL FOUND',
+        ]
+        unexpected_results = [
+            'Test.PDF.Index.Decoy.UNOFFICIAL FOUND',
+        ]
+        self.verify_output(output.out, expected=expected_results, unexpected=unexpected_results)
+
+    def test_pdf_dump_spill(self):
+        self.step_name('Test that an object too big to extract in memory is still scanned')
+
+        command = '{valgrind} {valgrind_args} {clamscan} -d {path_db} {testfile} --allmatch'.format(
+            valgrind=TC.valgrind, valgrind_args=TC.valgrind_args, clamscan=TC.clamscan,
+            path_db=TC.path_db / 'pdf.ndb',
+            testfile=TC.path_tmp / 'spill.pdf',
+        )
+        output = self.execute_command(command)
+
+        assert output.ec == 1  # virus
+
+        expected_results = [
+            'Test.PDF.Spill.Stream.UNOFFICIAL FOUND',
+            'Test.PDF.Spill.Contents.UNOFFICIAL FOUND',
+        ]
+        self.verify_output(output.out, expected=expected_results)
@@ -52,6 +52,7 @@ class TestCase(unittest.TestCase):
 
     check_clamav = None
     check_clamd = None
+    check_clamonacc = None
     check_fpu_endian = None
     milter = None
     clambc = None
@@ -105,6 +106,7 @@ class TestCase(unittest.TestCase):
         cls.path_tmp =         Path(tempfile.mkdtemp(prefix=(cls.__name__ + "-"), dir=os.getenv("TMP")))
         cls.check_clamav =     Path(os.getenv("CHECK_CLAMAV"))     if os.getenv("CHECK_CLAMAV") != None else None
         cls.check_clamd =      Path(os.getenv("CHECK_CLAMD"))      if os.getenv("CHECK_CLAMD") != None else None
+        cls.check_clamonacc =  Path(os.getenv("CHECK_CLAMONACC"))  if os.getenv("CHECK_CLAMONACC") != None else None
         cls.check_fpu_endian = Path(os.getenv("CHECK_FPU_ENDIAN")) if os.getenv("CHECK_FPU_ENDIAN") != None else None
         cls.milter =           Path(os.getenv("CLAMAV_MILTER"))    if os.getenv("CLAMAV_MILTER") != None else None
         cls.clambc =           Path(os.getenv("CLAMBC"))           if os.getenv("CLAMBC") != None else None